@@ -47,6 +47,8 @@ extern "C" {
 #include "../librmb/rados-dictionary-impl.h"
 #include "../librmb/rados-cluster.h"
 #include "../librmb/rados-guid-generator.h"
+#include "../librmb/rados-metrics.h"
+#include "../librmb/rados-throttle.h"
 #include "../librmb/rados-util.h"
 
 #if DOVECOT_PREREQ(2, 3)
@@ -121,6 +123,9 @@ int rados_dict_init(struct dict *driver, const char *uri, const struct dict_sett
   string clustername = "ceph";
   string rados_username = "client.admin";
   string ceph_cfg = "rbox_cfg";
+  // the dict process may not load the rbox plugin, the throttle limits (see rbox_throttle_*) are part of the uri
+  librmb::RadosThrottle::Limits limits;
+  bool throttle = false;
 
   if (uri != nullptr) {
     vector<string> props(explode(uri, ':'));
@@ -136,6 +141,18 @@ int rados_dict_init(struct dict *driver, const char *uri, const struct dict_sett
         rados_username = it->substr(16);
       } else if (it->compare(0, 21, "dict_cfg_object_name=") == 0) {
         ceph_cfg = it->substr(21);
+      } else if (it->compare(0, 21, "throttle_ops_per_sec=") == 0) {
+        limits.ops_per_sec = strtoull(it->substr(21).c_str(), NULL, 10);
+        throttle = true;
+      } else if (it->compare(0, 23, "throttle_bytes_per_sec=") == 0) {
+        limits.bytes_per_sec = strtoull(it->substr(23).c_str(), NULL, 10);
+        throttle = true;
+      } else if (it->compare(0, 22, "throttle_inflight_ops=") == 0) {
+        limits.max_inflight_ops = strtoull(it->substr(22).c_str(), NULL, 10);
+        throttle = true;
+      } else if (it->compare(0, 24, "throttle_inflight_bytes=") == 0) {
+        limits.max_inflight_bytes = strtoull(it->substr(24).c_str(), NULL, 10);
+        throttle = true;
       } else {
         *error_r = t_strdup_printf("Invalid URI!");
         return -1;
@@ -149,6 +166,11 @@ int rados_dict_init(struct dict *driver, const char *uri, const struct dict_sett
     username = dict_escape_string(username.c_str());
   }
 
+  if (throttle) {
+    // without limits in the uri, the ones of the rbox plugin (same process) are kept
+    librmb::RadosThrottle::global().set_limits(limits);
+  }
+
   dict = i_new(struct rados_dict, 1);
   dict->cluster = new librmb::RadosClusterImpl();
   int ret = dict->cluster->init(clustername, rados_username);
@@ -227,10 +249,12 @@ class rados_dict_lookup_context {
   string value;
   void *context = nullptr;
   dict_lookup_callback_t *callback;
+  uint64_t start = 0;
 
   explicit rados_dict_lookup_context(RadosDictionary *_dict) : callback(nullptr) {
     dict = _dict;
-    completion = librados::Rados::aio_create_completion(this, rados_lookup_complete_callback, nullptr);
+    // the callback is set on submit (see RadosThrottle)
+    completion = librados::Rados::aio_create_completion();
   }
 
   ~rados_dict_lookup_context() {}
@@ -248,6 +272,8 @@ static void rados_lookup_complete_callback(rados_completion_t comp ATTR_UNUSED,
 #endif
 
   int ret = lc->completion->get_return_value();
+  librmb::RadosMetrics::global().record(librmb::METRIC_DICT_LOOKUP, librmb::RadosMetrics::now_usecs() - lc->start,
+                                        ret < 0 && ret != -ENOENT);
 
   if (lc->callback != nullptr) {
     if (ret == 0) {
@@ -288,11 +314,15 @@ void rados_dict_lookup_async(struct dict *_dict, const char *key, dict_lookup_ca
   lc->context = context;
   lc->callback = callback;
   lc->read_op.omap_get_vals_by_keys(keys, &lc->result_map, &lc->r_val);
+  lc->start = librmb::RadosMetrics::now_usecs();
 
-  int err = d->get_io_ctx(key).aio_operate(d->get_full_oid(key), lc->completion, &lc->read_op,
-                                           LIBRADOS_OPERATION_NOFLAG, &lc->bl);
+  int err = librmb::RadosThrottle::global().aio_operate(&d->get_io_ctx(key), d->get_full_oid(key), lc->completion,
+                                                        &lc->read_op, LIBRADOS_OPERATION_NOFLAG, &lc->bl, 0,
+                                                        rados_lookup_complete_callback, lc);
 
   if (err < 0) {
+    librmb::RadosMetrics::global().record(librmb::METRIC_DICT_LOOKUP, librmb::RadosMetrics::now_usecs() - lc->start,
+                                          true);
     if (lc->callback != nullptr) {
       struct dict_lookup_result result;
       i_zero(&result);
@@ -323,7 +353,9 @@ int rados_dict_lookup(struct dict *_dict, pool_t pool, const char *key, const ch
   *value_r = nullptr;
   *error_r = nullptr;
 
+  librmb::RadosMetricsTimer timer(librmb::METRIC_DICT_LOOKUP);
   int err = d->get_io_ctx(key).omap_get_vals_by_keys(d->get_full_oid(key), keys, &result_map);
+  timer.set_failed(err < 0 && err != -ENOENT);
   if (err == 0) {
     auto value = result_map.find(key);
     if (value != result_map.end()) {
@@ -434,7 +466,9 @@ class rados_dict_transaction_context {
     atomic_inc_map[key] = diff;
   }
 
-  void deploy_set_map() {
+  /* @return false if at least one key could not be set */
+  bool deploy_set_map() {
+    bool ok = true;
     if (set_map.size() > 0) {
       struct rados_dict *dict = (struct rados_dict *)ctx.dict;
       RadosDictionary *d = dict->d;
@@ -454,13 +488,16 @@ class rados_dict_transaction_context {
 #endif
         if ((is_private(key) ? d->get_private_io_ctx() : d->get_shared_io_ctx()).omap_set(oid, map) < 0) {
           i_error("unable to set key(%s), oid(%s), is_private(%d)", key.c_str(), oid.c_str(), is_private(key));
+          ok = false;
         }
       }
       set_map.clear();
     }
+    return ok;
   }
 
-  void deploy_atomic_inc_map() {
+  bool deploy_atomic_inc_map() {
+    bool ok = true;
     if (atomic_inc_map.size() > 0) {
       struct rados_dict *dict = (struct rados_dict *)ctx.dict;
 
@@ -473,14 +510,19 @@ class rados_dict_transaction_context {
         const string key = it->first;
         std::string oid = is_private(key) ? d->get_private_oid() : d->get_shared_oid();
         // it->second is a signed long int
-        librmb::RadosUtils::osd_add(&(is_private(key) ? d->get_private_io_ctx() : d->get_shared_io_ctx()), oid, key,
-                                    it->second);
+        if (librmb::RadosUtils::osd_add(&(is_private(key) ? d->get_private_io_ctx() : d->get_shared_io_ctx()), oid,
+                                        key, it->second) < 0) {
+          i_error("unable to increment key(%s), oid(%s), is_private(%d)", key.c_str(), oid.c_str(), is_private(key));
+          ok = false;
+        }
       }
       atomic_inc_map.clear();
     }
+    return ok;
   }
 
-  void deploy_unset_set() {
+  bool deploy_unset_set() {
+    bool ok = true;
     if (unset_set.size() > 0) {
       struct rados_dict *dict = (struct rados_dict *)ctx.dict;
       RadosDictionary *d = dict->d;
@@ -497,10 +539,12 @@ class rados_dict_transaction_context {
 #endif
         if ((is_private(key) ? d->get_private_io_ctx() : d->get_shared_io_ctx()).omap_rm_keys(oid, keys) < 0) {
           i_error("unable to unset key(%s), oid(%s), is_private(%d)", key.c_str(), oid.c_str(), is_private(key));
+          ok = false;
         }
       }
       unset_set.clear();
     }
+    return ok;
   }
 };
 
@@ -540,11 +584,29 @@ int rados_dict_transaction_commit(struct dict_transaction_context *_ctx, bool as
   rados_dict_transaction_context *ctx = reinterpret_cast<rados_dict_transaction_context *>(_ctx);
   string old_value = "0";
 
-  ctx->deploy_set_map();
-  ctx->deploy_atomic_inc_map();
-  ctx->deploy_unset_set();
+#if DOVECOT_PREREQ(2, 3)
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_DICT_EVENT
+  struct event *event = event_create(_ctx->dict->event);
+#else
+  struct event *event = event_create(NULL);
+#endif
+  event_set_name(event, "dict_rados_commit_finished");
+  event_add_int(event, "set", ctx->set_map.size());
+  event_add_int(event, "unset", ctx->unset_set.size());
+  event_add_int(event, "atomic_inc", ctx->atomic_inc_map.size());
+#endif
+  uint64_t start = librmb::RadosMetrics::now_usecs();
+  bool failed = !ctx->deploy_set_map();
+  failed = !ctx->deploy_atomic_inc_map() || failed;
+  failed = !ctx->deploy_unset_set() || failed;
+  uint64_t usecs = librmb::RadosMetrics::now_usecs() - start;
+  librmb::RadosMetrics::global().record(librmb::METRIC_DICT_COMMIT, usecs, failed);
+#if DOVECOT_PREREQ(2, 3)
+  event_add_int(event, "rados_usecs", usecs);
+  e_debug(event, "commit finished in %llu usecs", (unsigned long long)usecs);  // NOLINT
+  event_unref(&event);
+#endif
 
-  bool failed = false;
   int ret;
 
   ctx->context = context;
@@ -715,8 +777,9 @@ struct dict_iterate_context *rados_dict_iterate_init(struct dict *_dict, const c
         }
       }
 
-      int err = d->get_private_io_ctx().aio_operate(d->get_private_oid(), private_read_completion, &private_read_op,
-                                                    &bl_private);
+      int err = librmb::RadosThrottle::global().aio_operate(&d->get_private_io_ctx(), d->get_private_oid(),
+                                                            private_read_completion, &private_read_op,
+                                                            LIBRADOS_OPERATION_NOFLAG, &bl_private, 0);
 #ifdef DEBUG
       i_debug("rados_dict_iterate_init(): private err=%d(%s)", err, strerror(-err));
 #endif
@@ -745,8 +808,9 @@ struct dict_iterate_context *rados_dict_iterate_init(struct dict *_dict, const c
         }
       }
 
-      int err =
-          d->get_shared_io_ctx().aio_operate(d->get_shared_oid(), shared_read_completion, &shared_read_op, &bl_shared);
+      int err = librmb::RadosThrottle::global().aio_operate(&d->get_shared_io_ctx(), d->get_shared_oid(),
+                                                            shared_read_completion, &shared_read_op,
+                                                            LIBRADOS_OPERATION_NOFLAG, &bl_shared, 0);
 #ifdef DEBUG
       i_debug("rados_dict_iterate_init(): shared err=%d(%s)", err, strerror(-err));
 #endif
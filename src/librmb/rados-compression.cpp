@@ -0,0 +1,333 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-compression.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "dovecot-ceph-plugin-config.h"
+#include "rados-metadata.h"
+
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace librmb {
+
+#define DECOMPRESS_CHUNK_SIZE (64 * 1024)
+
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_ZSTD
+class RadosDecompressorZstd : public RadosDecompressor {
+ public:
+  RadosDecompressorZstd(const char *data, size_t size) : stream(ZSTD_createDStream()), frame_done(false) {
+    input.src = data;
+    input.size = size;
+    input.pos = 0;
+    if (stream != NULL) {
+      ZSTD_initDStream(stream);
+    }
+  }
+  ~RadosDecompressorZstd() {
+    if (stream != NULL) {
+      ZSTD_freeDStream(stream);
+    }
+  }
+  ssize_t read(char *out, size_t size) override {
+    if (stream == NULL) {
+      return -1;
+    }
+    ZSTD_outBuffer output = {out, size, 0};
+    while (output.pos < output.size) {
+      size_t in_pos = input.pos;
+      size_t out_pos = output.pos;
+      size_t ret = ZSTD_decompressStream(stream, &output, &input);
+      if (ZSTD_isError(ret)) {
+        return -1;
+      }
+      if (input.pos == in_pos && output.pos == out_pos) {
+        // all input consumed and nothing buffered anymore
+        break;
+      }
+      frame_done = ret == 0;
+    }
+    if (output.pos == 0 && !frame_done) {
+      // truncated frame
+      return -1;
+    }
+    return output.pos;
+  }
+
+ private:
+  ZSTD_DStream *stream;
+  ZSTD_inBuffer input;
+  bool frame_done;
+};
+#endif
+
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_LZ4
+class RadosDecompressorLz4 : public RadosDecompressor {
+ public:
+  RadosDecompressorLz4(const char *data_, size_t size_)
+      : ctx(NULL), data(data_), size(size_), pos(0), frame_done(false) {
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION))) {
+      ctx = NULL;
+    }
+  }
+  ~RadosDecompressorLz4() {
+    if (ctx != NULL) {
+      LZ4F_freeDecompressionContext(ctx);
+    }
+  }
+  ssize_t read(char *out, size_t out_size) override {
+    if (ctx == NULL) {
+      return -1;
+    }
+    size_t written = 0;
+    while (written < out_size) {
+      size_t dst_size = out_size - written;
+      size_t src_size = size - pos;
+      size_t ret = LZ4F_decompress(ctx, out + written, &dst_size, data + pos, &src_size, NULL);
+      if (LZ4F_isError(ret)) {
+        return -1;
+      }
+      if (src_size == 0 && dst_size == 0) {
+        break;
+      }
+      pos += src_size;
+      written += dst_size;
+      frame_done = ret == 0;
+    }
+    if (written == 0 && !frame_done) {
+      return -1;
+    }
+    return written;
+  }
+
+ private:
+  LZ4F_decompressionContext_t ctx;
+  const char *data;
+  size_t size;
+  size_t pos;
+  bool frame_done;
+};
+#endif
+
+static int compress_buffer(rbox_compression_codec codec, int level, const char *src, size_t size,
+                           librados::bufferlist *out) {
+  switch (codec) {
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_ZSTD
+    case COMPRESSION_ZSTD: {
+      size_t bound = ZSTD_compressBound(size);
+      ceph::bufferptr ptr(bound);
+      size_t ret = ZSTD_compress(ptr.c_str(), bound, src, size, level);
+      if (ZSTD_isError(ret)) {
+        return -1;
+      }
+      ptr.set_length(ret);
+      out->append(ptr);
+      return 0;
+    }
+#endif
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_LZ4
+    case COMPRESSION_LZ4: {
+      LZ4F_preferences_t prefs;
+      memset(&prefs, 0, sizeof(prefs));
+      prefs.compressionLevel = level;
+      prefs.frameInfo.contentSize = size;
+      size_t bound = LZ4F_compressFrameBound(size, &prefs);
+      ceph::bufferptr ptr(bound);
+      size_t ret = LZ4F_compressFrame(ptr.c_str(), bound, src, size, &prefs);
+      if (LZ4F_isError(ret)) {
+        return -1;
+      }
+      ptr.set_length(ret);
+      out->append(ptr);
+      return 0;
+    }
+#endif
+    default:
+      return -ENOTSUP;
+  }
+}
+
+bool RadosCompression::set_codec(const std::string &name) {
+  rbox_compression_codec codec_;
+  if (!from_string(name, &codec_) || !is_supported(codec_)) {
+    return false;
+  }
+  codec = codec_;
+  return true;
+}
+
+int RadosCompression::compress(RadosMail *mail, uint64_t size) const {
+  if (mail == nullptr || mail->get_mail_buffer() == nullptr) {
+    return -1;
+  }
+  if (!is_enabled() || size == 0 || size < min_size) {
+    return 0;
+  }
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  if (buffer->length() < size) {
+    return -1;
+  }
+  librados::bufferlist compressed;
+  int ret = compress_buffer(codec, level, buffer->c_str(), size, &compressed);
+  if (ret < 0) {
+    return ret;
+  }
+  if (compressed.length() >= size) {
+    // not compressible, keep the original
+    return 0;
+  }
+  buffer->swap(compressed);
+  mail->set_mail_size(buffer->length());
+
+  RadosMetadata xattr_codec(RBOX_METADATA_COMPRESSION, to_string(codec));
+  mail->add_metadata(xattr_codec);
+  RadosMetadata xattr_size(RBOX_METADATA_UNCOMPRESSED_SIZE, static_cast<size_t>(size));
+  mail->add_metadata(xattr_size);
+  return 1;
+}
+
+int RadosCompression::recompress(RadosMail *mail) const {
+  rbox_compression_codec current;
+  uint64_t uncompressed_size;
+  if (get_compression(mail, &current, &uncompressed_size)) {
+    if (current == codec) {
+      return 0;
+    }
+    int ret = decompress(mail);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  return compress(mail, mail->get_mail_buffer()->length());
+}
+
+bool RadosCompression::get_compression(RadosMail *mail, rbox_compression_codec *codec_, uint64_t *uncompressed_size) {
+  const char *value = mail->get_metadata(RBOX_METADATA_COMPRESSION);
+  if (value == NULL || !from_string(value, codec_) || *codec_ == COMPRESSION_NONE) {
+    return false;
+  }
+  int64_t size = 0;
+  *uncompressed_size = mail->get_metadata(RBOX_METADATA_UNCOMPRESSED_SIZE, &size) && size > 0 ? size : 0;
+  return true;
+}
+
+int RadosCompression::decompress(RadosMail *mail) {
+  rbox_compression_codec codec_;
+  uint64_t uncompressed_size;
+  if (!get_compression(mail, &codec_, &uncompressed_size)) {
+    return 0;
+  }
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  if (buffer == nullptr) {
+    return -1;
+  }
+  RadosDecompressor *decompressor = create_decompressor(codec_, buffer->c_str(), buffer->length());
+  if (decompressor == nullptr) {
+    return -ENOTSUP;
+  }
+  librados::bufferlist out;
+  size_t chunk_size = uncompressed_size > 0 ? uncompressed_size : DECOMPRESS_CHUNK_SIZE;
+  ssize_t ret;
+  do {
+    ceph::bufferptr ptr(chunk_size);
+    ret = decompressor->read(ptr.c_str(), chunk_size);
+    if (ret > 0) {
+      ptr.set_length(ret);
+      out.append(ptr);
+    }
+    chunk_size = DECOMPRESS_CHUNK_SIZE;
+  } while (ret > 0);
+  delete decompressor;
+  if (ret < 0) {
+    return -EIO;
+  }
+
+  buffer->swap(out);
+  mail->set_mail_size(buffer->length());
+  mail->remove_metadata(RBOX_METADATA_COMPRESSION);
+  mail->remove_metadata(RBOX_METADATA_UNCOMPRESSED_SIZE);
+  return 0;
+}
+
+RadosDecompressor *RadosCompression::create_decompressor(rbox_compression_codec codec_, const char *data,
+                                                         size_t size) {
+  switch (codec_) {
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      return new RadosDecompressorZstd(data, size);
+#endif
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_LZ4
+    case COMPRESSION_LZ4:
+      return new RadosDecompressorLz4(data, size);
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+bool RadosCompression::has_frame_magic(const char *data, size_t size) {
+  static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+  static const unsigned char lz4_magic[] = {0x04, 0x22, 0x4d, 0x18};
+  if (data == NULL || size < sizeof(zstd_magic)) {
+    return false;
+  }
+  return memcmp(data, zstd_magic, sizeof(zstd_magic)) == 0 || memcmp(data, lz4_magic, sizeof(lz4_magic)) == 0;
+}
+
+bool RadosCompression::is_supported(rbox_compression_codec codec_) {
+  switch (codec_) {
+    case COMPRESSION_NONE:
+      return true;
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      return true;
+#endif
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_LZ4
+    case COMPRESSION_LZ4:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+const char *RadosCompression::to_string(rbox_compression_codec codec_) {
+  switch (codec_) {
+    case COMPRESSION_ZSTD:
+      return "zstd";
+    case COMPRESSION_LZ4:
+      return "lz4";
+    default:
+      return "none";
+  }
+}
+
+bool RadosCompression::from_string(const std::string &name, rbox_compression_codec *codec_) {
+  if (name.empty() || name.compare("none") == 0) {
+    *codec_ = COMPRESSION_NONE;
+  } else if (name.compare("zstd") == 0) {
+    *codec_ = COMPRESSION_ZSTD;
+  } else if (name.compare("lz4") == 0) {
+    *codec_ = COMPRESSION_LZ4;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace librmb
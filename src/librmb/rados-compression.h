@@ -0,0 +1,133 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_COMPRESSION_H_
+#define SRC_LIBRMB_RADOS_COMPRESSION_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include <rados/librados.hpp>
+#include "rados-mail.h"
+
+namespace librmb {
+
+enum rbox_compression_codec { COMPRESSION_NONE = 0, COMPRESSION_ZSTD = 1, COMPRESSION_LZ4 = 2 };
+
+/**
+ * RadosDecompressor
+ *
+ * Streaming decompression of a compressed mail buffer. The mail is
+ * decompressed in chunks as it is read, so header only reads do not
+ * need to decompress the whole mail.
+ */
+class RadosDecompressor {
+ public:
+  virtual ~RadosDecompressor() {}
+  /*!
+   * decompress the next chunk.
+   * @param[out] out buffer for the decompressed data
+   * @param[in] size size of the out buffer
+   * @return number of bytes written, 0 at the end of the compressed data or < 0 in case of an error
+   */
+  virtual ssize_t read(char *out, size_t size) = 0;
+};
+
+/**
+ * RadosCompression
+ *
+ * Per mail compression of the mail object. Compressed mails carry the codec
+ * (RBOX_METADATA_COMPRESSION) and the size before compression
+ * (RBOX_METADATA_UNCOMPRESSED_SIZE) as metadata. Codecs are optional, they are
+ * only available if librmb was built with libzstd / liblz4.
+ */
+class RadosCompression {
+ public:
+  static const uint64_t DEFAULT_MIN_SIZE = 4096;
+
+  RadosCompression() : codec(COMPRESSION_NONE), level(0), min_size(DEFAULT_MIN_SIZE) {}
+  ~RadosCompression() {}
+
+  /*!
+   * @param[in] name codec name (none, zstd, lz4)
+   * @return false if the codec is unknown or not supported by this build, the codec is not changed.
+   */
+  bool set_codec(const std::string &name);
+  rbox_compression_codec get_codec() const { return codec; }
+  /*!
+   * @param[in] level_ codec specific compression level, 0 = codec default.
+   */
+  void set_level(int level_) { level = level_; }
+  int get_level() const { return level; }
+  /*!
+   * @param[in] min_size_ mails smaller than min_size are not compressed
+   */
+  void set_min_size(uint64_t min_size_) { min_size = min_size_; }
+  uint64_t get_min_size() const { return min_size; }
+  bool is_enabled() const { return codec != COMPRESSION_NONE; }
+
+  /*!
+   * Compress the first size bytes of the mail buffer. The buffer is only replaced if the
+   * mail is not smaller than min_size and the compressed data is smaller than the original.
+   * Sets the mail size and adds the compression metadata to the mail.
+   *
+   * @param[in,out] mail with a valid mail buffer
+   * @param[in] size number of bytes of the mail buffer to compress
+   * @return 1 if the mail has been compressed, 0 if it is left uncompressed, < 0 in case of an error
+   */
+  int compress(RadosMail *mail, uint64_t size) const;
+  /*!
+   * Bring a mail with loaded metadata and mail buffer to this codec (e.g. when it is moved to the
+   * alt storage). Mails already compressed with this codec are left as they are.
+   * @return < 0 in case of an error
+   */
+  int recompress(RadosMail *mail) const;
+
+  /*!
+   * Reads the compression metadata of the mail.
+   * @param[in] mail with loaded metadata
+   * @param[out] codec_ codec of the mail
+   * @param[out] uncompressed_size size of the mail before compression (0 if unknown)
+   * @return false if the mail is not compressed (or the codec is unknown)
+   */
+  static bool get_compression(RadosMail *mail, rbox_compression_codec *codec_, uint64_t *uncompressed_size);
+  /*!
+   * Decompress the whole mail buffer in place and remove the compression metadata.
+   * @param[in,out] mail with loaded metadata and mail buffer
+   * @return 0 if the mail is not compressed or has been decompressed, < 0 in case of an error
+   */
+  static int decompress(RadosMail *mail);
+  /*!
+   * Create a streaming decompressor for data (the data is not copied and must stay valid).
+   * @return new decompressor, caller needs to delete it or nullptr if the codec is not supported
+   */
+  static RadosDecompressor *create_decompressor(rbox_compression_codec codec_, const char *data, size_t size);
+  /*!
+   * @return true if data starts with the frame magic of a codec. Cheap check before the metadata is loaded.
+   */
+  static bool has_frame_magic(const char *data, size_t size);
+  static bool is_supported(rbox_compression_codec codec_);
+  static const char *to_string(rbox_compression_codec codec_);
+
+ private:
+  static bool from_string(const std::string &name, rbox_compression_codec *codec_);
+
+ private:
+  rbox_compression_codec codec;
+  int level;
+  uint64_t min_size;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_COMPRESSION_H_
@@ -0,0 +1,192 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-dedup.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#include <map>
+#include <set>
+
+#include "dovecot-ceph-plugin-config.h"
+#include "rados-metadata.h"
+
+namespace librmb {
+
+const char *RadosDedup::DEDUP_NAMESPACE = "rbox_dedup";
+
+int RadosDedup::open(RadosCluster *cluster, const std::string &pool) {
+  if (io_ctx_created) {
+    return 0;
+  }
+  if (cluster == nullptr || !cluster->is_connected()) {
+    return -ENOTCONN;
+  }
+  int ret = cluster->io_ctx_create(pool, &io_ctx);
+  if (ret < 0) {
+    return ret;
+  }
+  io_ctx.set_namespace(DEDUP_NAMESPACE);
+  io_ctx_created = true;
+  return 0;
+}
+
+void RadosDedup::close() {
+  if (io_ctx_created) {
+    io_ctx.close();
+    io_ctx_created = false;
+  }
+}
+
+int RadosDedup::dedup(RadosMail *mail, const std::string &hash) {
+  if (mail == nullptr || mail->get_mail_buffer() == nullptr) {
+    return -1;
+  }
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  if (!is_enabled() || hash.empty() || buffer->length() == 0 || buffer->length() < min_size) {
+    return 0;
+  }
+  int ret = add_ref(hash, *mail->get_oid(), *buffer);
+  if (ret < 0) {
+    return ret;
+  }
+  RadosMetadata xattr_ref(RBOX_METADATA_EXT_REF, hash);
+  mail->add_metadata(xattr_ref);
+  buffer->clear();
+  mail->set_mail_size(0);
+  return 1;
+}
+
+int RadosDedup::resolve(RadosMail *mail) {
+  if (mail == nullptr || mail->get_mail_buffer() == nullptr) {
+    return -1;
+  }
+  const char *hash = mail->get_metadata(RBOX_METADATA_EXT_REF);
+  if (hash == NULL || *hash == '\0') {
+    return 0;
+  }
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  buffer->clear();
+  int ret = read(hash, buffer);
+  if (ret < 0) {
+    return ret;
+  }
+  mail->set_mail_size(buffer->length());
+  return 1;
+}
+
+int RadosDedup::add_ref(const std::string &hash, const std::string &ref, const librados::bufferlist &data) {
+  std::map<std::string, librados::bufferlist> refs;
+  refs[ref] = librados::bufferlist();
+  for (int i = 0; i < MAX_RETRIES; ++i) {
+    int ret = add_ref(hash, ref);
+    if (ret != -ENOENT) {
+      return ret;
+    }
+    librados::ObjectWriteOperation create_op;
+    create_op.create(true);
+    create_op.write_full(data);
+    create_op.omap_set(refs);
+    ret = io_ctx.operate(hash, &create_op);
+    if (ret != -EEXIST) {
+      return ret;
+    }
+    // stored concurrently by another mail, reference that one.
+  }
+  return -EBUSY;
+}
+
+int RadosDedup::add_ref(const std::string &hash, const std::string &ref) {
+  if (!io_ctx_created) {
+    return -ENOTCONN;
+  }
+  std::map<std::string, librados::bufferlist> refs;
+  refs[ref] = librados::bufferlist();
+  librados::ObjectWriteOperation ref_op;
+  ref_op.assert_exists();
+  ref_op.omap_set(refs);
+  return io_ctx.operate(hash, &ref_op);
+}
+
+int RadosDedup::release_ref(const std::string &hash, const std::string &ref) {
+  if (!io_ctx_created) {
+    return -ENOTCONN;
+  }
+  std::set<std::string> keys;
+  keys.insert(ref);
+  librados::ObjectWriteOperation unref_op;
+  unref_op.assert_exists();
+  unref_op.omap_rm_keys(keys);
+  int ret = io_ctx.operate(hash, &unref_op);
+  if (ret < 0) {
+    return ret == -ENOENT ? 0 : ret;
+  }
+
+  for (int i = 0; i < MAX_RETRIES; ++i) {
+    std::set<std::string> left;
+    int err = 0;
+    librados::ObjectReadOperation read_op;
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_OMAP_GET_KEYS_2
+    read_op.omap_get_keys2("", 1, &left, nullptr, &err);
+#else
+    read_op.omap_get_keys("", 1, &left, &err);
+#endif
+    ret = io_ctx.operate(hash, &read_op, nullptr);
+    if (ret < 0 || err < 0) {
+      ret = ret < 0 ? ret : err;
+      return ret == -ENOENT ? 0 : ret;
+    }
+    if (!left.empty()) {
+      return 0;
+    }
+    // the version guards against a reference added since the keys have been read.
+    librados::ObjectWriteOperation remove_op;
+    remove_op.assert_version(io_ctx.get_last_version());
+    remove_op.remove();
+    ret = io_ctx.operate(hash, &remove_op);
+    if (ret != -ERANGE && ret != -EOVERFLOW) {
+      return ret == -ENOENT ? 0 : ret;
+    }
+  }
+  return -EBUSY;
+}
+
+int RadosDedup::read(const std::string &hash, librados::bufferlist *data) {
+  if (!io_ctx_created) {
+    return -ENOTCONN;
+  }
+  size_t max = INT_MAX;
+  int ret = io_ctx.read(hash, *data, max, 0);
+  return ret < 0 ? ret : 0;
+}
+
+int RadosDedup::get_ref_count(const std::string &hash, uint64_t *count) {
+  if (!io_ctx_created) {
+    return -ENOTCONN;
+  }
+  std::set<std::string> keys;
+  int err = 0;
+  librados::ObjectReadOperation read_op;
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_OMAP_GET_KEYS_2
+  read_op.omap_get_keys2("", LONG_MAX, &keys, nullptr, &err);
+#else
+  read_op.omap_get_keys("", LONG_MAX, &keys, &err);
+#endif
+  int ret = io_ctx.operate(hash, &read_op, nullptr);
+  if (ret < 0) {
+    return ret;
+  }
+  *count = keys.size();
+  return err;
+}
+
+}  // namespace librmb
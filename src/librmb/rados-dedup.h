@@ -0,0 +1,123 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_DEDUP_H_
+#define SRC_LIBRMB_RADOS_DEDUP_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <rados/librados.hpp>
+#include "rados-cluster.h"
+#include "rados-mail.h"
+
+namespace librmb {
+
+/**
+ * RadosDedup
+ *
+ * Single instance store for mail bodies. A body is stored once as object
+ * <content hash> in the namespace DEDUP_NAMESPACE of the dedup pool, every
+ * mail object referencing it is registered as omap key (mail oid) of that
+ * object. Deduplicated mail objects have no data, they carry the content hash
+ * as RBOX_METADATA_EXT_REF. The body object is removed together with its
+ * last reference.
+ */
+class RadosDedup {
+ public:
+  static const char *DEDUP_NAMESPACE;
+  static const uint64_t DEFAULT_MIN_SIZE = 65536;
+
+  RadosDedup() : io_ctx_created(false), enabled(false), min_size(DEFAULT_MIN_SIZE) {}
+  ~RadosDedup() {}
+
+  /*!
+   * open the io context of the dedup pool.
+   * @param[in] cluster connected cluster
+   * @param[in] pool dedup pool (needs to exist)
+   * @return linux error code or 0 if successful
+   */
+  int open(RadosCluster *cluster, const std::string &pool);
+  bool is_open() const { return io_ctx_created; }
+  void close();
+  librados::IoCtx &get_io_ctx() { return io_ctx; }
+
+  /*!
+   * @param[in] enabled_ deduplicate new mails. Reading deduplicated mails does not depend on it.
+   */
+  void set_enabled(bool enabled_) { enabled = enabled_; }
+  bool is_enabled() const { return enabled && io_ctx_created; }
+  /*!
+   * @param[in] min_size_ mails smaller than min_size are stored as they are
+   */
+  void set_min_size(uint64_t min_size_) { min_size = min_size_; }
+  uint64_t get_min_size() const { return min_size; }
+
+  /*!
+   * Store the mail buffer in the dedup pool (data is only written if no other mail references the hash yet),
+   * register the mail as reference, set RBOX_METADATA_EXT_REF and clear the mail buffer.
+   *
+   * @param[in,out] mail with valid oid and mail buffer
+   * @param[in] hash hex encoded content hash of the mail buffer
+   * @return 1 if the mail has been deduplicated, 0 if it is left as it is, < 0 in case of an error
+   */
+  int dedup(RadosMail *mail, const std::string &hash);
+  /*!
+   * Read the referenced body of a deduplicated mail into the mail buffer.
+   * @param[in,out] mail with loaded metadata and valid mail buffer
+   * @return 1 if the body has been read, 0 if the mail is not deduplicated, < 0 in case of an error
+   */
+  int resolve(RadosMail *mail);
+
+  /*!
+   * Register ref as reference of the stored body, write data if the body does not exist.
+   * @param[in] hash content hash (object id of the body)
+   * @param[in] ref oid of the referencing mail object
+   * @param[in] data body
+   * @return linux error code or 0 if successful
+   */
+  int add_ref(const std::string &hash, const std::string &ref, const librados::bufferlist &data);
+  /*!
+   * Register ref as reference of an existing body (e.g. mail copy).
+   * @return -ENOENT if the body does not exist, linux error code or 0 if successful
+   */
+  int add_ref(const std::string &hash, const std::string &ref);
+  /*!
+   * Remove the reference, the body is removed if ref has been the last reference.
+   * @return linux error code or 0 if successful
+   */
+  int release_ref(const std::string &hash, const std::string &ref);
+  /*!
+   * @param[in] hash content hash
+   * @param[out] data valid ptr to bufferlist
+   * @return linux error code or 0 if successful
+   */
+  int read(const std::string &hash, librados::bufferlist *data);
+  /*!
+   * @param[in] hash content hash
+   * @param[out] count number of references
+   * @return linux error code or 0 if successful
+   */
+  int get_ref_count(const std::string &hash, uint64_t *count);
+
+ private:
+  static const int MAX_RETRIES = 5;
+
+  librados::IoCtx io_ctx;
+  bool io_ctx_created;
+  bool enabled;
+  uint64_t min_size;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_DEDUP_H_
@@ -34,6 +34,7 @@ class RadosDovecotCephCfgImpl : public RadosDovecotCephCfg {
   const std::string &get_rados_username() override { return dovecot_cfg.get_rados_username(); }
   void update_pool_name_metadata(const char *value) override { dovecot_cfg.update_pool_name_metadata(value); }
   const std::string &get_rados_save_log_file() override { return dovecot_cfg.get_rados_save_log_file(); }
+  bool is_save_log_binary() override { return dovecot_cfg.is_save_log_binary(); }
   const std::string &get_pool_name_metadata_key() override { return dovecot_cfg.get_pool_name_metadata_key(); }
 
   std::string &get_pool_name() override { return dovecot_cfg.get_pool_name(); }
@@ -46,6 +47,30 @@ class RadosDovecotCephCfgImpl : public RadosDovecotCephCfg {
   bool is_ceph_posix_bugfix_enabled() override { return dovecot_cfg.is_ceph_posix_bugfix_enabled(); }
   bool is_ceph_aio_wait_for_safe_and_cb() override { return dovecot_cfg.is_ceph_aio_wait_for_safe_and_cb(); }
   bool is_write_chunks() override { return dovecot_cfg.is_write_chunks(); }
+  const std::string &get_compression() override { return dovecot_cfg.get_compression(); }
+  int get_compression_level() override { return dovecot_cfg.get_compression_level(); }
+  uint64_t get_compression_min_size() override { return dovecot_cfg.get_compression_min_size(); }
+  const std::string &get_alt_compression() override { return dovecot_cfg.get_alt_compression(); }
+  int get_alt_compression_level() override { return dovecot_cfg.get_alt_compression_level(); }
+  bool is_dedup() override { return dovecot_cfg.is_dedup(); }
+  uint64_t get_dedup_min_size() override { return dovecot_cfg.get_dedup_min_size(); }
+  const std::string &get_dedup_pool() override { return dovecot_cfg.get_dedup_pool(); }
+  const std::string &get_metrics_file() override { return dovecot_cfg.get_metrics_file(); }
+  unsigned int get_read_ahead_mails() override { return dovecot_cfg.get_read_ahead_mails(); }
+  uint64_t get_read_ahead_max_bytes() override { return dovecot_cfg.get_read_ahead_max_bytes(); }
+  uint64_t get_mail_cache_size() override { return dovecot_cfg.get_mail_cache_size(); }
+  uint64_t get_stripe_min_size() override { return dovecot_cfg.get_stripe_min_size(); }
+  uint64_t get_stripe_size() override { return dovecot_cfg.get_stripe_size(); }
+  uint64_t get_pack_max_size() override { return dovecot_cfg.get_pack_max_size(); }
+  uint64_t get_pack_container_size() override { return dovecot_cfg.get_pack_container_size(); }
+  const std::string &get_metadata_pool() override { return dovecot_cfg.get_metadata_pool(); }
+  uint64_t get_throttle_ops_per_sec() override { return dovecot_cfg.get_throttle_ops_per_sec(); }
+  uint64_t get_throttle_bytes_per_sec() override { return dovecot_cfg.get_throttle_bytes_per_sec(); }
+  uint64_t get_throttle_inflight_ops() override { return dovecot_cfg.get_throttle_inflight_ops(); }
+  uint64_t get_throttle_inflight_bytes() override { return dovecot_cfg.get_throttle_inflight_bytes(); }
+  const std::string &get_replica_reads() override { return dovecot_cfg.get_replica_reads(); }
+  double get_hedged_reads_percentile() override { return dovecot_cfg.get_hedged_reads_percentile(); }
+  uint64_t get_hedged_reads_min_delay() override { return dovecot_cfg.get_hedged_reads_min_delay(); }
   // rados config
   bool is_user_mapping() override { return rados_cfg.is_user_mapping(); }
   void set_config_valid(bool is_valid_) override {
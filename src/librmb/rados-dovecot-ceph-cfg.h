@@ -32,6 +32,7 @@ class RadosDovecotCephCfg {
   virtual const std::string &get_rados_cluster_name() = 0;
   virtual const std::string &get_rados_username() = 0;
   virtual const std::string &get_rados_save_log_file() = 0;
+  virtual bool is_save_log_binary() = 0;
   virtual bool is_mail_attribute(enum rbox_metadata_key key) = 0;
   virtual bool is_updateable_attribute(enum rbox_metadata_key key) = 0;
   virtual void set_update_attributes(const std::string &update_attributes_) = 0;
@@ -41,6 +42,30 @@ class RadosDovecotCephCfg {
   virtual bool is_ceph_posix_bugfix_enabled() = 0;
   virtual bool is_ceph_aio_wait_for_safe_and_cb() = 0;
   virtual bool is_write_chunks() = 0;
+  virtual const std::string &get_compression() = 0;
+  virtual int get_compression_level() = 0;
+  virtual uint64_t get_compression_min_size() = 0;
+  virtual const std::string &get_alt_compression() = 0;
+  virtual int get_alt_compression_level() = 0;
+  virtual bool is_dedup() = 0;
+  virtual uint64_t get_dedup_min_size() = 0;
+  virtual const std::string &get_dedup_pool() = 0;
+  virtual const std::string &get_metrics_file() = 0;
+  virtual unsigned int get_read_ahead_mails() = 0;
+  virtual uint64_t get_read_ahead_max_bytes() = 0;
+  virtual uint64_t get_mail_cache_size() = 0;
+  virtual uint64_t get_stripe_min_size() = 0;
+  virtual uint64_t get_stripe_size() = 0;
+  virtual uint64_t get_pack_max_size() = 0;
+  virtual uint64_t get_pack_container_size() = 0;
+  virtual const std::string &get_metadata_pool() = 0;
+  virtual uint64_t get_throttle_ops_per_sec() = 0;
+  virtual uint64_t get_throttle_bytes_per_sec() = 0;
+  virtual uint64_t get_throttle_inflight_ops() = 0;
+  virtual uint64_t get_throttle_inflight_bytes() = 0;
+  virtual const std::string &get_replica_reads() = 0;
+  virtual double get_hedged_reads_percentile() = 0;
+  virtual uint64_t get_hedged_reads_min_delay() = 0;
 
   virtual const std::string &get_pool_name_metadata_key() = 0;
   virtual const std::string &get_update_attributes_key() = 0;
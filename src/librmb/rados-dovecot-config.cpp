@@ -25,9 +25,34 @@ RadosConfig::RadosConfig()
       prefix_keyword("k"),
       bugfix_cephfs_posix_hardlinks("rbox_bugfix_cephfs_21652"),
       save_log("rados_save_log"),
+      save_log_format("rados_save_log_format"),
       rbox_check_empty_mailboxes("rados_check_empty_mailboxes"),
       rbox_ceph_aio_wait_for_safe_and_cb("rbox_ceph_aio_wait_for_safe_and_cb"),
-      rbox_ceph_write_chunks("rbox_ceph_write_chunks") {
+      rbox_ceph_write_chunks("rbox_ceph_write_chunks"),
+      rbox_compression("rbox_compression"),
+      rbox_compression_level("rbox_compression_level"),
+      rbox_compression_min_size("rbox_compression_min_size"),
+      rbox_alt_compression("rbox_alt_compression"),
+      rbox_alt_compression_level("rbox_alt_compression_level"),
+      rbox_dedup("rbox_dedup"),
+      rbox_dedup_min_size("rbox_dedup_min_size"),
+      rbox_dedup_pool("rbox_dedup_pool"),
+      rbox_metrics_file("rbox_metrics_file"),
+      rbox_read_ahead_mails("rbox_read_ahead_mails"),
+      rbox_read_ahead_max_bytes("rbox_read_ahead_max_bytes"),
+      rbox_mail_cache_size("rbox_mail_cache_size"),
+      rbox_stripe_min_size("rbox_stripe_min_size"),
+      rbox_stripe_size("rbox_stripe_size"),
+      rbox_pack_max_size("rbox_pack_max_size"),
+      rbox_pack_container_size("rbox_pack_container_size"),
+      rbox_metadata_pool("rbox_metadata_pool"),
+      rbox_throttle_ops_per_sec("rbox_throttle_ops_per_sec"),
+      rbox_throttle_bytes_per_sec("rbox_throttle_bytes_per_sec"),
+      rbox_throttle_inflight_ops("rbox_throttle_inflight_ops"),
+      rbox_throttle_inflight_bytes("rbox_throttle_inflight_bytes"),
+      rbox_replica_reads("rbox_replica_reads"),
+      rbox_hedged_reads_percentile("rbox_hedged_reads_percentile"),
+      rbox_hedged_reads_min_delay("rbox_hedged_reads_min_delay") {
   config[pool_name] = "mail_storage";
 
   config[rbox_cfg_object_name] = "rbox_cfg";
@@ -35,9 +60,43 @@ RadosConfig::RadosConfig()
   config[rados_username] = "client.admin";
   config[bugfix_cephfs_posix_hardlinks] = "false";
   config[save_log] = "";
+  config[save_log_format] = "csv";
   config[rbox_check_empty_mailboxes] = "false";
   config[rbox_ceph_aio_wait_for_safe_and_cb] = "false";
   config[rbox_ceph_write_chunks] = "false";
+  config[rbox_compression] = "none";
+  config[rbox_compression_level] = "0";
+  config[rbox_compression_min_size] = "4096";
+  // empty: alt storage uses rbox_compression
+  config[rbox_alt_compression] = "";
+  config[rbox_alt_compression_level] = "0";
+  config[rbox_dedup] = "false";
+  config[rbox_dedup_min_size] = "65536";
+  // empty: mail bodies are deduplicated within the mail pool
+  config[rbox_dedup_pool] = "";
+  // empty: operation metrics are not exported
+  config[rbox_metrics_file] = "";
+  // 0: mails are not read ahead
+  config[rbox_read_ahead_mails] = "0";
+  config[rbox_read_ahead_max_bytes] = "16777216";
+  config[rbox_mail_cache_size] = "0";
+  // 0: mails are not striped
+  config[rbox_stripe_min_size] = "0";
+  config[rbox_stripe_size] = "4194304";
+  // 0: mails are not packed
+  config[rbox_pack_max_size] = "0";
+  config[rbox_pack_container_size] = "4194304";
+  config[rbox_metadata_pool] = "";
+  // 0: rados operations are not throttled
+  config[rbox_throttle_ops_per_sec] = "0";
+  config[rbox_throttle_bytes_per_sec] = "0";
+  config[rbox_throttle_inflight_ops] = "0";
+  config[rbox_throttle_inflight_bytes] = "0";
+  // none, balance or localize: read mail bodies and immutable metadata from replicas
+  config[rbox_replica_reads] = "none";
+  // 0: mail reads are not hedged
+  config[rbox_hedged_reads_percentile] = "0";
+  config[rbox_hedged_reads_min_delay] = "20000";
   is_valid = false;
 }
 
@@ -70,10 +129,35 @@ std::string RadosConfig::to_string() {
   ss << "  " << rados_username << "=" << config[rados_username] << std::endl;
   ss << "  " << bugfix_cephfs_posix_hardlinks << "=" << config[bugfix_cephfs_posix_hardlinks] << std::endl;
   ss << "  " << save_log << "=" << config[save_log] << std::endl;
+  ss << "  " << save_log_format << "=" << config[save_log_format] << std::endl;
   ss << "  " << rbox_check_empty_mailboxes << "=" << config[rbox_check_empty_mailboxes] << std::endl;
   ss << "  " << rbox_ceph_aio_wait_for_safe_and_cb << "=" << config[rbox_ceph_aio_wait_for_safe_and_cb] << std::endl;
   ss << "  " << rbox_ceph_write_chunks << "=" << config[rbox_ceph_write_chunks]
      << std::endl;
+  ss << "  " << rbox_compression << "=" << config[rbox_compression] << std::endl;
+  ss << "  " << rbox_compression_level << "=" << config[rbox_compression_level] << std::endl;
+  ss << "  " << rbox_compression_min_size << "=" << config[rbox_compression_min_size] << std::endl;
+  ss << "  " << rbox_alt_compression << "=" << config[rbox_alt_compression] << std::endl;
+  ss << "  " << rbox_alt_compression_level << "=" << config[rbox_alt_compression_level] << std::endl;
+  ss << "  " << rbox_dedup << "=" << config[rbox_dedup] << std::endl;
+  ss << "  " << rbox_dedup_min_size << "=" << config[rbox_dedup_min_size] << std::endl;
+  ss << "  " << rbox_dedup_pool << "=" << config[rbox_dedup_pool] << std::endl;
+  ss << "  " << rbox_metrics_file << "=" << config[rbox_metrics_file] << std::endl;
+  ss << "  " << rbox_read_ahead_mails << "=" << config[rbox_read_ahead_mails] << std::endl;
+  ss << "  " << rbox_read_ahead_max_bytes << "=" << config[rbox_read_ahead_max_bytes] << std::endl;
+  ss << "  " << rbox_mail_cache_size << "=" << config[rbox_mail_cache_size] << std::endl;
+  ss << "  " << rbox_stripe_min_size << "=" << config[rbox_stripe_min_size] << std::endl;
+  ss << "  " << rbox_stripe_size << "=" << config[rbox_stripe_size] << std::endl;
+  ss << "  " << rbox_pack_max_size << "=" << config[rbox_pack_max_size] << std::endl;
+  ss << "  " << rbox_pack_container_size << "=" << config[rbox_pack_container_size] << std::endl;
+  ss << "  " << rbox_metadata_pool << "=" << config[rbox_metadata_pool] << std::endl;
+  ss << "  " << rbox_throttle_ops_per_sec << "=" << config[rbox_throttle_ops_per_sec] << std::endl;
+  ss << "  " << rbox_throttle_bytes_per_sec << "=" << config[rbox_throttle_bytes_per_sec] << std::endl;
+  ss << "  " << rbox_throttle_inflight_ops << "=" << config[rbox_throttle_inflight_ops] << std::endl;
+  ss << "  " << rbox_throttle_inflight_bytes << "=" << config[rbox_throttle_inflight_bytes] << std::endl;
+  ss << "  " << rbox_replica_reads << "=" << config[rbox_replica_reads] << std::endl;
+  ss << "  " << rbox_hedged_reads_percentile << "=" << config[rbox_hedged_reads_percentile] << std::endl;
+  ss << "  " << rbox_hedged_reads_min_delay << "=" << config[rbox_hedged_reads_min_delay] << std::endl;
   return ss.str();
 }
 
@@ -12,6 +12,9 @@
 #ifndef SRC_LIBRMB_RADOS_DOVECOT_CONFIG_H_
 #define SRC_LIBRMB_RADOS_DOVECOT_CONFIG_H_
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include <map>
 #include <string>
 
@@ -37,6 +40,7 @@ class RadosConfig {
 
   std::string &get_pool_name() { return config[pool_name]; }
   const std::string &get_rados_save_log_file() { return config[save_log]; }
+  bool is_save_log_binary() { return config[save_log_format].compare("binary") == 0; }
   bool is_config_valid() { return is_valid; }
   void set_config_valid(bool is_valid_) { this->is_valid = is_valid_; }
 
@@ -60,6 +64,31 @@ class RadosConfig {
   bool is_write_chunks() {
     return config[rbox_ceph_write_chunks].compare("true") == 0 ? true : false;
   }
+  const std::string &get_compression() { return config[rbox_compression]; }
+  int get_compression_level() { return atoi(config[rbox_compression_level].c_str()); }
+  uint64_t get_compression_min_size() { return strtoull(config[rbox_compression_min_size].c_str(), NULL, 10); }
+  const std::string &get_alt_compression() { return config[rbox_alt_compression]; }
+  int get_alt_compression_level() { return atoi(config[rbox_alt_compression_level].c_str()); }
+  bool is_dedup() { return config[rbox_dedup].compare("true") == 0 ? true : false; }
+  uint64_t get_dedup_min_size() { return strtoull(config[rbox_dedup_min_size].c_str(), NULL, 10); }
+  const std::string &get_dedup_pool() { return config[rbox_dedup_pool]; }
+  const std::string &get_metrics_file() { return config[rbox_metrics_file]; }
+  unsigned int get_read_ahead_mails() { return strtoul(config[rbox_read_ahead_mails].c_str(), NULL, 10); }
+  uint64_t get_read_ahead_max_bytes() { return strtoull(config[rbox_read_ahead_max_bytes].c_str(), NULL, 10); }
+  uint64_t get_mail_cache_size() { return strtoull(config[rbox_mail_cache_size].c_str(), NULL, 10); }
+  uint64_t get_stripe_min_size() { return strtoull(config[rbox_stripe_min_size].c_str(), NULL, 10); }
+  uint64_t get_stripe_size() { return strtoull(config[rbox_stripe_size].c_str(), NULL, 10); }
+  uint64_t get_pack_max_size() { return strtoull(config[rbox_pack_max_size].c_str(), NULL, 10); }
+  uint64_t get_pack_container_size() { return strtoull(config[rbox_pack_container_size].c_str(), NULL, 10); }
+  const std::string &get_metadata_pool() { return config[rbox_metadata_pool]; }
+  void set_metadata_pool(const std::string &value) { config[rbox_metadata_pool] = value; }
+  uint64_t get_throttle_ops_per_sec() { return strtoull(config[rbox_throttle_ops_per_sec].c_str(), NULL, 10); }
+  uint64_t get_throttle_bytes_per_sec() { return strtoull(config[rbox_throttle_bytes_per_sec].c_str(), NULL, 10); }
+  uint64_t get_throttle_inflight_ops() { return strtoull(config[rbox_throttle_inflight_ops].c_str(), NULL, 10); }
+  uint64_t get_throttle_inflight_bytes() { return strtoull(config[rbox_throttle_inflight_bytes].c_str(), NULL, 10); }
+  const std::string &get_replica_reads() { return config[rbox_replica_reads]; }
+  double get_hedged_reads_percentile() { return atof(config[rbox_hedged_reads_percentile].c_str()); }
+  uint64_t get_hedged_reads_min_delay() { return strtoull(config[rbox_hedged_reads_min_delay].c_str(), NULL, 10); }
 
   /*!
    * print configuration
@@ -79,9 +108,34 @@ class RadosConfig {
   std::string prefix_keyword;
   std::string bugfix_cephfs_posix_hardlinks;
   std::string save_log;
+  std::string save_log_format;
   std::string rbox_check_empty_mailboxes;
   std::string rbox_ceph_aio_wait_for_safe_and_cb;
   std::string rbox_ceph_write_chunks;
+  std::string rbox_compression;
+  std::string rbox_compression_level;
+  std::string rbox_compression_min_size;
+  std::string rbox_alt_compression;
+  std::string rbox_alt_compression_level;
+  std::string rbox_dedup;
+  std::string rbox_dedup_min_size;
+  std::string rbox_dedup_pool;
+  std::string rbox_metrics_file;
+  std::string rbox_read_ahead_mails;
+  std::string rbox_read_ahead_max_bytes;
+  std::string rbox_mail_cache_size;
+  std::string rbox_stripe_min_size;
+  std::string rbox_stripe_size;
+  std::string rbox_pack_max_size;
+  std::string rbox_pack_container_size;
+  std::string rbox_metadata_pool;
+  std::string rbox_throttle_ops_per_sec;
+  std::string rbox_throttle_bytes_per_sec;
+  std::string rbox_throttle_inflight_ops;
+  std::string rbox_throttle_inflight_bytes;
+  std::string rbox_replica_reads;
+  std::string rbox_hedged_reads_percentile;
+  std::string rbox_hedged_reads_min_delay;
   bool is_valid;
 };
 
@@ -0,0 +1,163 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-hedged-reads.h"
+
+#include <limits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "rados-replica-reads.h"
+#include "rados-throttle.h"
+
+namespace librmb {
+
+namespace {
+
+/* completed attempts of one hedged read (bit per attempt) */
+struct HedgedWait {
+  HedgedWait() : completed(0) {}
+  std::mutex lock;
+  std::condition_variable cond;
+  int completed;
+};
+
+struct HedgedAttempt {
+  HedgedAttempt()
+      : wait(nullptr), index(0), completion(nullptr), read_err(0), stat_err(0), psize(0), save_date(0) {}
+  HedgedWait *wait;
+  int index;
+  librados::AioCompletion *completion;
+  librados::ObjectReadOperation op;
+  librados::bufferlist bl;
+  int read_err;
+  int stat_err;
+  uint64_t psize;
+  time_t save_date;
+};
+
+void attempt_complete_callback(librados::completion_t comp, void *arg) {
+  HedgedAttempt *attempt = static_cast<HedgedAttempt *>(arg);
+  std::lock_guard<std::mutex> guard(attempt->wait->lock);
+  attempt->wait->completed |= 1 << attempt->index;
+  attempt->wait->cond.notify_all();
+}
+
+int submit(librados::IoCtx *io_ctx, const std::string &oid, int flags, HedgedAttempt *attempt) {
+  attempt->op.read(0, INT_MAX, &attempt->bl, &attempt->read_err);
+  attempt->op.stat(&attempt->psize, &attempt->save_date, &attempt->stat_err);
+  attempt->completion = librados::Rados::aio_create_completion();
+  int ret = RadosThrottle::global().aio_operate(io_ctx, oid, attempt->completion, &attempt->op, flags, nullptr, 0,
+                                               attempt_complete_callback, attempt);
+  if (ret < 0) {
+    attempt->completion->release();
+    attempt->completion = nullptr;
+  }
+  return ret;
+}
+
+int get_result(HedgedAttempt *attempt) {
+  int ret = attempt->completion->get_return_value();
+  if (ret >= 0) {
+    ret = attempt->read_err < 0 ? attempt->read_err : attempt->stat_err;
+  }
+  return ret;
+}
+
+}  // namespace
+
+RadosHedgedReads &RadosHedgedReads::global() {
+  static RadosHedgedReads hedged_reads;
+  return hedged_reads;
+}
+
+void RadosHedgedReads::set_percentile(double percentile_) {
+  percentile = std::min(std::max(percentile_, 0.0), 100.0);
+}
+
+uint64_t RadosHedgedReads::get_delay(const RadosHistogram &latency) const {
+  // without samples the percentile is 0, the minimum delay is used then
+  return std::max(latency.percentile(get_percentile()), get_min_delay());
+}
+
+int RadosHedgedReads::read(librados::IoCtx *io_ctx, const std::string &oid, librados::bufferlist *buffer,
+                           uint64_t *psize, time_t *save_date) {
+  uint64_t start = RadosMetrics::now_usecs();
+  RadosReplicaReads &replica_reads = RadosReplicaReads::global();
+  HedgedWait wait;
+  HedgedAttempt attempts[2];
+  attempts[0].wait = &wait;
+  attempts[1].wait = &wait;
+  attempts[1].index = 1;
+
+  int ret = submit(io_ctx, oid, replica_reads.get_flags(), &attempts[0]);
+  if (ret < 0) {
+    return ret;
+  }
+  bool hedged = false;
+  int winner;
+  {
+    std::unique_lock<std::mutex> guard(wait.lock);
+    std::chrono::microseconds delay(get_delay(read_latency));
+    if (!wait.cond.wait_for(guard, delay, [&wait] { return wait.completed != 0; })) {
+      guard.unlock();
+      int flags = replica_reads.is_enabled() ? replica_reads.get_flags() : LIBRADOS_OPERATION_BALANCE_READS;
+      hedged = submit(io_ctx, oid, flags, &attempts[1]) >= 0;
+      guard.lock();
+    }
+    wait.cond.wait(guard, [&wait] { return wait.completed != 0; });
+    winner = (wait.completed & 1) != 0 ? 0 : 1;
+  }
+  ret = get_result(&attempts[winner]);
+  if (hedged) {
+    int other = 1 - winner;
+    if (ret < 0 && ret != -ENOENT) {
+      // the other read may still succeed
+      attempts[other].completion->wait_for_complete_and_cb();
+      int other_ret = get_result(&attempts[other]);
+      if (other_ret >= 0) {
+        winner = other;
+        ret = other_ret;
+      }
+    } else {
+      io_ctx->aio_cancel(attempts[other].completion);
+    }
+  }
+  // a cancelled read completes with -ECANCELED, its buffers are in use until then
+  for (int i = 0; i < 2; i++) {
+    if (attempts[i].completion != nullptr) {
+      attempts[i].completion->wait_for_complete_and_cb();
+      attempts[i].completion->release();
+    }
+  }
+  if (ret >= 0) {
+    buffer->claim_append(attempts[winner].bl);
+    *psize = attempts[winner].psize;
+    *save_date = attempts[winner].save_date;
+  }
+  uint64_t usecs = RadosMetrics::now_usecs() - start;
+  if (ret >= 0) {
+    read_latency.record(usecs);
+  }
+  if (hedged) {
+    bool failed = ret < 0 && ret != -ENOENT;
+    RadosMetrics::global().record(METRIC_HEDGED_READ, usecs, failed);
+    if (winner == 1) {
+      RadosMetrics::global().record(METRIC_HEDGE_WON, usecs, failed);
+    }
+  }
+  return ret;
+}
+
+}  // namespace librmb
@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_HEDGED_READS_H_
+#define SRC_LIBRMB_RADOS_HEDGED_READS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+
+#include <rados/librados.hpp>
+
+#include "rados-metrics.h"
+
+namespace librmb {
+
+/**
+ * RadosHedgedReads
+ *
+ * Hedged reads of mail objects: if a read has not completed after the hedge
+ * delay, the same read is sent again with replica flags (see
+ * RadosReplicaReads, balance if replica reads are disabled), so that a
+ * single slow OSD does not stall the fetch. The first successful read is
+ * taken, the other one is cancelled.
+ *
+ * The hedge delay is the configured percentile of the latency of the
+ * successful object reads done here, at least the minimum delay. It has its
+ * own histogram: METRIC_READ_MAIL also counts packed mails, mails taken from
+ * the read ahead and is reset when the metrics are flushed. Hedged reads are
+ * recorded as METRIC_HEDGED_READ, reads won by the second request as
+ * METRIC_HEDGE_WON.
+ */
+class RadosHedgedReads {
+ public:
+  static const uint64_t DEFAULT_MIN_DELAY = 20000;
+
+  RadosHedgedReads() : percentile(0), min_delay(DEFAULT_MIN_DELAY) {}
+
+  /*!
+   * @return the process wide policy.
+   */
+  static RadosHedgedReads &global();
+
+  /*!
+   * @param[in] percentile_ percentile (0-100) of the mail read latency after which a read is hedged, 0: disabled
+   */
+  void set_percentile(double percentile_);
+  double get_percentile() const { return percentile.load(std::memory_order_relaxed); }
+  /*!
+   * @param[in] usecs lower bound of the hedge delay
+   */
+  void set_min_delay(uint64_t usecs) { min_delay = usecs; }
+  uint64_t get_min_delay() const { return min_delay.load(std::memory_order_relaxed); }
+  bool is_enabled() const { return get_percentile() > 0; }
+
+  /*!
+   * @param[in] latency latency histogram of the hedged operation
+   * @return hedge delay in usecs
+   */
+  uint64_t get_delay(const RadosHistogram &latency) const;
+
+  /*!
+   * read the object data and its stat, hedged after get_delay(get_read_latency()).
+   *
+   * @param[out] buffer object data
+   * @return linux error code or 0 if successful
+   */
+  int read(librados::IoCtx *io_ctx, const std::string &oid, librados::bufferlist *buffer, uint64_t *psize,
+           time_t *save_date);
+  /* latency of the successful reads (hedged or not) */
+  const RadosHistogram &get_read_latency() const { return read_latency; }
+
+ private:
+  RadosHedgedReads(const RadosHedgedReads &);
+  RadosHedgedReads &operator=(const RadosHedgedReads &);
+
+  std::atomic<double> percentile;
+  std::atomic<uint64_t> min_delay;
+  RadosHistogram read_latency;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_HEDGED_READS_H_
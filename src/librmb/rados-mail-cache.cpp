@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-mail-cache.h"
+
+#include "rados-storage.h"
+
+namespace librmb {
+
+RadosMailCache &RadosMailCache::global() {
+  static RadosMailCache cache;
+  return cache;
+}
+
+void RadosMailCache::set_max_bytes(uint64_t max_bytes_) {
+  max_bytes = max_bytes_;
+  evict(max_bytes);
+}
+
+std::string RadosMailCache::make_key(RadosStorage *storage, const std::string &oid) {
+  // pool names and namespaces do not contain NUL
+  std::string key = storage->get_pool_name();
+  key.push_back('\0');
+  key.append(storage->get_namespace());
+  key.push_back('\0');
+  key.append(oid);
+  return key;
+}
+
+bool RadosMailCache::get(RadosStorage *storage, const std::string &oid, librados::bufferlist *buffer, uint64_t *psize,
+                         time_t *save_date) {
+  std::map<std::string, std::list<Entry>::iterator>::iterator it = entries.find(make_key(storage, oid));
+  if (it == entries.end()) {
+    ++misses;
+    return false;
+  }
+  lru.splice(lru.begin(), lru, it->second);
+  buffer->append(it->second->bl);
+  *psize = it->second->psize;
+  *save_date = it->second->save_date;
+  ++hits;
+  return true;
+}
+
+void RadosMailCache::put(RadosStorage *storage, const std::string &oid, librados::bufferlist &buffer, uint64_t psize,
+                         time_t save_date) {
+  std::string key = make_key(storage, oid);
+  std::map<std::string, std::list<Entry>::iterator>::iterator it = entries.find(key);
+  if (it != entries.end()) {
+    erase(it);
+  }
+  uint64_t size = buffer.length();
+  if (!is_enabled() || size > max_bytes / 4) {
+    return;
+  }
+  evict(max_bytes - size);
+  // make the buffer contiguous once, so that the readers (c_str()) share it without rebuilding it
+  buffer.c_str();
+  Entry entry;
+  entry.key = key;
+  entry.bl = buffer;
+  entry.psize = psize;
+  entry.save_date = save_date;
+  lru.push_front(entry);
+  entries[key] = lru.begin();
+  bytes += size;
+}
+
+void RadosMailCache::remove(RadosStorage *storage, const std::string &oid) {
+  std::map<std::string, std::list<Entry>::iterator>::iterator it = entries.find(make_key(storage, oid));
+  if (it != entries.end()) {
+    erase(it);
+  }
+}
+
+void RadosMailCache::clear() {
+  lru.clear();
+  entries.clear();
+  bytes = 0;
+}
+
+void RadosMailCache::evict(uint64_t max_size) {
+  while (bytes > max_size && !lru.empty()) {
+    erase(entries.find(lru.back().key));
+  }
+}
+
+void RadosMailCache::erase(std::map<std::string, std::list<Entry>::iterator>::iterator it) {
+  bytes -= it->second->bl.length();
+  lru.erase(it->second);
+  entries.erase(it);
+}
+
+}  // namespace librmb
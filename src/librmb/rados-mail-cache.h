@@ -0,0 +1,101 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_MAIL_CACHE_H_
+#define SRC_LIBRMB_RADOS_MAIL_CACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <rados/librados.hpp>
+
+namespace librmb {
+
+class RadosStorage;
+
+/**
+ * RadosMailCache
+ *
+ * Process wide LRU cache of mail objects (data as read from rados + stat),
+ * bounded by the total size of the cached data. Entries are keyed by pool,
+ * namespace and oid of the storage the mail was read from. Mail objects are
+ * immutable, so entries only have to be removed if the mail is expunged or
+ * moved to another pool. The cached bufferlists share their buffers with the
+ * readers instead of copying them.
+ */
+class RadosMailCache {
+ public:
+  RadosMailCache() : max_bytes(0), bytes(0), hits(0), misses(0) {}
+
+  /*!
+   * @return the process wide cache.
+   */
+  static RadosMailCache &global();
+
+  /*!
+   * @param[in] max_bytes_ max size of all cached mails, 0 disables the cache. Entries exceeding the new
+   * size are evicted.
+   */
+  void set_max_bytes(uint64_t max_bytes_);
+  bool is_enabled() const { return max_bytes > 0; }
+
+  /*!
+   * @param[in] storage pool and namespace of the mail object
+   * @param[in] oid mail object
+   * @param[out] buffer valid ptr, the cached data is appended (shared, not copied)
+   * @param[out] psize object size
+   * @param[out] save_date object mtime
+   * @return false if oid is not cached
+   */
+  bool get(RadosStorage *storage, const std::string &oid, librados::bufferlist *buffer, uint64_t *psize,
+           time_t *save_date);
+  /*!
+   * Add or replace the mail object. Objects larger than a quarter of the cache are not cached, so a
+   * single large mail does not evict everything else.
+   */
+  void put(RadosStorage *storage, const std::string &oid, librados::bufferlist &buffer, uint64_t psize,
+           time_t save_date);
+  void remove(RadosStorage *storage, const std::string &oid);
+  void clear();
+
+  size_t get_count() const { return entries.size(); }
+  uint64_t get_bytes() const { return bytes; }
+  uint64_t get_hits() const { return hits; }
+  uint64_t get_misses() const { return misses; }
+
+ private:
+  struct Entry {
+    std::string key;
+    librados::bufferlist bl;
+    uint64_t psize;
+    time_t save_date;
+  };
+
+  static std::string make_key(RadosStorage *storage, const std::string &oid);
+  void evict(uint64_t max_size);
+  void erase(std::map<std::string, std::list<Entry>::iterator>::iterator it);
+
+  uint64_t max_bytes;
+  uint64_t bytes;
+  uint64_t hits;
+  uint64_t misses;
+  // most recently used first
+  std::list<Entry> lru;
+  std::map<std::string, std::list<Entry>::iterator> entries;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_MAIL_CACHE_H_
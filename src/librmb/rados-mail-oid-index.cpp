@@ -0,0 +1,86 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-mail-oid-index.h"
+
+namespace librmb {
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+RadosMailOidIndex::RadosMailOidIndex(const std::list<RadosMail *> &mail_objects) {
+  guid_index.reserve(mail_objects.size());
+  for (std::list<RadosMail *>::const_iterator it = mail_objects.begin(); it != mail_objects.end(); ++it) {
+    add(*it);
+  }
+}
+
+bool RadosMailOidIndex::oid_to_guid(const std::string &oid, unsigned char *guid) {
+  if (oid.size() != OID_GUID_SIZE * 2) {
+    return false;
+  }
+  for (int i = 0; i < OID_GUID_SIZE; i++) {
+    int high = hex_value(oid[i * 2]);
+    int low = hex_value(oid[i * 2 + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    guid[i] = static_cast<unsigned char>((high << 4) | low);
+  }
+  return true;
+}
+
+RadosMailOidIndex::GuidKey RadosMailOidIndex::to_key(const unsigned char *guid) {
+  GuidKey key = {0, 0};
+  for (int i = 0; i < 8; i++) {
+    key.hi = (key.hi << 8) | guid[i];
+    key.lo = (key.lo << 8) | guid[i + 8];
+  }
+  return key;
+}
+
+void RadosMailOidIndex::add(RadosMail *mail) {
+  if (mail == nullptr) {
+    return;
+  }
+  unsigned char guid[OID_GUID_SIZE];
+  if (oid_to_guid(*mail->get_oid(), guid)) {
+    guid_index[to_key(guid)] = mail;
+  } else {
+    other_index[*mail->get_oid()] = mail;
+  }
+}
+
+RadosMail *RadosMailOidIndex::find(const unsigned char *oid) const {
+  if (oid == nullptr) {
+    return nullptr;
+  }
+  auto it = guid_index.find(to_key(oid));
+  return it != guid_index.end() ? it->second : nullptr;
+}
+
+RadosMail *RadosMailOidIndex::find(const std::string &oid) const {
+  unsigned char guid[OID_GUID_SIZE];
+  if (oid_to_guid(oid, guid)) {
+    return find(guid);
+  }
+  auto it = other_index.find(oid);
+  return it != other_index.end() ? it->second : nullptr;
+}
+
+}  // namespace librmb
@@ -0,0 +1,84 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_MAIL_OID_INDEX_H_
+#define SRC_LIBRMB_RADOS_MAIL_OID_INDEX_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "rados-mail.h"
+
+namespace librmb {
+
+/**
+ * RadosMailOidIndex
+ *
+ * Hash index of mail objects keyed by the binary (16 byte) guid of
+ * their oid. Used to match dovecot index records (obox_mail_index_record)
+ * against the objects of a namespace in constant time. Objects whose oid is
+ * not a guid are kept in a separate string keyed map.
+ */
+class RadosMailOidIndex {
+ public:
+  static const int OID_GUID_SIZE = 16;
+
+  RadosMailOidIndex() {}
+  explicit RadosMailOidIndex(const std::list<RadosMail *> &mail_objects);
+  ~RadosMailOidIndex() {}
+
+  /*!
+   * add mail to index (mail is not owned by the index)
+   * @param[in] mail valid mail object
+   */
+  void add(RadosMail *mail);
+  /*!
+   * @param[in] oid binary guid (16 bytes)
+   * @return mail or nullptr
+   */
+  RadosMail *find(const unsigned char *oid) const;
+  /*!
+   * @param[in] oid object identifier
+   * @return mail or nullptr
+   */
+  RadosMail *find(const std::string &oid) const;
+  size_t size() const { return guid_index.size() + other_index.size(); }
+
+  /*!
+   * convert a 32 character hex string to a binary guid
+   * @param[in] oid lowercase hex string as written by guid_128_to_string
+   * @param[out] guid buffer with at least OID_GUID_SIZE bytes
+   * @return false if oid is not a lowercase hex guid; such oids are matched exactly
+   */
+  static bool oid_to_guid(const std::string &oid, unsigned char *guid);
+
+ private:
+  struct GuidKey {
+    uint64_t hi;
+    uint64_t lo;
+    bool operator==(const GuidKey &other) const { return hi == other.hi && lo == other.lo; }
+  };
+  struct GuidKeyHash {
+    // oids are random guids, so folding both halves is a sufficient hash
+    size_t operator()(const GuidKey &key) const { return static_cast<size_t>(key.hi ^ (key.lo * 31)); }
+  };
+  static GuidKey to_key(const unsigned char *guid);
+
+  std::unordered_map<GuidKey, RadosMail *, GuidKeyHash> guid_index;
+  std::unordered_map<std::string, RadosMail *> other_index;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_MAIL_OID_INDEX_H_
@@ -0,0 +1,526 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-mail-pack.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rados-replica-reads.h"
+#include "rados-util.h"
+
+namespace librmb {
+
+const char *RadosMailPack::PACK_NAMESPACE = "rbox_packs";
+
+namespace {
+
+const char *XATTR_SIZE = "S";
+const char *XATTR_CURRENT = "C";
+const char ENTRY_MAGIC = 'P';
+const char ENTRY_VERSION = 1;
+
+void open_pack_io_ctx(librados::IoCtx &io_ctx, librados::IoCtx *pack_io_ctx) {
+  pack_io_ctx->dup(io_ctx);
+  pack_io_ctx->set_namespace(RadosMailPack::PACK_NAMESPACE);
+}
+
+// sizes and offsets are encoded little endian
+void encode_u32(uint32_t value, librados::bufferlist *bl) {
+  char buf[4];
+  for (int i = 0; i < 4; i++) {
+    buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+  bl->append(buf, sizeof(buf));
+}
+
+bool decode_u32(const char **pos, const char *end, uint32_t *value) {
+  if (end - *pos < 4) {
+    return false;
+  }
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(*pos);
+  *value = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+  *pos += 4;
+  return true;
+}
+
+void encode_map(const std::map<std::string, ceph::bufferlist> &map, librados::bufferlist *bl) {
+  encode_u32(map.size(), bl);
+  for (std::map<std::string, ceph::bufferlist>::const_iterator it = map.begin(); it != map.end(); ++it) {
+    encode_u32(it->first.size(), bl);
+    bl->append(it->first.c_str(), it->first.size());
+    encode_u32(it->second.length(), bl);
+    bl->append(it->second);
+  }
+}
+
+bool decode_map(const char **pos, const char *end, std::map<std::string, ceph::bufferlist> *map) {
+  uint32_t count = 0;
+  if (!decode_u32(pos, end, &count)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t key_size = 0;
+    if (!decode_u32(pos, end, &key_size) || key_size > static_cast<size_t>(end - *pos)) {
+      return false;
+    }
+    std::string key(*pos, key_size);
+    *pos += key_size;
+    uint32_t value_size = 0;
+    if (!decode_u32(pos, end, &value_size) || value_size > static_cast<size_t>(end - *pos)) {
+      return false;
+    }
+    (*map)[key].append(*pos, value_size);
+    *pos += value_size;
+  }
+  return true;
+}
+
+librados::bufferlist to_bl(uint64_t value) {
+  librados::bufferlist bl;
+  bl.append(std::to_string(value));
+  return bl;
+}
+
+/* S and C are decimal strings, so they can be compared by cmpxattr */
+int read_number(librados::IoCtx &pack_io_ctx, const std::string &oid, const char *name, uint64_t *value) {
+  librados::bufferlist bl;
+  int ret = pack_io_ctx.getxattr(oid, name, bl);
+  if (ret < 0) {
+    return ret;
+  }
+  std::string str = bl.to_str();
+  char *end = NULL;
+  errno = 0;
+  unsigned long long number = strtoull(str.c_str(), &end, 10);  // NOLINT
+  if (str.empty() || *end != '\0' || errno != 0) {
+    return -EINVAL;
+  }
+  *value = number;
+  return 0;
+}
+
+}  // namespace
+
+void RadosMailPack::Entry::encode(librados::bufferlist *bl) const {
+  bl->append(ENTRY_MAGIC);
+  bl->append(ENTRY_VERSION);
+  encode_u32(offset, bl);
+  encode_u32(length, bl);
+  encode_map(metadata, bl);
+  encode_map(extended_metadata, bl);
+}
+
+bool RadosMailPack::Entry::decode(librados::bufferlist &bl) {
+  const char *pos = bl.c_str();
+  const char *end = pos + bl.length();
+  if (bl.length() < 2 || pos[0] != ENTRY_MAGIC || pos[1] != ENTRY_VERSION) {
+    return false;
+  }
+  pos += 2;
+  Entry entry;
+  if (!decode_u32(&pos, end, &entry.offset) || !decode_u32(&pos, end, &entry.length) ||
+      !decode_map(&pos, end, &entry.metadata) || !decode_map(&pos, end, &entry.extended_metadata)) {
+    return false;
+  }
+  offset = entry.offset;
+  length = entry.length;
+  metadata.swap(entry.metadata);
+  extended_metadata.swap(entry.extended_metadata);
+  return true;
+}
+
+std::string RadosMailPack::get_container_oid(const std::string &mailbox_guid, uint32_t container) {
+  // fixed width, so the directory lists the containers in order
+  char number[9];
+  snprintf(number, sizeof(number), "%08x", container);
+  return mailbox_guid + "." + number;
+}
+
+int RadosMailPack::start_container(librados::IoCtx &pack_io_ctx, const std::string &mailbox_guid, uint32_t number,
+                                   Container *current) {
+  std::string oid = get_container_oid(mailbox_guid, number);
+  librados::ObjectWriteOperation create_op;
+  create_op.create(true);
+  create_op.setxattr(XATTR_SIZE, to_bl(0));
+  int ret = pack_io_ctx.operate(oid, &create_op);
+  uint64_t size = 0;
+  if (ret == -EEXIST) {
+    // started by another process
+    ret = read_number(pack_io_ctx, oid, XATTR_SIZE, &size);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  std::map<std::string, librados::bufferlist> directory_entry;
+  directory_entry[oid] = librados::bufferlist();
+  librados::ObjectWriteOperation directory_op;
+  directory_op.create(false);
+  directory_op.omap_set(directory_entry);
+  directory_op.setxattr(XATTR_CURRENT, to_bl(number));
+  ret = pack_io_ctx.operate(mailbox_guid, &directory_op);
+  if (ret < 0) {
+    return ret;
+  }
+  current->number = number;
+  current->size = size;
+  return 0;
+}
+
+int RadosMailPack::load_current(librados::IoCtx &pack_io_ctx, const std::string &mailbox_guid, Container *current) {
+  uint64_t number = 0;
+  int ret = read_number(pack_io_ctx, mailbox_guid, XATTR_CURRENT, &number);
+  if (ret == -ENOENT || ret == -ENODATA) {
+    return start_container(pack_io_ctx, mailbox_guid, 1, current);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  if (number == 0 || number >= UINT32_MAX) {
+    return -EINVAL;
+  }
+  uint64_t size = 0;
+  ret = read_number(pack_io_ctx, get_container_oid(mailbox_guid, number), XATTR_SIZE, &size);
+  if (ret == -ENOENT) {
+    // removed by a compaction
+    return start_container(pack_io_ctx, mailbox_guid, number + 1, current);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  current->number = number;
+  current->size = size;
+  return 0;
+}
+
+int RadosMailPack::append(librados::IoCtx &io_ctx, const std::string &mailbox_guid,
+                          const std::vector<RadosMail *> &mails, std::vector<Location> *locations) {
+  if (locations == nullptr) {
+    return -EINVAL;
+  }
+  locations->assign(mails.size(), Location());
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+
+  Container &current = containers[mailbox_guid];
+  size_t next = 0;
+  int retries = 0;
+  while (next < mails.size()) {
+    if (retries++ > MAX_RETRIES) {
+      current = Container();
+      return -EBUSY;
+    }
+    int ret = 0;
+    if (current.number == 0) {
+      ret = load_current(pack_io_ctx, mailbox_guid, &current);
+      if (ret < 0) {
+        current = Container();
+        return ret;
+      }
+    }
+    // as many mails as fit into the container, an empty container takes at least one.
+    librados::bufferlist data;
+    std::map<std::string, librados::bufferlist> entries;
+    uint64_t size = current.size;
+    size_t end = next;
+    for (; end < mails.size(); end++) {
+      librados::bufferlist *buffer = mails[end]->get_mail_buffer();
+      if (buffer == nullptr) {
+        return -EINVAL;
+      }
+      uint64_t length = buffer->length();
+      bool fits = size <= container_size && length <= container_size - size && size + length <= UINT32_MAX;
+      if (!fits && !(size == 0 && end == next)) {
+        break;
+      }
+      Entry entry;
+      entry.offset = size;
+      entry.length = length;
+      entry.metadata = *mails[end]->get_metadata();
+      entry.extended_metadata = *mails[end]->get_extended_metadata();
+      entry.encode(&entries[*mails[end]->get_oid()]);
+      data.append(*buffer);
+
+      (*locations)[end].container = current.number;
+      (*locations)[end].offset = entry.offset;
+      (*locations)[end].length = entry.length;
+      size += length;
+    }
+    if (end == next) {
+      // full or sealed by a compaction
+      uint32_t full = current.number;
+      ret = load_current(pack_io_ctx, mailbox_guid, &current);
+      if (ret >= 0 && current.number == full) {
+        ret = start_container(pack_io_ctx, mailbox_guid, full + 1, &current);
+      }
+      if (ret < 0) {
+        current = Container();
+        return ret;
+      }
+      continue;
+    }
+
+    librados::ObjectWriteOperation write_op;
+    write_op.cmpxattr(XATTR_SIZE, LIBRADOS_CMPXATTR_OP_EQ, current.size);
+    write_op.write(current.size, data);
+    write_op.setxattr(XATTR_SIZE, to_bl(size));
+    write_op.omap_set(entries);
+    ret = pack_io_ctx.operate(get_container_oid(mailbox_guid, current.number), &write_op);
+    if (ret == -ECANCELED || ret == -ENOENT) {
+      // appended by another process, sealed or removed: reload the current container
+      current = Container();
+      continue;
+    }
+    if (ret < 0) {
+      current = Container();
+      return ret;
+    }
+    current.size = size;
+    next = end;
+    retries = 0;
+  }
+  return 0;
+}
+
+int RadosMailPack::read(librados::IoCtx &io_ctx, const std::string &mailbox_guid, const Location &location,
+                        librados::bufferlist *buffer) {
+  if (buffer == nullptr || location.container == 0) {
+    return -EINVAL;
+  }
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  // written ranges of a container never change, they may be read from a replica
+  librados::bufferlist bl;
+  int read_err = 0;
+  librados::ObjectReadOperation op;
+  op.read(location.offset, location.length, &bl, &read_err);
+  int ret = RadosReplicaReads::global().operate(&pack_io_ctx, get_container_oid(mailbox_guid, location.container),
+                                                &op, location.length);
+  if (ret >= 0) {
+    ret = read_err;
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  if (bl.length() != location.length) {
+    return -EIO;
+  }
+  buffer->claim_append(bl);
+  return 0;
+}
+
+int RadosMailPack::load_entry(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                              const std::string &oid, Entry *entry) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  std::set<std::string> keys;
+  keys.insert(oid);
+  std::map<std::string, librados::bufferlist> values;
+  int ret = pack_io_ctx.omap_get_vals_by_keys(get_container_oid(mailbox_guid, container), keys, &values);
+  if (ret < 0) {
+    return ret;
+  }
+  std::map<std::string, librados::bufferlist>::iterator it = values.find(oid);
+  if (it == values.end()) {
+    return -ENOENT;
+  }
+  return entry->decode(it->second) ? 0 : -EINVAL;
+}
+
+int RadosMailPack::save_entry(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                              const std::string &oid, const Entry &entry) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  std::map<std::string, librados::bufferlist> values;
+  entry.encode(&values[oid]);
+  librados::ObjectWriteOperation write_op;
+  write_op.assert_exists();
+  write_op.omap_set(values);
+  return pack_io_ctx.operate(get_container_oid(mailbox_guid, container), &write_op);
+}
+
+int RadosMailPack::load_metadata(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                                 RadosMail *mail) {
+  if (mail == nullptr) {
+    return -EINVAL;
+  }
+  Entry entry;
+  int ret = load_entry(io_ctx, mailbox_guid, container, *mail->get_oid(), &entry);
+  if (ret < 0) {
+    return ret;
+  }
+  mail->get_metadata()->swap(entry.metadata);
+  mail->get_extended_metadata()->swap(entry.extended_metadata);
+  return 0;
+}
+
+int RadosMailPack::remove(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                          const std::set<std::string> &oids) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  librados::ObjectWriteOperation write_op;
+  write_op.assert_exists();
+  write_op.omap_rm_keys(oids);
+  int ret = pack_io_ctx.operate(get_container_oid(mailbox_guid, container), &write_op);
+  return ret == -ENOENT ? 0 : ret;
+}
+
+int RadosMailPack::remove_container(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  std::string oid = get_container_oid(mailbox_guid, container);
+  int ret = pack_io_ctx.remove(oid);
+  if (ret < 0 && ret != -ENOENT) {
+    return ret;
+  }
+  std::set<std::string> keys;
+  keys.insert(oid);
+  ret = pack_io_ctx.omap_rm_keys(mailbox_guid, keys);
+  return ret == -ENOENT ? 0 : ret;
+}
+
+int RadosMailPack::compact(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                           const std::set<std::string> &expunged, std::map<std::string, Location> *relocated) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  std::string oid = get_container_oid(mailbox_guid, container);
+
+  // the current container still takes new mails, it is compacted once another container is started.
+  uint64_t current = 0;
+  int ret = read_number(pack_io_ctx, mailbox_guid, XATTR_CURRENT, &current);
+  if (ret < 0) {
+    return ret == -ENOENT ? 0 : ret;
+  }
+  if (current == container) {
+    return 0;
+  }
+  uint64_t size = 0;
+  ret = read_number(pack_io_ctx, oid, XATTR_SIZE, &size);
+  if (ret < 0) {
+    return ret == -ENOENT ? 0 : ret;
+  }
+  std::map<std::string, Entry> entries;
+  ret = list_entries(io_ctx, mailbox_guid, container, &entries);
+  if (ret < 0) {
+    return ret;
+  }
+  uint64_t live = 0;
+  for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end();) {
+    if (expunged.find(it->first) != expunged.end()) {
+      entries.erase(it++);
+      continue;
+    }
+    live += it->second.length;
+    ++it;
+  }
+  // a sealed container is left over by an interrupted compaction
+  if (size != SEALED) {
+    if (live * 2 >= size) {
+      return 0;
+    }
+    librados::ObjectWriteOperation seal_op;
+    seal_op.cmpxattr(XATTR_SIZE, LIBRADOS_CMPXATTR_OP_EQ, size);
+    seal_op.setxattr(XATTR_SIZE, to_bl(SEALED));
+    ret = pack_io_ctx.operate(oid, &seal_op);
+    if (ret == -ECANCELED) {
+      // appended by another process, try again with the next expunge
+      return 0;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  if (entries.empty()) {
+    return 1;
+  }
+
+  librados::bufferlist data;
+  uint64_t data_size = 0;
+  time_t mtime = 0;
+  ret = pack_io_ctx.stat(oid, &data_size, &mtime);
+  if (ret >= 0) {
+    ret = pack_io_ctx.read(oid, data, data_size, 0);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  std::vector<RadosMail *> mails;
+  for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end() && ret >= 0; ++it) {
+    if (static_cast<uint64_t>(it->second.offset) + it->second.length > data.length()) {
+      ret = -EIO;
+      break;
+    }
+    RadosMail *mail = new RadosMail();
+    mail->set_oid(it->first);
+    mail->set_mail_buffer(new librados::bufferlist());
+    mail->get_mail_buffer()->substr_of(data, it->second.offset, it->second.length);
+    mail->get_metadata()->swap(it->second.metadata);
+    mail->get_extended_metadata()->swap(it->second.extended_metadata);
+    mails.push_back(mail);
+  }
+  std::vector<Location> locations;
+  if (ret >= 0) {
+    ret = append(io_ctx, mailbox_guid, mails, &locations);
+  }
+  for (size_t i = 0; i < mails.size(); i++) {
+    if (ret >= 0) {
+      (*relocated)[*mails[i]->get_oid()] = locations[i];
+    }
+    delete mails[i]->get_mail_buffer();
+    delete mails[i];
+  }
+  return ret < 0 ? ret : 1;
+}
+
+int RadosMailPack::list_containers(librados::IoCtx &io_ctx, const std::string &mailbox_guid,
+                                   std::vector<uint32_t> *containers) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  std::map<std::string, librados::bufferlist> directory;
+  int ret = RadosUtils::get_all_keys_and_values(&pack_io_ctx, mailbox_guid, &directory);
+  if (ret < 0) {
+    return ret == -ENOENT ? 0 : ret;
+  }
+  for (std::map<std::string, librados::bufferlist>::iterator it = directory.begin(); it != directory.end(); ++it) {
+    if (it->first.size() <= mailbox_guid.size() + 1 || it->first.compare(0, mailbox_guid.size(), mailbox_guid) != 0) {
+      continue;
+    }
+    char *end = NULL;
+    unsigned long number = strtoul(it->first.c_str() + mailbox_guid.size() + 1, &end, 16);  // NOLINT
+    if (*end == '\0' && number > 0 && number < UINT32_MAX) {
+      containers->push_back(number);
+    }
+  }
+  return 0;
+}
+
+int RadosMailPack::list_entries(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                                std::map<std::string, Entry> *entries) {
+  librados::IoCtx pack_io_ctx;
+  open_pack_io_ctx(io_ctx, &pack_io_ctx);
+  std::map<std::string, librados::bufferlist> values;
+  int ret = RadosUtils::get_all_keys_and_values(&pack_io_ctx, get_container_oid(mailbox_guid, container), &values);
+  if (ret < 0) {
+    return ret;
+  }
+  for (std::map<std::string, librados::bufferlist>::iterator it = values.begin(); it != values.end(); ++it) {
+    Entry entry;
+    if (entry.decode(it->second)) {
+      (*entries)[it->first] = entry;
+    }
+  }
+  return 0;
+}
+
+}  // namespace librmb
@@ -0,0 +1,189 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_MAIL_PACK_H_
+#define SRC_LIBRMB_RADOS_MAIL_PACK_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <rados/librados.hpp>
+#include "rados-mail.h"
+
+namespace librmb {
+
+/**
+ * RadosMailPack
+ *
+ * Small mails are appended to container objects of their mailbox instead of
+ * being stored in their own object. Containers and the container directory
+ * of a mailbox live in the namespace PACK_NAMESPACE of the mail pool:
+ *
+ *   <mailbox guid>             xattr C: number of the current container
+ *                              omap:    <container oid> -> ""
+ *   <mailbox guid>.<%08x n>    data:    mail | mail | ...
+ *                              xattr S: appended bytes (SEALED: no appends)
+ *                              omap:    <mail oid> -> Entry (offset, length, metadata)
+ *
+ * The location of a packed mail (container, offset, length) is kept in the
+ * dovecot index, so reading it is a single ranged read. Appends are guarded
+ * by S, concurrent writers to a container retry. Containers with less than
+ * half of their data live are compacted: the container is sealed, its live
+ * mails are appended to the current container and it is removed.
+ *
+ * Containers need omap and ranged writes, which erasure coded pools do not
+ * support. Packing is therefore disabled if the metadata is stored in a
+ * separate pool (rbox_metadata_pool), whose mail pool usually is erasure
+ * coded. Mails packed before remain readable.
+ */
+class RadosMailPack {
+ public:
+  static const char *PACK_NAMESPACE;
+  static const uint64_t DEFAULT_CONTAINER_SIZE = 4 * 1024 * 1024;
+
+  struct Location {
+    Location() : container(0), offset(0), length(0) {}
+    // 0: not packed
+    uint32_t container;
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  /* omap value of a packed mail in its container */
+  struct Entry {
+    Entry() : offset(0), length(0) {}
+    void encode(librados::bufferlist *bl) const;
+    /*!
+     * @return false if bl is no valid entry
+     */
+    bool decode(librados::bufferlist &bl);
+
+    uint32_t offset;
+    uint32_t length;
+    std::map<std::string, ceph::bufferlist> metadata;
+    std::map<std::string, ceph::bufferlist> extended_metadata;
+  };
+
+  RadosMailPack() : max_size(0), container_size(DEFAULT_CONTAINER_SIZE) {}
+  ~RadosMailPack() {}
+
+  /*!
+   * @param[in] max_size_ mails of at most max_size bytes are packed, 0 disables packing of new mails. Reading
+   * packed mails does not depend on it.
+   */
+  void set_max_size(uint64_t max_size_) { max_size = max_size_; }
+  uint64_t get_max_size() const { return max_size; }
+  void set_container_size(uint64_t container_size_) { container_size = container_size_; }
+  uint64_t get_container_size() const { return container_size; }
+  bool is_enabled() const { return max_size > 0 && container_size > 0; }
+  bool is_packable(uint64_t size) const { return is_enabled() && size > 0 && size <= max_size && size <= container_size; }
+
+  /*!
+   * Append the mails (mail buffer, metadata and extended metadata) to the current container of the mailbox, a
+   * new container is started if it is full. Mails fitting into one container are written with one operation.
+   *
+   * @param[in] io_ctx io context of the mail pool
+   * @param[in] mails valid mails with mail buffer
+   * @param[out] locations location of each mail (same order as mails)
+   * @return linux error code or 0 if successful
+   */
+  int append(librados::IoCtx &io_ctx, const std::string &mailbox_guid, const std::vector<RadosMail *> &mails,
+             std::vector<Location> *locations);
+  /*!
+   * @param[out] buffer valid ptr, the mail data is appended
+   * @return -ENOENT if the container does not exist (anymore), linux error code or 0 if successful
+   */
+  static int read(librados::IoCtx &io_ctx, const std::string &mailbox_guid, const Location &location,
+                  librados::bufferlist *buffer);
+  /*!
+   * @param[in] oid mail oid
+   * @param[out] entry valid ptr
+   * @return -ENOENT if the mail is not in the container, linux error code or 0 if successful
+   */
+  static int load_entry(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                        const std::string &oid, Entry *entry);
+  /*!
+   * Replace the entry of a mail (e.g. updated flags or keywords), the location is not changed.
+   * @return linux error code or 0 if successful
+   */
+  static int save_entry(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                        const std::string &oid, const Entry &entry);
+  /*!
+   * Load the metadata of the mail from its entry.
+   * @param[in,out] mail with valid oid
+   * @return -ENOENT if the mail is not in the container, linux error code or 0 if successful
+   */
+  static int load_metadata(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                           RadosMail *mail);
+  /*!
+   * Remove the entries of the mails, their data is released by the next compaction.
+   * @return linux error code or 0 if successful, a missing container is no error
+   */
+  static int remove(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                    const std::set<std::string> &oids);
+  /*!
+   * Compact the container if less than half of its data is live and it is not the current container of the
+   * mailbox: the container is sealed and its live mails are appended to the current container. The caller
+   * updates the locations and removes the container with remove_container() afterwards.
+   *
+   * @param[in] expunged mails which are not live, although their entries have not been removed yet
+   * @param[out] relocated new location of each live mail
+   * @return 1 if the container has been compacted, 0 if not, < 0 in case of an error
+   */
+  int compact(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+              const std::set<std::string> &expunged, std::map<std::string, Location> *relocated);
+  /*!
+   * Remove the container and its directory entry.
+   * @return linux error code or 0 if successful
+   */
+  static int remove_container(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container);
+  /*!
+   * @param[out] containers numbers of all containers of the mailbox
+   * @return linux error code or 0 if successful, a mailbox without containers is no error
+   */
+  static int list_containers(librados::IoCtx &io_ctx, const std::string &mailbox_guid,
+                             std::vector<uint32_t> *containers);
+  /*!
+   * @param[out] entries entries of all mails in the container, by mail oid
+   * @return linux error code or 0 if successful
+   */
+  static int list_entries(librados::IoCtx &io_ctx, const std::string &mailbox_guid, uint32_t container,
+                          std::map<std::string, Entry> *entries);
+
+  static std::string get_container_oid(const std::string &mailbox_guid, uint32_t container);
+
+ private:
+  static const int MAX_RETRIES = 5;
+  static const uint64_t SEALED = UINT64_MAX;
+
+  /* current container of a mailbox as seen by this process */
+  struct Container {
+    Container() : number(0), size(0) {}
+    uint32_t number;
+    uint64_t size;
+  };
+
+  int load_current(librados::IoCtx &pack_io_ctx, const std::string &mailbox_guid, Container *current);
+  int start_container(librados::IoCtx &pack_io_ctx, const std::string &mailbox_guid, uint32_t number,
+                      Container *current);
+
+  uint64_t max_size;
+  uint64_t container_size;
+  std::map<std::string, Container> containers;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_MAIL_PACK_H_
@@ -29,37 +29,115 @@ RadosMail::RadosMail()
       active_op(0),
       mail_buffer(nullptr),
       save_date_rados(-1),
+      compact(false),
+      compact_numeric(0),
       valid(true),
       index_ref(false) {}
 
 RadosMail::~RadosMail() {}
 
+#define COMPACT_UNSET 0xffff
+
+static bool is_numeric_key(librmb::rbox_metadata_key key) {
+  return key == librmb::RBOX_METADATA_MAIL_UID || key == librmb::RBOX_METADATA_RECEIVED_TIME ||
+         key == librmb::RBOX_METADATA_PHYSICAL_SIZE || key == librmb::RBOX_METADATA_VIRTUAL_SIZE ||
+         key == librmb::RBOX_METADATA_OLDV1_SAVE_TIME || key == librmb::RBOX_METADATA_UNCOMPRESSED_SIZE;
+}
+
+static bool parse_number(const char* value, int64_t* number) {
+  if (value == NULL || *value == '\0') {
+    return false;
+  }
+  char* end = NULL;
+  *number = strtoll(value, &end, 10);
+  return *end == '\0';
+}
+
+void RadosMail::compact_metadata() {
+  if (compact) {
+    return;
+  }
+  for (int i = 0; i < RBOX_METADATA_SLOT_COUNT; i++) {
+    compact_offsets[i] = COMPACT_UNSET;
+  }
+  size_t size = 0;
+  for (map<string, ceph::bufferlist>::iterator it = attrset.begin(); it != attrset.end(); ++it) {
+    size += it->second.length() + 1;
+  }
+  compact_values.reserve(size);
+
+  compact_numeric = 0;
+  for (map<string, ceph::bufferlist>::iterator it = attrset.begin(); it != attrset.end();) {
+    rbox_metadata_key key = static_cast<rbox_metadata_key>(it->first[0]);
+    int slot = it->first.size() == 1 ? rbox_metadata_key_to_slot(key) : -1;
+    if (slot < 0 || compact_values.size() >= COMPACT_UNSET) {
+      ++it;
+      continue;
+    }
+    compact_offsets[slot] = compact_values.size();
+    // values are usually \0 terminated (see RadosMetadata)
+    const char* value = it->second.c_str();
+    compact_values.append(value, strnlen(value, it->second.length()));
+    compact_values.push_back('\0');
+    if (is_numeric_key(key) && parse_number(compact_values.c_str() + compact_offsets[slot], &compact_numbers[slot])) {
+      compact_numeric |= 1U << slot;
+    }
+    attrset.erase(it++);
+  }
+  compact = true;
+}
+
+const char* RadosMail::get_metadata(enum rbox_metadata_key key) {
+  if (compact) {
+    int slot = rbox_metadata_key_to_slot(key);
+    if (slot >= 0 && compact_offsets[slot] != COMPACT_UNSET) {
+      return compact_values.c_str() + compact_offsets[slot];
+    }
+  }
+  map<string, ceph::bufferlist>::iterator it = attrset.find(string(1, static_cast<char>(key)));
+  return it != attrset.end() ? it->second.c_str() : NULL;
+}
+
+bool RadosMail::get_metadata(enum rbox_metadata_key key, int64_t* value) {
+  if (compact) {
+    int slot = rbox_metadata_key_to_slot(key);
+    if (slot >= 0 && (compact_numeric & (1U << slot)) != 0) {
+      *value = compact_numbers[slot];
+      return true;
+    }
+  }
+  return parse_number(get_metadata(key), value);
+}
+
+void RadosMail::remove_metadata(enum rbox_metadata_key key) {
+  if (compact) {
+    int slot = rbox_metadata_key_to_slot(key);
+    if (slot >= 0) {
+      compact_offsets[slot] = COMPACT_UNSET;
+      compact_numeric &= ~(1U << slot);
+    }
+  }
+  attrset.erase(string(1, static_cast<char>(key)));
+}
+
 std::string RadosMail::to_string(const string& padding) {
-  char* uid = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_MAIL_UID, &attrset, &uid);
-  char* recv_time_str = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_RECEIVED_TIME, &attrset, &recv_time_str);
-  char* p_size = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_PHYSICAL_SIZE, &attrset, &p_size);
-  char* v_size = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_VIRTUAL_SIZE, &attrset, &v_size);
-
-  char* rbox_version = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_VERSION, &attrset, &rbox_version);
-  char* mailbox_guid = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_MAILBOX_GUID, &attrset, &mailbox_guid);
-  char* mail_guid = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_GUID, &attrset, &mail_guid);
-  char* mb_orig_name = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_ORIG_MAILBOX, &attrset, &mb_orig_name);
+  const char* uid = get_metadata(RBOX_METADATA_MAIL_UID);
+  const char* recv_time_str = get_metadata(RBOX_METADATA_RECEIVED_TIME);
+  const char* p_size = get_metadata(RBOX_METADATA_PHYSICAL_SIZE);
+  const char* v_size = get_metadata(RBOX_METADATA_VIRTUAL_SIZE);
+
+  const char* rbox_version = get_metadata(RBOX_METADATA_VERSION);
+  const char* mailbox_guid = get_metadata(RBOX_METADATA_MAILBOX_GUID);
+  const char* mail_guid = get_metadata(RBOX_METADATA_GUID);
+  const char* mb_orig_name = get_metadata(RBOX_METADATA_ORIG_MAILBOX);
 
   // string keywords = get_metadata(RBOX_METADATA_OLDV1_KEYWORDS);
-  char* flags = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_OLDV1_FLAGS, &attrset, &flags);
-  char* pvt_flags = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_PVT_FLAGS, &attrset, &pvt_flags);
-  char* from_envelope = NULL;
-  RadosUtils::get_metadata(RBOX_METADATA_FROM_ENVELOPE, &attrset, &from_envelope);
+  const char* flags = get_metadata(RBOX_METADATA_OLDV1_FLAGS);
+  const char* pvt_flags = get_metadata(RBOX_METADATA_PVT_FLAGS);
+  const char* from_envelope = get_metadata(RBOX_METADATA_FROM_ENVELOPE);
+  const char* compression = get_metadata(RBOX_METADATA_COMPRESSION);
+  const char* uncompressed_size = get_metadata(RBOX_METADATA_UNCOMPRESSED_SIZE);
+  const char* stripes = get_metadata(RBOX_METADATA_STRIPES);
 
   time_t ts = -1;
   if (recv_time_str != NULL) {
@@ -123,6 +201,16 @@ std::string RadosMail::to_string(const string& padding) {
     ss << padding << "        " << static_cast<char>(RBOX_METADATA_VERSION) << "(rbox_version): " << rbox_version
        << endl;
   }
+  if (compression != NULL) {
+    ss << padding << "        " << static_cast<char>(RBOX_METADATA_COMPRESSION) << "(compression)=" << compression;
+    if (uncompressed_size != NULL) {
+      ss << " " << static_cast<char>(RBOX_METADATA_UNCOMPRESSED_SIZE) << "(uncompressed_size)=" << uncompressed_size;
+    }
+    ss << endl;
+  }
+  if (stripes != NULL) {
+    ss << padding << "        " << static_cast<char>(RBOX_METADATA_STRIPES) << "(stripes)=" << stripes << endl;
+  }
 
   if (extended_attrset.size() > 0) {
     ss << padding << "        " << static_cast<char>(RBOX_METADATA_OLDV1_KEYWORDS) << "(keywords): " << std::endl;
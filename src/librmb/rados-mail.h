@@ -99,6 +99,32 @@ class RadosMail {
    */
   void add_extended_metadata(const RadosMetadata& metadata) { extended_attrset[metadata.key] = metadata.bl; }
 
+  /*!
+   * @return value of the attribute or NULL if not set.
+   */
+  const char* get_metadata(enum rbox_metadata_key key);
+  /*!
+   * parsed value of a numeric attribute (uid, sizes, dates).
+   * @return false if not set or not numeric
+   */
+  bool get_metadata(enum rbox_metadata_key key, int64_t* value);
+  /*!
+   * remove the attribute (from the attribute map or the fixed slots)
+   */
+  void remove_metadata(enum rbox_metadata_key key);
+  /*!
+   * Moves the rbox_metadata_key attributes from the attribute map into fixed slots (one buffer for all
+   * values, parsed values for uid, sizes and dates). Only keywords and unknown attributes stay in the
+   * attribute map, so get_metadata(key) needs to be used to access them. Used for mails which are only
+   * read (e.g. rmb ls, doveadm rmb check indices), a compacted mail can't be saved.
+   */
+  void compact_metadata();
+  bool is_compact() { return compact; }
+  /*!
+   * @return true if the mail has any attribute.
+   */
+  bool has_metadata() { return !compact_values.empty() || !attrset.empty(); }
+
   const string get_extended_metadata(const string& key) {
     if (extended_attrset.find(key) != extended_attrset.end()) {
       return extended_attrset[key].to_str();
@@ -119,6 +145,13 @@ class RadosMail {
 
   map<string, ceph::bufferlist> attrset;
   map<string, ceph::bufferlist> extended_attrset;
+
+  // compacted attributes: offset of the \0 terminated value in compact_values per slot.
+  bool compact;
+  string compact_values;
+  uint16_t compact_offsets[RBOX_METADATA_SLOT_COUNT];
+  int64_t compact_numbers[RBOX_METADATA_SLOT_COUNT];
+  uint32_t compact_numeric;  // bit per slot with a parsed value
   bool valid;
   bool index_ref;
 };
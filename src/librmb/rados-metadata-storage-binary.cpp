@@ -0,0 +1,200 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-metadata-storage-binary.h"
+#include <string.h>
+
+std::string librmb::RadosMetadataStorageBinary::module_name = "binary";
+
+namespace librmb {
+
+const unsigned char RadosMetadataStorageBinary::FORMAT_MAGIC = 0x00;
+const unsigned char RadosMetadataStorageBinary::FORMAT_VERSION = 0x01;
+const unsigned char RadosMetadataStorageBinary::RECORD_KEYWORD = 0x01;
+const unsigned char RadosMetadataStorageBinary::RECORD_ATTRIBUTE = 0x02;
+
+static void encode_varint(uint32_t value, ceph::bufferlist *bl) {
+  char buf[5];
+  int len = 0;
+  while (value >= 0x80) {
+    buf[len++] = static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = static_cast<char>(value);
+  bl->append(buf, len);
+}
+
+static bool decode_varint(const char **pos, const char *end, uint32_t *value) {
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35 && *pos < end; shift += 7) {
+    unsigned char c = static_cast<unsigned char>(*(*pos)++);
+    result |= static_cast<uint32_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool decode_value(const char **pos, const char *end, const char **value, uint32_t *size) {
+  if (!decode_varint(pos, end, size) || *size > static_cast<size_t>(end - *pos)) {
+    return false;
+  }
+  *value = *pos;
+  *pos += *size;
+  return true;
+}
+
+static void encode_value(const ceph::bufferlist &value, ceph::bufferlist *bl) {
+  encode_varint(value.length(), bl);
+  bl->append(value);
+}
+
+// single char attributes are encoded without key record
+static bool is_slot_key(const std::string &key) {
+  return key.size() == 1 && static_cast<unsigned char>(key[0]) > RadosMetadataStorageBinary::RECORD_ATTRIBUTE &&
+         static_cast<unsigned char>(key[0]) < RBOX_METADATA_BINARY_KEYS;
+}
+
+bool RadosMetadataStorageBinary::is_binary(const char *data, size_t size) {
+  return size >= 2 && static_cast<unsigned char>(data[0]) == FORMAT_MAGIC;
+}
+
+bool RadosMetadataStorageBinary::decode(const char *data, size_t size, RadosMetadataBinaryView *view) {
+  if (!is_binary(data, size) || static_cast<unsigned char>(data[1]) != FORMAT_VERSION) {
+    return false;
+  }
+  memset(view->values, 0, sizeof(view->values));
+  memset(view->sizes, 0, sizeof(view->sizes));
+  const char *pos = data + 2;
+  const char *end = data + size;
+  view->records = end;
+  view->records_end = end;
+
+  while (pos < end) {
+    unsigned char type = static_cast<unsigned char>(*pos);
+    if (type == RECORD_KEYWORD || type == RECORD_ATTRIBUTE) {
+      // keyword and multi char attribute records are written last
+      view->records = pos;
+      const char *key;
+      const char *value;
+      uint32_t key_size;
+      uint32_t value_size;
+      while (next_record(&pos, end, &type, &key, &key_size, &value, &value_size)) {
+      }
+      return pos == end;
+    }
+    if (type == FORMAT_MAGIC || type >= RBOX_METADATA_BINARY_KEYS) {
+      return false;
+    }
+    ++pos;
+    if (!decode_value(&pos, end, &view->values[type], &view->sizes[type])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RadosMetadataStorageBinary::next_record(const char **pos, const char *end, unsigned char *type,
+                                             const char **key, uint32_t *key_size, const char **value,
+                                             uint32_t *value_size) {
+  if (*pos >= end) {
+    return false;
+  }
+  unsigned char t = static_cast<unsigned char>(**pos);
+  if (t != RECORD_KEYWORD && t != RECORD_ATTRIBUTE) {
+    return false;
+  }
+  const char *p = *pos + 1;
+  if (!decode_value(&p, end, key, key_size) || !decode_value(&p, end, value, value_size)) {
+    return false;
+  }
+  *type = t;
+  *pos = p;
+  return true;
+}
+
+int RadosMetadataStorageBinary::decode_attribute(RadosMail *mail, const ceph::bufferlist &bl) {
+  // shares the buffers of bl, c_str only rebuilds (copies) a fragmented bufferlist.
+  ceph::bufferlist data(bl);
+  if (!is_binary(data.c_str(), data.length())) {
+    // written by the ima module
+    return RadosMetadataStorageIma::decode_attribute(mail, bl);
+  }
+  RadosMetadataBinaryView view;
+  if (!decode(data.c_str(), data.length(), &view)) {
+    return -1;
+  }
+  // RadosMail owns its metadata as bufferlists, so the values of the view are copied.
+  for (int i = 0; i < RBOX_METADATA_BINARY_KEYS; i++) {
+    if (view.values[i] != nullptr) {
+      ceph::bufferlist &value = (*mail->get_metadata())[std::string(1, static_cast<char>(i))];
+      value.clear();
+      value.append(view.values[i], view.sizes[i]);
+    }
+  }
+  const char *pos = view.records;
+  unsigned char type;
+  const char *key;
+  const char *value;
+  uint32_t key_size;
+  uint32_t value_size;
+  while (next_record(&pos, view.records_end, &type, &key, &key_size, &value, &value_size)) {
+    std::map<std::string, ceph::bufferlist> *target =
+        type == RECORD_KEYWORD ? mail->get_extended_metadata() : mail->get_metadata();
+    ceph::bufferlist &bl_value = (*target)[std::string(key, key_size)];
+    bl_value.clear();
+    bl_value.append(value, value_size);
+  }
+  return 0;
+}
+
+void RadosMetadataStorageBinary::encode_attribute(RadosMail *mail, librados::ObjectWriteOperation *write_op,
+                                                  ceph::bufferlist *bl) {
+  char header[2] = {static_cast<char>(FORMAT_MAGIC), static_cast<char>(FORMAT_VERSION)};
+  bl->append(header, sizeof(header));
+
+  std::map<std::string, ceph::bufferlist> *metadata = mail->get_metadata();
+  for (std::map<std::string, ceph::bufferlist>::iterator it = metadata->begin(); it != metadata->end(); ++it) {
+    if (!is_immutable_attribute((*it).first)) {
+      write_op->setxattr((*it).first.c_str(), (*it).second);
+    } else if (is_slot_key((*it).first)) {
+      bl->append((*it).first[0]);
+      encode_value((*it).second, bl);
+    }
+  }
+  // records, written last
+  for (std::map<std::string, ceph::bufferlist>::iterator it = metadata->begin(); it != metadata->end(); ++it) {
+    if (!is_slot_key((*it).first) && is_immutable_attribute((*it).first)) {
+      bl->append(static_cast<char>(RECORD_ATTRIBUTE));
+      encode_varint((*it).first.size(), bl);
+      bl->append((*it).first.c_str(), (*it).first.size());
+      encode_value((*it).second, bl);
+    }
+  }
+  std::map<std::string, ceph::bufferlist> *keywords = mail->get_extended_metadata();
+  if (keywords->empty()) {
+    return;
+  }
+  if (!is_immutable_keyword()) {
+    write_op->omap_set(*keywords);
+    return;
+  }
+  for (std::map<std::string, ceph::bufferlist>::iterator it = keywords->begin(); it != keywords->end(); ++it) {
+    bl->append(static_cast<char>(RECORD_KEYWORD));
+    encode_varint((*it).first.size(), bl);
+    bl->append((*it).first.c_str(), (*it).first.size());
+    encode_value((*it).second, bl);
+  }
+}
+
+} /* namespace librmb */
@@ -0,0 +1,87 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_METADATA_STORAGE_BINARY_H_
+#define SRC_LIBRMB_RADOS_METADATA_STORAGE_BINARY_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "rados-metadata-storage-ima.h"
+
+namespace librmb {
+
+#define RBOX_METADATA_BINARY_KEYS 128
+
+/**
+ * Flat, non owning view of a binary encoded metadata attribute.
+ * Values point into the encoded buffer. decode_attribute copies them into the
+ * metadata of the mail, readers that only need single values can use decode directly.
+ */
+struct RadosMetadataBinaryView {
+  /* value and size of the single char attributes, indexed by rbox_metadata_key (nullptr if not set) */
+  const char *values[RBOX_METADATA_BINARY_KEYS];
+  uint32_t sizes[RBOX_METADATA_BINARY_KEYS];
+  /* keyword and multi char attribute records (see RadosMetadataStorageBinary::next_record) */
+  const char *records;
+  const char *records_end;
+};
+
+/**
+ * Same as RadosMetadataStorageIma, but the immutable attributes are encoded in a
+ * compact, versioned binary format instead of json:
+ *
+ *  header:  0x00, version
+ *  records: <rbox_metadata_key> <varint size> <value>                         single char attribute
+ *           RECORD_KEYWORD|RECORD_ATTRIBUTE <varint size> <key> <varint size> <value>
+ *
+ * Objects with a json encoded attribute (written by the ima module) are still readable.
+ */
+class RadosMetadataStorageBinary : public RadosMetadataStorageIma {
+ public:
+  RadosMetadataStorageBinary(librados::IoCtx *io_ctx_, RadosDovecotCephCfg *cfg_)
+      : RadosMetadataStorageIma(io_ctx_, cfg_) {}
+  virtual ~RadosMetadataStorageBinary() {}
+
+  /*!
+   * @return true if data starts with a binary metadata header
+   */
+  static bool is_binary(const char *data, size_t size);
+  /*!
+   * decode the binary metadata attribute.
+   * @param[in] data encoded attribute, needs to stay valid while the view is used
+   * @param[out] view valid ptr
+   * @return false if data is not a valid binary metadata attribute
+   */
+  static bool decode(const char *data, size_t size, RadosMetadataBinaryView *view);
+  /*!
+   * iterate the keyword and multi char attribute records of a view.
+   * @param[in,out] pos current record, use view.records for the first one
+   * @return false if there are no more records
+   */
+  static bool next_record(const char **pos, const char *end, unsigned char *type, const char **key,
+                          uint32_t *key_size, const char **value, uint32_t *value_size);
+
+ protected:
+  int decode_attribute(RadosMail *mail, const ceph::bufferlist &bl) override;
+  void encode_attribute(RadosMail *mail, librados::ObjectWriteOperation *write_op, ceph::bufferlist *bl) override;
+
+ public:
+  static std::string module_name;
+  static const unsigned char FORMAT_MAGIC;
+  static const unsigned char FORMAT_VERSION;
+  static const unsigned char RECORD_KEYWORD;
+  static const unsigned char RECORD_ATTRIBUTE;
+};
+
+} /* namespace librmb */
+
+#endif /* SRC_LIBRMB_RADOS_METADATA_STORAGE_BINARY_H_ */
@@ -11,6 +11,9 @@
 
 #include "rados-metadata-storage-default.h"
 #include "rados-util.h"
+#include "rados-metrics.h"
+#include "rados-replica-reads.h"
+#include "rados-throttle.h"
 #include <utility>
 namespace librmb {
 
@@ -28,17 +31,55 @@ int RadosMetadataStorageDefault::load_metadata(RadosMail *mail) {
   if (mail->get_metadata()->size() > 0) {
     mail->get_metadata()->clear();
   }
+  RadosMetricsTimer timer(METRIC_METADATA_LOAD);
   ret = io_ctx->getxattrs(*mail->get_oid(), *mail->get_metadata());
 
   if (ret >= 0) {
     ret = RadosUtils::get_all_keys_and_values(io_ctx, *mail->get_oid(), mail->get_extended_metadata());
   }
 
-  return ret;
+  return timer.result(ret);
+}
+int RadosMetadataStorageDefault::load_immutable_metadata(RadosMail *mail) {
+  if (mail == nullptr || !RadosReplicaReads::global().is_enabled()) {
+    return load_metadata(mail);
+  }
+  if (mail->get_metadata()->size() > 0) {
+    mail->get_metadata()->clear();
+  }
+  // keywords (omap) are not loaded
+  RadosMetricsTimer timer(METRIC_METADATA_LOAD);
+  return timer.result(RadosReplicaReads::global().read_xattrs(io_ctx, *mail->get_oid(), mail->get_metadata()));
+}
+librados::IoCtx *RadosMetadataStorageDefault::read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                                                     std::map<std::string, ceph::bufferlist> *xattrs,
+                                                                     int *prval) {
+  read_op->getxattrs(xattrs, prval);
+  return io_ctx;
+}
+int RadosMetadataStorageDefault::decode_immutable_metadata(RadosMail *mail,
+                                                           std::map<std::string, ceph::bufferlist> *xattrs) {
+  if (mail == nullptr || xattrs == nullptr) {
+    return -1;
+  }
+  mail->get_metadata()->clear();
+  return load_metadata(mail, xattrs, nullptr);
+}
+int RadosMetadataStorageDefault::load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                                               std::map<std::string, ceph::bufferlist> *omap) {
+  if (mail == nullptr || xattrs == nullptr) {
+    return -1;
+  }
+  mail->get_metadata()->swap(*xattrs);
+  if (omap != nullptr) {
+    mail->get_extended_metadata()->swap(*omap);
+  }
+  return 0;
 }
 int RadosMetadataStorageDefault::set_metadata(RadosMail *mail, RadosMetadata &xattr) {
   mail->add_metadata(xattr);
-  return io_ctx->setxattr(*mail->get_oid(), xattr.key.c_str(), xattr.bl);
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+  return timer.result(io_ctx->setxattr(*mail->get_oid(), xattr.key.c_str(), xattr.bl));
 }
 
 int RadosMetadataStorageDefault::set_metadata(RadosMail *mail, RadosMetadata &xattr,
@@ -48,7 +89,8 @@ int RadosMetadataStorageDefault::set_metadata(RadosMail *mail, RadosMetadata &xa
     mail->set_completion(librados::Rados::aio_create_completion());
     mail->set_active_op(1);
   }
-  return io_ctx->aio_operate(*mail->get_oid(), mail->get_completion(), write_op);
+  return RadosThrottle::global().aio_operate(io_ctx, *mail->get_oid(), mail->get_completion(), write_op,
+                                            xattr.bl.length());
 }
 
 void RadosMetadataStorageDefault::save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) {
@@ -62,6 +104,7 @@ void RadosMetadataStorageDefault::save_metadata(librados::ObjectWriteOperation *
   }
 }
 bool RadosMetadataStorageDefault::update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) {
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
   librados::ObjectWriteOperation write_op;
   librados::AioCompletion *completion = librados::Rados::aio_create_completion();
 
@@ -70,9 +113,10 @@ bool RadosMetadataStorageDefault::update_metadata(const std::string &oid, std::l
     write_op.setxattr((*it).key.c_str(), (*it).bl);
   }
 
-  int ret = io_ctx->aio_operate(oid, completion, &write_op);
+  int ret = RadosThrottle::global().aio_operate(io_ctx, oid, completion, &write_op, 0);
   completion->wait_for_complete();
   completion->release();
+  timer.set_failed(ret != 0);
   return ret == 0;
 }
 int RadosMetadataStorageDefault::update_keyword_metadata(const std::string &oid, RadosMetadata *metadata) {
@@ -80,7 +124,8 @@ int RadosMetadataStorageDefault::update_keyword_metadata(const std::string &oid,
   if (metadata != nullptr) {
     std::map<std::string, librados::bufferlist> map;
     map.insert(std::pair<string, librados::bufferlist>(metadata->key, metadata->bl));
-    ret = io_ctx->omap_set(oid, map);
+    RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+    ret = timer.result(io_ctx->omap_set(oid, map));
   }
   return ret;
 }
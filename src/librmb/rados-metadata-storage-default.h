@@ -29,8 +29,15 @@ class RadosMetadataStorageDefault : public RadosStorageMetadataModule {
   explicit RadosMetadataStorageDefault(librados::IoCtx *io_ctx_);
   virtual ~RadosMetadataStorageDefault();
   void set_io_ctx(librados::IoCtx *io_ctx_) override { this->io_ctx = io_ctx_; }
+  bool has_xattr_metadata() override { return true; }
 
   int load_metadata(RadosMail *mail) override;
+  int load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                    std::map<std::string, ceph::bufferlist> *omap) override;
+  int load_immutable_metadata(RadosMail *mail) override;
+  librados::IoCtx *read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                           std::map<std::string, ceph::bufferlist> *xattrs, int *prval) override;
+  int decode_immutable_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs) override;
   int set_metadata(RadosMail *mail, RadosMetadata &xattr) override;
   bool update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) override;
   void save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) override;
@@ -11,6 +11,9 @@
 
 #include "rados-metadata-storage-ima.h"
 #include "rados-util.h"
+#include "rados-metrics.h"
+#include "rados-replica-reads.h"
+#include "rados-throttle.h"
 #include <string.h>
 #include <utility>
 
@@ -63,48 +66,97 @@ int RadosMetadataStorageIma::load_metadata(RadosMail *mail) {
   if (mail->get_metadata()->size() > 0) {
     return 0;
   }
+  RadosMetricsTimer timer(METRIC_METADATA_LOAD);
 
   std::map<string, ceph::bufferlist> attr;
   int ret = io_ctx->getxattrs(*mail->get_oid(), attr);
   if (ret < 0) {
-    return ret;
+    return timer.result(ret);
   }
 
-  if (attr.find(cfg->get_metadata_storage_attribute()) != attr.end()) {
-    // json object for immutable attributes.
-    json_t *root;
-    json_error_t error;
-    root = json_loads(attr[cfg->get_metadata_storage_attribute()].to_str().c_str(), 0, &error);
-    parse_attribute(mail, root);
+  // load other omap values.
+  std::map<string, ceph::bufferlist> omap;
+  if (cfg->is_updateable_attribute(librmb::RBOX_METADATA_OLDV1_KEYWORDS)) {
+    ret = RadosUtils::get_all_keys_and_values(io_ctx, *mail->get_oid(), &omap);
+  }
+  int ret_load = load_metadata(mail, &attr, &omap);
+  return timer.result(ret < 0 ? ret : ret_load);
+}
+
+int RadosMetadataStorageIma::load_immutable_metadata(RadosMail *mail) {
+  if (mail == nullptr) {
+    return -1;
+  }
+  // reloaded like in the other modules, load_metadata keeps metadata which has been loaded before
+  mail->get_metadata()->clear();
+  if (!RadosReplicaReads::global().is_enabled()) {
+    return load_metadata(mail);
+  }
+  RadosMetricsTimer timer(METRIC_METADATA_LOAD);
+  std::map<string, ceph::bufferlist> attr;
+  int ret = RadosReplicaReads::global().read_xattrs(io_ctx, *mail->get_oid(), &attr);
+  if (ret < 0) {
+    return timer.result(ret);
+  }
+  // keywords (omap) are not loaded
+  return timer.result(load_metadata(mail, &attr, nullptr));
+}
+
+librados::IoCtx *RadosMetadataStorageIma::read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                                                 std::map<std::string, ceph::bufferlist> *xattrs,
+                                                                 int *prval) {
+  read_op->getxattrs(xattrs, prval);
+  return io_ctx;
+}
+
+int RadosMetadataStorageIma::decode_immutable_metadata(RadosMail *mail,
+                                                       std::map<std::string, ceph::bufferlist> *xattrs) {
+  if (mail == nullptr || xattrs == nullptr) {
+    return -1;
+  }
+  mail->get_metadata()->clear();
+  // keywords (omap) are not loaded
+  return load_metadata(mail, xattrs, nullptr);
+}
+
+int RadosMetadataStorageIma::load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                                           std::map<std::string, ceph::bufferlist> *omap) {
+  if (mail == nullptr || xattrs == nullptr) {
+    return -1;
+  }
 
-    json_decref(root);
+  std::map<string, ceph::bufferlist>::iterator it_ima = xattrs->find(cfg->get_metadata_storage_attribute());
+  if (it_ima != xattrs->end()) {
+    decode_attribute(mail, (*it_ima).second);
   }
 
   // load other attributes
-  for (std::map<string, ceph::bufferlist>::iterator it = attr.begin(); it != attr.end(); ++it) {
+  for (std::map<string, ceph::bufferlist>::iterator it = xattrs->begin(); it != xattrs->end(); ++it) {
     if ((*it).first.compare(cfg->get_metadata_storage_attribute()) != 0) {
       (*mail->get_metadata())[(*it).first] = (*it).second;
     }
   }
 
   // load other omap values.
-  if (cfg->is_updateable_attribute(librmb::RBOX_METADATA_OLDV1_KEYWORDS)) {
-    ret = RadosUtils::get_all_keys_and_values(io_ctx, *mail->get_oid(), mail->get_extended_metadata());
+  if (omap != nullptr && cfg->is_updateable_attribute(librmb::RBOX_METADATA_OLDV1_KEYWORDS)) {
+    for (std::map<string, ceph::bufferlist>::iterator it = omap->begin(); it != omap->end(); ++it) {
+      (*mail->get_extended_metadata())[(*it).first] = (*it).second;
+    }
   }
-
-  return ret;
+  return 0;
 }
 
 // it is required that mail->get_metadata is up to date before update.
 int RadosMetadataStorageIma::set_metadata(RadosMail *mail, RadosMetadata &xattr) {
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
   enum rbox_metadata_key k = static_cast<enum rbox_metadata_key>(*xattr.key.c_str());
   if (!cfg->is_updateable_attribute(k)) {
     mail->add_metadata(xattr);
     librados::ObjectWriteOperation op;
     save_metadata(&op, mail);
-    return io_ctx->operate(*mail->get_oid(), &op);
+    return timer.result(io_ctx->operate(*mail->get_oid(), &op));
   } else {
-    return io_ctx->setxattr(*mail->get_oid(), xattr.key.c_str(), xattr.bl);
+    return timer.result(io_ctx->setxattr(*mail->get_oid(), xattr.key.c_str(), xattr.bl));
   }
 }
 
@@ -123,15 +175,34 @@ int RadosMetadataStorageIma::set_metadata(RadosMail *mail, RadosMetadata &xattr,
 
 }  // namespace librmb
 
-void RadosMetadataStorageIma::save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) {
+bool RadosMetadataStorageIma::is_immutable_attribute(const std::string &key) {
+  enum rbox_metadata_key k = static_cast<enum rbox_metadata_key>(*key.c_str());
+  return !cfg->is_updateable_attribute(k) || !cfg->is_update_attributes();
+}
+
+bool RadosMetadataStorageIma::is_immutable_keyword() {
+  return !cfg->is_updateable_attribute(librmb::RBOX_METADATA_OLDV1_KEYWORDS) || !cfg->is_update_attributes();
+}
+
+int RadosMetadataStorageIma::decode_attribute(RadosMail *mail, const ceph::bufferlist &bl) {
+  // json object for immutable attributes.
+  json_t *root;
+  json_error_t error;
+  root = json_loads(bl.to_str().c_str(), 0, &error);
+  parse_attribute(mail, root);
+
+  json_decref(root);
+  return 0;
+}
+
+void RadosMetadataStorageIma::encode_attribute(RadosMail *mail, librados::ObjectWriteOperation *write_op,
+                                               ceph::bufferlist *bl) {
   char *s = NULL;
   json_t *root = json_object();
-  librados::bufferlist bl;
   if (mail->get_metadata()->size() > 0) {
     for (std::map<string, ceph::bufferlist>::iterator it = mail->get_metadata()->begin();
          it != mail->get_metadata()->end(); ++it) {
-      enum rbox_metadata_key k = static_cast<enum rbox_metadata_key>(*(*it).first.c_str());
-      if (!cfg->is_updateable_attribute(k) || !cfg->is_update_attributes()) {
+      if (is_immutable_attribute((*it).first)) {
         json_object_set_new(root, (*it).first.c_str(), json_string((*it).second.to_str().c_str()));
       } else {
         write_op->setxattr((*it).first.c_str(), (*it).second);
@@ -141,7 +212,7 @@ void RadosMetadataStorageIma::save_metadata(librados::ObjectWriteOperation *writ
   json_t *keyword = json_object();
   // build extended Metadata object
   if (mail->get_extended_metadata()->size() > 0) {
-    if (!cfg->is_updateable_attribute(librmb::RBOX_METADATA_OLDV1_KEYWORDS) || !cfg->is_update_attributes()) {
+    if (is_immutable_keyword()) {
       for (std::map<string, ceph::bufferlist>::iterator it = mail->get_extended_metadata()->begin();
            it != mail->get_extended_metadata()->end(); ++it) {
         json_object_set_new(keyword, (*it).first.c_str(), json_string((*it).second.to_str().c_str()));
@@ -153,11 +224,15 @@ void RadosMetadataStorageIma::save_metadata(librados::ObjectWriteOperation *writ
   }
 
   s = json_dumps(root, 0);
-  bl.append(s);
+  bl->append(s);
   free(s);
   json_decref(keyword);
   json_decref(root);
+}
 
+void RadosMetadataStorageIma::save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) {
+  librados::bufferlist bl;
+  encode_attribute(mail, write_op, &bl);
   write_op->setxattr(cfg->get_metadata_storage_attribute().c_str(), bl);
 }
 
@@ -168,6 +243,7 @@ bool RadosMetadataStorageIma::update_metadata(const std::string &oid, std::list<
     return true;
   }
 
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
   RadosMail obj;
   obj.set_oid(oid);
   load_metadata(&obj);
@@ -180,9 +256,10 @@ bool RadosMetadataStorageIma::update_metadata(const std::string &oid, std::list<
   // write update
   save_metadata(&write_op, &obj);
   librados::AioCompletion *completion = librados::Rados::aio_create_completion();
-  int ret = io_ctx->aio_operate(oid, completion, &write_op);
+  int ret = RadosThrottle::global().aio_operate(io_ctx, oid, completion, &write_op, 0);
   completion->wait_for_complete();
   completion->release();
+  timer.set_failed(ret != 0);
   return ret == 0;
 }
 int RadosMetadataStorageIma::update_keyword_metadata(const std::string &oid, RadosMetadata *metadata) {
@@ -192,7 +269,8 @@ int RadosMetadataStorageIma::update_keyword_metadata(const std::string &oid, Rad
     } else {
       std::map<std::string, librados::bufferlist> map;
       map.insert(std::pair<string, librados::bufferlist>(metadata->key, metadata->bl));
-      ret = io_ctx->omap_set(oid, map);
+      RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+      ret = timer.result(io_ctx->omap_set(oid, map));
     }
   }
   return ret;
@@ -36,11 +36,27 @@ class RadosMetadataStorageIma : public RadosStorageMetadataModule {
  private:
   int parse_attribute(RadosMail *mail, json_t *root);
 
+ protected:
+  /* true if the attribute is saved in the metadata storage attribute (not as separate xattribute) */
+  bool is_immutable_attribute(const std::string &key);
+  /* true if the keywords are saved in the metadata storage attribute (not as omap values) */
+  bool is_immutable_keyword();
+  /* read the immutable attributes from the metadata storage attribute */
+  virtual int decode_attribute(RadosMail *mail, const ceph::bufferlist &bl);
+  /* build the metadata storage attribute, mutable attributes are added to write_op */
+  virtual void encode_attribute(RadosMail *mail, librados::ObjectWriteOperation *write_op, ceph::bufferlist *bl);
+
  public:
   RadosMetadataStorageIma(librados::IoCtx *io_ctx_, RadosDovecotCephCfg *cfg_);
   virtual ~RadosMetadataStorageIma();
   void set_io_ctx(librados::IoCtx *io_ctx_) override { this->io_ctx = io_ctx_; }
   int load_metadata(RadosMail *mail) override;
+  int load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                    std::map<std::string, ceph::bufferlist> *omap) override;
+  int load_immutable_metadata(RadosMail *mail) override;
+  librados::IoCtx *read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                           std::map<std::string, ceph::bufferlist> *xattrs, int *prval) override;
+  int decode_immutable_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs) override;
   int set_metadata(RadosMail *mail, RadosMetadata &xattr) override;
   int set_metadata(RadosMail *mail, RadosMetadata &xattr, librados::ObjectWriteOperation *write_op) override;
   bool update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) override;
@@ -55,7 +71,7 @@ class RadosMetadataStorageIma : public RadosStorageMetadataModule {
   static std::string module_name;
   static std::string keyword_key;
 
- private:
+ protected:
   librados::IoCtx *io_ctx;
   RadosDovecotCephCfg *cfg;
 };
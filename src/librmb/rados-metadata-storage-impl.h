@@ -16,12 +16,16 @@
 #include "rados-metadata-storage-module.h"
 #include "rados-metadata-storage-default.h"
 #include "rados-metadata-storage-ima.h"
+#include "rados-metadata-storage-binary.h"
+#include "rados-metadata-storage-pool.h"
 #include "rados-metadata-storage.h"
 
 namespace librmb {
 class RadosMetadataStorageImpl : public RadosMetadataStorage {
  public:
-  RadosMetadataStorageImpl() {
+  /* cluster is needed to open a separate metadata pool (rbox_metadata_pool) */
+  explicit RadosMetadataStorageImpl(RadosCluster *cluster_ = nullptr) {
+    cluster = cluster_;
     storage = nullptr;
     io_ctx = nullptr;
     cfg = nullptr;
@@ -39,8 +43,18 @@ class RadosMetadataStorageImpl : public RadosMetadataStorage {
     if (storage == nullptr) {
       // decide metadata storage!
       std::string storage_module_name = cfg_->get_metadata_storage_module();
-      if (storage_module_name.compare(librmb::RadosMetadataStorageIma::module_name) == 0) {
+      if (!cfg_->get_metadata_pool().empty()) {
+        librmb::RadosMetadataStoragePool *pool_storage = new librmb::RadosMetadataStoragePool(io_ctx);
+        if (pool_storage->open(cluster, cfg_->get_metadata_pool()) < 0) {
+          // the metadata is not accessible, do not fall back to the mail objects.
+          delete pool_storage;
+          return nullptr;
+        }
+        storage = pool_storage;
+      } else if (storage_module_name.compare(librmb::RadosMetadataStorageIma::module_name) == 0) {
         storage = new librmb::RadosMetadataStorageIma(io_ctx, cfg_);
+      } else if (storage_module_name.compare(librmb::RadosMetadataStorageBinary::module_name) == 0) {
+        storage = new librmb::RadosMetadataStorageBinary(io_ctx, cfg_);
       } else {
         storage = new librmb::RadosMetadataStorageDefault(io_ctx);
       }
@@ -54,6 +68,7 @@ class RadosMetadataStorageImpl : public RadosMetadataStorage {
   }
 
  private:
+  RadosCluster *cluster;
   librados::IoCtx *io_ctx;
   RadosDovecotCephCfg *cfg;
   RadosStorageMetadataModule *storage;
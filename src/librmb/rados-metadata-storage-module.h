@@ -12,6 +12,9 @@
 #ifndef SRC_LIBRMB_RADOS_METADATA_STORAGE_MODULE_H_
 #define SRC_LIBRMB_RADOS_METADATA_STORAGE_MODULE_H_
 
+#include <list>
+#include <map>
+#include <string>
 #include <rados/librados.hpp>
 
 #include "rados-mail.h"
@@ -22,8 +25,46 @@ class RadosStorageMetadataModule {
   virtual ~RadosStorageMetadataModule(){};
   /* update io_ctx */
   virtual void set_io_ctx(librados::IoCtx *io_ctx){};
+  /* true if each metadata attribute is stored as a separate xattribute, so that
+   * it can be used as osd side listing filter (see RadosStorage::find_mails) */
+  virtual bool has_xattr_metadata() { return false; }
+  /* true if the metadata is not stored with the mail object, mails are then listed
+   * by their metadata (see find_mails) */
+  virtual bool has_separate_metadata() { return false; }
+  /* metadata objects with the given attribute (only modules with separate metadata) */
+  virtual librados::NObjectIterator find_mails(const RadosMetadata *attr) {
+    return librados::NObjectIterator::__EndObjectIterator;
+  }
+  /* follow a copy or move of the mail object (see RadosStorage::copy/move): attributes in to_update
+   * are replaced, delete_source removes the metadata of the source (only modules with separate metadata) */
+  virtual int copy_metadata(const std::string &src_oid, const char *src_ns, const std::string &dest_oid,
+                            const char *dest_ns, std::list<RadosMetadata> &to_update, bool delete_source) {
+    return 0;
+  }
+  /* remove the metadata of a removed mail object (only modules with separate metadata) */
+  virtual int remove_metadata(const std::string &oid) { return 0; }
+  /* asynchronous remove_metadata: adds the remove of the metadata to write_op and returns the io context write_op
+   * has to be executed on (nullptr if there is no separate metadata) */
+  virtual librados::IoCtx *remove_metadata(librados::ObjectWriteOperation *write_op) { return nullptr; }
   /* load the metadta into RadosMail */
   virtual int load_metadata(RadosMail *mail) = 0;
+  /* load the metadata into RadosMail from already read xattributes and omap values
+   * (e.g. read together with the object stat in one read operation) */
+  virtual int load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                            std::map<std::string, ceph::bufferlist> *omap) = 0;
+  /* load the metadata into RadosMail to read attributes which do not change after the save (all but flags
+   * and keywords, which may be missing or outdated), the read may be served by a replica (see RadosReplicaReads) */
+  virtual int load_immutable_metadata(RadosMail *mail) { return load_metadata(mail); }
+  /* asynchronous load_immutable_metadata: adds the read of the immutable metadata to read_op and returns the io
+   * context read_op has to be executed on (nullptr if not supported, use load_immutable_metadata then). Once the
+   * operation completed, the read xattributes are loaded with decode_immutable_metadata. */
+  virtual librados::IoCtx *read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                                   std::map<std::string, ceph::bufferlist> *xattrs, int *prval) {
+    return nullptr;
+  }
+  virtual int decode_immutable_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs) {
+    return -1;
+  }
   /* set a new metadata attribute to a mail object */
   virtual int set_metadata(RadosMail *mail, RadosMetadata &xattr) = 0;
   /* set a new metadata attribute to a mail object */
@@ -0,0 +1,286 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-metadata-storage-pool.h"
+#include <string.h>
+#include <utility>
+#include "rados-metrics.h"
+#include "rados-replica-reads.h"
+#include "rados-storage-impl.h"
+#include "rados-throttle.h"
+#include "rados-util.h"
+
+namespace librmb {
+
+std::string RadosMetadataStoragePool::module_name = "pool";
+
+RadosMetadataStoragePool::RadosMetadataStoragePool(librados::IoCtx *io_ctx_)
+    : io_ctx(io_ctx_), io_ctx_created(false) {}
+
+RadosMetadataStoragePool::~RadosMetadataStoragePool() { close(); }
+
+int RadosMetadataStoragePool::open(RadosCluster *cluster, const std::string &pool) {
+  if (io_ctx_created) {
+    return 0;
+  }
+  if (cluster == nullptr || !cluster->is_connected()) {
+    return -ENOTCONN;
+  }
+  int ret = cluster->io_ctx_create(pool, &metadata_io_ctx);
+  if (ret < 0) {
+    return ret;
+  }
+  io_ctx_created = true;
+  return 0;
+}
+
+void RadosMetadataStoragePool::close() {
+  if (io_ctx_created) {
+    metadata_io_ctx.close();
+    io_ctx_created = false;
+  }
+}
+
+librados::IoCtx *RadosMetadataStoragePool::get_metadata_io_ctx() {
+  if (!io_ctx_created || io_ctx == nullptr) {
+    return nullptr;
+  }
+  metadata_io_ctx.set_namespace(io_ctx->get_namespace());
+  return &metadata_io_ctx;
+}
+
+librados::NObjectIterator RadosMetadataStoragePool::find_mails(const RadosMetadata *attr) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return librados::NObjectIterator::__EndObjectIterator;
+  }
+  if (attr != nullptr) {
+    ceph::bufferlist filter_bl;
+    RadosStorageImpl::encode_plain_filter(attr, &filter_bl);
+    return meta_io_ctx->nobjects_begin(filter_bl);
+  }
+  return meta_io_ctx->nobjects_begin();
+}
+
+int RadosMetadataStoragePool::load_metadata(RadosMail *mail) {
+  if (mail == nullptr) {
+    return -1;
+  }
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  if (mail->get_metadata()->size() > 0) {
+    mail->get_metadata()->clear();
+  }
+  RadosMetricsTimer timer(METRIC_METADATA_LOAD);
+  int ret = meta_io_ctx->getxattrs(*mail->get_oid(), *mail->get_metadata());
+  if (ret >= 0) {
+    ret = RadosUtils::get_all_keys_and_values(meta_io_ctx, *mail->get_oid(), mail->get_extended_metadata());
+  }
+  return timer.result(ret);
+}
+
+int RadosMetadataStoragePool::load_immutable_metadata(RadosMail *mail) {
+  if (mail == nullptr || !RadosReplicaReads::global().is_enabled()) {
+    return load_metadata(mail);
+  }
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  if (mail->get_metadata()->size() > 0) {
+    mail->get_metadata()->clear();
+  }
+  RadosMetricsTimer timer(METRIC_METADATA_LOAD);
+  return timer.result(RadosReplicaReads::global().read_xattrs(meta_io_ctx, *mail->get_oid(), mail->get_metadata()));
+}
+
+librados::IoCtx *RadosMetadataStoragePool::read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                                                  std::map<std::string, ceph::bufferlist> *xattrs,
+                                                                  int *prval) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx != nullptr) {
+    read_op->getxattrs(xattrs, prval);
+  }
+  return meta_io_ctx;
+}
+
+int RadosMetadataStoragePool::decode_immutable_metadata(RadosMail *mail,
+                                                        std::map<std::string, ceph::bufferlist> *xattrs) {
+  if (mail == nullptr || xattrs == nullptr) {
+    return -1;
+  }
+  mail->get_metadata()->clear();
+  mail->get_metadata()->swap(*xattrs);
+  return 0;
+}
+
+int RadosMetadataStoragePool::load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                                            std::map<std::string, ceph::bufferlist> *omap) {
+  return load_metadata(mail);
+}
+
+int RadosMetadataStoragePool::set_metadata(RadosMail *mail, RadosMetadata &xattr) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  mail->add_metadata(xattr);
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+  return timer.result(meta_io_ctx->setxattr(*mail->get_oid(), xattr.key.c_str(), xattr.bl));
+}
+
+int RadosMetadataStoragePool::set_metadata(RadosMail *mail, RadosMetadata &xattr,
+                                           librados::ObjectWriteOperation *write_op) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  mail->add_metadata(xattr);
+  if (mail->get_completion() == nullptr) {
+    mail->set_completion(librados::Rados::aio_create_completion());
+    mail->set_active_op(1);
+  }
+  return RadosThrottle::global().aio_operate(meta_io_ctx, *mail->get_oid(), mail->get_completion(), write_op,
+                                            xattr.bl.length());
+}
+
+void RadosMetadataStoragePool::save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  int ret = -ENOTCONN;
+  if (meta_io_ctx != nullptr) {
+    RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+    librados::ObjectWriteOperation metadata_op;
+    metadata_op.create(false);
+    for (std::map<string, ceph::bufferlist>::iterator it = mail->get_metadata()->begin();
+         it != mail->get_metadata()->end(); ++it) {
+      metadata_op.setxattr((*it).first.c_str(), (*it).second);
+    }
+    if (mail->get_extended_metadata()->size() > 0) {
+      metadata_op.omap_set(*mail->get_extended_metadata());
+    }
+    ret = timer.result(meta_io_ctx->operate(*mail->get_oid(), &metadata_op));
+  }
+  if (ret < 0) {
+    // a mail without metadata cannot be found, let writing the mail object fail.
+    write_op->assert_exists();
+  }
+}
+
+bool RadosMetadataStoragePool::update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return false;
+  }
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+  librados::ObjectWriteOperation write_op;
+  for (std::list<RadosMetadata>::iterator it = to_update.begin(); it != to_update.end(); ++it) {
+    write_op.setxattr((*it).key.c_str(), (*it).bl);
+  }
+  int ret = meta_io_ctx->operate(oid, &write_op);
+  timer.set_failed(ret != 0);
+  return ret == 0;
+}
+
+int RadosMetadataStoragePool::copy_metadata(const std::string &src_oid, const char *src_ns,
+                                            const std::string &dest_oid, const char *dest_ns,
+                                            std::list<RadosMetadata> &to_update, bool delete_source) {
+  if (!io_ctx_created) {
+    return -ENOTCONN;
+  }
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+  librados::ObjectWriteOperation write_op;
+  bool same_object = src_oid.compare(dest_oid) == 0 && strcmp(src_ns, dest_ns) == 0;
+  if (same_object) {
+    write_op.assert_exists();
+    for (std::list<RadosMetadata>::iterator it = to_update.begin(); it != to_update.end(); ++it) {
+      write_op.setxattr((*it).key.c_str(), (*it).bl);
+    }
+  } else {
+    std::map<std::string, ceph::bufferlist> xattrs;
+    std::map<std::string, ceph::bufferlist> omap;
+    metadata_io_ctx.set_namespace(src_ns);
+    int ret = metadata_io_ctx.getxattrs(src_oid, xattrs);
+    if (ret >= 0) {
+      ret = RadosUtils::get_all_keys_and_values(&metadata_io_ctx, src_oid, &omap);
+    }
+    if (ret < 0) {
+      return timer.result(ret);
+    }
+    for (std::list<RadosMetadata>::iterator it = to_update.begin(); it != to_update.end(); ++it) {
+      xattrs[(*it).key] = (*it).bl;
+    }
+    write_op.create(false);
+    for (std::map<std::string, ceph::bufferlist>::iterator it = xattrs.begin(); it != xattrs.end(); ++it) {
+      write_op.setxattr((*it).first.c_str(), (*it).second);
+    }
+    if (omap.size() > 0) {
+      write_op.omap_set(omap);
+    }
+  }
+  metadata_io_ctx.set_namespace(dest_ns);
+  int ret = metadata_io_ctx.operate(dest_oid, &write_op);
+  if (ret >= 0 && delete_source && !same_object) {
+    metadata_io_ctx.set_namespace(src_ns);
+    ret = metadata_io_ctx.remove(src_oid);
+  }
+  return timer.result(ret);
+}
+
+int RadosMetadataStoragePool::remove_metadata(const std::string &oid) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  int ret = meta_io_ctx->remove(oid);
+  return ret == -ENOENT ? 0 : ret;
+}
+
+librados::IoCtx *RadosMetadataStoragePool::remove_metadata(librados::ObjectWriteOperation *write_op) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx != nullptr) {
+    write_op->remove();
+  }
+  return meta_io_ctx;
+}
+
+int RadosMetadataStoragePool::update_keyword_metadata(const std::string &oid, RadosMetadata *metadata) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (metadata == nullptr || meta_io_ctx == nullptr) {
+    return -1;
+  }
+  std::map<std::string, librados::bufferlist> map;
+  map.insert(std::pair<string, librados::bufferlist>(metadata->key, metadata->bl));
+  RadosMetricsTimer timer(METRIC_METADATA_SAVE);
+  return timer.result(meta_io_ctx->omap_set(oid, map));
+}
+
+int RadosMetadataStoragePool::remove_keyword_metadata(const std::string &oid, std::string &key) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  std::set<std::string> keys;
+  keys.insert(key);
+  return meta_io_ctx->omap_rm_keys(oid, keys);
+}
+
+int RadosMetadataStoragePool::load_keyword_metadata(const std::string &oid, std::set<std::string> &keys,
+                                                    std::map<std::string, ceph::bufferlist> *metadata) {
+  librados::IoCtx *meta_io_ctx = get_metadata_io_ctx();
+  if (meta_io_ctx == nullptr) {
+    return -ENOTCONN;
+  }
+  return meta_io_ctx->omap_get_vals_by_keys(oid, keys, metadata);
+}
+
+} /* namespace librmb */
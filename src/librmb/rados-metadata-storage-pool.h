@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_METADATA_STORAGE_POOL_H_
+#define SRC_LIBRMB_RADOS_METADATA_STORAGE_POOL_H_
+#include <list>
+#include <map>
+#include <string>
+#include <set>
+#include "rados-cluster.h"
+#include "rados-metadata-storage-module.h"
+
+namespace librmb {
+/**
+ * Stores the mail metadata in a separate pool.
+ *
+ * The metadata of a mail is kept in an object of the metadata pool with the
+ * oid and namespace of the mail object: each metadata attribute as single
+ * xattribute, keywords as omap values. The mail objects only carry the mail
+ * data, so they can be stored in an erasure coded pool, while flag and
+ * keyword updates and the index rebuild only access the (replicated)
+ * metadata pool.
+ *
+ * The io context given by set_io_ctx is the one of the mail objects, only its
+ * namespace is used.
+ *
+ * Small mails are not packed with a metadata pool (see RadosMailPack), the
+ * containers would need omap in the mail pool.
+ */
+class RadosMetadataStoragePool : public RadosStorageMetadataModule {
+ public:
+  explicit RadosMetadataStoragePool(librados::IoCtx *io_ctx_);
+  virtual ~RadosMetadataStoragePool();
+
+  /*!
+   * open the io context of the metadata pool.
+   * @param[in] cluster connected cluster
+   * @param[in] pool metadata pool (needs to exist)
+   * @return linux error code or 0 if successful
+   */
+  int open(RadosCluster *cluster, const std::string &pool);
+  void close();
+
+  void set_io_ctx(librados::IoCtx *io_ctx_) override { this->io_ctx = io_ctx_; }
+  bool has_xattr_metadata() override { return true; }
+  bool has_separate_metadata() override { return true; }
+  librados::NObjectIterator find_mails(const RadosMetadata *attr) override;
+
+  int load_metadata(RadosMail *mail) override;
+  /* xattrs and omap of the mail object do not contain metadata, it is loaded from the metadata pool */
+  int load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                    std::map<std::string, ceph::bufferlist> *omap) override;
+  int load_immutable_metadata(RadosMail *mail) override;
+  /* read_op is executed on the metadata object */
+  librados::IoCtx *read_immutable_metadata(librados::ObjectReadOperation *read_op,
+                                           std::map<std::string, ceph::bufferlist> *xattrs, int *prval) override;
+  int decode_immutable_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs) override;
+  int set_metadata(RadosMail *mail, RadosMetadata &xattr) override;
+  /* write_op is executed on the metadata object */
+  int set_metadata(RadosMail *mail, RadosMetadata &xattr, librados::ObjectWriteOperation *write_op) override;
+  bool update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) override;
+  /* the metadata object is written synchronously. If that fails, write_op asserts the existence
+   * of the (new) mail object, so that writing the mail fails as well. */
+  void save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) override;
+  int copy_metadata(const std::string &src_oid, const char *src_ns, const std::string &dest_oid,
+                    const char *dest_ns, std::list<RadosMetadata> &to_update, bool delete_source) override;
+  int remove_metadata(const std::string &oid) override;
+  /* write_op is executed on the metadata object */
+  librados::IoCtx *remove_metadata(librados::ObjectWriteOperation *write_op) override;
+
+  int update_keyword_metadata(const std::string &oid, RadosMetadata *metadata) override;
+  int remove_keyword_metadata(const std::string &oid, std::string &key) override;
+  int load_keyword_metadata(const std::string &oid, std::set<std::string> &keys,
+                            std::map<std::string, ceph::bufferlist> *metadata) override;
+
+ public:
+  static std::string module_name;
+
+ private:
+  /* io context of the metadata pool in the namespace of the mail io context */
+  librados::IoCtx *get_metadata_io_ctx();
+
+  librados::IoCtx *io_ctx;
+  librados::IoCtx metadata_io_ctx;
+  bool io_ctx_created;
+};
+
+} /* namespace librmb */
+
+#endif  // SRC_LIBRMB_RADOS_METADATA_STORAGE_POOL_H_
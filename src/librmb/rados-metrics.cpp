@@ -0,0 +1,315 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>  // NOLINT
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace librmb {
+
+static const char *metric_op_names[METRIC_OP_COUNT] = {
+    "save_mail", "read_mail", "copy", "move", "delete_mail", "metadata_load", "metadata_save", "dict_lookup",
+    "dict_commit", "throttle", "replica_mail", "replica_meta", "hedged_read", "hedge_won"};
+
+static void update_max(std::atomic<uint64_t> *max, uint64_t value) {
+  uint64_t current = max->load(std::memory_order_relaxed);
+  while (value > current && !max->compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+int RadosHistogram::bucket_index(uint64_t value) {
+  if (value < static_cast<uint64_t>(SUB_BUCKETS)) {
+    return static_cast<int>(value);
+  }
+  int magnitude = 63 - __builtin_clzll(value);
+  if (magnitude >= MAX_MAGNITUDE) {
+    return BUCKET_COUNT - 1;
+  }
+  int shift = magnitude - SUB_BUCKET_BITS;
+  int sub_bucket = static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+  return (shift + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t RadosHistogram::bucket_upper_bound(int index) {
+  if (index < SUB_BUCKETS) {
+    return index;
+  }
+  int shift = index / SUB_BUCKETS - 1;
+  uint64_t lower = static_cast<uint64_t>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+  return lower + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+void RadosHistogram::record(uint64_t value) {
+  buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(value, std::memory_order_relaxed);
+  update_max(&max, value);
+}
+
+uint64_t RadosHistogram::percentile(double p) const {
+  uint64_t total = get_count();
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    seen += get_bucket(i);
+    if (seen >= rank) {
+      uint64_t bound = bucket_upper_bound(i);
+      return bound < get_max() ? bound : get_max();
+    }
+  }
+  return get_max();
+}
+
+void RadosHistogram::reset() {
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    buckets[i].store(0, std::memory_order_relaxed);
+  }
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  max.store(0, std::memory_order_relaxed);
+}
+
+void RadosHistogram::add_bucket(int index, uint64_t n) {
+  if (index >= 0 && index < BUCKET_COUNT) {
+    buckets[index].fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+void RadosHistogram::add_totals(uint64_t count_, uint64_t sum_, uint64_t max_) {
+  count.fetch_add(count_, std::memory_order_relaxed);
+  sum.fetch_add(sum_, std::memory_order_relaxed);
+  update_max(&max, max_);
+}
+
+void RadosHistogram::move_to(RadosHistogram *target) {
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    uint64_t n = buckets[i].exchange(0, std::memory_order_relaxed);
+    if (n > 0) {
+      target->add_bucket(i, n);
+    }
+  }
+  target->add_totals(count.exchange(0, std::memory_order_relaxed), sum.exchange(0, std::memory_order_relaxed),
+                     max.exchange(0, std::memory_order_relaxed));
+}
+
+RadosMetrics &RadosMetrics::global() {
+  static RadosMetrics metrics;
+  return metrics;
+}
+
+void RadosMetrics::record(enum rbox_metric_op op, uint64_t usecs, bool failed) {
+  histograms[op].record(usecs);
+  if (failed) {
+    errors[op].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void RadosMetrics::reset() {
+  for (int i = 0; i < METRIC_OP_COUNT; i++) {
+    histograms[i].reset();
+    errors[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+std::string RadosMetrics::serialize() const {
+  std::stringstream ss;
+  for (int i = 0; i < METRIC_OP_COUNT; i++) {
+    const RadosHistogram &h = histograms[i];
+    if (h.get_count() == 0) {
+      continue;
+    }
+    ss << metric_op_names[i] << " " << h.get_count() << " " << get_errors(static_cast<enum rbox_metric_op>(i)) << " "
+       << h.get_sum() << " " << h.get_max();
+    for (int b = 0; b < RadosHistogram::BUCKET_COUNT; b++) {
+      if (h.get_bucket(b) > 0) {
+        ss << " " << b << ":" << h.get_bucket(b);
+      }
+    }
+    ss << "\n";
+  }
+  return ss.str();
+}
+
+bool RadosMetrics::merge(const std::string &line) {
+  std::istringstream is(line);
+  std::string name;
+  uint64_t count, errors_, sum, max;
+  if (!(is >> name >> count >> errors_ >> sum >> max)) {
+    return false;
+  }
+  int op = 0;
+  while (op < METRIC_OP_COUNT && name.compare(metric_op_names[op]) != 0) {
+    op++;
+  }
+  if (op == METRIC_OP_COUNT) {
+    return false;
+  }
+  std::string bucket;
+  while (is >> bucket) {
+    size_t pos = bucket.find(':');
+    if (pos == std::string::npos) {
+      return false;
+    }
+    histograms[op].add_bucket(atoi(bucket.substr(0, pos).c_str()), strtoull(bucket.c_str() + pos + 1, NULL, 10));
+  }
+  histograms[op].add_totals(count, sum, max);
+  errors[op].fetch_add(errors_, std::memory_order_relaxed);
+  return true;
+}
+
+const off_t RadosMetrics::COMPACT_FILE_SIZE = 1024 * 1024;
+
+/* open the metrics file with a shared lock, which keeps it from being compacted while we append. */
+static int open_locked(const std::string &path) {
+  while (true) {
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+    if (fd < 0) {
+      return -errno;
+    }
+    struct stat fd_st, path_st;
+    if (flock(fd, LOCK_SH) < 0 || fstat(fd, &fd_st) < 0) {
+      int ret = -errno;
+      close(fd);
+      return ret;
+    }
+    if (stat(path.c_str(), &path_st) == 0 && path_st.st_ino == fd_st.st_ino) {
+      return fd;
+    }
+    // replaced by a compaction in the meantime
+    close(fd);
+  }
+}
+
+int RadosMetrics::compact_file(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  if (flock(fd, LOCK_EX) < 0) {
+    int ret = -errno;
+    close(fd);
+    return ret;
+  }
+  struct stat fd_st, path_st;
+  int ret = 0;
+  if (fstat(fd, &fd_st) < 0 || stat(path.c_str(), &path_st) < 0 || path_st.st_ino != fd_st.st_ino ||
+      fd_st.st_size < COMPACT_FILE_SIZE) {
+    // compacted by another process
+    close(fd);
+    return 0;
+  }
+  RadosMetrics *merged = new RadosMetrics();
+  ret = merged->load_file(path);
+  if (ret == 0) {
+    std::stringstream tmp_path;
+    tmp_path << path << "." << getpid() << ".tmp";
+    std::ofstream tmp(tmp_path.str().c_str(), std::ofstream::out | std::ofstream::trunc);
+    tmp << merged->serialize();
+    tmp.close();
+    if (tmp.fail() || rename(tmp_path.str().c_str(), path.c_str()) < 0) {
+      ret = -EIO;
+      unlink(tmp_path.str().c_str());
+    }
+  }
+  delete merged;
+  close(fd);
+  return ret;
+}
+
+int RadosMetrics::flush_to_file(const std::string &path) {
+  RadosMetrics *snapshot = new RadosMetrics();
+  for (int i = 0; i < METRIC_OP_COUNT; i++) {
+    histograms[i].move_to(&snapshot->histograms[i]);
+    snapshot->errors[i].store(errors[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  std::string data = snapshot->serialize();
+  delete snapshot;
+  if (data.empty()) {
+    return 0;
+  }
+
+  int fd = open_locked(path);
+  if (fd < 0) {
+    return fd;
+  }
+  // one write, so that lines of concurrent processes do not interleave.
+  int ret = 0;
+  ssize_t written = write(fd, data.c_str(), data.size());
+  if (written < 0) {
+    ret = -errno;
+  } else if (static_cast<size_t>(written) != data.size()) {
+    ret = -EIO;
+  }
+  struct stat st;
+  bool compact = ret == 0 && fstat(fd, &st) == 0 && st.st_size >= COMPACT_FILE_SIZE;
+  close(fd);
+  if (compact) {
+    ret = compact_file(path);
+  }
+  return ret;
+}
+
+int RadosMetrics::load_file(const std::string &path) {
+  std::ifstream file(path.c_str());
+  if (!file.is_open()) {
+    return -ENOENT;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && !merge(line)) {
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
+std::string RadosMetrics::to_string() const {
+  std::stringstream ss;
+  ss << std::left << std::setw(16) << "operation" << std::right << std::setw(12) << "count" << std::setw(10)
+     << "errors" << std::setw(12) << "mean(us)" << std::setw(12) << "p50(us)" << std::setw(12) << "p90(us)"
+     << std::setw(12) << "p99(us)" << std::setw(12) << "max(us)" << std::endl;
+  for (int i = 0; i < METRIC_OP_COUNT; i++) {
+    const RadosHistogram &h = histograms[i];
+    uint64_t count = h.get_count();
+    ss << std::left << std::setw(16) << metric_op_names[i] << std::right << std::setw(12) << count << std::setw(10)
+       << get_errors(static_cast<enum rbox_metric_op>(i)) << std::setw(12) << (count > 0 ? h.get_sum() / count : 0)
+       << std::setw(12) << h.percentile(50) << std::setw(12) << h.percentile(90) << std::setw(12)
+       << h.percentile(99) << std::setw(12) << h.get_max() << std::endl;
+  }
+  return ss.str();
+}
+
+const char *RadosMetrics::op_to_string(enum rbox_metric_op op) {
+  return op < METRIC_OP_COUNT ? metric_op_names[op] : "unknown";
+}
+
+uint64_t RadosMetrics::now_usecs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace librmb
@@ -0,0 +1,184 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_METRICS_H_
+#define SRC_LIBRMB_RADOS_METRICS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <string>
+
+namespace librmb {
+
+enum rbox_metric_op {
+  METRIC_SAVE_MAIL = 0,
+  METRIC_READ_MAIL,
+  METRIC_COPY,
+  METRIC_MOVE,
+  METRIC_DELETE_MAIL,
+  METRIC_METADATA_LOAD,
+  METRIC_METADATA_SAVE,
+  METRIC_DICT_LOOKUP,
+  METRIC_DICT_COMMIT,
+  // time operations waited for admission (see RadosThrottle)
+  METRIC_THROTTLE,
+  // reads of mail bodies and immutable metadata sent to replicas (see RadosReplicaReads)
+  METRIC_REPLICA_READ_MAIL,
+  METRIC_REPLICA_READ_METADATA,
+  // mail reads which were hedged and those won by the second read (see RadosHedgedReads)
+  METRIC_HEDGED_READ,
+  METRIC_HEDGE_WON,
+  METRIC_OP_COUNT
+};
+
+/**
+ * RadosHistogram
+ *
+ * Lock free latency histogram (microseconds) with HDR style buckets: every
+ * power of two is split into SUB_BUCKETS linear buckets, which keeps the
+ * relative error of the reported percentiles below 1/SUB_BUCKETS.
+ */
+class RadosHistogram {
+ public:
+  static const int SUB_BUCKET_BITS = 3;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  // values >= 2^MAX_MAGNITUDE usecs are counted in the last bucket.
+  static const int MAX_MAGNITUDE = 40;
+  static const int BUCKET_COUNT = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  RadosHistogram() { reset(); }
+
+  void record(uint64_t value);
+  /*!
+   * @param[in] p percentile (0-100)
+   * @return upper bound of the bucket holding the percentile, 0 if empty.
+   */
+  uint64_t percentile(double p) const;
+  uint64_t get_count() const { return count.load(std::memory_order_relaxed); }
+  uint64_t get_sum() const { return sum.load(std::memory_order_relaxed); }
+  uint64_t get_max() const { return max.load(std::memory_order_relaxed); }
+  uint64_t get_bucket(int index) const { return buckets[index].load(std::memory_order_relaxed); }
+  void reset();
+
+  /*!
+   * add already aggregated values (e.g. read from a metrics file).
+   */
+  void add_bucket(int index, uint64_t n);
+  void add_totals(uint64_t count_, uint64_t sum_, uint64_t max_);
+  /*!
+   * add all values to target and reset this histogram, values recorded concurrently are not lost.
+   */
+  void move_to(RadosHistogram *target);
+
+  static int bucket_index(uint64_t value);
+  static uint64_t bucket_upper_bound(int index);
+
+ private:
+  std::atomic<uint64_t> buckets[BUCKET_COUNT];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> max;
+};
+
+/**
+ * RadosMetrics
+ *
+ * Latency histograms and error counters per librmb operation. Recording
+ * only uses relaxed atomics, so it is safe from librados callbacks.
+ */
+class RadosMetrics {
+ public:
+  RadosMetrics() { reset(); }
+  /*!
+   * @return the process wide registry.
+   */
+  static RadosMetrics &global();
+
+  void record(enum rbox_metric_op op, uint64_t usecs, bool failed);
+  const RadosHistogram &get_histogram(enum rbox_metric_op op) const { return histograms[op]; }
+  uint64_t get_errors(enum rbox_metric_op op) const { return errors[op].load(std::memory_order_relaxed); }
+  void reset();
+
+  /*!
+   * @return one line per recorded operation: name count errors sum max [bucket:n ...]
+   */
+  std::string serialize() const;
+  /*!
+   * add a line created by serialize.
+   * @return false if the line can not be parsed.
+   */
+  bool merge(const std::string &line);
+  /*!
+   * append serialize() to the file and reset the registry, so that every
+   * process and storage contributes its operations once. As soon as the file
+   * exceeds COMPACT_FILE_SIZE, it is replaced by one merged line per operation.
+   * @return linux error code or 0 if successful
+   */
+  int flush_to_file(const std::string &path);
+  /*!
+   * replace the file by the merged lines of its content (exclusive lock, appending
+   * processes hold a shared one).
+   * @return linux error code or 0 if successful
+   */
+  static int compact_file(const std::string &path);
+  /*!
+   * merge all lines of a metrics file.
+   * @return linux error code or 0 if successful
+   */
+  int load_file(const std::string &path);
+  /*!
+   * @return count, errors, mean, p50, p90, p99 and max per operation (human readable)
+   */
+  std::string to_string() const;
+
+  static const char *op_to_string(enum rbox_metric_op op);
+  static const off_t COMPACT_FILE_SIZE;
+  static uint64_t now_usecs();
+
+ private:
+  RadosMetrics(const RadosMetrics &);
+  RadosMetrics &operator=(const RadosMetrics &);
+
+  RadosHistogram histograms[METRIC_OP_COUNT];
+  std::atomic<uint64_t> errors[METRIC_OP_COUNT];
+};
+
+/**
+ * RadosMetricsTimer
+ *
+ * Records the lifetime of the timer as latency of op in the global registry.
+ */
+class RadosMetricsTimer {
+ public:
+  explicit RadosMetricsTimer(enum rbox_metric_op op_) : op(op_), failed(false), start(RadosMetrics::now_usecs()) {}
+  ~RadosMetricsTimer() { RadosMetrics::global().record(op, RadosMetrics::now_usecs() - start, failed); }
+
+  /*!
+   * @param[in] ret result of the operation (< 0 counts as error)
+   * @return ret
+   */
+  int result(int ret) {
+    failed = ret < 0;
+    return ret;
+  }
+  void set_failed(bool failed_) { failed = failed_; }
+
+ private:
+  enum rbox_metric_op op;
+  bool failed;
+  uint64_t start;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_METRICS_H_
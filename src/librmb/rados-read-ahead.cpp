@@ -0,0 +1,143 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-read-ahead.h"
+
+#include <limits.h>
+
+#include <set>
+
+#include "rados-replica-reads.h"
+
+namespace librmb {
+
+RadosReadAhead::~RadosReadAhead() {
+  clear();
+  for (std::list<PendingRead *>::iterator it = dropped.begin(); it != dropped.end(); ++it) {
+    wait(*it);
+    (*it)->completion->release();
+    delete *it;
+  }
+}
+
+bool RadosReadAhead::is_sequential(const std::string &source, uint32_t position) {
+  bool sequential = source == last_source && position == last_position + 1;
+  run_length = sequential ? run_length + 1 : 0;
+  if (!sequential) {
+    last_source = source;
+  }
+  last_position = position;
+  // a single step forward is common for random access too
+  return run_length >= 2;
+}
+
+int RadosReadAhead::update_window(RadosStorage *storage,
+                                  const std::list<std::pair<std::string, uint64_t>> &next_mails) {
+  release_dropped();
+  std::set<std::string> window;
+  for (std::list<std::pair<std::string, uint64_t>>::const_iterator it = next_mails.begin(); it != next_mails.end();
+       ++it) {
+    window.insert(it->first);
+  }
+  // the reader went somewhere else
+  for (std::map<std::string, PendingRead *>::iterator it = reads.begin(); it != reads.end();) {
+    std::map<std::string, PendingRead *>::iterator current = it++;
+    if (window.find(current->first) == window.end()) {
+      drop(current);
+    }
+  }
+
+  int started = 0;
+  for (std::list<std::pair<std::string, uint64_t>>::const_iterator it = next_mails.begin(); it != next_mails.end();
+       ++it) {
+    if (reads.find(it->first) != reads.end()) {
+      continue;
+    }
+    if (reads.size() >= max_mails || (!reads.empty() && bytes + it->second > max_bytes)) {
+      break;
+    }
+    PendingRead *read = new PendingRead();
+    read->io_ctx = &storage->get_io_ctx();
+    read->expected_size = it->second;
+    read->op.read(0, INT_MAX, &read->bl, &read->read_err);
+    read->op.stat(&read->psize, &read->save_date, &read->stat_err);
+    read->completion = librados::Rados::aio_create_completion();
+    if (storage->aio_operate(read->io_ctx, it->first, read->completion, &read->op,
+                             RadosReplicaReads::global().get_flags(), &read->bl) < 0) {
+      read->completion->release();
+      delete read;
+      break;
+    }
+    reads[it->first] = read;
+    bytes += read->expected_size;
+    ++started;
+  }
+  return started;
+}
+
+bool RadosReadAhead::take(const std::string &oid, librados::bufferlist *buffer, uint64_t *psize, time_t *save_date,
+                          int *ret_r) {
+  std::map<std::string, PendingRead *>::iterator it = reads.find(oid);
+  if (it == reads.end()) {
+    return false;
+  }
+  PendingRead *read = it->second;
+  wait(read);
+  *ret_r = read->completion->get_return_value();
+  if (*ret_r >= 0) {
+    buffer->claim_append(read->bl);
+    *psize = read->psize;
+    *save_date = read->save_date;
+  }
+  read->completion->release();
+  bytes -= read->expected_size;
+  delete read;
+  reads.erase(it);
+  return true;
+}
+
+void RadosReadAhead::drop(std::map<std::string, PendingRead *>::iterator it) {
+  PendingRead *read = it->second;
+  cancel(read);
+  bytes -= read->expected_size;
+  dropped.push_back(read);
+  reads.erase(it);
+}
+
+void RadosReadAhead::release_dropped() {
+  for (std::list<PendingRead *>::iterator it = dropped.begin(); it != dropped.end();) {
+    if (!is_complete(*it)) {
+      ++it;
+      continue;
+    }
+    (*it)->completion->release();
+    delete *it;
+    it = dropped.erase(it);
+  }
+}
+
+void RadosReadAhead::clear() {
+  while (!reads.empty()) {
+    drop(reads.begin());
+  }
+  release_dropped();
+}
+
+void RadosReadAhead::cancel(PendingRead *read) {
+  // completes the read with -ECANCELED if it is still in flight
+  read->io_ctx->aio_cancel(read->completion);
+}
+
+bool RadosReadAhead::is_complete(PendingRead *read) { return read->completion->is_complete_and_cb(); }
+
+void RadosReadAhead::wait(PendingRead *read) { read->completion->wait_for_complete_and_cb(); }
+
+}  // namespace librmb
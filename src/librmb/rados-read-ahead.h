@@ -0,0 +1,133 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_READ_AHEAD_H_
+#define SRC_LIBRMB_RADOS_READ_AHEAD_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include <rados/librados.hpp>
+#include "rados-storage.h"
+
+namespace librmb {
+
+/**
+ * RadosReadAhead
+ *
+ * Read ahead window for sequential mail reads (POP3 RETR, initial IMAP sync).
+ * The reader announces the mails it is going to read next, their objects are
+ * read (data + stat) asynchronously and handed over by take() when the mail
+ * is actually read. The window is bounded by the number of mails and bytes.
+ * Reads which leave the window are cancelled and released once librados
+ * completed them, only the destructor waits for them.
+ */
+class RadosReadAhead {
+ public:
+  static const uint64_t DEFAULT_MAX_BYTES = 16 * 1024 * 1024;
+
+  RadosReadAhead() : max_mails(0), max_bytes(DEFAULT_MAX_BYTES), bytes(0), last_position(0), run_length(0) {}
+  virtual ~RadosReadAhead();
+
+  /*!
+   * @param[in] max_mails_ max number of pending reads, 0 disables the read ahead
+   * @param[in] max_bytes_ max expected size of all pending reads
+   */
+  void set_window(unsigned int max_mails_, uint64_t max_bytes_) {
+    max_mails = max_mails_;
+    max_bytes = max_bytes_;
+  }
+  bool is_enabled() const { return max_mails > 0; }
+  unsigned int get_max_mails() const { return max_mails; }
+
+  /*!
+   * Track the read position, e.g. mailbox and sequence.
+   * @return true if position directly follows the last read position of the same source
+   */
+  bool is_sequential(const std::string &source, uint32_t position);
+
+  /*!
+   * Make the given mails the read ahead window. Pending reads of other mails are dropped, reads for the
+   * given mails are started (in the given order) as long as the window is not full.
+   *
+   * @param[in] storage storage to read from
+   * @param[in] next_mails oids of the mails which will be read next and their expected size (0 if unknown)
+   * @return number of started reads
+   */
+  int update_window(RadosStorage *storage, const std::list<std::pair<std::string, uint64_t>> &next_mails);
+
+  /*!
+   * Hand over a pending read. Waits for the read to complete.
+   *
+   * @param[in] oid mail object
+   * @param[out] buffer valid ptr, the mail data is appended
+   * @param[out] psize object size
+   * @param[out] save_date object mtime
+   * @param[out] ret_r librados return value of the read
+   * @return false if there is no pending read for oid
+   */
+  bool take(const std::string &oid, librados::bufferlist *buffer, uint64_t *psize, time_t *save_date, int *ret_r);
+
+  /*!
+   * Drop all pending reads.
+   */
+  void clear();
+
+  size_t get_pending_count() const { return reads.size(); }
+  uint64_t get_pending_bytes() const { return bytes; }
+  /* dropped reads librados did not complete yet */
+  size_t get_dropped_count() const { return dropped.size(); }
+
+ protected:
+  struct PendingRead {
+    PendingRead()
+        : io_ctx(nullptr), completion(nullptr), psize(0), save_date(0), read_err(0), stat_err(0), expected_size(0) {}
+    librados::IoCtx *io_ctx;
+    librados::AioCompletion *completion;
+    librados::ObjectReadOperation op;
+    librados::bufferlist bl;
+    uint64_t psize;
+    time_t save_date;
+    int read_err;
+    int stat_err;
+    uint64_t expected_size;
+  };
+
+  /* completion handling, overridden by tests */
+  virtual void cancel(PendingRead *read);
+  virtual bool is_complete(PendingRead *read);
+  virtual void wait(PendingRead *read);
+
+ private:
+  void drop(std::map<std::string, PendingRead *>::iterator it);
+  /* release the dropped reads which are complete */
+  void release_dropped();
+
+  unsigned int max_mails;
+  uint64_t max_bytes;
+  uint64_t bytes;
+  std::map<std::string, PendingRead *> reads;
+  // the buffers of a dropped read are in use until it is complete
+  std::list<PendingRead *> dropped;
+
+  std::string last_source;
+  uint32_t last_position;
+  unsigned int run_length;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_READ_AHEAD_H_
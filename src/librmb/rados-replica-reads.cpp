@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-replica-reads.h"
+
+#include "rados-metrics.h"
+#include "rados-throttle.h"
+
+namespace librmb {
+
+RadosReplicaReads &RadosReplicaReads::global() {
+  static RadosReplicaReads replica_reads;
+  return replica_reads;
+}
+
+bool RadosReplicaReads::set_mode(const std::string &mode_) {
+  if (mode_.compare("balance") == 0) {
+    mode = REPLICA_READS_BALANCE;
+  } else if (mode_.compare("localize") == 0) {
+    mode = REPLICA_READS_LOCALIZE;
+  } else {
+    mode = REPLICA_READS_NONE;
+    return mode_.empty() || mode_.compare("none") == 0;
+  }
+  return true;
+}
+
+int RadosReplicaReads::get_flags() const {
+  switch (get_mode()) {
+    case REPLICA_READS_BALANCE:
+      return LIBRADOS_OPERATION_BALANCE_READS;
+    case REPLICA_READS_LOCALIZE:
+      return LIBRADOS_OPERATION_LOCALIZE_READS;
+    default:
+      return LIBRADOS_OPERATION_NOFLAG;
+  }
+}
+
+int RadosReplicaReads::operate(librados::IoCtx *io_ctx, const std::string &oid, librados::ObjectReadOperation *op,
+                               uint64_t bytes) {
+  librados::AioCompletion *completion = librados::Rados::aio_create_completion();
+  int ret = RadosThrottle::global().aio_operate(io_ctx, oid, completion, op, get_flags(), nullptr, bytes);
+  if (ret >= 0) {
+    completion->wait_for_complete_and_cb();
+    ret = completion->get_return_value();
+  }
+  completion->release();
+  return ret;
+}
+
+int RadosReplicaReads::read_xattrs(librados::IoCtx *io_ctx, const std::string &oid,
+                                   std::map<std::string, ceph::bufferlist> *xattrs) {
+  uint64_t start = RadosMetrics::now_usecs();
+  int xattrs_err = 0;
+  librados::ObjectReadOperation op;
+  op.getxattrs(xattrs, &xattrs_err);
+  int ret = operate(io_ctx, oid, &op, 0);
+  if (ret >= 0) {
+    ret = xattrs_err;
+  }
+  if (is_enabled()) {
+    RadosMetrics::global().record(METRIC_REPLICA_READ_METADATA, RadosMetrics::now_usecs() - start,
+                                  ret < 0 && ret != -ENOENT);
+  }
+  return ret;
+}
+
+}  // namespace librmb
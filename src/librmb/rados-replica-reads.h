@@ -0,0 +1,84 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_REPLICA_READS_H_
+#define SRC_LIBRMB_RADOS_REPLICA_READS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#include <rados/librados.hpp>
+
+namespace librmb {
+
+enum rbox_replica_read_mode { REPLICA_READS_NONE = 0, REPLICA_READS_BALANCE, REPLICA_READS_LOCALIZE };
+
+/**
+ * RadosReplicaReads
+ *
+ * Process wide policy for reads which may be served by a replica instead of
+ * the primary OSD (LIBRADOS_OPERATION_BALANCE_READS / LOCALIZE_READS). Only
+ * data which never changes after the save is read this way: mail bodies
+ * (objects, stripes, packed ranges) and the immutable metadata. Flags and
+ * keywords are always read from the primary.
+ *
+ * Reads sent with the replica flags are recorded as METRIC_REPLICA_READ_MAIL
+ * and METRIC_REPLICA_READ_METADATA, compared to METRIC_READ_MAIL and
+ * METRIC_METADATA_LOAD they show the share and latency of replica reads.
+ */
+class RadosReplicaReads {
+ public:
+  RadosReplicaReads() : mode(REPLICA_READS_NONE) {}
+
+  /*!
+   * @return the process wide policy.
+   */
+  static RadosReplicaReads &global();
+
+  /*!
+   * @param[in] mode_ none, balance or localize
+   * @return false if mode_ is unknown, replica reads are disabled then.
+   */
+  bool set_mode(const std::string &mode_);
+  enum rbox_replica_read_mode get_mode() const {
+    return static_cast<enum rbox_replica_read_mode>(mode.load(std::memory_order_relaxed));
+  }
+  bool is_enabled() const { return get_mode() != REPLICA_READS_NONE; }
+  /*!
+   * @return librados operation flags for reads of immutable data
+   */
+  int get_flags() const;
+
+  /*!
+   * execute a read operation of immutable data with get_flags() and wait for it.
+   * @param[in] bytes expected size of the read data (see RadosThrottle), 0 if unknown
+   * @return return value of the operation
+   */
+  int operate(librados::IoCtx *io_ctx, const std::string &oid, librados::ObjectReadOperation *op, uint64_t bytes);
+  /*!
+   * read all xattributes of an object holding immutable metadata (recorded as METRIC_REPLICA_READ_METADATA).
+   * @return linux error code or 0 if successful
+   */
+  int read_xattrs(librados::IoCtx *io_ctx, const std::string &oid, std::map<std::string, ceph::bufferlist> *xattrs);
+
+ private:
+  RadosReplicaReads(const RadosReplicaReads &);
+  RadosReplicaReads &operator=(const RadosReplicaReads &);
+
+  std::atomic<int> mode;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_REPLICA_READS_H_
@@ -11,21 +11,311 @@
 
 #include "rados-save-log.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace librmb {
 
+#define SAVE_LOG_MAGIC_0 'R'
+#define SAVE_LOG_MAGIC_1 'B'
+#define SAVE_LOG_HEADER_SIZE 10
+#define SAVE_LOG_MAX_FIELD_SIZE 0xffff
+#define SAVE_LOG_DEFAULT_BUFFER_SIZE (64 * 1024)
+#define SAVE_LOG_DEFAULT_FLUSH_INTERVAL 1
+#define SAVE_LOG_DEFAULT_MAX_FILE_SIZE (256 * 1024 * 1024)
+
+// crc32 (ieee) lookup table, filled once during static initialization.
+struct SaveLogCrc32Table {
+  SaveLogCrc32Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+  }
+  uint32_t table[256];
+};
+static const SaveLogCrc32Table crc32_table;
+
+static uint32_t save_log_crc32(const char *data, size_t size) {
+  uint32_t crc = 0xffffffffU;
+  for (size_t i = 0; i < size; i++) {
+    crc = crc32_table.table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffffU;
+}
+
+static void put_u16(std::string *buffer, uint16_t value) {
+  buffer->push_back(static_cast<char>(value & 0xff));
+  buffer->push_back(static_cast<char>((value >> 8) & 0xff));
+}
+
+static void put_u32(std::string *buffer, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buffer->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+static uint32_t get_u32(const char *data) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) {
+    value = (value << 8) | static_cast<unsigned char>(data[i]);
+  }
+  return value;
+}
+
+static void put_field(std::string *buffer, const std::string &field) {
+  put_u16(buffer, static_cast<uint16_t>(field.size()));
+  buffer->append(field);
+}
+
+static bool get_field(const std::string &payload, size_t *pos, std::string *field) {
+  if (*pos + 2 > payload.size()) {
+    return false;
+  }
+  size_t size = static_cast<unsigned char>(payload[*pos]) | (static_cast<unsigned char>(payload[*pos + 1]) << 8);
+  *pos += 2;
+  if (*pos + size > payload.size()) {
+    return false;
+  }
+  field->assign(payload, *pos, size);
+  *pos += size;
+  return true;
+}
+
+bool RadosSaveLogEntry::to_binary(std::string *buffer) const {
+  // a truncated field would pass the checksum and replay wrong
+  if (op.size() > SAVE_LOG_MAX_FIELD_SIZE || pool.size() > SAVE_LOG_MAX_FIELD_SIZE ||
+      ns.size() > SAVE_LOG_MAX_FIELD_SIZE || oid.size() > SAVE_LOG_MAX_FIELD_SIZE) {
+    return false;
+  }
+  std::string payload;
+  payload.reserve(op.size() + pool.size() + ns.size() + oid.size() + 8);
+  put_field(&payload, op);
+  put_field(&payload, pool);
+  put_field(&payload, ns);
+  put_field(&payload, oid);
+
+  buffer->push_back(SAVE_LOG_MAGIC_0);
+  buffer->push_back(SAVE_LOG_MAGIC_1);
+  put_u32(buffer, static_cast<uint32_t>(payload.size()));
+  put_u32(buffer, save_log_crc32(payload.data(), payload.size()));
+  buffer->append(payload);
+  return true;
+}
+
+bool RadosSaveLogEntry::is_binary(std::istream &is) {
+  char magic[2];
+  std::streampos start = is.tellg();
+  if (!is.read(magic, 2)) {
+    is.clear();
+    is.seekg(start);
+    return false;
+  }
+  is.seekg(start);
+  return magic[0] == SAVE_LOG_MAGIC_0 && magic[1] == SAVE_LOG_MAGIC_1;
+}
+
+bool RadosSaveLogEntry::read_binary(std::istream &is, RadosSaveLogEntry *entry) {
+  char header[SAVE_LOG_HEADER_SIZE];
+  is.read(header, SAVE_LOG_HEADER_SIZE);
+  if (is.gcount() == 0 && is.eof()) {
+    return false;
+  }
+  if (is.gcount() != SAVE_LOG_HEADER_SIZE || header[0] != SAVE_LOG_MAGIC_0 || header[1] != SAVE_LOG_MAGIC_1) {
+    is.setstate(std::ios::failbit);
+    return false;
+  }
+  uint32_t size = get_u32(header + 2);
+  uint32_t crc = get_u32(header + 6);
+  if (size > 4 * (SAVE_LOG_MAX_FIELD_SIZE + 2)) {
+    is.setstate(std::ios::failbit);
+    return false;
+  }
+  std::string payload(size, '\0');
+  is.read(&payload[0], size);
+  if (static_cast<uint32_t>(is.gcount()) != size || save_log_crc32(payload.data(), payload.size()) != crc) {
+    // truncated entry or checksum mismatch.
+    is.clear(is.rdstate() & ~std::ios::eofbit);
+    is.setstate(std::ios::failbit);
+    return false;
+  }
+  size_t pos = 0;
+  if (!get_field(payload, &pos, &entry->op) || !get_field(payload, &pos, &entry->pool) ||
+      !get_field(payload, &pos, &entry->ns) || !get_field(payload, &pos, &entry->oid)) {
+    is.setstate(std::ios::failbit);
+    return false;
+  }
+  entry->parse_mv_op();
+  return true;
+}
+
+bool RadosSaveLogEntry::skip_damaged_binary(std::istream &is, std::streampos start, RadosSaveLogEntry *entry,
+                                            uint64_t *skipped) {
+  std::streampos pos = start + std::streamoff(1);
+  for (;;) {
+    is.clear();
+    is.seekg(pos);
+    // next magic
+    int c;
+    bool magic = false;
+    while (!magic && (c = is.get()) != std::char_traits<char>::eof()) {
+      magic = c == SAVE_LOG_MAGIC_0 && is.peek() == SAVE_LOG_MAGIC_1;
+    }
+    if (!magic) {
+      is.clear();
+      is.seekg(0, std::ios::end);
+      *skipped = static_cast<uint64_t>(is.tellg() - start);
+      is.setstate(std::ios::eofbit | std::ios::failbit);
+      return false;
+    }
+    std::streampos candidate = is.tellg() - std::streamoff(1);
+    is.seekg(candidate);
+    *entry = RadosSaveLogEntry();
+    if (read_binary(is, entry)) {
+      *skipped = static_cast<uint64_t>(candidate - start);
+      return true;
+    }
+    pos = candidate + std::streamoff(1);
+  }
+}
+
+void RadosSaveLog::init_defaults() {
+  binary = false;
+  fd = -1;
+  inode = 0;
+  last_flush = 0;
+  max_buffer_size = SAVE_LOG_DEFAULT_BUFFER_SIZE;
+  flush_interval = SAVE_LOG_DEFAULT_FLUSH_INTERVAL;
+  max_file_size = SAVE_LOG_DEFAULT_MAX_FILE_SIZE;
+}
+
+bool RadosSaveLog::open_binary() {
+  fd = ::open(logfile.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  inode = fstat(fd, &st) == 0 ? st.st_ino : 0;
+  last_flush = time(NULL);
+  return true;
+}
+
 bool RadosSaveLog::open() {
-  if (this->log_active && !ofs.is_open()) {
+  if (!this->log_active) {
+    return false;
+  }
+  if (binary) {
+    if (fd < 0) {
+      this->log_active = open_binary();
+    }
+  } else if (!ofs.is_open()) {
     ofs.open(this->logfile, std::ofstream::out | std::ofstream::app);
     this->log_active = ofs.is_open();
   }
   return this->log_active;
 }
-void RadosSaveLog::append(const RadosSaveLogEntry &entry) {
-  if (this->log_active && ofs.is_open()) {
-    ofs << entry;
+
+bool RadosSaveLog::append(const RadosSaveLogEntry &entry) {
+  if (!this->log_active) {
+    return true;
+  }
+  if (!binary) {
+    if (ofs.is_open()) {
+      ofs << entry;
+    }
+    return true;
+  }
+  if (fd < 0) {
+    return true;
+  }
+  if (!entry.to_binary(&buffer)) {
+    return false;
+  }
+  if (buffer.size() >= max_buffer_size || time(NULL) - last_flush >= flush_interval) {
+    flush();
   }
+  return true;
 }
+
+bool RadosSaveLog::reopen_if_rotated() {
+  struct stat st;
+  if (stat(logfile.c_str(), &st) == 0 && st.st_ino == inode) {
+    return true;
+  }
+  // log file has been rotated (by another process)
+  ::close(fd);
+  return open_binary();
+}
+
+void RadosSaveLog::rotate_if_needed() {
+  struct stat st;
+  if (max_file_size <= 0 || fstat(fd, &st) < 0 || st.st_size < max_file_size) {
+    return;
+  }
+  // only rotate if no other process did it in the meantime.
+  struct stat path_st;
+  if (stat(logfile.c_str(), &path_st) == 0 && path_st.st_ino == st.st_ino) {
+    std::stringstream rotated;
+    rotated << logfile << "." << time(NULL) << "." << getpid();
+    if (rename(logfile.c_str(), rotated.str().c_str()) < 0) {
+      return;
+    }
+  }
+  ::close(fd);
+  open_binary();
+}
+
+bool RadosSaveLog::flush() {
+  if (!binary || fd < 0) {
+    return true;
+  }
+  last_flush = time(NULL);
+  if (buffer.empty()) {
+    return true;
+  }
+  if (!reopen_if_rotated()) {
+    buffer.clear();
+    log_active = false;
+    return false;
+  }
+  const char *data = buffer.data();
+  size_t left = buffer.size();
+  while (left > 0) {
+    ssize_t ret = write(fd, data, left);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // do not let the buffer grow without limit.
+      buffer.clear();
+      return false;
+    }
+    data += ret;
+    left -= ret;
+  }
+  buffer.clear();
+  rotate_if_needed();
+  return true;
+}
+
 bool RadosSaveLog::close() {
+  if (binary) {
+    if (fd < 0) {
+      return true;
+    }
+    bool ret = flush();
+    if (::close(fd) < 0) {
+      ret = false;
+    }
+    fd = -1;
+    return ret;
+  }
   if (this->log_active && ofs.is_open()) {
     ofs.close();
     return !ofs.is_open();
@@ -12,9 +12,13 @@
 #ifndef SRC_LIBRMB_RADOS_SAVE_LOG_H_
 #define SRC_LIBRMB_RADOS_SAVE_LOG_H_
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 #include <fstream>  // std::ofstream
 //#include <regex>
 #include <cstdio>
+#include <string>
 #include <vector>
 #include <sstream>
 #include <list>
@@ -75,6 +79,34 @@ class RadosSaveLogEntry {
   }
   static std::string op_save() { return "save"; }
   static std::string op_cpy() { return "cpy"; }
+  // format: pack:mailbox_guid:container, a saved mail which is an entry of a pack container (see RadosMailPack)
+  static std::string op_pack(const std::string &mailbox_guid, uint32_t container) {
+    std::stringstream pack;
+    pack << "pack:" << mailbox_guid << ":" << container;
+    return pack.str();
+  }
+  /*!
+   * @param[out] mailbox_guid mailbox of the pack container
+   * @param[out] container pack container of the saved mail
+   * @return false if the entry is no packed save (op_pack)
+   */
+  bool parse_pack_op(std::string *mailbox_guid, uint32_t *container) const {
+    if (op.compare(0, 5, "pack:") != 0) {
+      return false;
+    }
+    size_t pos = op.find(':', 5);
+    if (pos == std::string::npos || pos == 5) {
+      return false;
+    }
+    std::istringstream in(op.substr(pos + 1));
+    uint32_t value;
+    if (!(in >> value) || value == 0) {
+      return false;
+    }
+    *mailbox_guid = op.substr(5, pos - 5);
+    *container = value;
+    return true;
+  }
   static std::string op_mv(const std::string &src_ns, const std::string &src_oid, const std::string &src_user,
                            std::list<librmb::RadosMetadata *> &metadata) {
     std::stringstream mv;
@@ -113,6 +145,37 @@ class RadosSaveLogEntry {
     return is;
   }
 
+  /*!
+   * append the entry in binary save log format to buffer:
+   * magic "RB", u32 payload length, u32 crc32(payload), payload
+   * payload: u16 length prefixed op, pool, ns, oid
+   * @param[out] buffer valid ptr.
+   * @return false if a field is longer than 0xffff bytes, nothing is appended then.
+   */
+  bool to_binary(std::string *buffer) const;
+  /*!
+   * read one binary entry from stream. failbit is set on a truncated entry or a checksum mismatch,
+   * eofbit if the stream has no further entry.
+   * @param[in] is input stream
+   * @param[out] entry valid ptr.
+   * @return true if entry is valid
+   */
+  static bool read_binary(std::istream &is, RadosSaveLogEntry *entry);
+  /*!
+   * skip a damaged entry (e.g. torn write of a killed process): scan forward from start + 1 to the next
+   * magic which starts an entry with a valid checksum and read that entry.
+   * @param[in] start position of the damaged entry
+   * @param[out] entry valid ptr.
+   * @param[out] skipped number of bytes skipped
+   * @return true if an entry was read, false if the stream has no further valid entry (eofbit set)
+   */
+  static bool skip_damaged_binary(std::istream &is, std::streampos start, RadosSaveLogEntry *entry,
+                                  uint64_t *skipped);
+  /*!
+   * @return true if the stream starts with a binary save log entry. (does not consume input)
+   */
+  static bool is_binary(std::istream &is);
+
   static std::string convert_metadata(std::list<librmb::RadosMetadata *> &metadata, const std::string &separator) {
     std::stringstream metadata_str;
     std::list<librmb::RadosMetadata *>::iterator list_it;
@@ -140,24 +203,67 @@ class RadosSaveLogEntry {
   std::list<librmb::RadosMetadata> metadata;
 };
 
+/**
+ * RadosSaveLog
+ *
+ * Writes the save log either as csv (default, one flushed line per entry) or in
+ * binary format. In binary format entries are collected in a per process buffer
+ * (dovecot mail processes are single threaded, so append is not synchronized) and
+ * written with one O_APPEND write (group commit) as soon as the buffer exceeds
+ * max_buffer_size or flush_interval seconds passed since the last flush. The rbox
+ * plugin flushes on every transaction commit, so entries never wait for a later
+ * append. Remaining entries are written on close. The log file is rotated to <logfile>.<time>.<pid>
+ * as soon as it exceeds max_file_size.
+ */
 class RadosSaveLog {
  public:
-  explicit RadosSaveLog(const std::string &logfile_) : logfile(logfile_) { log_active = !logfile.empty(); }
-  RadosSaveLog() { log_active = false; }
+  explicit RadosSaveLog(const std::string &logfile_) : logfile(logfile_) {
+    log_active = !logfile.empty();
+    init_defaults();
+  }
+  RadosSaveLog() {
+    log_active = false;
+    init_defaults();
+  }
   void set_save_log_file(const std::string &logfile_) {
     this->logfile = logfile_;
     this->log_active = !logfile.empty();
   }
-  virtual ~RadosSaveLog(){};
+  /*! needs to be set before open */
+  void set_binary_format(bool binary_) { this->binary = binary_; }
+  void set_max_buffer_size(size_t max_buffer_size_) { this->max_buffer_size = max_buffer_size_; }
+  void set_flush_interval(time_t flush_interval_) { this->flush_interval = flush_interval_; }
+  void set_max_file_size(off_t max_file_size_) { this->max_file_size = max_file_size_; }
+  virtual ~RadosSaveLog() { close(); }
   bool open();
-  void append(const RadosSaveLogEntry &entry);
+  /*!
+   * @return false if the entry cannot be stored in the binary format (field longer than 0xffff bytes)
+   */
+  bool append(const RadosSaveLogEntry &entry);
+  /*! write buffered binary entries to the log file */
+  bool flush();
   bool close();
-  bool is_open() { return ofs.is_open(); }
+  bool is_open() { return binary ? fd >= 0 : ofs.is_open(); }
+
+ private:
+  void init_defaults();
+  bool open_binary();
+  bool reopen_if_rotated();
+  void rotate_if_needed();
 
  private:
   std::string logfile;
   bool log_active;
   std::ofstream ofs;
+
+  bool binary;
+  int fd;
+  ino_t inode;
+  std::string buffer;
+  time_t last_flush;
+  size_t max_buffer_size;
+  time_t flush_interval;
+  off_t max_file_size;
 };
 
 } /* namespace librmb */
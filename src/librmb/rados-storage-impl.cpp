@@ -16,10 +16,14 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <rados/librados.hpp>
 #include "encoding.h"
 #include "limits.h"
+#include "rados-metrics.h"
+#include "rados-replica-reads.h"
+#include "rados-throttle.h"
 
 using std::pair;
 using std::string;
@@ -40,13 +44,22 @@ RadosStorageImpl::RadosStorageImpl(RadosCluster *_cluster) {
 
 RadosStorageImpl::~RadosStorageImpl() {}
 
+// arg: start time of the save operation (heap allocated)
+static void save_mail_complete_callback(rados_completion_t comp, void *arg) {
+  uint64_t *start = reinterpret_cast<uint64_t *>(arg);
+  librmb::RadosMetrics::global().record(librmb::METRIC_SAVE_MAIL, librmb::RadosMetrics::now_usecs() - *start,
+                                        rados_aio_get_return_value(comp) < 0);
+  delete start;
+}
+
 int RadosStorageImpl::split_buffer_and_exec_op(RadosMail *current_object,
                                                librados::ObjectWriteOperation *write_op_xattr,
                                                const uint64_t &max_write) {
   if (!cluster->is_connected() || !io_ctx_created) {
     return -1;
   }
-  std::cout << "splitting buffer and exec op " << std::endl;
+  uint64_t *start = new uint64_t(RadosMetrics::now_usecs());
+  // the callback is set on submit (see RadosThrottle)
   current_object->set_completion(librados::Rados::aio_create_completion());
 
   /* librados::ObjectWriteOperation *op =
@@ -85,22 +98,43 @@ int RadosStorageImpl::split_buffer_and_exec_op(RadosMail *current_object,
     }
     current_object->set_active_op(i + 1);
   }
-  ret_val = get_io_ctx().aio_operate(*current_object->get_oid(), current_object->get_completion(), write_op_xattr);
+  ret_val = RadosThrottle::global().aio_operate(&get_io_ctx(), *current_object->get_oid(),
+                                               current_object->get_completion(), write_op_xattr, write_buffer_size,
+                                               save_mail_complete_callback, start);
+  if (ret_val < 0) {
+    // callback is never invoked
+    RadosMetrics::global().record(METRIC_SAVE_MAIL, RadosMetrics::now_usecs() - *start, true);
+    delete start;
+  }
   current_object->set_write_operation(write_op_xattr);
 
   return ret_val;
 }
 
 int RadosStorageImpl::save_mail(const std::string &oid, librados::bufferlist &buffer) {
-  return get_io_ctx().write_full(oid, buffer);
+  RadosMetricsTimer timer(METRIC_SAVE_MAIL);
+  return timer.result(get_io_ctx().write_full(oid, buffer));
 }
 
 int RadosStorageImpl::read_mail(const std::string &oid, librados::bufferlist *buffer) {
   if (!cluster->is_connected() || !io_ctx_created) {
     return -1;
   }
-  size_t max = INT_MAX;
-  return get_io_ctx().read(oid, *buffer, max, 0);
+  RadosMetricsTimer timer(METRIC_READ_MAIL);
+  RadosReplicaReads &replica_reads = RadosReplicaReads::global();
+  uint64_t start = RadosMetrics::now_usecs();
+  int read_err = 0;
+  librados::ObjectReadOperation op;
+  op.read(0, INT_MAX, buffer, &read_err);
+  int ret = replica_reads.operate(&get_io_ctx(), oid, &op, 0);
+  if (ret >= 0) {
+    ret = read_err < 0 ? read_err : buffer->length();
+  }
+  if (replica_reads.is_enabled()) {
+    RadosMetrics::global().record(METRIC_REPLICA_READ_MAIL, RadosMetrics::now_usecs() - start,
+                                  ret < 0 && ret != -ENOENT);
+  }
+  return timer.result(ret);
 }
 
 int RadosStorageImpl::delete_mail(RadosMail *mail) {
@@ -115,7 +149,8 @@ int RadosStorageImpl::delete_mail(const std::string &oid) {
   if (!cluster->is_connected() || oid.empty() || !io_ctx_created) {
     return -1;
   }
-  return get_io_ctx().remove(oid);
+  RadosMetricsTimer timer(METRIC_DELETE_MAIL);
+  return timer.result(get_io_ctx().remove(oid));
 }
 
 int RadosStorageImpl::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
@@ -124,11 +159,22 @@ int RadosStorageImpl::aio_operate(librados::IoCtx *io_ctx_, const std::string &o
     return -1;
   }
 
-  if (io_ctx_ != nullptr) {
-    return io_ctx_->aio_operate(oid, c, op);
-  } else {
-    return get_io_ctx().aio_operate(oid, c, op);
+  return RadosThrottle::global().aio_operate(io_ctx_ != nullptr ? io_ctx_ : &get_io_ctx(), oid, c, op, 0);
+}
+
+int RadosStorageImpl::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                  librados::ObjectReadOperation *op, librados::bufferlist *pbl) {
+  return aio_operate(io_ctx_, oid, c, op, LIBRADOS_OPERATION_NOFLAG, pbl);
+}
+
+int RadosStorageImpl::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                  librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) {
+  if (!cluster->is_connected() || !io_ctx_created) {
+    return -1;
   }
+
+  return RadosThrottle::global().aio_operate(io_ctx_ != nullptr ? io_ctx_ : &get_io_ctx(), oid, c, op, flags, pbl,
+                                            0);
 }
 
 int RadosStorageImpl::stat_mail(const std::string &oid, uint64_t *psize, time_t *pmtime) {
@@ -142,25 +188,67 @@ void RadosStorageImpl::set_namespace(const std::string &_nspace) {
   this->nspace = _nspace;
 }
 
+void RadosStorageImpl::encode_plain_filter(const RadosMetadata *attr, ceph::bufferlist *filter_bl) {
+  std::string filter_name = PLAIN_FILTER_NAME;
+  encode(filter_name, *filter_bl);
+  encode("_" + attr->key, *filter_bl);
+  encode(attr->bl.to_str(), *filter_bl);
+}
+
 librados::NObjectIterator RadosStorageImpl::find_mails(const RadosMetadata *attr) {
   if (!cluster->is_connected() || !io_ctx_created) {
     return librados::NObjectIterator::__EndObjectIterator;
   }
 
   if (attr != nullptr) {
-    std::string filter_name = PLAIN_FILTER_NAME;
     ceph::bufferlist filter_bl;
-
-    encode(filter_name, filter_bl);
-    encode("_" + attr->key, filter_bl);
-    encode(attr->bl.to_str(), filter_bl);
-
+    encode_plain_filter(attr, &filter_bl);
     return get_io_ctx().nobjects_begin(filter_bl);
   } else {
     return get_io_ctx().nobjects_begin();
   }
 }
 
+int RadosStorageImpl::split_mail_listing(
+    unsigned int slice_count, std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) {
+  if (!cluster->is_connected() || !io_ctx_created || slices == nullptr || slice_count == 0) {
+    return -1;
+  }
+  librados::ObjectCursor begin = get_io_ctx().object_list_begin();
+  librados::ObjectCursor end = get_io_ctx().object_list_end();
+  for (unsigned int i = 0; i < slice_count; ++i) {
+    librados::ObjectCursor start;
+    librados::ObjectCursor finish;
+    get_io_ctx().object_list_slice(begin, end, i, slice_count, &start, &finish);
+    slices->push_back(std::make_pair(start, finish));
+  }
+  return 0;
+}
+
+int RadosStorageImpl::list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish,
+                                 size_t max_count, const RadosMetadata *attr, std::vector<std::string> *oids,
+                                 bool *more) {
+  if (!cluster->is_connected() || !io_ctx_created || cursor == nullptr || oids == nullptr || more == nullptr) {
+    return -1;
+  }
+  std::vector<librados::ObjectItem> items;
+  librados::ObjectCursor next;
+  ceph::bufferlist filter;
+  if (attr != nullptr) {
+    encode_plain_filter(attr, &filter);
+  }
+  int ret = get_io_ctx().object_list(*cursor, finish, max_count, filter, &items, &next);
+  if (ret < 0) {
+    return ret;
+  }
+  for (std::vector<librados::ObjectItem>::iterator it = items.begin(); it != items.end(); ++it) {
+    oids->push_back(it->oid);
+  }
+  *cursor = next;
+  *more = !get_io_ctx().object_list_is_end(next) && next < finish;
+  return 0;
+}
+
 librados::IoCtx &RadosStorageImpl::get_io_ctx() { return io_ctx; }
 
 int RadosStorageImpl::open_connection(const std::string &poolname, const std::string &clustername,
@@ -264,6 +352,7 @@ int RadosStorageImpl::move(std::string &src_oid, const char *src_ns, std::string
   if (!cluster->is_connected() || !io_ctx_created) {
     return -1;
   }
+  RadosMetricsTimer timer(METRIC_MOVE);
 
   int ret = 0;
   librados::ObjectWriteOperation write_op;
@@ -286,7 +375,7 @@ int RadosStorageImpl::move(std::string &src_oid, const char *src_ns, std::string
     uint64_t size;
     ret = src_io_ctx.stat(src_oid, &size, &t);
     if (ret < 0) {
-      return ret;
+      return timer.result(ret);
     }
   }
 
@@ -312,7 +401,7 @@ int RadosStorageImpl::move(std::string &src_oid, const char *src_ns, std::string
   completion->release();
   // reset io_ctx
   dest_io_ctx.set_namespace(dest_ns);
-  return ret;
+  return timer.result(ret);
 }
 
 // assumes that destination io ctx is current io_ctx;
@@ -321,6 +410,7 @@ int RadosStorageImpl::copy(std::string &src_oid, const char *src_ns, std::string
   if (!cluster->is_connected() || !io_ctx_created) {
     return -1;
   }
+  RadosMetricsTimer timer(METRIC_COPY);
 
   librados::ObjectWriteOperation write_op;
   librados::IoCtx src_io_ctx, dest_io_ctx;
@@ -359,7 +449,7 @@ int RadosStorageImpl::copy(std::string &src_oid, const char *src_ns, std::string
   completion->release();
   // reset io_ctx
   dest_io_ctx.set_namespace(dest_ns);
-  return ret;
+  return timer.result(ret);
 }
 
 // if save_async = true, don't forget to call wait_for_rados_operations e.g. wait_for_write_operations_complete
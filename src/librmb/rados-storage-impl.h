@@ -19,6 +19,8 @@
 #include <cstdint>
 #include <list>
 #include <algorithm>
+#include <utility>
+#include <vector>
 #include <rados/librados.hpp>
 
 #include "rados-mail.h"
@@ -48,7 +50,15 @@ class RadosStorageImpl : public RadosStorage {
 
   int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
                   librados::ObjectWriteOperation *op) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, librados::bufferlist *pbl) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) override;
   librados::NObjectIterator find_mails(const RadosMetadata *attr) override;
+  int split_mail_listing(unsigned int slice_count,
+                         std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) override;
+  int list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish, size_t max_count,
+                 const RadosMetadata *attr, std::vector<std::string> *oids, bool *more) override;
   int open_connection(const std::string &poolname) override;
   int open_connection(const std::string &poolname, const std::string &clustername,
                       const std::string &rados_username) override;
@@ -71,6 +81,9 @@ class RadosStorageImpl : public RadosStorage {
 
   void free_rados_mail(librmb::RadosMail *mail) override;
 
+  /* osd side listing filter for objects with the given xattribute (see find_mails) */
+  static void encode_plain_filter(const RadosMetadata *attr, ceph::bufferlist *filter_bl);
+
  private:
   int create_connection(const std::string &poolname);
 
@@ -15,6 +15,8 @@
 #include <string>
 #include <map>
 #include <list>
+#include <utility>
+#include <vector>
 
 #include <rados/librados.hpp>
 #include "rados-cluster.h"
@@ -95,11 +97,48 @@ class RadosStorage {
    * */
   virtual int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
                           librados::ObjectWriteOperation *op) = 0;
+  /*! asynchron execution of a read operation
+   *
+   * @param[in] io_ctx valid io context or nullptr to use the current one
+   * @param[in] oid object identifier
+   * @param[in] c valid pointer to a completion.
+   * @param[in] op the prepared read operation
+   * @param[out] pbl optional bufferlist for read data
+   * */
+  virtual int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                          librados::ObjectReadOperation *op, librados::bufferlist *pbl) = 0;
+  /*! asynchron execution of a read operation with librados operation flags
+   *
+   * @param[in] flags LIBRADOS_OPERATION_* (e.g. RadosReplicaReads::get_flags for immutable data)
+   * */
+  virtual int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                          librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) = 0;
   /*! search for mails based on given Filter
    * @param[in] attr a list of filter attributes
    *
    * @return object iterator or librados::NObjectIterator::__EndObjectIterator */
   virtual librados::NObjectIterator find_mails(const RadosMetadata *attr) = 0;
+  /*! split the object listing of the current namespace into slice_count ranges of
+   * roughly equal size, which can be listed in parallel (see list_mails).
+   *
+   * @param[in] slice_count number of ranges to create
+   * @param[out] slices list of (start, finish) cursors
+   *
+   * @return linux errorcode or 0 if successful */
+  virtual int split_mail_listing(unsigned int slice_count,
+                                 std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) = 0;
+  /*! list the next chunk of object ids within the range [cursor, finish)
+   *
+   * @param[in,out] cursor current position in the range, is moved to the next position.
+   * @param[in] finish end of the range
+   * @param[in] max_count max number of object ids to return
+   * @param[in] attr optional xattribute filter evaluated by the osd (see find_mails), can be nullptr
+   * @param[out] oids found object ids are appended
+   * @param[out] more false if the end of the range has been reached
+   *
+   * @return linux errorcode or 0 if successful */
+  virtual int list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish, size_t max_count,
+                         const RadosMetadata *attr, std::vector<std::string> *oids, bool *more) = 0;
   /*! open the rados connections with default cluster and username
    * @param[in] poolname the poolname to connect to, in case this one does not exists, it will be created.
    * */
@@ -0,0 +1,253 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-striping.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "rados-metadata.h"
+#include "rados-replica-reads.h"
+#include "rados-throttle.h"
+
+namespace librmb {
+
+const char *RadosStriping::STRIPE_NAMESPACE = "rbox_stripes";
+
+namespace {
+
+/* one stripe operation of a parallel read, write, copy or remove */
+struct StripeOp {
+  StripeOp() : completion(nullptr), read_err(0), expected_length(0) {}
+  librados::AioCompletion *completion;
+  librados::ObjectWriteOperation write_op;
+  librados::ObjectReadOperation read_op;
+  librados::bufferlist bl;
+  int read_err;
+  uint64_t expected_length;
+};
+
+void open_stripe_io_ctx(librados::IoCtx &io_ctx, librados::IoCtx *stripe_io_ctx) {
+  stripe_io_ctx->dup(io_ctx);
+  stripe_io_ctx->set_namespace(RadosStriping::STRIPE_NAMESPACE);
+}
+
+int submit(librados::IoCtx &stripe_io_ctx, const std::string &oid, StripeOp *op, bool read) {
+  op->completion = librados::Rados::aio_create_completion();
+  int ret = read ? RadosThrottle::global().aio_operate(&stripe_io_ctx, oid, op->completion, &op->read_op,
+                                                      RadosReplicaReads::global().get_flags(), &op->bl,
+                                                      op->expected_length)
+                 : RadosThrottle::global().aio_operate(&stripe_io_ctx, oid, op->completion, &op->write_op,
+                                                      op->bl.length());
+  if (ret < 0) {
+    op->completion->release();
+    op->completion = nullptr;
+  }
+  return ret;
+}
+
+/* wait for all submitted operations, return the first error */
+int wait_all(const std::vector<StripeOp *> &ops, bool ignore_enoent) {
+  int ret = 0;
+  for (std::vector<StripeOp *>::const_iterator it = ops.begin(); it != ops.end(); ++it) {
+    if ((*it)->completion == nullptr) {
+      continue;
+    }
+    (*it)->completion->wait_for_complete_and_cb();
+    int op_ret = (*it)->completion->get_return_value();
+    (*it)->completion->release();
+    (*it)->completion = nullptr;
+    if (op_ret < 0 && !(ignore_enoent && op_ret == -ENOENT) && ret == 0) {
+      ret = op_ret;
+    }
+  }
+  return ret;
+}
+
+void free_all(std::vector<StripeOp *> *ops) {
+  for (std::vector<StripeOp *>::iterator it = ops->begin(); it != ops->end(); ++it) {
+    delete *it;
+  }
+  ops->clear();
+}
+
+}  // namespace
+
+std::string RadosStriping::Manifest::to_string() const {
+  std::stringstream ss;
+  ss << count << " " << stripe_size << " " << size;
+  return ss.str();
+}
+
+bool RadosStriping::Manifest::from_string(const char *value) {
+  if (value == NULL) {
+    return false;
+  }
+  std::istringstream in(value);
+  Manifest manifest;
+  if (!(in >> manifest.count >> manifest.stripe_size >> manifest.size) || manifest.stripe_size == 0 ||
+      manifest.count != (manifest.size + manifest.stripe_size - 1) / manifest.stripe_size) {
+    return false;
+  }
+  *this = manifest;
+  return true;
+}
+
+std::string RadosStriping::get_stripe_oid(const std::string &oid, uint32_t index) {
+  std::stringstream ss;
+  ss << oid << "." << index;
+  return ss.str();
+}
+
+int RadosStriping::stripe(librados::IoCtx &io_ctx, RadosMail *mail) const {
+  if (mail == nullptr || mail->get_mail_buffer() == nullptr) {
+    return -1;
+  }
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  if (!is_enabled() || buffer->length() < min_size || buffer->length() <= stripe_size) {
+    return 0;
+  }
+  Manifest manifest;
+  manifest.size = buffer->length();
+  manifest.stripe_size = stripe_size;
+  manifest.count = (manifest.size + stripe_size - 1) / stripe_size;
+
+  librados::IoCtx stripe_io_ctx;
+  open_stripe_io_ctx(io_ctx, &stripe_io_ctx);
+  std::vector<StripeOp *> ops;
+  int ret = 0;
+  for (uint32_t i = 0; i < manifest.count && ret >= 0; i++) {
+    StripeOp *op = new StripeOp();
+    ops.push_back(op);
+    uint64_t offset = i * stripe_size;
+    op->bl.substr_of(*buffer, offset, std::min(stripe_size, manifest.size - offset));
+    op->write_op.write_full(op->bl);
+    ret = submit(stripe_io_ctx, get_stripe_oid(*mail->get_oid(), i), op, false);
+  }
+  int wait_ret = wait_all(ops, false);
+  free_all(&ops);
+  ret = ret < 0 ? ret : wait_ret;
+  if (ret < 0) {
+    remove(io_ctx, *mail->get_oid(), manifest);
+    return ret;
+  }
+  RadosMetadata xattr_stripes(RBOX_METADATA_STRIPES, manifest.to_string());
+  mail->add_metadata(xattr_stripes);
+  buffer->clear();
+  mail->set_mail_size(0);
+  return 1;
+}
+
+bool RadosStriping::get_manifest(RadosMail *mail, Manifest *manifest) {
+  return mail != nullptr && manifest->from_string(mail->get_metadata(RBOX_METADATA_STRIPES));
+}
+
+int RadosStriping::resolve(librados::IoCtx &io_ctx, RadosMail *mail) {
+  if (mail == nullptr || mail->get_mail_buffer() == nullptr) {
+    return -1;
+  }
+  Manifest manifest;
+  if (!get_manifest(mail, &manifest)) {
+    return 0;
+  }
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  buffer->clear();
+  int ret = read(io_ctx, *mail->get_oid(), manifest, 0, manifest.size, buffer);
+  if (ret < 0) {
+    return ret;
+  }
+  mail->set_mail_size(buffer->length());
+  return 1;
+}
+
+int RadosStriping::read(librados::IoCtx &io_ctx, const std::string &oid, const Manifest &manifest, uint64_t offset,
+                        uint64_t length, librados::bufferlist *buffer) {
+  if (offset >= manifest.size || length == 0) {
+    return 0;
+  }
+  length = std::min(length, manifest.size - offset);
+  uint32_t first = offset / manifest.stripe_size;
+  uint32_t last = (offset + length - 1) / manifest.stripe_size;
+
+  librados::IoCtx stripe_io_ctx;
+  open_stripe_io_ctx(io_ctx, &stripe_io_ctx);
+  std::vector<StripeOp *> ops;
+  int ret = 0;
+  for (uint32_t i = first; i <= last && ret >= 0; i++) {
+    StripeOp *op = new StripeOp();
+    ops.push_back(op);
+    uint64_t stripe_offset = static_cast<uint64_t>(i) * manifest.stripe_size;
+    uint64_t begin = std::max(offset, stripe_offset);
+    uint64_t end = std::min(offset + length, stripe_offset + manifest.stripe_size);
+    op->expected_length = end - begin;
+    op->read_op.read(begin - stripe_offset, op->expected_length, &op->bl, &op->read_err);
+    ret = submit(stripe_io_ctx, get_stripe_oid(oid, i), op, true);
+  }
+  int wait_ret = wait_all(ops, false);
+  ret = ret < 0 ? ret : wait_ret;
+  for (std::vector<StripeOp *>::iterator it = ops.begin(); it != ops.end() && ret >= 0; ++it) {
+    // a short stripe means the mail is incomplete
+    if ((*it)->bl.length() != (*it)->expected_length) {
+      ret = -EIO;
+    }
+  }
+  if (ret >= 0) {
+    for (std::vector<StripeOp *>::iterator it = ops.begin(); it != ops.end(); ++it) {
+      buffer->claim_append((*it)->bl);
+    }
+    ret = length;
+  }
+  free_all(&ops);
+  return ret;
+}
+
+int RadosStriping::copy(librados::IoCtx &io_ctx, const std::string &src_oid, const std::string &dest_oid,
+                        const Manifest &manifest) {
+  librados::IoCtx stripe_io_ctx;
+  open_stripe_io_ctx(io_ctx, &stripe_io_ctx);
+  std::vector<StripeOp *> ops;
+  int ret = 0;
+  for (uint32_t i = 0; i < manifest.count && ret >= 0; i++) {
+    StripeOp *op = new StripeOp();
+    ops.push_back(op);
+    op->write_op.copy_from(get_stripe_oid(src_oid, i), stripe_io_ctx, 0);
+    ret = submit(stripe_io_ctx, get_stripe_oid(dest_oid, i), op, false);
+  }
+  int wait_ret = wait_all(ops, false);
+  free_all(&ops);
+  ret = ret < 0 ? ret : wait_ret;
+  if (ret < 0) {
+    remove(io_ctx, dest_oid, manifest);
+  }
+  return ret;
+}
+
+int RadosStriping::remove(librados::IoCtx &io_ctx, const std::string &oid, const Manifest &manifest) {
+  librados::IoCtx stripe_io_ctx;
+  open_stripe_io_ctx(io_ctx, &stripe_io_ctx);
+  std::vector<StripeOp *> ops;
+  int ret = 0;
+  for (uint32_t i = 0; i < manifest.count; i++) {
+    StripeOp *op = new StripeOp();
+    ops.push_back(op);
+    op->write_op.remove();
+    int submit_ret = submit(stripe_io_ctx, get_stripe_oid(oid, i), op, false);
+    ret = ret < 0 ? ret : submit_ret;
+  }
+  int wait_ret = wait_all(ops, true);
+  free_all(&ops);
+  return ret < 0 ? ret : wait_ret;
+}
+
+}  // namespace librmb
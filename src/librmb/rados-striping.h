@@ -0,0 +1,114 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_STRIPING_H_
+#define SRC_LIBRMB_RADOS_STRIPING_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <rados/librados.hpp>
+#include "rados-mail.h"
+
+namespace librmb {
+
+/**
+ * RadosStriping
+ *
+ * Large mails are stored in stripes: the (possibly compressed) mail buffer
+ * is split into objects <oid>.<n> of stripe size bytes in the namespace
+ * STRIPE_NAMESPACE of the mail's pool, which are written and read in
+ * parallel. Striped mail objects have no data, they carry the manifest
+ * (stripe count, stripe size, size) as RBOX_METADATA_STRIPES. The stripes
+ * belong to one mail object, copies get their own stripes.
+ */
+class RadosStriping {
+ public:
+  static const char *STRIPE_NAMESPACE;
+  static const uint64_t DEFAULT_STRIPE_SIZE = 4 * 1024 * 1024;
+
+  struct Manifest {
+    Manifest() : count(0), stripe_size(0), size(0) {}
+    std::string to_string() const;
+    /*!
+     * @return false if value is no valid manifest
+     */
+    bool from_string(const char *value);
+
+    uint32_t count;
+    uint64_t stripe_size;
+    uint64_t size;
+  };
+
+  RadosStriping() : min_size(0), stripe_size(DEFAULT_STRIPE_SIZE) {}
+  ~RadosStriping() {}
+
+  /*!
+   * @param[in] min_size_ mails of at least min_size bytes are striped, 0 disables striping of new mails.
+   * Reading striped mails does not depend on it.
+   */
+  void set_min_size(uint64_t min_size_) { min_size = min_size_; }
+  uint64_t get_min_size() const { return min_size; }
+  void set_stripe_size(uint64_t stripe_size_) { stripe_size = stripe_size_; }
+  uint64_t get_stripe_size() const { return stripe_size; }
+  bool is_enabled() const { return min_size > 0 && stripe_size > 0; }
+
+  /*!
+   * Write the mail buffer as stripes (waits for all of them), set RBOX_METADATA_STRIPES and clear the mail buffer.
+   *
+   * @param[in] io_ctx io context of the mail object
+   * @param[in,out] mail with valid oid and mail buffer
+   * @return 1 if the mail has been striped, 0 if it is left as it is, < 0 in case of an error
+   */
+  int stripe(librados::IoCtx &io_ctx, RadosMail *mail) const;
+
+  /*!
+   * @param[in] mail with loaded metadata
+   * @param[out] manifest manifest of a striped mail
+   * @return false if the mail is not striped
+   */
+  static bool get_manifest(RadosMail *mail, Manifest *manifest);
+  /*!
+   * Read the stripes of a striped mail (in parallel) into the mail buffer.
+   * @param[in,out] mail with loaded metadata and valid mail buffer
+   * @return 1 if the body has been read, 0 if the mail is not striped, < 0 in case of an error
+   */
+  static int resolve(librados::IoCtx &io_ctx, RadosMail *mail);
+  /*!
+   * Read a range of a striped mail, only the stripes covering the range are read (in parallel).
+   * @param[out] buffer valid ptr, the data is appended
+   * @return number of bytes read or linux error code
+   */
+  static int read(librados::IoCtx &io_ctx, const std::string &oid, const Manifest &manifest, uint64_t offset,
+                  uint64_t length, librados::bufferlist *buffer);
+  /*!
+   * Copy the stripes of src_oid to dest_oid (same pool).
+   * @return linux error code or 0 if successful
+   */
+  static int copy(librados::IoCtx &io_ctx, const std::string &src_oid, const std::string &dest_oid,
+                  const Manifest &manifest);
+  /*!
+   * Remove the stripes, missing stripes are ignored.
+   * @return linux error code or 0 if successful
+   */
+  static int remove(librados::IoCtx &io_ctx, const std::string &oid, const Manifest &manifest);
+
+  static std::string get_stripe_oid(const std::string &oid, uint32_t index);
+
+ private:
+  uint64_t min_size;
+  uint64_t stripe_size;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_STRIPING_H_
@@ -0,0 +1,229 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-throttle.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "rados-metrics.h"
+
+namespace librmb {
+
+// set while a completion callback of the throttle runs
+static thread_local bool in_completion_callback = false;
+
+RadosThrottle &RadosThrottle::global() {
+  static RadosThrottle throttle;
+  return throttle;
+}
+
+RadosThrottle::~RadosThrottle() {
+  for (std::map<int64_t, Budget *>::iterator it = budgets.begin(); it != budgets.end(); ++it) {
+    delete it->second;
+  }
+}
+
+void RadosThrottle::set_limits(const Limits &limits_) {
+  std::lock_guard<std::mutex> guard(lock);
+  limits = limits_;
+  enabled = limits.ops_per_sec > 0 || limits.bytes_per_sec > 0 || limits.max_inflight_ops > 0 ||
+            limits.max_inflight_bytes > 0;
+  // buckets start full with the new rates
+  for (std::map<int64_t, Budget *>::iterator it = budgets.begin(); it != budgets.end(); ++it) {
+    it->second->refilled = 0;
+  }
+  released.notify_all();
+}
+
+RadosThrottle::Limits RadosThrottle::get_limits() {
+  std::lock_guard<std::mutex> guard(lock);
+  return limits;
+}
+
+void RadosThrottle::refill(Budget *budget, uint64_t now) {
+  if (budget->refilled == 0) {
+    budget->ops_tokens = limits.ops_per_sec;
+    budget->bytes_tokens = limits.bytes_per_sec;
+  } else if (now > budget->refilled) {
+    double elapsed = (now - budget->refilled) / 1000000.0;
+    budget->ops_tokens = std::min<double>(limits.ops_per_sec, budget->ops_tokens + elapsed * limits.ops_per_sec);
+    budget->bytes_tokens =
+        std::min<double>(limits.bytes_per_sec, budget->bytes_tokens + elapsed * limits.bytes_per_sec);
+  }
+  budget->refilled = now;
+}
+
+uint64_t RadosThrottle::admit(Budget *budget, uint64_t bytes, uint64_t now) {
+  if (limits.max_inflight_ops > 0 && budget->inflight_ops >= limits.max_inflight_ops) {
+    return UINT64_MAX;
+  }
+  if (limits.max_inflight_bytes > 0 && budget->inflight_ops > 0 &&
+      budget->inflight_bytes + bytes > limits.max_inflight_bytes) {
+    return UINT64_MAX;
+  }
+  refill(budget, now);
+  double wait = 0;
+  if (limits.ops_per_sec > 0 && budget->ops_tokens < 1) {
+    wait = (1 - budget->ops_tokens) * 1000000.0 / limits.ops_per_sec;
+  }
+  if (limits.bytes_per_sec > 0 && bytes > 0) {
+    // operations larger than the burst wait for a full bucket
+    double needed = std::min<double>(bytes, limits.bytes_per_sec);
+    if (budget->bytes_tokens < needed) {
+      wait = std::max(wait, (needed - budget->bytes_tokens) * 1000000.0 / limits.bytes_per_sec);
+    }
+  }
+  if (wait > 0) {
+    return static_cast<uint64_t>(wait) + 1;
+  }
+  if (limits.ops_per_sec > 0) {
+    budget->ops_tokens -= 1;
+  }
+  if (limits.bytes_per_sec > 0) {
+    budget->bytes_tokens -= bytes;
+  }
+  budget->inflight_ops++;
+  budget->inflight_bytes += bytes;
+  return 0;
+}
+
+RadosThrottle::Budget *RadosThrottle::get_budget(int64_t pool) {
+  Budget *&budget = budgets[pool];
+  if (budget == nullptr) {
+    budget = new Budget();
+  }
+  return budget;
+}
+
+uint64_t RadosThrottle::try_acquire(int64_t pool, uint64_t bytes, uint64_t now) {
+  std::lock_guard<std::mutex> guard(lock);
+  return admit(get_budget(pool), bytes, now);
+}
+
+void RadosThrottle::release(int64_t pool, uint64_t bytes) {
+  Budget *budget;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    budget = get_budget(pool);
+  }
+  release(budget, bytes);
+}
+
+RadosThrottle::Budget *RadosThrottle::acquire(int64_t pool, uint64_t bytes) {
+  uint64_t start = RadosMetrics::now_usecs();
+  bool waited = false;
+  Budget *budget;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    budget = get_budget(pool);
+    for (;;) {
+      uint64_t wait = admit(budget, bytes, RadosMetrics::now_usecs());
+      if (wait == 0) {
+        break;
+      }
+      if (in_completion_callback) {
+        // waiting would block the release of all other operations
+        budget->inflight_ops++;
+        budget->inflight_bytes += bytes;
+        break;
+      }
+      waited = true;
+      if (wait == UINT64_MAX) {
+        released.wait(guard);
+      } else {
+        released.wait_for(guard, std::chrono::microseconds(wait));
+      }
+    }
+  }
+  if (waited) {
+    uint64_t usecs = RadosMetrics::now_usecs() - start;
+    throttled++;
+    throttled_usecs += usecs;
+    RadosMetrics::global().record(METRIC_THROTTLE, usecs, false);
+  }
+  return budget;
+}
+
+void RadosThrottle::release(Budget *budget, uint64_t bytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  budget->inflight_ops--;
+  budget->inflight_bytes -= bytes;
+  released.notify_all();
+}
+
+void RadosThrottle::complete_callback(librados::completion_t comp, void *arg) {
+  Token *token = static_cast<Token *>(arg);
+  token->throttle->release(token->budget, token->bytes);
+  if (token->cb != nullptr) {
+    in_completion_callback = true;
+    token->cb(comp, token->cb_arg);
+    in_completion_callback = false;
+  }
+  delete token;
+}
+
+RadosThrottle::Token *RadosThrottle::prepare(librados::IoCtx *io_ctx, librados::AioCompletion *c, uint64_t bytes,
+                                             librados::callback_t cb, void *cb_arg) {
+  if (!is_enabled()) {
+    if (cb != nullptr) {
+      c->set_complete_callback(cb_arg, cb);
+    }
+    return nullptr;
+  }
+  Token *token = new Token();
+  token->throttle = this;
+  token->bytes = bytes;
+  token->cb = cb;
+  token->cb_arg = cb_arg;
+  token->budget = acquire(io_ctx->get_id(), bytes);
+  c->set_complete_callback(token, complete_callback);
+  return token;
+}
+
+int RadosThrottle::aio_operate(librados::IoCtx *io_ctx, const std::string &oid, librados::AioCompletion *c,
+                               librados::ObjectWriteOperation *op, uint64_t bytes, librados::callback_t cb,
+                               void *cb_arg) {
+  Token *token = prepare(io_ctx, c, bytes, cb, cb_arg);
+  int ret = io_ctx->aio_operate(oid, c, op);
+  if (ret < 0 && token != nullptr) {
+    // the operation has not been submitted, there is no callback
+    release(token->budget, token->bytes);
+    delete token;
+  }
+  return ret;
+}
+
+int RadosThrottle::aio_operate(librados::IoCtx *io_ctx, const std::string &oid, librados::AioCompletion *c,
+                               librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl,
+                               uint64_t bytes, librados::callback_t cb, void *cb_arg) {
+  Token *token = prepare(io_ctx, c, bytes, cb, cb_arg);
+  int ret = io_ctx->aio_operate(oid, c, op, flags, pbl);
+  if (ret < 0 && token != nullptr) {
+    release(token->budget, token->bytes);
+    delete token;
+  }
+  return ret;
+}
+
+uint64_t RadosThrottle::get_inflight_ops(int64_t pool) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<int64_t, Budget *>::iterator it = budgets.find(pool);
+  return it != budgets.end() ? it->second->inflight_ops : 0;
+}
+
+uint64_t RadosThrottle::get_inflight_bytes(int64_t pool) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<int64_t, Budget *>::iterator it = budgets.find(pool);
+  return it != budgets.end() ? it->second->inflight_bytes : 0;
+}
+
+}  // namespace librmb
@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_LIBRMB_RADOS_THROTTLE_H_
+#define SRC_LIBRMB_RADOS_THROTTLE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <rados/librados.hpp>
+
+namespace librmb {
+
+/**
+ * RadosThrottle
+ *
+ * Process wide admission control for asynchronous rados operations. Each
+ * pool has a token bucket for operations and bytes per second (burst: one
+ * second) and a limit of operations and bytes in flight. Submitting an
+ * operation blocks until it fits into the limits of its pool, the budget is
+ * returned by the completion callback (librados thread). An operation larger
+ * than a limit is admitted as soon as nothing else is in flight or the
+ * bucket is full. Operations submitted from a completion callback are not
+ * delayed, the callback thread returns the budget of all other operations.
+ * The time spent waiting is recorded as METRIC_THROTTLE.
+ */
+class RadosThrottle {
+ public:
+  struct Limits {
+    Limits() : ops_per_sec(0), bytes_per_sec(0), max_inflight_ops(0), max_inflight_bytes(0) {}
+    // 0: unlimited
+    uint64_t ops_per_sec;
+    uint64_t bytes_per_sec;
+    uint64_t max_inflight_ops;
+    uint64_t max_inflight_bytes;
+  };
+
+  RadosThrottle() : enabled(false), throttled(0), throttled_usecs(0) {}
+  ~RadosThrottle();
+
+  /*!
+   * @return the process wide throttle.
+   */
+  static RadosThrottle &global();
+
+  /*!
+   * @param[in] limits_ limits per pool, applied to operations submitted afterwards.
+   */
+  void set_limits(const Limits &limits_);
+  Limits get_limits();
+  bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+  /*!
+   * Wait until the operation fits into the limits of the pool of io_ctx and submit it. c must not have a
+   * complete callback, it is replaced by the one returning the budget, which calls cb (optional) afterwards.
+   *
+   * @param[in] bytes bytes written (write) or expected to be read (read), 0 if unknown
+   * @return return value of IoCtx::aio_operate
+   */
+  int aio_operate(librados::IoCtx *io_ctx, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectWriteOperation *op, uint64_t bytes, librados::callback_t cb = nullptr,
+                  void *cb_arg = nullptr);
+  /*!
+   * @param[in] flags librados operation flags (LIBRADOS_OPERATION_*)
+   */
+  int aio_operate(librados::IoCtx *io_ctx, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl, uint64_t bytes,
+                  librados::callback_t cb = nullptr, void *cb_arg = nullptr);
+
+  /*!
+   * Admit an operation of pool at the given time without waiting, aio_operate waits and retries until it is
+   * admitted. Separate from aio_operate to test the limits with a simulated clock.
+   *
+   * @param[in] now usecs (see RadosMetrics::now_usecs)
+   * @return 0 if the operation is admitted (return its budget with release), else usecs to wait for tokens
+   *         (UINT64_MAX: wait for the release of an operation in flight)
+   */
+  uint64_t try_acquire(int64_t pool, uint64_t bytes, uint64_t now);
+  void release(int64_t pool, uint64_t bytes);
+
+  uint64_t get_inflight_ops(int64_t pool);
+  uint64_t get_inflight_bytes(int64_t pool);
+  /* operations which had to wait and their total waiting time */
+  uint64_t get_throttled() const { return throttled.load(std::memory_order_relaxed); }
+  uint64_t get_throttled_usecs() const { return throttled_usecs.load(std::memory_order_relaxed); }
+
+ private:
+  struct Budget {
+    Budget() : ops_tokens(0), bytes_tokens(0), refilled(0), inflight_ops(0), inflight_bytes(0) {}
+    double ops_tokens;
+    double bytes_tokens;
+    uint64_t refilled;
+    uint64_t inflight_ops;
+    uint64_t inflight_bytes;
+  };
+  /* passed to the completion callback */
+  struct Token {
+    RadosThrottle *throttle;
+    Budget *budget;
+    uint64_t bytes;
+    librados::callback_t cb;
+    void *cb_arg;
+  };
+
+  RadosThrottle(const RadosThrottle &);
+  RadosThrottle &operator=(const RadosThrottle &);
+
+  Budget *get_budget(int64_t pool);
+  Budget *acquire(int64_t pool, uint64_t bytes);
+  void release(Budget *budget, uint64_t bytes);
+  void refill(Budget *budget, uint64_t now);
+  /* see try_acquire */
+  uint64_t admit(Budget *budget, uint64_t bytes, uint64_t now);
+  Token *prepare(librados::IoCtx *io_ctx, librados::AioCompletion *c, uint64_t bytes, librados::callback_t cb,
+                 void *cb_arg);
+  static void complete_callback(librados::completion_t comp, void *arg);
+
+  std::mutex lock;
+  std::condition_variable released;
+  Limits limits;
+  std::atomic<bool> enabled;
+  std::map<int64_t, Budget *> budgets;
+  std::atomic<uint64_t> throttled;
+  std::atomic<uint64_t> throttled_usecs;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_LIBRMB_RADOS_THROTTLE_H_
@@ -71,7 +71,13 @@ enum rbox_metadata_key {
   /** additional save time **/
   RBOX_METADATA_OLDV1_SAVE_TIME = 'S',
   /** currently unused...**/
-  RBOX_METADATA_OLDV1_SPACE = ' '
+  RBOX_METADATA_OLDV1_SPACE = ' ',
+  /** compression codec of the mail object (zstd, lz4), not set for uncompressed mails **/
+  RBOX_METADATA_COMPRESSION = 'Q',
+  /** size of the mail before compression **/
+  RBOX_METADATA_UNCOMPRESSED_SIZE = 'L',
+  /** stripe manifest (<count> <stripe size> <size>) of mails stored in stripes, see RadosStriping **/
+  RBOX_METADATA_STRIPES = 'T'
 };
 
 /*!
@@ -117,10 +123,71 @@ static const char *rbox_metadata_key_to_char(rbox_metadata_key type) {
       return "S";
     case RBOX_METADATA_OLDV1_SPACE:
       return " ";
+    case RBOX_METADATA_COMPRESSION:
+      return "Q";
+    case RBOX_METADATA_UNCOMPRESSED_SIZE:
+      return "L";
+    case RBOX_METADATA_STRIPES:
+      return "T";
     default:
       return "";
   }
 }
+
+#define RBOX_METADATA_SLOT_COUNT 21
+/*!
+ *  Fixed slot of a metadata key (see RadosMail::compact_metadata).
+ *  @param[in]  type  The rbox_metadata_key instance
+ *  @return slot index (0 - RBOX_METADATA_SLOT_COUNT-1) or -1 for unknown keys
+ */
+static inline int rbox_metadata_key_to_slot(rbox_metadata_key type) {
+  switch (type) {
+    case RBOX_METADATA_MAILBOX_GUID:
+      return 0;
+    case RBOX_METADATA_GUID:
+      return 1;
+    case RBOX_METADATA_POP3_UIDL:
+      return 2;
+    case RBOX_METADATA_POP3_ORDER:
+      return 3;
+    case RBOX_METADATA_RECEIVED_TIME:
+      return 4;
+    case RBOX_METADATA_PHYSICAL_SIZE:
+      return 5;
+    case RBOX_METADATA_VIRTUAL_SIZE:
+      return 6;
+    case RBOX_METADATA_EXT_REF:
+      return 7;
+    case RBOX_METADATA_ORIG_MAILBOX:
+      return 8;
+    case RBOX_METADATA_MAIL_UID:
+      return 9;
+    case RBOX_METADATA_VERSION:
+      return 10;
+    case RBOX_METADATA_FROM_ENVELOPE:
+      return 11;
+    case RBOX_METADATA_PVT_FLAGS:
+      return 12;
+    case RBOX_METADATA_OLDV1_EXPUNGED:
+      return 13;
+    case RBOX_METADATA_OLDV1_FLAGS:
+      return 14;
+    case RBOX_METADATA_OLDV1_KEYWORDS:
+      return 15;
+    case RBOX_METADATA_OLDV1_SAVE_TIME:
+      return 16;
+    case RBOX_METADATA_OLDV1_SPACE:
+      return 17;
+    case RBOX_METADATA_COMPRESSION:
+      return 18;
+    case RBOX_METADATA_UNCOMPRESSED_SIZE:
+      return 19;
+    case RBOX_METADATA_STRIPES:
+      return 20;
+    default:
+      return -1;
+  }
+}
 enum rbox_ceph_aio_wait_method { WAIT_FOR_COMPLETE_AND_CB, WAIT_FOR_SAFE_AND_CB };
 }  // namespace
 #endif /* SRC_LIBRMB_RADOS_TYPES_H_ */
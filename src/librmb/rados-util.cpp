@@ -14,6 +14,7 @@
 #endif
 
 #include "rados-util.h"
+#include <errno.h>
 #include <limits.h>
 #include <string>
 #include <list>
@@ -21,6 +22,8 @@
 #include <sstream>
 #include <set>
 #include "encoding.h"
+#include "rados-striping.h"
+#include "rados-mail-cache.h"
 
 namespace librmb {
 
@@ -186,61 +189,37 @@ bool RadosUtils::is_numeric_optional(const char *text) {
   return is_numeric(text);
 }
 
-bool RadosUtils::validate_metadata(map<string, ceph::bufferlist> *metadata) {
-  char *uid = NULL;
-  get_metadata(RBOX_METADATA_MAIL_UID, metadata, &uid);
-  char *recv_time_str = NULL;
-  get_metadata(RBOX_METADATA_RECEIVED_TIME, metadata, &recv_time_str);
-  char *p_size = NULL;
-  get_metadata(RBOX_METADATA_PHYSICAL_SIZE, metadata, &p_size);
-  char *v_size = NULL;
-  get_metadata(RBOX_METADATA_VIRTUAL_SIZE, metadata, &v_size);
-
-  char *rbox_version;
-  get_metadata(RBOX_METADATA_VERSION, metadata, &rbox_version);
-  char *mailbox_guid = NULL;
-  get_metadata(RBOX_METADATA_MAILBOX_GUID, metadata, &mailbox_guid);
-  char *mail_guid = NULL;
-  get_metadata(RBOX_METADATA_GUID, metadata, &mail_guid);
-  char *mb_orig_name = NULL;
-  get_metadata(RBOX_METADATA_ORIG_MAILBOX, metadata, &mb_orig_name);
-
-  char *flags = NULL;
-  get_metadata(RBOX_METADATA_OLDV1_FLAGS, metadata, &flags);
-  char *pvt_flags = NULL;
-  get_metadata(RBOX_METADATA_PVT_FLAGS, metadata, &pvt_flags);
-  char *from_envelope = NULL;
-  get_metadata(RBOX_METADATA_FROM_ENVELOPE, metadata, &from_envelope);
-
+template <typename Lookup>
+static bool validate_metadata_values(Lookup get) {
   int test = 0;
-  test += is_numeric(uid) ? 0 : 1;
-  test += is_numeric(recv_time_str) ? 0 : 1;
-  test += is_numeric(p_size) ? 0 : 1;
-  test += is_numeric(v_size) ? 0 : 1;
+  test += RadosUtils::is_numeric(get(RBOX_METADATA_MAIL_UID)) ? 0 : 1;
+  test += RadosUtils::is_numeric(get(RBOX_METADATA_RECEIVED_TIME)) ? 0 : 1;
+  test += RadosUtils::is_numeric(get(RBOX_METADATA_PHYSICAL_SIZE)) ? 0 : 1;
+  test += RadosUtils::is_numeric(get(RBOX_METADATA_VIRTUAL_SIZE)) ? 0 : 1;
 
-  test += is_numeric_optional(flags) ? 0 : 1;
-  test += is_numeric_optional(pvt_flags) ? 0 : 1;
+  test += RadosUtils::is_numeric_optional(get(RBOX_METADATA_OLDV1_FLAGS)) ? 0 : 1;
+  test += RadosUtils::is_numeric_optional(get(RBOX_METADATA_PVT_FLAGS)) ? 0 : 1;
 
-  test += mailbox_guid == NULL ? 1 : 0;
-  test += mail_guid == NULL ? 1 : 0;
+  test += get(RBOX_METADATA_MAILBOX_GUID) == NULL ? 1 : 0;
+  test += get(RBOX_METADATA_GUID) == NULL ? 1 : 0;
   return test == 0;
 }
-// assumes that destination is open and initialized with uses namespace
-int RadosUtils::move_to_alt(std::string &oid, RadosStorage *primary, RadosStorage *alt_storage,
-                            RadosMetadataStorage *metadata, bool inverse) {
-  int ret = -1;
-  ret = copy_to_alt(oid, oid, primary, alt_storage, metadata, inverse);
-  if (ret > 0) {
-    if (inverse) {
-      ret = alt_storage->get_io_ctx().remove(oid);
-    } else {
-      ret = primary->get_io_ctx().remove(oid);
-    }
-  }
-  return ret;
+
+bool RadosUtils::validate_metadata(map<string, ceph::bufferlist> *metadata) {
+  return validate_metadata_values([metadata](rbox_metadata_key key) {
+    char *value = NULL;
+    get_metadata(key, metadata, &value);
+    return static_cast<const char *>(value);
+  });
 }
-int RadosUtils::copy_to_alt(std::string &src_oid, std::string &dest_oid, RadosStorage *primary,
-                            RadosStorage *alt_storage, RadosMetadataStorage *metadata, bool inverse) {
+
+bool RadosUtils::validate_metadata(RadosMail *mail) {
+  return validate_metadata_values([mail](rbox_metadata_key key) { return mail->get_metadata(key); });
+}
+// stripes_r: manifest of the source stripes, the copy is stored in one piece.
+static int copy_mail_to_alt(std::string &src_oid, std::string &dest_oid, RadosStorage *primary,
+                            RadosStorage *alt_storage, RadosMetadataStorage *metadata, bool inverse,
+                            const RadosCompression *compression, RadosStriping::Manifest *stripes_r) {
   int ret = 0;
 
   // TODO(jrse) check that storage is connected and open.
@@ -272,8 +251,24 @@ int RadosUtils::copy_to_alt(std::string &src_oid, std::string &dest_oid, RadosSt
   if (ret < 0) {
     return ret;
   }
+  if (RadosStriping::get_manifest(&mail, stripes_r)) {
+    ret = RadosStriping::resolve(inverse ? alt_storage->get_io_ctx() : primary->get_io_ctx(), &mail);
+    if (ret < 0) {
+      return ret;
+    }
+    mail.remove_metadata(RBOX_METADATA_STRIPES);
+  }
+  // deduplicated mails have no data, the shared body keeps its codec.
+  if (compression != nullptr && mail.get_metadata(RBOX_METADATA_EXT_REF) == NULL) {
+    ret = compression->recompress(&mail);
+    if (ret < 0) {
+      return ret;
+    }
+  }
 
   mail.set_oid(dest_oid);
+  // a cached copy of an earlier object in the destination pool is outdated (e.g. recompressed)
+  RadosMailCache::global().remove(inverse ? primary : alt_storage, dest_oid);
 
   librados::ObjectWriteOperation write_op;  // = new librados::ObjectWriteOperation();
   metadata->get_storage()->save_metadata(&write_op, &mail);
@@ -302,4 +297,42 @@ int RadosUtils::copy_to_alt(std::string &src_oid, std::string &dest_oid, RadosSt
   return success ? 0 : 1;
 }
 
+// assumes that destination is open and initialized with uses namespace
+int RadosUtils::move_to_alt(std::string &oid, RadosStorage *primary, RadosStorage *alt_storage,
+                            RadosMetadataStorage *metadata, bool inverse, const RadosCompression *compression) {
+  int ret = -1;
+  RadosStriping::Manifest stripes;
+  ret = copy_mail_to_alt(oid, oid, primary, alt_storage, metadata, inverse, compression, &stripes);
+  if (ret > 0) {
+    librados::IoCtx &src_io_ctx = inverse ? alt_storage->get_io_ctx() : primary->get_io_ctx();
+    RadosMailCache::global().remove(inverse ? alt_storage : primary, oid);
+    ret = src_io_ctx.remove(oid);
+    if (ret >= 0 && stripes.count > 0) {
+      ret = RadosStriping::remove(src_io_ctx, oid, stripes);
+    }
+  }
+  return ret;
+}
+int RadosUtils::copy_to_alt(std::string &src_oid, std::string &dest_oid, RadosStorage *primary,
+                            RadosStorage *alt_storage, RadosMetadataStorage *metadata, bool inverse,
+                            const RadosCompression *compression) {
+  RadosStriping::Manifest stripes;
+  return copy_mail_to_alt(src_oid, dest_oid, primary, alt_storage, metadata, inverse, compression, &stripes);
+}
+
+int RadosUtils::release_mail_refs(librados::IoCtx &io_ctx, RadosMail *mail, RadosDedup *dedup) {
+  const char *hash = mail->get_metadata(RBOX_METADATA_EXT_REF);
+  if (hash != NULL) {
+    if (dedup == nullptr || !dedup->is_open()) {
+      return -ENOTCONN;
+    }
+    return dedup->release_ref(hash, *mail->get_oid());
+  }
+  RadosStriping::Manifest stripes;
+  if (RadosStriping::get_manifest(mail, &stripes)) {
+    return RadosStriping::remove(io_ctx, *mail->get_oid(), stripes);
+  }
+  return 0;
+}
+
 }  // namespace librmb
@@ -22,6 +22,8 @@
 #include "rados-storage.h"
 #include "rados-metadata-storage.h"
 #include "rados-types.h"
+#include "rados-compression.h"
+#include "rados-dedup.h"
 
 namespace librmb {
 
@@ -118,10 +120,14 @@ class RadosUtils {
    * @param[in] alt_storage rados alternative storage
    * @param[in] metadata storage
    * @param[in] bool inverse if true, copy from alt to primary.
+   * @param[in] compression compression of the destination storage or nullptr to copy the mail as it is.
    * @return linux error code or 0 if sucessful
+   *
+   * deduplicated mails are copied without their body, which is referenced by oid (see RadosDedup).
+   * striped mails are copied in one piece, the stripes stay in the source pool (see RadosStriping).
    */
   static int copy_to_alt(std::string &src_oid, std::string &dest_oid, RadosStorage *primary, RadosStorage *alt_storage,
-                         RadosMetadataStorage *metadata, bool inverse);
+                         RadosMetadataStorage *metadata, bool inverse, const RadosCompression *compression = nullptr);
   /*!
    * move object to alternative storage
    * @param[in] src_oid
@@ -130,10 +136,11 @@ class RadosUtils {
    * @param[in] alt_storage rados alternative storage
    * @param[in] metadata storage
    * @param[in] bool inverse if true, move from alt to primary.
+   * @param[in] compression compression of the destination storage or nullptr to move the mail as it is.
    * @return linux error code or 0 if sucessful
    */
   static int move_to_alt(std::string &oid, RadosStorage *primary, RadosStorage *alt_storage,
-                         RadosMetadataStorage *metadata, bool inverse);
+                         RadosMetadataStorage *metadata, bool inverse, const RadosCompression *compression = nullptr);
   /*!
    * increment (add) value directly on osd
    * @param[in] ioctx
@@ -163,6 +170,13 @@ class RadosUtils {
    * @return true if all keys and value are correct. (type, name, value)
    */
   static bool validate_metadata(std::map<std::string, ceph::bufferlist> *metadata);
+  /*!
+   * check all metadata of the mail is valid (mail may be compacted, see RadosMail::compact_metadata)
+   *
+   * @param[in] mail
+   * @return true if all keys and value are correct. (type, name, value)
+   */
+  static bool validate_metadata(RadosMail *mail);
   /*!
    * get metadata
    *
@@ -180,6 +194,16 @@ class RadosUtils {
    * @return the metadata value
    */
   static void get_metadata(rbox_metadata_key key, std::map<std::string, ceph::bufferlist> *metadata, char **value);
+  /*!
+   * release what a removed mail object references: its dedup body reference (RBOX_METADATA_EXT_REF) or
+   * its stripes (RBOX_METADATA_STRIPES). Has to be called after the mail object itself has been removed.
+   *
+   * @param[in] io_ctx io context of the mail object
+   * @param[in] mail removed mail with its immutable metadata loaded
+   * @param[in] dedup open dedup pool, may be nullptr for mails which are not deduplicated
+   * @return -ENOTCONN if the mail is deduplicated and dedup is not open, linux error code or 0 if successful
+   */
+  static int release_mail_refs(librados::IoCtx &io_ctx, RadosMail *mail, RadosDedup *dedup);
 };
 
 }  // namespace librmb
@@ -11,6 +11,10 @@
 
 #include "ls_cmd_parser.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
 #include <iostream>
 #include <string>
 
@@ -22,6 +26,92 @@ CmdLineParser::~CmdLineParser() {
   }
 }
 
+static bool parse_number(const std::string &str, int64_t *val) {
+  if (str.empty()) {
+    return false;
+  }
+  char *end = nullptr;
+  errno = 0;
+  int64_t result = strtoll(str.c_str(), &end, 10);
+  if (errno != 0 || end == str.c_str() || *end != '\0') {
+    return false;
+  }
+  *val = result;
+  return true;
+}
+
+static bool parse_date(const std::string &str, time_t *val) {
+  if (RadosUtils::convert_str_to_time_t(str, val)) {
+    return true;
+  }
+  // allow to omit the seconds or the time part.
+  const char *formats[] = {"%Y-%m-%d %H:%M", "%Y-%m-%d"};
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+    struct tm tm = {0};
+    const char *end = strptime(str.c_str(), formats[i], &tm);
+    if (end != NULL && *end == '\0') {
+      tm.tm_isdst = -1;
+      *val = mktime(&tm);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+static std::function<bool(const T &)> compile_compare(const std::string &op, const T &ref) {
+  if (op.compare(">") == 0) {
+    return [ref](const T &v) { return v > ref; };
+  } else if (op.compare("<") == 0) {
+    return [ref](const T &v) { return v < ref; };
+  }
+  return [ref](const T &v) { return v == ref; };
+}
+
+bool Predicate::compile() {
+  matcher = nullptr;
+  if (key.compare("-") == 0) {
+    matcher = [](const std::string &) { return true; };
+    return true;
+  }
+  if (key.empty() || (op.compare("=") != 0 && op.compare(">") != 0 && op.compare("<") != 0)) {
+    return false;
+  }
+  rbox_metadata_key rbox_key = static_cast<librmb::rbox_metadata_key>(key[0]);
+
+  if (RadosUtils::is_date_attribute(rbox_key)) {
+    time_t query_date = 0;
+    if (!parse_date(value, &query_date)) {
+      std::cerr << "search criteria: " << key << " '" << value << "' is not a valid date (%Y-%m-%d %H:%M:%S)"
+                << std::endl;
+      return false;
+    }
+    type = PREDICATE_DATE;
+    std::function<bool(const int64_t &)> cmp = compile_compare<int64_t>(op, static_cast<int64_t>(query_date));
+    matcher = [cmp](const std::string &obj_value) {
+      int64_t obj_date = 0;
+      return parse_number(obj_value, &obj_date) && cmp(obj_date);
+    };
+  } else if (rbox_key == RBOX_METADATA_VIRTUAL_SIZE || rbox_key == RBOX_METADATA_PHYSICAL_SIZE ||
+             rbox_key == RBOX_METADATA_MAIL_UID) {
+    int64_t ref = 0;
+    if (!parse_number(value, &ref)) {
+      std::cerr << "search criteria: " << key << " '" << value << "' is not a number" << std::endl;
+      return false;
+    }
+    type = PREDICATE_NUMERIC;
+    std::function<bool(const int64_t &)> cmp = compile_compare<int64_t>(op, ref);
+    matcher = [cmp](const std::string &obj_value) {
+      int64_t val = 0;
+      return parse_number(obj_value, &val) && cmp(val);
+    };
+  } else {
+    type = PREDICATE_STRING;
+    matcher = compile_compare<std::string>(op, value);
+  }
+  return true;
+}
+
 Predicate *CmdLineParser::create_predicate(const std::string &_ls_value) {
   Predicate *p = new Predicate();
 
@@ -29,16 +119,45 @@ Predicate *CmdLineParser::create_predicate(const std::string &_ls_value) {
   pos = (pos == std::string::npos) ? _ls_value.find(">") : pos;
   pos = (pos == std::string::npos) ? _ls_value.find("<") : pos;
 
-  p->key = _ls_value.substr(0, pos);
-  p->op = _ls_value[pos];
-  p->value = _ls_value.substr(pos + 1, _ls_value.length());
-  p->valid = true;
+  if (pos == std::string::npos) {
+    // e.g. "-" (all)
+    p->key = _ls_value;
+  } else {
+    p->key = _ls_value.substr(0, pos);
+    p->op = _ls_value[pos];
+    p->value = _ls_value.substr(pos + 1, _ls_value.length());
+  }
+  p->valid = p->compile();
 
   this->keys += p->key + " ";
   // std::cout << " predicate: key " << p->key << " op " << p->op << " value " << p->value << std::endl;
   return p;
 }
 
+bool CmdLineParser::matches(RadosMail *mail) {
+  for (std::map<std::string, Predicate *>::iterator it = predicates.begin(); it != predicates.end(); ++it) {
+    if (it->first.compare("-") == 0) {
+      continue;
+    }
+    const char *value = mail->get_metadata(static_cast<rbox_metadata_key>(it->first[0]));
+    if (value == NULL || !it->second->eval(value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Predicate *CmdLineParser::get_filter_predicate() {
+  for (std::map<std::string, Predicate *>::iterator it = predicates.begin(); it != predicates.end(); ++it) {
+    // date and numeric values are stored in a different representation than the query value (e.g. epoch
+    // seconds), the osd filter compares raw strings, so only string predicates can be pushed down.
+    if (it->second->is_equality() && it->second->get_type() == Predicate::PREDICATE_STRING) {
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
 void CmdLineParser::set_output_dir(const std::string& out) {
   if (out.length() > 0 && out.at(0) == '~') {
     // Convert tilde to $HOME path (if exists)
@@ -61,6 +180,18 @@ void CmdLineParser::set_output_dir(const std::string& out) {
   }
 }
 
+bool CmdLineParser::add_predicate(Predicate *p) {
+  if (!p->valid) {
+    delete p;
+    return false;
+  }
+  if (predicates.find(p->key) != predicates.end()) {
+    delete predicates[p->key];
+  }
+  predicates[p->key] = p;
+  return true;
+}
+
 bool CmdLineParser::parse_ls_string() {
   std::string pred_sep = ";";
 
@@ -68,10 +199,7 @@ bool CmdLineParser::parse_ls_string() {
   if (pos == std::string::npos) {
     // single condition.
     Predicate *p = create_predicate(ls_value);
-    if (p->valid) {
-      predicates[p->key] = p;
-    }
-    return p->valid;
+    return add_predicate(p);
 
   } else {
     int offset = 0;
@@ -79,20 +207,15 @@ bool CmdLineParser::parse_ls_string() {
     while (pos != std::string::npos) {
       tmp = tmp.substr(0, pos);
 
-      Predicate *p = create_predicate(tmp);
-      if (p->valid) {
-        predicates[p->key] = p;
+      if (!add_predicate(create_predicate(tmp))) {
+        return false;
       }
 
       tmp = ls_value.substr(offset + pos + 1, ls_value.length());
       offset += pos + 1;
       pos = tmp.find(pred_sep);
     }
-    Predicate *p = create_predicate(tmp);
-    if (p->valid) {
-      predicates[p->key] = p;
-    }
-    return p->valid;
+    return add_predicate(create_predicate(tmp));
   }
 }
 }  // namespace librmb
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <ctime>
 #include <map>
+#include <functional>
 
 #include "../../rados-mail.h"
 #include "rados-util.h"
@@ -27,77 +28,54 @@
 
 namespace librmb {
 
+/**
+ * Predicate
+ *
+ * one condition of a rmb ls query (key op value). The reference value and the
+ * operator are compiled once (see compile()) into a typed matcher (numeric, date or
+ * string), so that eval only has to convert the object value.
+ */
 class Predicate {
  public:
+  enum predicate_type { PREDICATE_STRING = 0, PREDICATE_NUMERIC = 1, PREDICATE_DATE = 2 };
+
+  Predicate() : valid(false), type(PREDICATE_STRING) {}
+
   std::string key;
   std::string op;
   std::string value;  // value to check against e.g. key > value
   bool valid;
 
+  /*!
+   * parse the reference value and the operator and create the typed matcher.
+   * @return false if the reference value can not be converted to the key type.
+   */
+  bool compile();
+
   bool eval(const std::string &_p_value) {
-    rbox_metadata_key rbox_key = static_cast<librmb::rbox_metadata_key>(*key.c_str());
-
-    if (rbox_key == RBOX_METADATA_RECEIVED_TIME || rbox_key == RBOX_METADATA_OLDV1_SAVE_TIME) {
-      // ref value
-      time_t query_date = 0;
-      convert_str_to_time_t(this->value, &query_date);
-
-      uint64_t val2 = -1;
-      try {
-        val2 = std::stol(_p_value);
-      } catch (std::exception &e) {
-        std::cerr << "eval: search criteria: RBOX_METADATA_RECEIVED_TIME or RBOX_METADATA_OLDV1_SAVE_TIME '" << _p_value
-                  << "' is not a number " << std::endl;
-      }
-      time_t obj_date = static_cast<time_t>(val2);
-
-      double diff = difftime(obj_date, query_date);
-      // std::cout << " comparing : " << query_date << " " << obj_date << std::endl;
-      if (this->op.compare("=") == 0) {
-        return diff == 0;
-      } else if (this->op.compare(">") == 0) {
-        return diff > 0;
-      } else {
-        return diff < 0;
-      }
-      // time
-      return true;
-    } else if (rbox_key == RBOX_METADATA_VIRTUAL_SIZE || rbox_key == RBOX_METADATA_PHYSICAL_SIZE ||
-               rbox_key == RBOX_METADATA_MAIL_UID) {
-      uint64_t val = -1;
-      uint64_t val2 = -1;
-      try {
-        val = std::stol(_p_value);
-        val2 = std::stol(this->value);
-      } catch (std::exception &e) {
-        std::cerr << "eval: search criteria: RBOX_METADATA_VIRTUAL_SIZE or RBOX_METADATA_PHYSICAL_SIZE or "
-                     "RBOX_METADATA_MAIL_UID: _p_value "
-                  << _p_value << " or " << this->value << " is not a number" << std::endl;
-      }
-
-      if (this->op.compare("=") == 0) {
-        // numeric
-        return val == val2;
-      } else if (this->op.compare(">") == 0) {
-        return val > val2;
-      } else {
-        return val < val2;
-      }
-
-    } else {
-      // string
-      // std::cout << " comparing : " << this->value << " with " << _p_value << std::endl;
-      return this->value.compare(_p_value) == 0;
+    if (!matcher && !compile()) {
+      return false;
     }
-    return false;
+    return matcher(_p_value);
   }
 
+  /*!
+   * @return true if the predicate is an equality on a single xattribute. Only string
+   *         equalities can be evaluated by the osd (see PLAIN_FILTER_NAME)
+   */
+  bool is_equality() const { return valid && op.compare("=") == 0 && key.compare("-") != 0; }
+  predicate_type get_type() const { return type; }
+
   bool convert_str_to_time_t(const std::string &date, time_t *val) {
     return librmb::RadosUtils::convert_str_to_time_t(date, val);
   }
   int convert_time_t_to_str(const time_t &t, std::string *ret_val) {
     return librmb::RadosUtils::convert_time_t_to_str(t, ret_val);
   }
+
+ private:
+  predicate_type type;
+  std::function<bool(const std::string &)> matcher;
 };
 
 class CmdLineParser {
@@ -116,11 +94,21 @@ class CmdLineParser {
   bool contains_key(const std::string &key) { return keys.find(key) != keys.npos ? true : false; }
   Predicate *get_predicate(const std::string &key) { return predicates[key]; }
   Predicate *create_predicate(const std::string &ls_value);
+  /*!
+   * @return true if all predicates match the metadata of the given mail
+   */
+  bool matches(RadosMail *mail);
+  /*!
+   * @return the first string equality predicate, which can be pushed down to the osd, or nullptr
+   */
+  Predicate *get_filter_predicate();
 
   void set_output_dir(const std::string &out);
   std::string &get_output_dir() { return this->out_dir; }
 
  private:
+  bool add_predicate(Predicate *p);
+
   std::map<std::string, Predicate *> predicates;
   std::string ls_value;
   std::string keys;
@@ -16,6 +16,7 @@
 #include <iostream>
 #include "mailbox_tools.h"
 #include "rados-util.h"
+#include "rados-compression.h"
 
 namespace librmb {
 
@@ -81,6 +82,11 @@ int MailboxTools::save_mail(librmb::RadosMail* mail_obj) {
     return -1;
   }
 
+  // mails compressed by librmb are exported uncompressed
+  if (librmb::RadosCompression::decompress(mail_obj) < 0) {
+    std::cerr << " unable to decompress mail " << *mail_obj->get_oid() << std::endl;
+    return -1;
+  }
   std::string file_path = mailbox_path + "/" + filename;
   std::cout << " writing mail to " << file_path << std::endl;
   std::ofstream myfile(file_path, std::ofstream::binary | std::ofstream::out);
@@ -98,8 +104,10 @@ int MailboxTools::build_filename(librmb::RadosMail* mail_obj, std::string* filen
   }
 
   std::stringstream ss;
-  char* m_mail_uid;
-  RadosUtils::get_metadata(librmb::RBOX_METADATA_MAIL_UID, mail_obj->get_metadata(), &m_mail_uid);
+  const char* m_mail_uid = mail_obj->get_metadata(librmb::RBOX_METADATA_MAIL_UID);
+  if (m_mail_uid == NULL) {
+    return -1;
+  }
   ss << m_mail_uid << ".";
   ss << *mail_obj->get_oid();
   *filename = ss.str();
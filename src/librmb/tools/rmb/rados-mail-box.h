@@ -42,23 +42,8 @@ class RadosMailBox {
       mails.push_back(mail);
       return;
     }
-    if (parser->get_predicates().size() == 0) {
+    if (parser->matches(mail)) {
       mails.push_back(mail);
-      return;
-    }
-    for (std::map<std::string, Predicate *>::iterator it = parser->get_predicates().begin();
-         it != parser->get_predicates().end(); ++it) {
-      if (mail->get_metadata()->find(it->first) != mail->get_metadata()->end()) {
-        std::string key = it->first;
-        char *value;
-        RadosUtils::get_metadata(key, mail->get_metadata(), &value);
-        if (it->second->eval(value)) {
-          mails.push_back(mail);
-        }
-        return;
-      } else if (it->first.compare("-") == 0) {
-        mails.push_back(mail);
-      }
     }
   }
 
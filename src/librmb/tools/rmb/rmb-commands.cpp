@@ -11,8 +11,16 @@
 
 #include "rmb-commands.h"
 #include <time.h>
+#include <limits.h>
+#include <unistd.h>
 #include <algorithm>  // std::sort
+#include <chrono>
 #include <cstdio>
+#include <fstream>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "../../rados-cluster-impl.h"
 #include "../../rados-storage-impl.h"
@@ -21,7 +29,12 @@
 #include "rados-dovecot-ceph-cfg-impl.h"
 #include "rados-namespace-manager.h"
 #include "rados-metadata-storage-ima.h"
+#include "rados-metadata-storage-binary.h"
 #include "rados-metadata-storage-default.h"
+#include "rados-metadata-storage-pool.h"
+#include "rados-dedup.h"
+#include "rados-striping.h"
+#include "rados-mail-pack.h"
 #include "ls_cmd_parser.h"
 
 namespace librmb {
@@ -31,39 +44,368 @@ RmbCommands::RmbCommands(librmb::RadosStorage *storage_, librmb::RadosCluster *c
   this->storage = storage_;
   this->cluster = cluster_;
   this->opts = opts_;
+  this->metadata_cfg = nullptr;
   if (this->opts != nullptr) {
     is_debug = ((*opts).find("debug") != (*opts).end()) ? true : false;
   }
 }
-RmbCommands::~RmbCommands() {}
+RmbCommands::~RmbCommands() { delete metadata_cfg; }
 
 void RmbCommands::print_debug(const std::string &msg) {
   if (this->is_debug) {
     std::cout << msg << std::endl;
   }
 }
+/* a damaged binary entry is skipped, the number of skipped bytes is reported */
+static void read_save_log_entry(std::istream &read, bool binary, librmb::RadosSaveLogEntry *entry) {
+  if (!binary) {
+    read >> *entry;
+    return;
+  }
+  if (read.peek() == std::char_traits<char>::eof()) {
+    return;
+  }
+  std::streampos start = read.tellg();
+  if (librmb::RadosSaveLogEntry::read_binary(read, entry)) {
+    return;
+  }
+  uint64_t skipped = 0;
+  bool found = librmb::RadosSaveLogEntry::skip_damaged_binary(read, start, entry, &skipped);
+  std::cerr << "skipped " << skipped << " bytes of a damaged entry at offset " << start
+            << (found ? "" : " (end of log)") << std::endl;
+}
+
+int RmbCommands::print_save_log(const std::string &save_log) {
+  std::ifstream read(save_log, std::ifstream::in | std::ifstream::binary);
+  if (!read.is_open()) {
+    std::cerr << " path to log file not valid " << std::endl;
+    return -1;
+  }
+  bool binary = librmb::RadosSaveLogEntry::is_binary(read);
+  int count = 0;
+  while (true) {
+    librmb::RadosSaveLogEntry entry;
+    read_save_log_entry(read, binary, &entry);
+    if (read.eof()) {
+      break;
+    }
+    if (read.fail()) {
+      std::cerr << "Objectentry at line '" << (count + 1) << "' is not valid" << std::endl;
+      return -1;
+    }
+    std::cout << entry;
+    count++;
+  }
+  return count;
+}
+
+const char *RmbCommands::REPLAY_JOURNAL_SUFFIX = ".replay";
+
+/*!
+ * aio operation of a save log replay, a move to another namespace needs a second operation
+ * (remove the source object) after the copy succeeded.
+ */
+struct ReplayOp {
+  librmb::RadosSaveLogEntry *entry = nullptr;
+  bool remove_source = false;
+  // save, cpy: the immutable metadata is read before the remove, the references of the mail are released after it
+  bool read_metadata = false;
+  librmb::RadosMail mail;
+  std::map<std::string, ceph::bufferlist> xattrs;
+  int xattrs_ret = 0;
+  librados::ObjectReadOperation read_op;
+  librados::ObjectWriteOperation write_op;
+  librados::AioCompletion *completion = nullptr;
+};
+
+struct ReplayState {
+  librmb::RadosStorage *storage = nullptr;
+  // metadata module and dedup pool of the current pool
+  librmb::RadosStorageMetadataModule *ms = nullptr;
+  librmb::RadosDedup *dedup = nullptr;
+  std::map<std::string, librados::IoCtx> io_ctxs;
+  std::list<ReplayOp *> in_flight;
+  // namespace/oid of the objects modified by the operations in flight
+  std::multiset<std::string> in_flight_objects;
+  std::ofstream journal;
+  std::map<std::string, std::list<librmb::RadosSaveLogEntry>> *moved_items = nullptr;
+  int replayed = 0;
+  int failed = 0;
+};
+
+static std::string replay_key(const librmb::RadosSaveLogEntry &entry) {
+  return entry.op + "," + entry.pool + "," + entry.ns + "," + entry.oid;
+}
+
+static bool is_move_entry(const librmb::RadosSaveLogEntry &entry) { return entry.op.compare(0, 3, "mv:") == 0; }
+
+static void replay_objects(const librmb::RadosSaveLogEntry &entry, std::vector<std::string> *objects) {
+  objects->push_back(entry.ns + "/" + entry.oid);
+  if (is_move_entry(entry)) {
+    objects->push_back(entry.src_ns + "/" + entry.src_oid);
+  }
+}
+
+static librados::IoCtx *replay_io_ctx(ReplayState *state, const std::string &ns) {
+  std::map<std::string, librados::IoCtx>::iterator it = state->io_ctxs.find(ns);
+  if (it != state->io_ctxs.end()) {
+    return &it->second;
+  }
+  librados::IoCtx &io_ctx = state->io_ctxs[ns];
+  io_ctx.dup(state->storage->get_io_ctx());
+  io_ctx.set_namespace(ns);
+  return &io_ctx;
+}
+
+static void release_replay_op(ReplayState *state, ReplayOp *op) {
+  std::vector<std::string> objects;
+  replay_objects(*op->entry, &objects);
+  for (std::vector<std::string>::iterator it = objects.begin(); it != objects.end(); ++it) {
+    state->in_flight_objects.erase(state->in_flight_objects.find(*it));
+  }
+  delete op;
+}
+
+static bool issue_replay_op(ReplayState *state, ReplayOp *op, librados::IoCtx *io_ctx, const std::string &oid) {
+  op->completion = librados::Rados::aio_create_completion();
+  int ret = op->read_metadata ? state->storage->aio_operate(io_ctx, oid, op->completion, &op->read_op, nullptr)
+                              : state->storage->aio_operate(io_ctx, oid, op->completion, &op->write_op);
+  if (ret < 0) {
+    std::cerr << " unable to replay save log entry for oid: " << op->entry->oid << " errorcode: " << ret
+              << std::endl;
+    op->completion->release();
+    ++state->failed;
+    release_replay_op(state, op);
+    return false;
+  }
+  state->in_flight.push_back(op);
+  return true;
+}
+
+/*!
+ * Remove the entry of a packed mail from its container. A compaction moves live mails to the current container
+ * of the mailbox, so the newer containers are checked as well. This is a rare case, it is done synchronously.
+ */
+static int replay_pack_entry(librados::IoCtx *io_ctx, const librmb::RadosSaveLogEntry &entry,
+                             const std::string &mailbox_guid, uint32_t container) {
+  std::vector<uint32_t> containers;
+  int ret = librmb::RadosMailPack::list_containers(*io_ctx, mailbox_guid, &containers);
+  if (ret < 0) {
+    return ret;
+  }
+  containers.push_back(container);
+  std::set<std::string> oids;
+  oids.insert(entry.oid);
+  for (std::vector<uint32_t>::iterator it = containers.begin(); it != containers.end(); ++it) {
+    if (*it < container) {
+      continue;
+    }
+    ret = librmb::RadosMailPack::remove(*io_ctx, mailbox_guid, *it, oids);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+/*!
+ * save, cpy => remove the object, pack => remove the entry from its pack container, mv => move the object back
+ * to its source (same as RadosStorage::move with delete_source)
+ */
+static void start_replay_op(ReplayState *state, librmb::RadosSaveLogEntry *entry) {
+  ReplayOp *op = new ReplayOp();
+  op->entry = entry;
+  std::vector<std::string> objects;
+  replay_objects(*entry, &objects);
+  state->in_flight_objects.insert(objects.begin(), objects.end());
+
+  librados::IoCtx *io_ctx = replay_io_ctx(state, entry->ns);
+  std::string mailbox_guid;
+  uint32_t container;
+  if (entry->parse_pack_op(&mailbox_guid, &container)) {
+    int ret = replay_pack_entry(io_ctx, *entry, mailbox_guid, container);
+    release_replay_op(state, op);
+    if (ret < 0) {
+      std::cerr << "Packed mail " << entry->oid << " not deleted: errorcode: " << ret << std::endl;
+      ++state->failed;
+      return;
+    }
+    ++state->replayed;
+    state->journal << replay_key(*entry) << std::endl;
+    return;
+  }
+  if (!is_move_entry(*entry)) {
+    op->mail.set_oid(entry->oid);
+    state->ms->set_io_ctx(io_ctx);
+    librados::IoCtx *metadata_io_ctx = state->ms->read_immutable_metadata(&op->read_op, &op->xattrs, &op->xattrs_ret);
+    if (metadata_io_ctx != nullptr) {
+      op->read_metadata = true;
+      issue_replay_op(state, op, metadata_io_ctx, entry->oid);
+      return;
+    }
+    state->ms->load_immutable_metadata(&op->mail);
+    op->write_op.remove();
+    issue_replay_op(state, op, io_ctx, entry->oid);
+    return;
+  }
+  librados::IoCtx *src_io_ctx = replay_io_ctx(state, entry->src_ns);
+  if (entry->ns.compare(entry->src_ns) != 0) {
+    op->write_op.copy_from(entry->oid, *io_ctx, 0);
+    op->remove_source = true;
+  } else if (entry->oid.compare(entry->src_oid) == 0) {
+    op->write_op.assert_exists();
+  } else {
+    // same namespace, other oid: the moved object has to exist (same as RadosStorage::move). This is a rare case,
+    // the stat is done synchronously.
+    uint64_t size;
+    time_t mtime;
+    int ret = io_ctx->stat(entry->oid, &size, &mtime);
+    if (ret < 0) {
+      std::cerr << "moving : " << entry->oid << " to " << entry->src_oid << " failed ! ret code: " << ret
+                << std::endl;
+      ++state->failed;
+      release_replay_op(state, op);
+      return;
+    }
+  }
+  time_t save_time = time(NULL);
+  op->write_op.mtime(&save_time);
+  for (std::list<RadosMetadata>::iterator it = entry->metadata.begin(); it != entry->metadata.end(); ++it) {
+    op->write_op.setxattr((*it).key.c_str(), (*it).bl);
+  }
+  issue_replay_op(state, op, src_io_ctx, entry->src_oid);
+}
+
+static void finish_replay_op(ReplayState *state, ReplayOp *op) {
+  op->completion->wait_for_complete();
+  int ret = op->completion->get_return_value();
+  op->completion->release();
+  op->completion = nullptr;
+  librmb::RadosSaveLogEntry *entry = op->entry;
+
+  if (op->read_metadata) {
+    // a missing object is reported by the remove
+    if (ret >= 0 && op->xattrs_ret >= 0) {
+      state->ms->decode_immutable_metadata(&op->mail, &op->xattrs);
+    }
+    op->read_metadata = false;
+    op->write_op.remove();
+    issue_replay_op(state, op, replay_io_ctx(state, entry->ns), entry->oid);
+    return;
+  }
+  if (op->remove_source && ret == 0) {
+    // copy succeeded, remove the source object
+    ReplayOp *remove = new ReplayOp();
+    remove->entry = entry;
+    remove->write_op.remove();
+    state->in_flight_objects.insert(op->entry->ns + "/" + op->entry->oid);
+    state->in_flight_objects.insert(op->entry->src_ns + "/" + op->entry->src_oid);
+    release_replay_op(state, op);
+    issue_replay_op(state, remove, replay_io_ctx(state, entry->ns), entry->oid);
+    return;
+  }
+  int ret_refs = 0;
+  if (!is_move_entry(*entry) && ret == 0) {
+    ret_refs = librmb::RadosUtils::release_mail_refs(*replay_io_ctx(state, entry->ns), &op->mail, state->dedup);
+  }
+  release_replay_op(state, op);
+
+  if (!is_move_entry(*entry)) {
+    if (ret < 0 && ret != -ENOENT) {
+      std::cerr << "Object " << entry->oid << " not deleted: errorcode: " << ret << std::endl;
+      ++state->failed;
+      return;
+    }
+    if (ret_refs < 0) {
+      std::cerr << "Object " << entry->oid << " deleted, releasing its references failed: errorcode: " << ret_refs
+                << std::endl;
+      ++state->failed;
+      return;
+    }
+    if (ret == 0) {
+      ++state->replayed;
+    }
+  } else {
+    if (ret < 0) {
+      std::cerr << "moving : " << entry->oid << " to " << entry->src_oid << " failed ! ret code: " << ret
+                << std::endl;
+      ++state->failed;
+      return;
+    }
+    (*state->moved_items)[entry->src_user].push_back(*entry);
+    ++state->replayed;
+  }
+  state->journal << replay_key(*entry) << std::endl;
+}
+
+static void drain_replay_ops(ReplayState *state, size_t max_in_flight) {
+  while (state->in_flight.size() > max_in_flight) {
+    ReplayOp *op = state->in_flight.front();
+    state->in_flight.pop_front();
+    finish_replay_op(state, op);
+  }
+}
+
+static void replay_pool(ReplayState *state, std::vector<librmb::RadosSaveLogEntry> *entries, unsigned int window) {
+  std::vector<std::string> objects;
+  for (std::vector<librmb::RadosSaveLogEntry>::iterator it = entries->begin(); it != entries->end(); ++it) {
+    objects.clear();
+    replay_objects(*it, &objects);
+    for (std::vector<std::string>::iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+      if (state->in_flight_objects.find(*obj) != state->in_flight_objects.end()) {
+        // keep the log order for operations on the same object
+        drain_replay_ops(state, 0);
+        break;
+      }
+    }
+    drain_replay_ops(state, window > 0 ? window - 1 : 0);
+    start_replay_op(state, &(*it));
+  }
+  drain_replay_ops(state, 0);
+  state->io_ctxs.clear();
+}
+
 int RmbCommands::delete_with_save_log(const std::string &save_log, const std::string &rados_cluster,
                                       const std::string &rados_user,
-                                      std::map<std::string, std::list<librmb::RadosSaveLogEntry>> *moved_items) {
+                                      std::map<std::string, std::list<librmb::RadosSaveLogEntry>> *moved_items,
+                                      unsigned int window, const std::string &dedup_pool,
+                                      const std::string &metadata_pool) {
   librmb::RadosClusterImpl cluster;
   librmb::RadosStorageImpl storage(&cluster);
-  int count = 0;
 
   if (moved_items == nullptr) {
     return -1;
   }
 
   /** check content **/
-  std::ifstream read(save_log);
+  std::ifstream read(save_log, std::ifstream::in | std::ifstream::binary);
   if (!read.is_open()) {
     std::cerr << " path to log file not valid " << std::endl;
     return -1;
   }
+
+  // entries which have been replayed by a previous (interrupted) run
+  std::string journal_file = save_log + REPLAY_JOURNAL_SUFFIX;
+  std::set<std::string> done;
+  std::ifstream journal_in(journal_file);
+  std::string line;
+  while (std::getline(journal_in, line)) {
+    done.insert(line);
+  }
+  journal_in.close();
+
+  // group the entries by pool, the order of the log is kept per pool.
+  std::vector<std::string> pools;
+  std::map<std::string, std::vector<librmb::RadosSaveLogEntry>> entries;
+  std::set<std::string> seen;
+  int duplicates = 0;
+  int skipped = 0;
+  bool binary = librmb::RadosSaveLogEntry::is_binary(read);
   int line_count = 0;
   while (true) {
     line_count++;
     librmb::RadosSaveLogEntry entry;
-    read >> entry;
+    read_save_log_entry(read, binary, &entry);
     if (read.eof()) {
       break;
     }
@@ -71,48 +413,78 @@ int RmbCommands::delete_with_save_log(const std::string &save_log, const std::st
       std::cout << "Objectentry at line '" << line_count << "' is not valid: " << std::endl;
       break;
     }
-
-    if (storage.get_pool_name().compare(entry.pool) != 0) {
-      // close connection before open a new one.
-      // TODO(jrse): worst case are alternating pool entries e.g. mail_storage ,
-      //       mail_storage_alt.... maybe we should group the entries by pool...
-      storage.close_connection();
-      int open_connection = storage.open_connection(entry.pool, rados_cluster, rados_user);
-      if (open_connection < 0) {
-        std::cerr << " error opening rados connection. Errorcode: " << open_connection << std::endl;
-        cluster.deinit();
-        return -1;
-      }
+    std::string key = replay_key(entry);
+    if (!seen.insert(key).second) {
+      ++duplicates;
+      continue;
     }
-    storage.set_namespace(entry.ns);
-    if (entry.op.compare("save") == 0 || entry.op.compare("cpy") == 0) {
-      int ret_delete = storage.delete_mail(entry.oid);
-      if (ret_delete < 0) {
-        std::cout << "Object " << entry.oid << " not deleted: errorcode: " << ret_delete << std::endl;
-      } else {
-        std::cout << "Object " << entry.oid << " successfully deleted" << std::endl;
-        count++;
-      }
-    } else {
-      int ret = storage.move(entry.oid, entry.ns.c_str(), entry.src_oid, entry.src_ns.c_str(), entry.metadata, true);
-      if (ret < 0) {
-        std::cerr << "moving : " << entry.oid << " to " << entry.src_oid << " failed ! ret code: " << ret << std::endl;
-      } else {
-        if (moved_items->find(entry.src_user) == moved_items->end()) {
-          std::list<librmb::RadosSaveLogEntry> entries;
-          entries.push_back(entry);
-          (*moved_items)[entry.src_user] = entries;
-        } else {
-          (*moved_items)[entry.src_user].push_back(entry);
-        }
-      }
-      count++;
+    if (done.find(key) != done.end()) {
+      ++skipped;
+      continue;
+    }
+    if (entries.find(entry.pool) == entries.end()) {
+      pools.push_back(entry.pool);
     }
+    entries[entry.pool].push_back(entry);
   }
   read.close();
+
+  ReplayState state;
+  state.storage = &storage;
+  state.moved_items = moved_items;
+  state.journal.open(journal_file, std::ofstream::out | std::ofstream::app);
+  if (!state.journal.is_open()) {
+    std::cerr << " unable to open replay journal " << journal_file << ", the replay is not resumable" << std::endl;
+  }
+  for (std::vector<std::string>::iterator it = pools.begin(); it != pools.end(); ++it) {
+    // close connection before open a new one.
+    storage.close_connection();
+    int open_connection = storage.open_connection(*it, rados_cluster, rados_user);
+    if (open_connection < 0) {
+      std::cerr << " error opening rados connection. Errorcode: " << open_connection << std::endl;
+      cluster.deinit();
+      return -1;
+    }
+    // the metadata module of the pool decodes the references of the removed mails
+    librmb::RadosCephConfig ceph_cfg(&storage.get_io_ctx());
+    ceph_cfg.load_cfg();
+    librmb::RadosConfig dovecot_cfg;
+    dovecot_cfg.set_metadata_pool(metadata_pool);
+    librmb::RadosDovecotCephCfgImpl cfg(dovecot_cfg, ceph_cfg);
+    librmb::RadosStorageMetadataModule *ms = create_metadata_storage_module(&cluster, &storage.get_io_ctx(), &cfg);
+    if (ms == nullptr) {
+      std::cerr << " unable to open metadata pool " << metadata_pool << ", entries of pool " << *it
+                << " are not replayed" << std::endl;
+      state.failed += static_cast<int>(entries[*it].size());
+      continue;
+    }
+    librmb::RadosDedup dedup;
+    std::string pool_dedup = dedup_pool.empty() ? *it : dedup_pool;
+    if (dedup.open(&cluster, pool_dedup) < 0) {
+      std::cerr << " unable to open dedup pool " << pool_dedup << std::endl;
+    }
+    state.ms = ms;
+    state.dedup = &dedup;
+    replay_pool(&state, &entries[*it], window);
+    state.ms = nullptr;
+    state.dedup = nullptr;
+    dedup.close();
+    delete ms;
+  }
+  state.journal.close();
   storage.close_connection();
   cluster.deinit();
-  return count;
+
+  std::cout << "replayed entries: " << state.replayed << ", failed: " << state.failed
+            << ", duplicates: " << duplicates << ", already replayed: " << skipped << std::endl;
+  if (state.failed == 0) {
+    // replay complete
+    std::remove(journal_file.c_str());
+  } else {
+    std::cout << "failed entries are retried if the replay is restarted (journal: " << journal_file << ")"
+              << std::endl;
+  }
+  return state.replayed;
 }
 
 int RmbCommands::lspools() {
@@ -134,37 +506,300 @@ int RmbCommands::lspools() {
   return 0;
 }
 
-int RmbCommands::delete_namespace(librmb::RadosStorageMetadataModule *ms, std::list<librmb::RadosMail *> &mail_objects,
-                                  librmb::RadosCephConfig *cfg, bool confirmed) {
-  if (ms == nullptr || cfg == nullptr) {
+unsigned int RmbCommands::get_uint_option(std::map<std::string, std::string> *opts, const std::string &key,
+                                          unsigned int default_value) {
+  if (opts == nullptr || opts->find(key) == opts->end()) {
+    return default_value;
+  }
+  try {
+    int value = std::stoi((*opts)[key]);
+    return value > 0 ? static_cast<unsigned int>(value) : default_value;
+  } catch (std::exception &e) {
+    std::cerr << " invalid value for " << key << ": " << (*opts)[key] << std::endl;
+    return default_value;
+  }
+}
+
+const unsigned int RmbCommands::DELETE_PROGRESS_INTERVAL = 5;
+
+/**
+ * aggregated progress of all delete threads.
+ */
+struct DeleteProgress {
+  std::mutex lock;
+  uint64_t deleted = 0;
+  uint64_t failed = 0;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+};
+
+/**
+ * One outstanding remove operation. The immutable metadata is read first (if there is a metadata module),
+ * the dedup reference and the stripes of the mail are only known from it.
+ */
+struct AioRemove {
+  enum { READ_METADATA, REMOVE_MAIL } stage = REMOVE_MAIL;
+  std::string oid;
+  librmb::RadosMail mail;
+  std::map<std::string, ceph::bufferlist> xattrs;
+  int xattrs_ret = 0;
+  librados::ObjectReadOperation read_op;
+  librados::ObjectWriteOperation write_op;
+  librados::AioCompletion *completion = nullptr;
+};
+
+int RmbCommands::open_dedup(librmb::RadosDedup *dedup) {
+  std::string dedup_pool = opts->find("dedup_pool") != opts->end() ? (*opts)["dedup_pool"] : storage->get_pool_name();
+  int ret = dedup->open(cluster, dedup_pool);
+  if (ret < 0) {
+    std::cerr << " unable to open dedup pool " << dedup_pool << ", errorcode: " << ret << std::endl;
+  }
+  return ret;
+}
+
+int RmbCommands::delete_namespace(librmb::RadosCephConfig *cfg, bool confirmed,
+                                  librmb::RadosStorageMetadataModule *ms) {
+  if (cfg == nullptr || storage == nullptr) {
+    return -1;
+  }
+  if (!confirmed) {
+    std::cout << "WARNING: Deleting a namespace will remove all mail "
+                 "objects from ceph, but not from dovecot index, this "
+                 "may lead to corrupt mailbox\n"
+              << " add --yes-i-really-really-mean-it to confirm the delete " << std::endl;
+    return 0;
+  }
+  print_debug("entry: delete_namespace");
+  unsigned int threads = get_uint_option(opts, "threads", DEFAULT_SCAN_THREADS);
+  unsigned int window = get_uint_option(opts, "max_concurrent_ios", DEFAULT_SCAN_WINDOW);
+  // objects per second, shared by all threads (0 = unlimited)
+  unsigned int rate = get_uint_option(opts, "rate", 0);
+  double thread_rate = rate > 0 ? std::max(1.0, static_cast<double>(rate) / threads) : 0;
+
+  std::cout << " deleting mail objects : " << storage->get_pool_name() << " ns: " << storage->get_namespace()
+            << std::endl;
+  std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> slices;
+  int ret = storage->split_mail_listing(threads, &slices);
+  if (ret < 0) {
+    std::cerr << " unable to split object listing, errorcode: " << ret << std::endl;
+    print_debug("end: delete_namespace");
+    return ret;
+  }
+
+  librmb::RadosDedup dedup;
+  if (ms != nullptr) {
+    // a deduplicated mail which cannot release its reference is counted as failed
+    open_dedup(&dedup);
+  }
+
+  DeleteProgress progress;
+  std::vector<int> results(slices.size(), 0);
+  std::vector<std::thread> deleters;
+  for (size_t i = 0; i < slices.size(); ++i) {
+    deleters.push_back(std::thread([this, ms, &dedup, &slices, &results, i, window, thread_rate, &progress]() {
+      results[i] = delete_slice(ms, &dedup, slices[i], window, thread_rate, &progress);
+    }));
+  }
+  for (std::vector<std::thread>::iterator it = deleters.begin(); it != deleters.end(); ++it) {
+    it->join();
+  }
+  dedup.close();
+  print_delete_progress(&progress, true);
+
+  for (std::vector<int>::iterator it = results.begin(); it != results.end(); ++it) {
+    if (*it < 0) {
+      // the objects which are already deleted are not listed again, so a rerun continues here.
+      std::cerr << " listing objects failed, errorcode: " << *it << ", please restart the delete" << std::endl;
+      print_debug("end: delete_namespace");
+      return *it;
+    }
+  }
+  if (progress.failed > 0) {
+    print_debug("end: delete_namespace");
     return -1;
   }
 
-  librmb::CmdLineParser parser("-");
-  if (parser.parse_ls_string()) {
-    std::string sort_type = "uid";
-    int ret = load_objects(ms, mail_objects, sort_type);
-    if (ret < 0 || mail_objects.size() == 0) {
+  if (cfg->is_user_mapping()) {
+    // delete namespace object also.
+    std::cout << "user mapping active " << std::endl;
+    std::string indirect_ns = (*opts)["namespace"] + cfg->get_user_suffix();
+    (*opts)["to_delete"] = indirect_ns;
+    storage->set_namespace("users");
+    delete_mail(confirmed);
+  }
+  print_debug("end: delete_namespace");
+  return 0;
+}
+
+void RmbCommands::print_delete_progress(DeleteProgress *progress, bool finished) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (!finished && now - progress->last_report < std::chrono::seconds(DELETE_PROGRESS_INTERVAL)) {
+    return;
+  }
+  progress->last_report = now;
+  double seconds = std::chrono::duration<double>(now - progress->begin).count();
+  std::cout << (finished ? " finished: " : " progress: ") << "deleted objects: " << progress->deleted
+            << ", failed: " << progress->failed << ", time: " << seconds << "s";
+  if (seconds > 0) {
+    std::cout << ", " << static_cast<uint64_t>(progress->deleted / seconds) << " objects/s";
+  }
+  std::cout << std::endl;
+}
+
+/* @return linux error code or 0 if successful (remove is freed on error) */
+int RmbCommands::start_remove_op(AioRemove *remove) {
+  remove->stage = AioRemove::REMOVE_MAIL;
+  remove->write_op.remove();
+  remove->completion = librados::Rados::aio_create_completion();
+  int ret = storage->aio_operate(nullptr, remove->oid, remove->completion, &remove->write_op);
+  if (ret < 0) {
+    std::cerr << " unable to delete mail object with oid: " << remove->oid << " errorcode: " << ret << std::endl;
+    remove->completion->release();
+    delete remove;
+  }
+  return ret;
+}
+
+/* @return the pending operation or nullptr on error */
+AioRemove *RmbCommands::start_delete_op(librmb::RadosStorageMetadataModule *ms, const std::string &oid) {
+  AioRemove *remove = new AioRemove();
+  remove->oid = oid;
+  remove->mail.set_oid(oid);
+  if (ms != nullptr) {
+    librados::IoCtx *metadata_io_ctx =
+        ms->read_immutable_metadata(&remove->read_op, &remove->xattrs, &remove->xattrs_ret);
+    if (metadata_io_ctx == nullptr) {
+      ms->load_immutable_metadata(&remove->mail);
+    } else {
+      remove->stage = AioRemove::READ_METADATA;
+      remove->completion = librados::Rados::aio_create_completion();
+      int ret = storage->aio_operate(metadata_io_ctx, oid, remove->completion, &remove->read_op, nullptr);
+      if (ret < 0) {
+        std::cerr << " unable to read mail object with oid: " << oid << " errorcode: " << ret << std::endl;
+        remove->completion->release();
+        delete remove;
+        return nullptr;
+      }
+      return remove;
+    }
+  }
+  return start_remove_op(remove) < 0 ? nullptr : remove;
+}
+
+/* wait for the current operation of remove and issue the next one.
+   @return 1 if the remove is pending (in_flight), 0 if the object has been deleted, < 0 on error */
+int RmbCommands::finish_delete_op(librmb::RadosStorageMetadataModule *ms, librmb::RadosDedup *dedup,
+                                  AioRemove *remove, std::list<AioRemove *> *in_flight) {
+  remove->completion->wait_for_complete();
+  int ret = remove->completion->get_return_value();
+  remove->completion->release();
+
+  if (remove->stage == AioRemove::READ_METADATA) {
+    if (ret == -ENOENT) {
+      // deleted in the meantime.
+      delete remove;
+      return 0;
+    }
+    if (ret >= 0 && remove->xattrs_ret >= 0) {
+      ms->decode_immutable_metadata(&remove->mail, &remove->xattrs);
+    } else {
+      std::cerr << " unable to read metadata of mail object with oid: " << remove->oid << " errorcode: " << ret
+                << ", its references are not released" << std::endl;
+    }
+    ret = start_remove_op(remove);
+    if (ret < 0) {
       return ret;
     }
+    in_flight->push_back(remove);
+    return 1;
+  }
 
-    for (std::list<librmb::RadosMail *>::iterator it_mail = mail_objects.begin(); it_mail != mail_objects.end();
-         ++it_mail) {
-      (*opts)["to_delete"] = *(*it_mail)->get_oid();
-      delete_mail(confirmed);
+  if (ret == -ENOENT) {
+    // deleted in the meantime.
+    ret = 0;
+  } else if (ret < 0) {
+    std::cerr << " unable to delete mail object with oid: " << remove->oid << " errorcode: " << ret << std::endl;
+  } else {
+    ret = librmb::RadosUtils::release_mail_refs(storage->get_io_ctx(), &remove->mail, dedup);
+    if (ret < 0) {
+      std::cerr << " unable to release the references of mail object with oid: " << remove->oid
+                << " errorcode: " << ret << std::endl;
     }
-    if (cfg->is_user_mapping()) {
-      // delete namespace object also.
-      std::cout << "user mapping active " << std::endl;
-      std::string indirect_ns = (*opts)["namespace"] + cfg->get_user_suffix();
-      (*opts)["to_delete"] = indirect_ns;
-      storage->set_namespace("users");
-      delete_mail(confirmed);
+  }
+  delete remove;
+  return ret;
+}
+
+int RmbCommands::delete_slice(librmb::RadosStorageMetadataModule *ms, librmb::RadosDedup *dedup,
+                              const std::pair<librados::ObjectCursor, librados::ObjectCursor> &slice,
+                              unsigned int window, double rate, DeleteProgress *progress) {
+  librados::ObjectCursor cursor = slice.first;
+  std::list<AioRemove *> in_flight;
+  std::vector<std::string> oids;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  uint64_t issued = 0;
+  uint64_t deleted = 0;
+  uint64_t failed = 0;
+  bool more = true;
+  int ret = 0;
+
+  while (more) {
+    oids.clear();
+    ret = storage->list_mails(&cursor, slice.second, SCAN_LIST_CHUNK, nullptr, &oids, &more);
+    if (ret < 0) {
+      break;
     }
+    for (std::vector<std::string>::iterator it = oids.begin(); it != oids.end(); ++it) {
+      if (rate > 0) {
+        // rate limit: issue the n-th remove not before begin + n / rate.
+        std::this_thread::sleep_until(begin + std::chrono::microseconds(static_cast<int64_t>(issued * 1e6 / rate)));
+      }
+      // the remove following a metadata read takes the slot of the read
+      while (!in_flight.empty() && in_flight.size() >= window) {
+        AioRemove *remove = in_flight.front();
+        in_flight.pop_front();
+        int ret_remove = finish_delete_op(ms, dedup, remove, &in_flight);
+        if (ret_remove < 0) {
+          ++failed;
+        } else if (ret_remove == 0) {
+          ++deleted;
+        }
+      }
+      ++issued;
+      AioRemove *remove = start_delete_op(ms, *it);
+      if (remove == nullptr) {
+        ++failed;
+        continue;
+      }
+      in_flight.push_back(remove);
+    }
+    {
+      std::lock_guard<std::mutex> guard(progress->lock);
+      progress->deleted += deleted;
+      progress->failed += failed;
+      print_delete_progress(progress, false);
+    }
+    deleted = 0;
+    failed = 0;
   }
-  return 0;
+
+  while (!in_flight.empty()) {
+    AioRemove *remove = in_flight.front();
+    in_flight.pop_front();
+    int ret_remove = finish_delete_op(ms, dedup, remove, &in_flight);
+    if (ret_remove < 0) {
+      ++failed;
+    } else if (ret_remove == 0) {
+      ++deleted;
+    }
+  }
+  std::lock_guard<std::mutex> guard(progress->lock);
+  progress->deleted += deleted;
+  progress->failed += failed;
+  return ret;
 }
-int RmbCommands::delete_mail(bool confirmed) {
+
+int RmbCommands::delete_mail(bool confirmed, librmb::RadosStorageMetadataModule *ms) {
   int ret = -1;
   print_debug("entry: delete_mail");
   if (!confirmed) {
@@ -174,11 +809,26 @@ int RmbCommands::delete_mail(bool confirmed) {
               << " add --yes-i-really-really-mean-it to confirm the delete " << std::endl;
   } else {
     std::cout << " deleting mail : " << storage->get_pool_name() << " ns: " << storage->get_namespace() << std::endl;
+    librmb::RadosMail mail;
+    mail.set_oid((*opts)["to_delete"]);
+    if (ms != nullptr) {
+      ms->load_immutable_metadata(&mail);
+    }
     ret = storage->delete_mail((*opts)["to_delete"]);
     if (ret < 0) {
       std::cout << "unable to delete e-mail object with oid: " << (*opts)["to_delete"] << std::endl;
     } else {
       std::cout << "Success: email object with oid: " << (*opts)["to_delete"] << " deleted" << std::endl;
+      librmb::RadosDedup dedup;
+      if (mail.get_metadata(librmb::RBOX_METADATA_EXT_REF) != NULL) {
+        open_dedup(&dedup);
+      }
+      ret = librmb::RadosUtils::release_mail_refs(storage->get_io_ctx(), &mail, &dedup);
+      if (ret < 0) {
+        std::cout << "unable to release the references of e-mail object with oid: " << (*opts)["to_delete"]
+                  << " errorcode: " << ret << std::endl;
+      }
+      dedup.close();
     }
   }
   print_debug("end: delete_mail");
@@ -311,69 +961,35 @@ int RmbCommands::configuration(bool confirmed, librmb::RadosCephConfig &ceph_cfg
   return 0;
 }
 
-bool RmbCommands::sort_uid(librmb::RadosMail *i, librmb::RadosMail *j) {
-  std::string::size_type sz;  // alias of size_t
-  char *t;
+static bool get_numeric_metadata(librmb::rbox_metadata_key key, librmb::RadosMail *mail, int64_t *val) {
+  return mail->get_metadata(key, val);
+}
+
+/* mails without a (numeric) value are sorted to the front */
+static bool sort_numeric_metadata(librmb::rbox_metadata_key key, librmb::RadosMail *i, librmb::RadosMail *j) {
   if (i == nullptr || j == nullptr) {
     return false;
   }
-  RadosUtils::get_metadata(librmb::RBOX_METADATA_MAIL_UID, i->get_metadata(), &t);
-  try {
-    uint64_t i_uid = std::stol(t, &sz);
-    char *m_mail_uid;
-    RadosUtils::get_metadata(librmb::RBOX_METADATA_MAIL_UID, i->get_metadata(), &m_mail_uid);
-    uint64_t j_uid = std::stol(m_mail_uid, &sz);
-
-    return i_uid < j_uid;
-  } catch (std::exception &e) {
-    char *uid;
-    RadosUtils::get_metadata(librmb::RBOX_METADATA_MAIL_UID, i->get_metadata(), &uid);
-    std::cerr << " sort_uid: " << t << "(" << *i->get_oid() << ") or " << uid << " (" << j->get_oid()
-              << ") is not a number" << std::endl;
-    return false;
+  int64_t i_val = 0;
+  int64_t j_val = 0;
+  bool i_valid = get_numeric_metadata(key, i, &i_val);
+  bool j_valid = get_numeric_metadata(key, j, &j_val);
+  if (!i_valid || !j_valid) {
+    return !i_valid && j_valid;
   }
+  return i_val < j_val;
+}
+
+bool RmbCommands::sort_uid(librmb::RadosMail *i, librmb::RadosMail *j) {
+  return sort_numeric_metadata(librmb::RBOX_METADATA_MAIL_UID, i, j);
 }
 
 bool RmbCommands::sort_recv_date(librmb::RadosMail *i, librmb::RadosMail *j) {
-  std::string::size_type sz;  // alias of size_t
-  char *t;
-  if (i == nullptr || j == nullptr) {
-    return false;
-  }
-  RadosUtils::get_metadata(librmb::RBOX_METADATA_RECEIVED_TIME, i->get_metadata(), &t);
-  try {
-    int64_t i_uid = std::stol(t, &sz);
-    char *m_time;
-    RadosUtils::get_metadata(librmb::RBOX_METADATA_RECEIVED_TIME, i->get_metadata(), &m_time);
-    int64_t j_uid = std::stol(m_time, &sz);
-    return i_uid < j_uid;
-  } catch (std::exception &e) {
-    char *m_recv_time;
-    RadosUtils::get_metadata(librmb::RBOX_METADATA_RECEIVED_TIME, i->get_metadata(), &m_recv_time);
-    std::cerr << " sort_recv_date: " << t << " or " << m_recv_time << " is not a number" << std::endl;
-    return false;
-  }
+  return sort_numeric_metadata(librmb::RBOX_METADATA_RECEIVED_TIME, i, j);
 }
 
 bool RmbCommands::sort_phy_size(librmb::RadosMail *i, librmb::RadosMail *j) {
-  std::string::size_type sz;  // alias of size_t
-  char *t;
-  if (i == nullptr || j == nullptr) {
-    return false;
-  }
-  RadosUtils::get_metadata(librmb::RBOX_METADATA_PHYSICAL_SIZE, i->get_metadata(), &t);
-  try {
-    uint64_t i_uid = std::stol(t, &sz);
-    char *m_phy_size;
-    RadosUtils::get_metadata(librmb::RBOX_METADATA_PHYSICAL_SIZE, i->get_metadata(), &m_phy_size);
-    uint64_t j_uid = std::stol(m_phy_size, &sz);
-    return i_uid < j_uid;
-  } catch (std::exception &e) {
-    char *m_phy_size;
-    RadosUtils::get_metadata(librmb::RBOX_METADATA_PHYSICAL_SIZE, i->get_metadata(), &m_phy_size);
-    std::cerr << " sort_physical_size: " << t << " or " << m_phy_size << " is not a number" << std::endl;
-    return false;
-  }
+  return sort_numeric_metadata(librmb::RBOX_METADATA_PHYSICAL_SIZE, i, j);
 }
 
 bool RmbCommands::sort_save_date(librmb::RadosMail *i, librmb::RadosMail *j) {
@@ -383,48 +999,166 @@ bool RmbCommands::sort_save_date(librmb::RadosMail *i, librmb::RadosMail *j) {
   return i->get_rados_save_date() < j->get_rados_save_date();
 }
 
+RmbCommands::sort_function RmbCommands::get_sort_function(const std::string &sort_string) {
+  if (sort_string.compare("uid") == 0) {
+    return sort_uid;
+  } else if (sort_string.compare("recv_date") == 0) {
+    return sort_recv_date;
+  } else if (sort_string.compare("phy_size") == 0) {
+    return sort_phy_size;
+  }
+  return sort_save_date;
+}
+
+const unsigned int RmbCommands::DEFAULT_SCAN_THREADS = 4;
+const unsigned int RmbCommands::DEFAULT_SCAN_WINDOW = 64;
+const size_t RmbCommands::SCAN_LIST_CHUNK = 1024;
+
+/**
+ * One outstanding stat + getxattrs read operation of the object scan.
+ */
 struct AioStat {
-  librmb::RadosMail *mail;
-  std::list<librmb::RadosMail *> *mail_objects;
+  librmb::RadosMail *mail = nullptr;
   uint64_t object_size = 0;
-  time_t save_date_rados;
-  librmb::RadosStorageMetadataModule *ms;
-  bool load_metadata;
-  librados::AioCompletion *completion;
+  time_t save_date_rados = 0;
+  int stat_ret = 0;
+  int xattrs_ret = 0;
+  int omap_ret = 0;
+  std::map<std::string, ceph::bufferlist> xattrs;
+  std::map<std::string, ceph::bufferlist> omap;
+  librados::ObjectReadOperation read_op;
+  librados::AioCompletion *completion = nullptr;
 };
 
-static void aio_cb(rados_completion_t cb, void *arg) {
-  if (arg == nullptr) {
-    return;
-  }
-  AioStat *stat = static_cast<AioStat *>(arg);
-  if (stat->completion == nullptr || stat->mail == nullptr || stat->ms == nullptr || stat->mail_objects == nullptr) {
-    std::cout << "aio_cb callback failed, invalid stat object" << std::endl;
-    return;
-  }
+void RmbCommands::finish_scan_op(librmb::RadosStorageMetadataModule *ms, AioStat *stat, bool load_metadata,
+                                 const std::function<void(librmb::RadosMail *)> &mail_cb, std::mutex *cb_lock) {
+  stat->completion->wait_for_complete();
+  int ret = stat->completion->get_return_value();
+  stat->completion->release();
 
-  if (stat->completion->get_return_value() == 0 && stat->object_size > 0) {
-    stat->mail->set_mail_size(stat->object_size);
-    stat->mail->set_rados_save_date(stat->save_date_rados);
-    if (stat->load_metadata) {
-      if (stat->ms->load_metadata(stat->mail) < 0) {
-        stat->mail->set_valid(false);
+  librmb::RadosMail *mail = stat->mail;
+  if (ret == 0 && stat->stat_ret == 0 && stat->object_size > 0) {
+    mail->set_mail_size(stat->object_size);
+    mail->set_rados_save_date(stat->save_date_rados);
+    if (load_metadata) {
+      if (stat->xattrs_ret < 0 || ms->load_metadata(mail, &stat->xattrs, &stat->omap) < 0) {
+        mail->set_valid(false);
       }
-      if (stat->mail->get_metadata()->empty()) {
-        stat->mail->set_valid(false);
+      // scanned mails are only read, keep the attributes in fixed slots
+      mail->compact_metadata();
+      if (!mail->has_metadata()) {
+        mail->set_valid(false);
       }
-      if (!librmb::RadosUtils::validate_metadata(stat->mail->get_metadata())) {
-        stat->mail->set_valid(false);
+      if (!librmb::RadosUtils::validate_metadata(mail)) {
+        mail->set_valid(false);
       }
     }
   } else {
-    stat->mail->set_valid(false);
+    mail->set_valid(false);
+  }
+  {
+    std::lock_guard<std::mutex> guard(*cb_lock);
+    mail_cb(mail);
   }
-  stat->mail_objects->push_back(stat->mail);
   delete stat;
 }
+
+int RmbCommands::scan_slice(librmb::RadosStorageMetadataModule *ms,
+                            const std::pair<librados::ObjectCursor, librados::ObjectCursor> &slice,
+                            bool load_metadata, const librmb::RadosMetadata *attr, unsigned int window,
+                            const std::function<void(librmb::RadosMail *)> &mail_cb, std::mutex *cb_lock) {
+  librados::ObjectCursor cursor = slice.first;
+  std::list<AioStat *> in_flight;
+  std::vector<std::string> oids;
+  bool more = true;
+  int ret = 0;
+
+  while (more) {
+    oids.clear();
+    ret = storage->list_mails(&cursor, slice.second, SCAN_LIST_CHUNK, attr, &oids, &more);
+    if (ret < 0) {
+      break;
+    }
+    for (std::vector<std::string>::iterator it = oids.begin(); it != oids.end(); ++it) {
+      // bounded window: wait for the oldest operation before issuing a new one.
+      if (in_flight.size() >= window) {
+        finish_scan_op(ms, in_flight.front(), load_metadata, mail_cb, cb_lock);
+        in_flight.pop_front();
+      }
+      AioStat *stat = new AioStat();
+      stat->mail = new librmb::RadosMail();
+      stat->mail->set_oid(*it);
+      stat->read_op.stat(&stat->object_size, &stat->save_date_rados, &stat->stat_ret);
+      if (load_metadata) {
+        stat->read_op.getxattrs(&stat->xattrs, &stat->xattrs_ret);
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_OMAP_GET_VALS2
+        stat->read_op.omap_get_vals2("", LONG_MAX, &stat->omap, nullptr, &stat->omap_ret);
+#else
+        stat->read_op.omap_get_vals("", LONG_MAX, &stat->omap, &stat->omap_ret);
+#endif
+      }
+      stat->completion = librados::Rados::aio_create_completion();
+      int ret_op = storage->aio_operate(nullptr, *it, stat->completion, &stat->read_op, nullptr);
+      if (ret_op < 0) {
+        std::cout << " object '" << *it << "' is not a valid mail object, ret code: " << ret_op << std::endl;
+        stat->completion->release();
+        delete stat->mail;
+        delete stat;
+        continue;
+      }
+      in_flight.push_back(stat);
+      if (is_debug) {
+        std::cout << "added: mail " << *it << std::endl;
+      }
+    }
+  }
+
+  for (std::list<AioStat *>::iterator it = in_flight.begin(); it != in_flight.end(); ++it) {
+    finish_scan_op(ms, *it, load_metadata, mail_cb, cb_lock);
+  }
+  return ret;
+}
+
+int RmbCommands::scan_objects(librmb::RadosStorageMetadataModule *ms, bool load_metadata,
+                              const librmb::RadosMetadata *attr,
+                              const std::function<void(librmb::RadosMail *)> &mail_cb) {
+  if (ms == nullptr || storage == nullptr) {
+    return -1;
+  }
+  unsigned int threads = get_uint_option(opts, "threads", DEFAULT_SCAN_THREADS);
+  unsigned int window = get_uint_option(opts, "max_concurrent_ios", DEFAULT_SCAN_WINDOW);
+
+  // split the namespace listing into pg ranges, each one is listed by its own thread.
+  std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> slices;
+  int ret = storage->split_mail_listing(threads, &slices);
+  if (ret < 0) {
+    std::cerr << " unable to split object listing, errorcode: " << ret << std::endl;
+    return ret;
+  }
+
+  std::mutex cb_lock;
+  std::vector<int> results(slices.size(), 0);
+  std::vector<std::thread> listers;
+  for (size_t i = 0; i < slices.size(); ++i) {
+    listers.push_back(
+        std::thread([this, ms, &slices, &results, i, load_metadata, attr, window, &mail_cb, &cb_lock]() {
+          results[i] = scan_slice(ms, slices[i], load_metadata, attr, window, mail_cb, &cb_lock);
+        }));
+  }
+  for (std::vector<std::thread>::iterator it = listers.begin(); it != listers.end(); ++it) {
+    it->join();
+  }
+  for (std::vector<int>::iterator it = results.begin(); it != results.end(); ++it) {
+    if (*it < 0) {
+      std::cerr << " listing objects failed, errorcode: " << *it << std::endl;
+      return *it;
+    }
+  }
+  return 0;
+}
+
 int RmbCommands::load_objects(librmb::RadosStorageMetadataModule *ms, std::list<librmb::RadosMail *> &mail_objects,
-                              std::string &sort_string, bool load_metadata) {
+                              std::string &sort_string, bool load_metadata, librmb::CmdLineParser *filter) {
   time_t begin = time(NULL);
 
   print_debug("entry: load_objects");
@@ -432,55 +1166,49 @@ int RmbCommands::load_objects(librmb::RadosStorageMetadataModule *ms, std::list<
     print_debug("end: load_objects");
     return -1;
   }
-  // TODO(jrse): Fix completions.....
-  std::list<librados::AioCompletion *> completions;
-  // load all objects metadata into memory
-  librados::NObjectIterator iter(storage->find_mails(nullptr));
-  while (iter != librados::NObjectIterator::__EndObjectIterator) {
-    librmb::RadosMail *mail = new librmb::RadosMail();
-    AioStat *stat = new AioStat();
-    stat->mail = mail;
-    stat->mail_objects = &mail_objects;
-    stat->load_metadata = load_metadata;
-    stat->ms = ms;
-    std::string oid = iter->get_oid();
-    stat->completion = librados::Rados::aio_create_completion(static_cast<void *>(stat), aio_cb, NULL);
-    int ret = storage->get_io_ctx().aio_stat(oid, stat->completion, &stat->object_size, &stat->save_date_rados);
-    if (ret != 0) {
-      std::cout << " object '" << oid << "' is not a valid mail object, size = 0, ret code: " << ret << std::endl;
-      ++iter;
-      delete mail;
-      delete stat;
-      continue;
-    }
-    mail->set_oid(oid);
-    completions.push_back(stat->completion);
 
-    ++iter;
-    if (is_debug) {
-      std::cout << "added: mail " << *mail->get_oid() << std::endl;
+  // push one string equality predicate down to the osd, the remaining ones are evaluated on the fly.
+  librmb::RadosMetadata *attr = nullptr;
+  if (filter != nullptr && load_metadata && ms->has_xattr_metadata()) {
+    librmb::Predicate *p = filter->get_filter_predicate();
+    if (p != nullptr) {
+      attr = new librmb::RadosMetadata(static_cast<librmb::rbox_metadata_key>(p->key[0]), p->value);
     }
   }
 
-  for (std::list<librados::AioCompletion *>::iterator it = completions.begin(); it != completions.end(); ++it) {
-    (*it)->wait_for_complete_and_cb();
-    (*it)->release();
-  }
+  sort_function sort = load_metadata ? get_sort_function(sort_string) : sort_save_date;
+  size_t limit = get_uint_option(opts, "limit", 0);
+  // bounded max heap: the top element is the last one in sort order.
+  std::vector<librmb::RadosMail *> top_k;
 
-  if (load_metadata) {
-    if (sort_string.compare("uid") == 0) {
-      mail_objects.sort(sort_uid);
-      // std::sort(mail_objects.begin(), mail_objects.end(), sort_uid);
-    } else if (sort_string.compare("recv_date") == 0) {
-      mail_objects.sort(sort_recv_date);
-      // std::sort(mail_objects.begin(), mail_objects.end(), sort_recv_date);
-    } else if (sort_string.compare("phy_size") == 0) {
-      mail_objects.sort(sort_phy_size);
-      //   std::sort(mail_objects.begin(), mail_objects.end(), sort_phy_size);
-    } else {
-      mail_objects.sort(sort_save_date);
-      //  std::sort(mail_objects.begin(), mail_objects.end(), sort_save_date);
+  int ret = scan_objects(ms, load_metadata, attr, [&](librmb::RadosMail *mail) {
+    if (filter != nullptr && mail->is_valid() && !filter->matches(mail)) {
+      delete mail;
+      return;
+    }
+    if (limit == 0) {
+      mail_objects.push_back(mail);
+      return;
+    }
+    top_k.push_back(mail);
+    std::push_heap(top_k.begin(), top_k.end(), sort);
+    if (top_k.size() > limit) {
+      std::pop_heap(top_k.begin(), top_k.end(), sort);
+      delete top_k.back();
+      top_k.pop_back();
     }
+  });
+  delete attr;
+
+  if (limit > 0) {
+    std::sort_heap(top_k.begin(), top_k.end(), sort);
+    mail_objects.insert(mail_objects.end(), top_k.begin(), top_k.end());
+  } else if (load_metadata) {
+    mail_objects.sort(sort);
+  }
+  if (ret < 0) {
+    print_debug("end: load_objects");
+    return ret;
   }
   time_t end = time(NULL);
 
@@ -497,28 +1225,259 @@ int RmbCommands::print_mail(std::map<std::string, librmb::RadosMailBox *> *mailb
       continue;
     }
     std::cout << it->second->to_string() << std::endl;
-    if (!download) {
+  }
+  int ret = 0;
+  if (download) {
+    ret = export_mails(mailbox, output_dir);
+  }
+  print_debug("end: print_mail");
+  return ret;
+}
+
+const uint64_t RmbCommands::EXPORT_CHUNK_SIZE = 4 * 1024 * 1024;
+const unsigned int RmbCommands::DEFAULT_EXPORT_INFLIGHT_MB = 64;
+const char *RmbCommands::EXPORT_MANIFEST = ".rmb_export_manifest";
+
+/**
+ * One outstanding ranged read of the mail export.
+ */
+struct AioExportRead {
+  librmb::RadosMail *mail = nullptr;
+  librmb::MailboxTools *tools = nullptr;
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  bool last = false;
+  int read_ret = 0;
+  librados::bufferlist bl;
+  librados::ObjectReadOperation read_op;
+  librados::AioCompletion *completion = nullptr;
+};
+
+/**
+ * Consumer side of the export: reads complete in issue order, so only one mail file is open at a time.
+ */
+struct ExportState {
+  std::ofstream manifest;
+  std::ofstream file;
+  std::string file_path;
+  librmb::RadosMail *failed_mail = nullptr;
+  uint64_t inflight_bytes = 0;
+  uint64_t bytes = 0;
+  unsigned int mails = 0;
+  unsigned int errors = 0;
+};
+
+static void fail_export(ExportState *state, librmb::RadosMail *mail) {
+  state->failed_mail = mail;
+  state->errors++;
+  if (state->file.is_open()) {
+    // remove the partially written mail, it will be exported again on the next run.
+    state->file.close();
+    unlink(state->file_path.c_str());
+  }
+}
+
+static void finish_export_read(AioExportRead *read, ExportState *state) {
+  read->completion->wait_for_complete();
+  int ret = read->completion->get_return_value();
+  read->completion->release();
+  state->inflight_bytes -= read->length;
+
+  if (state->failed_mail != read->mail) {
+    if (ret < 0 || read->read_ret < 0) {
+      std::cerr << " error reading mail : " << *read->mail->get_oid()
+                << " errorcode: " << (ret < 0 ? ret : read->read_ret) << std::endl;
+      fail_export(state, read->mail);
+    } else {
+      if (read->offset == 0) {
+        std::string filename;
+        read->tools->build_filename(read->mail, &filename);
+        state->file_path = read->tools->get_mailbox_path() + "/" + filename;
+        std::cout << " writing mail to " << state->file_path << std::endl;
+        state->file.open(state->file_path, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+      }
+      if (!state->file.is_open()) {
+        std::cout << " error saving mail : " << *read->mail->get_oid() << " to " << state->file_path << std::endl;
+        fail_export(state, read->mail);
+      } else {
+        read->bl.write_stream(state->file);
+        state->bytes += read->bl.length();
+        if (read->last) {
+          state->file.close();
+          if (state->file.fail()) {
+            std::cout << " error saving mail : " << *read->mail->get_oid() << " to " << state->file_path << std::endl;
+            fail_export(state, read->mail);
+          } else {
+            state->manifest << *read->mail->get_oid() << std::endl;
+            state->mails++;
+          }
+        }
+      }
+    }
+  }
+  delete read;
+}
+
+/**
+ * Mails compressed by librmb are read as a whole and written uncompressed (see MailboxTools::save_mail),
+ * deduplicated mails are read from the dedup pool, striped mails from their stripes.
+ */
+static void export_whole_mail(librmb::RadosStorage *storage, librmb::RadosDedup *dedup, librmb::MailboxTools *tools,
+                              librmb::RadosMail *mail, ExportState *state) {
+  librados::bufferlist *bl = new librados::bufferlist();
+  mail->set_mail_buffer(bl);
+  int ret = storage->read_mail(*mail->get_oid(), bl);
+  if (ret >= 0 && mail->get_metadata(librmb::RBOX_METADATA_EXT_REF) != NULL) {
+    ret = dedup->is_open() ? dedup->resolve(mail) : -ENOTCONN;
+  } else if (ret >= 0 && mail->get_metadata(librmb::RBOX_METADATA_STRIPES) != NULL) {
+    ret = librmb::RadosStriping::resolve(storage->get_io_ctx(), mail);
+    if (ret == 0) {
+      // invalid manifest
+      ret = -EINVAL;
+    }
+  }
+  if (ret < 0) {
+    std::cerr << " error reading mail : " << *mail->get_oid() << " errorcode: " << ret << std::endl;
+    fail_export(state, mail);
+  } else {
+    mail->set_mail_size(bl->length());
+    if (tools->save_mail(mail) < 0) {
+      std::cout << " error saving mail : " << *mail->get_oid() << std::endl;
+      fail_export(state, mail);
+    } else {
+      state->manifest << *mail->get_oid() << std::endl;
+      state->bytes += mail->get_mail_size();
+      state->mails++;
+    }
+  }
+  mail->set_mail_buffer(nullptr);
+  delete bl;
+}
+
+int RmbCommands::export_mails(std::map<std::string, librmb::RadosMailBox *> *mailbox, const std::string &output_dir) {
+  print_debug("entry: export_mails");
+  unsigned int window = get_uint_option(opts, "max_concurrent_ios", DEFAULT_SCAN_WINDOW);
+  uint64_t max_inflight_bytes =
+      static_cast<uint64_t>(get_uint_option(opts, "max_inflight_mb", DEFAULT_EXPORT_INFLIGHT_MB)) * 1024 * 1024;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+  // mails listed in the manifest have been exported by a previous (interrupted) run.
+  std::string manifest_path = output_dir + "/" + EXPORT_MANIFEST;
+  std::set<std::string> exported;
+  {
+    std::ifstream manifest(manifest_path);
+    std::string oid;
+    while (std::getline(manifest, oid)) {
+      exported.insert(oid);
+    }
+  }
+
+  librmb::RadosDedup dedup;
+  if (open_dedup(&dedup) < 0) {
+    std::cerr << " deduplicated mails are skipped" << std::endl;
+  }
+
+  ExportState state;
+  std::list<AioExportRead *> in_flight;
+  std::list<librmb::MailboxTools *> tools_list;
+  unsigned int skipped = 0;
+  int ret = 0;
+
+  for (std::map<std::string, librmb::RadosMailBox *>::iterator it = mailbox->begin(); it != mailbox->end(); ++it) {
+    if (it->second->get_mail_count() == 0) {
       continue;
     }
-    librmb::MailboxTools tools(it->second, output_dir);
-    if (tools.init_mailbox_dir() < 0) {
+    librmb::MailboxTools *tools = new librmb::MailboxTools(it->second, output_dir);
+    tools_list.push_back(tools);
+    if (tools->init_mailbox_dir() < 0) {
       std::cout << " error initializing output dir : " << output_dir << std::endl;
+      ret = -1;
       break;
     }
+    if (!state.manifest.is_open()) {
+      state.manifest.open(manifest_path, std::ofstream::out | std::ofstream::app);
+    }
     for (std::list<librmb::RadosMail *>::iterator it_mail = it->second->get_mails().begin();
          it_mail != it->second->get_mails().end(); ++it_mail) {
-      const std::string oid = *(*it_mail)->get_oid();
-      librados::bufferlist bl;
-      (*it_mail)->set_mail_buffer(&bl);
-      if (storage->read_mail(oid, (*it_mail)->get_mail_buffer()) > 0) {
-        if (tools.save_mail((*it_mail)) < 0) {
-          std::cout << " error saving mail : " << oid << " to " << tools.get_mailbox_path() << std::endl;
+      librmb::RadosMail *mail = *it_mail;
+      const std::string oid = *mail->get_oid();
+      // deduplicated and striped mails have no data
+      bool external_body = mail->get_metadata(librmb::RBOX_METADATA_EXT_REF) != NULL ||
+                           mail->get_metadata(librmb::RBOX_METADATA_STRIPES) != NULL;
+      if (!mail->is_valid() || (mail->get_mail_size() <= 0 && !external_body)) {
+        std::cerr << " mail : " << oid << " is not valid, skipping" << std::endl;
+        state.errors++;
+        continue;
+      }
+      if (exported.find(oid) != exported.end()) {
+        skipped++;
+        continue;
+      }
+      if (mail->get_metadata(librmb::RBOX_METADATA_COMPRESSION) != NULL || external_body) {
+        while (!in_flight.empty()) {
+          finish_export_read(in_flight.front(), &state);
+          in_flight.pop_front();
+        }
+        export_whole_mail(storage, &dedup, tools, mail, &state);
+        continue;
+      }
+      uint64_t size = static_cast<uint64_t>(mail->get_mail_size());
+      for (uint64_t offset = 0; offset < size; offset += EXPORT_CHUNK_SIZE) {
+        uint64_t length = std::min(EXPORT_CHUNK_SIZE, size - offset);
+        // bounded number of reads and bytes in flight: wait for the oldest read first.
+        while (!in_flight.empty() &&
+               (in_flight.size() >= window || state.inflight_bytes + length > max_inflight_bytes)) {
+          finish_export_read(in_flight.front(), &state);
+          in_flight.pop_front();
+        }
+        AioExportRead *read = new AioExportRead();
+        read->mail = mail;
+        read->tools = tools;
+        read->offset = offset;
+        read->length = length;
+        read->last = offset + length >= size;
+        read->read_op.read(offset, length, &read->bl, &read->read_ret);
+        read->completion = librados::Rados::aio_create_completion();
+        int ret_op = storage->aio_operate(nullptr, oid, read->completion, &read->read_op, nullptr);
+        if (ret_op < 0) {
+          std::cerr << " error reading mail : " << oid << " errorcode: " << ret_op << std::endl;
+          read->completion->release();
+          delete read;
+          // finish the already issued chunks of this mail, before dropping it.
+          while (!in_flight.empty()) {
+            finish_export_read(in_flight.front(), &state);
+            in_flight.pop_front();
+          }
+          fail_export(&state, mail);
+          break;
         }
+        state.inflight_bytes += length;
+        in_flight.push_back(read);
       }
     }
   }
-  print_debug("end: print_mail");
-  return 0;
+  while (!in_flight.empty()) {
+    finish_export_read(in_flight.front(), &state);
+    in_flight.pop_front();
+  }
+  for (std::list<librmb::MailboxTools *>::iterator it = tools_list.begin(); it != tools_list.end(); ++it) {
+    delete *it;
+  }
+  dedup.close();
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  std::cout << " exported mails: " << state.mails << ", skipped (already exported): " << skipped
+            << ", failed: " << state.errors << ", bytes: " << state.bytes << ", time: " << seconds << "s";
+  if (seconds > 0) {
+    std::cout << ", throughput: " << (state.bytes / seconds / (1024 * 1024)) << " MB/s";
+  }
+  std::cout << std::endl;
+  if (ret == 0 && state.errors > 0) {
+    // failed mails are not in the manifest, a rerun exports them.
+    ret = -EIO;
+  }
+  print_debug("end: export_mails");
+  return ret;
 }
 
 int RmbCommands::query_mail_storage(std::list<librmb::RadosMail *> *mail_objects, librmb::CmdLineParser *parser,
@@ -528,11 +1487,8 @@ int RmbCommands::query_mail_storage(std::list<librmb::RadosMail *> *mail_objects
   std::map<std::string, librmb::RadosMailBox *> mailbox;
   for (std::list<librmb::RadosMail *>::iterator it = mail_objects->begin(); it != mail_objects->end(); ++it) {
     std::string mailbox_key = std::string(1, static_cast<char>(librmb::RBOX_METADATA_MAILBOX_GUID));
-    char *mailbox_guid = NULL;
-    RadosUtils::get_metadata(mailbox_key, (*it)->get_metadata(), &mailbox_guid);
-    std::string mailbox_orig_name_key = std::string(1, static_cast<char>(librmb::RBOX_METADATA_ORIG_MAILBOX));
-    char *mailbox_orig_name = NULL;
-    RadosUtils::get_metadata(mailbox_orig_name_key, (*it)->get_metadata(), &mailbox_orig_name);
+    const char *mailbox_guid = (*it)->get_metadata(librmb::RBOX_METADATA_MAILBOX_GUID);
+    const char *mailbox_orig_name = (*it)->get_metadata(librmb::RBOX_METADATA_ORIG_MAILBOX);
 
     if (mailbox_guid == NULL || mailbox_orig_name == NULL) {
       std::cout << " mail " << *(*it)->get_oid() << " with empty mailbox guid is not valid: " << std::endl;
@@ -541,7 +1497,7 @@ int RmbCommands::query_mail_storage(std::list<librmb::RadosMail *> *mail_objects
 
     if (parser->contains_key(mailbox_key)) {
       librmb::Predicate *p = parser->get_predicate(mailbox_key);
-      if (!p->eval(mailbox_guid)) {
+      if (p != nullptr && !p->eval(mailbox_guid)) {
         continue;
       }
     }
@@ -570,11 +1526,15 @@ int RmbCommands::query_mail_storage(std::list<librmb::RadosMail *> *mail_objects
 RadosStorageMetadataModule *RmbCommands::init_metadata_storage_module(librmb::RadosCephConfig &ceph_cfg,
                                                                       std::string *uid) {
   print_debug("entry: init_metadata_storage_module");
-  librmb::RadosConfig dovecot_cfg;
-  RadosStorageMetadataModule *ms = nullptr;
   dovecot_cfg.set_config_valid(true);
+  if (opts->find("metadata_pool") != opts->end()) {
+    dovecot_cfg.set_metadata_pool((*opts)["metadata_pool"]);
+  }
   ceph_cfg.set_config_valid(true);
-  librmb::RadosDovecotCephCfgImpl cfg(dovecot_cfg, ceph_cfg);
+  // the module keeps a pointer to its configuration
+  delete metadata_cfg;
+  metadata_cfg = new librmb::RadosDovecotCephCfgImpl(dovecot_cfg, ceph_cfg);
+  librmb::RadosDovecotCephCfg &cfg = *metadata_cfg;
   librmb::RadosNamespaceManager mgr(&cfg);
 
   if (uid == nullptr) {
@@ -584,11 +1544,10 @@ RadosStorageMetadataModule *RmbCommands::init_metadata_storage_module(librmb::Ra
   }
 
   // decide metadata storage!
-  std::string storage_module_name = ceph_cfg.get_metadata_storage_module();
-  if (storage_module_name.compare(librmb::RadosMetadataStorageIma::module_name) == 0) {
-    ms = new librmb::RadosMetadataStorageIma(&storage->get_io_ctx(), &cfg);
-  } else {
-    ms = new librmb::RadosMetadataStorageDefault(&storage->get_io_ctx());
+  RadosStorageMetadataModule *ms = create_metadata_storage_module(cluster, &storage->get_io_ctx(), &cfg);
+  if (ms == nullptr) {
+    print_debug("end: init_metadata_storage_module");
+    return nullptr;
   }
   if (!(*opts)["namespace"].empty()) {
     *uid = (*opts)["namespace"] + cfg.get_user_suffix();
@@ -609,6 +1568,34 @@ RadosStorageMetadataModule *RmbCommands::init_metadata_storage_module(librmb::Ra
   print_debug("end: init_metadata_storage_module");
   return ms;
 }
+RadosStorageMetadataModule *RmbCommands::create_metadata_storage_module(librmb::RadosCluster *cluster,
+                                                                        librados::IoCtx *io_ctx,
+                                                                        librmb::RadosDovecotCephCfg *cfg) {
+  const std::string &storage_module_name = cfg->get_metadata_storage_module();
+  if (!cfg->get_metadata_pool().empty() ||
+      storage_module_name.compare(librmb::RadosMetadataStoragePool::module_name) == 0) {
+    // same as RadosMetadataStorageImpl: the metadata is not accessible, do not fall back to the mail objects.
+    if (cfg->get_metadata_pool().empty()) {
+      std::cerr << " metadata module " << storage_module_name << " requires a metadata pool (--metadata-pool)"
+                << std::endl;
+      return nullptr;
+    }
+    librmb::RadosMetadataStoragePool *pool_storage = new librmb::RadosMetadataStoragePool(io_ctx);
+    int ret = pool_storage->open(cluster, cfg->get_metadata_pool());
+    if (ret < 0) {
+      std::cerr << " unable to open metadata pool " << cfg->get_metadata_pool() << ", errorcode: " << ret
+                << std::endl;
+      delete pool_storage;
+      return nullptr;
+    }
+    return pool_storage;
+  } else if (storage_module_name.compare(librmb::RadosMetadataStorageIma::module_name) == 0) {
+    return new librmb::RadosMetadataStorageIma(io_ctx, cfg);
+  } else if (storage_module_name.compare(librmb::RadosMetadataStorageBinary::module_name) == 0) {
+    return new librmb::RadosMetadataStorageBinary(io_ctx, cfg);
+  }
+  return new librmb::RadosMetadataStorageDefault(io_ctx);
+}
 int RmbCommands::update_attributes(librmb::RadosStorageMetadataModule *ms,
                                    std::map<std::string, std::string> *metadata) {
   std::string oid = (*opts)["set"];
@@ -19,11 +19,15 @@
 #include <sstream>
 #include <iterator>
 #include <list>
+#include <functional>
+#include <mutex>
+#include <utility>
 
 #include "rados-storage.h"
 #include "rados-cluster.h"
 #include "rados-metadata-storage.h"
 #include "rados-dovecot-ceph-cfg.h"
+#include "rados-dovecot-config.h"
 #include "rados-ceph-config.h"
 #include "ls_cmd_parser.h"
 #include "mailbox_tools.h"
@@ -32,44 +36,169 @@
 
 namespace librmb {
 
+struct AioStat;
+struct AioRemove;
+struct DeleteProgress;
+class RadosDedup;
+
 class RmbCommands {
  public:
   RmbCommands(librmb::RadosStorage *storage_, librmb::RadosCluster *cluster_,
               std::map<std::string, std::string> *opts_);
   virtual ~RmbCommands();
 
+  /*!
+   * revert the save log (csv or binary format): saved and copied objects are removed, moved objects are moved
+   * back. Duplicate entries are replayed once, the entries of a pool are replayed with at most window
+   * operations in flight (operations on the same object keep the log order). Replayed entries are recorded in
+   * <save_log>REPLAY_JOURNAL_SUFFIX and skipped by the next run, the journal is removed if all entries succeeded.
+   * The dedup reference and the stripes of a removed object are released (read from its immutable metadata).
+   *
+   * @param[out] moved_items successfully moved entries per user
+   * @param[in] dedup_pool pool of the deduplicated mail bodies, default: the pool of the entry
+   * @param[in] metadata_pool pool of the mail metadata (rbox_metadata_pool), default: the mail objects
+   * @return number of replayed entries or -1 on error
+   */
   static int delete_with_save_log(const std::string &save_log, const std::string &rados_cluster,
                                   const std::string &rados_user,
-                                  std::map<std::string, std::list<librmb::RadosSaveLogEntry>> *moved_items);
+                                  std::map<std::string, std::list<librmb::RadosSaveLogEntry>> *moved_items,
+                                  unsigned int window = DEFAULT_SCAN_WINDOW, const std::string &dedup_pool = "",
+                                  const std::string &metadata_pool = "");
+  /*!
+   * print a save log (csv or binary format) as csv to stdout.
+   * @return number of entries or -1 on error
+   */
+  static int print_save_log(const std::string &save_log);
   void print_debug(const std::string &msg);
   static int lspools();
-  int delete_mail(bool confirmed);
-  int delete_namespace(librmb::RadosStorageMetadataModule *ms, std::list<librmb::RadosMail *> &mail_objects,
-                       librmb::RadosCephConfig *cfg, bool confirmed);
+  /*!
+   * @return the positive integer value of option key or default_value if it is missing or invalid
+   */
+  static unsigned int get_uint_option(std::map<std::string, std::string> *opts, const std::string &key,
+                                      unsigned int default_value);
+  /*!
+   * delete the mail object (opts: to_delete).
+   *
+   * @param[in] ms optional metadata module, the dedup reference and the stripes of the mail are released with it
+   *            (opts: dedup_pool, default: the mail pool)
+   * @return linux errorcode or 0 if successful
+   */
+  int delete_mail(bool confirmed, librmb::RadosStorageMetadataModule *ms = nullptr);
+  /*!
+   * delete all objects of the current namespace. The listing is split into pg ranges (opts: threads),
+   * each one removing its objects with a bounded number of aio removes in flight (opts: max_concurrent_ios).
+   * (opts: rate) limits the removes per second. Deleted objects are not listed again, so an interrupted
+   * delete continues where it stopped when it is restarted.
+   *
+   * @param[in] ms optional metadata module, the immutable metadata of each object is read (in the same window)
+   *            before it is removed to release its dedup reference and its stripes (opts: dedup_pool)
+   * @return linux errorcode or 0 if successful
+   */
+  int delete_namespace(librmb::RadosCephConfig *cfg, bool confirmed, librmb::RadosStorageMetadataModule *ms = nullptr);
 
   int rename_user(librmb::RadosCephConfig *cfg, bool confirmed, const std::string &uid);
 
   int configuration(bool confirmed, librmb::RadosCephConfig &ceph_cfg);
 
+  /*!
+   * load all mail objects of the current namespace.
+   *
+   * @param[in] ms metadata module
+   * @param[out] mail_objects loaded mails, sorted by sort_string
+   * @param[in] sort_string uid, recv_date, phy_size or save_date
+   * @param[in] load_metadata if false, only stat the objects
+   * @param[in] filter optional ls query, mails not matching are dropped while scanning. An equality predicate
+   *            is evaluated by the osd, if the metadata module stores plain xattributes.
+   *            (opts: limit) keep only the first n mails in sort order (bounded heap)
+   * @return linux errorcode or 0 if successful
+   */
   int load_objects(librmb::RadosStorageMetadataModule *ms, std::list<librmb::RadosMail *> &mail_objects,
-                   std::string &sort_string, bool load_metadata = true);
+                   std::string &sort_string, bool load_metadata = true, librmb::CmdLineParser *filter = nullptr);
+  /*!
+   * scan all objects of the current namespace. The object listing is split into pg ranges which
+   * are listed by parallel threads (opts: threads), each one keeping a bounded number of combined
+   * stat/getxattrs read operations in flight (opts: max_concurrent_ios).
+   *
+   * @param[in] ms metadata module used to parse the loaded metadata
+   * @param[in] load_metadata if false, only stat the objects
+   * @param[in] attr optional xattribute filter, evaluated by the osd while listing.
+   * @param[in] mail_cb called (serialized) for every scanned mail, takes ownership of the mail.
+   * @return linux errorcode or 0 if successful
+   */
+  int scan_objects(librmb::RadosStorageMetadataModule *ms, bool load_metadata, const librmb::RadosMetadata *attr,
+                   const std::function<void(librmb::RadosMail *)> &mail_cb);
   int update_attributes(librmb::RadosStorageMetadataModule *ms, std::map<std::string, std::string> *metadata);
   int print_mail(std::map<std::string, librmb::RadosMailBox *> *mailbox, std::string &output_dir, bool download);
+  /*!
+   * download the mails of all mailboxes to output_dir/<mailbox_guid>/<uid>.<oid>. The mails are read in
+   * ranged chunks (EXPORT_CHUNK_SIZE) with a bounded number of reads (opts: max_concurrent_ios) and
+   * bytes (opts: max_inflight_mb) in flight. Exported oids are recorded in output_dir/EXPORT_MANIFEST,
+   * mails listed there are skipped, so an interrupted export can be resumed.
+   *
+   * @return linux errorcode or 0 if successful, -EIO if at least one mail could not be exported
+   */
+  int export_mails(std::map<std::string, librmb::RadosMailBox *> *mailbox, const std::string &output_dir);
   int query_mail_storage(std::list<librmb::RadosMail *> *mail_objects, librmb::CmdLineParser *parser, bool download,
                          bool silent);
   librmb::RadosStorageMetadataModule *init_metadata_storage_module(librmb::RadosCephConfig &ceph_cfg, std::string *uid);
+  /*!
+   * create the metadata module configured in cfg (metadata_storage_module) for the mail objects of io_ctx. If a
+   * metadata pool is configured (rbox_metadata_pool), the pool module is opened with it.
+   * @param[in] cluster connection used to open the metadata pool
+   * @param[in] cfg configuration, has to outlive the module
+   * @return nullptr if the metadata pool could not be opened
+   */
+  static librmb::RadosStorageMetadataModule *create_metadata_storage_module(librmb::RadosCluster *cluster,
+                                                                            librados::IoCtx *io_ctx,
+                                                                            librmb::RadosDovecotCephCfg *cfg);
   static bool sort_uid(librmb::RadosMail *i, librmb::RadosMail *j);
   static bool sort_recv_date(librmb::RadosMail *i, librmb::RadosMail *j);
   static bool sort_phy_size(librmb::RadosMail *i, librmb::RadosMail *j);
   static bool sort_save_date(librmb::RadosMail *i, librmb::RadosMail *j);
+  typedef bool (*sort_function)(librmb::RadosMail *i, librmb::RadosMail *j);
+  static sort_function get_sort_function(const std::string &sort_string);
 
   void set_output_path(librmb::CmdLineParser *parser);
 
+ private:
+  int scan_slice(librmb::RadosStorageMetadataModule *ms,
+                 const std::pair<librados::ObjectCursor, librados::ObjectCursor> &slice, bool load_metadata,
+                 const librmb::RadosMetadata *attr, unsigned int window,
+                 const std::function<void(librmb::RadosMail *)> &mail_cb, std::mutex *cb_lock);
+  int delete_slice(librmb::RadosStorageMetadataModule *ms, librmb::RadosDedup *dedup,
+                   const std::pair<librados::ObjectCursor, librados::ObjectCursor> &slice, unsigned int window,
+                   double rate, DeleteProgress *progress);
+  AioRemove *start_delete_op(librmb::RadosStorageMetadataModule *ms, const std::string &oid);
+  int start_remove_op(AioRemove *remove);
+  int finish_delete_op(librmb::RadosStorageMetadataModule *ms, librmb::RadosDedup *dedup, AioRemove *remove,
+                       std::list<AioRemove *> *in_flight);
+  /*!
+   * open the dedup pool (opts: dedup_pool, default: the mail pool)
+   * @return linux errorcode or 0 if successful
+   */
+  int open_dedup(librmb::RadosDedup *dedup);
+  void print_delete_progress(DeleteProgress *progress, bool finished);
+  void finish_scan_op(librmb::RadosStorageMetadataModule *ms, AioStat *stat, bool load_metadata,
+                      const std::function<void(librmb::RadosMail *)> &mail_cb, std::mutex *cb_lock);
+
+ public:
+  static const unsigned int DEFAULT_SCAN_THREADS;
+  static const unsigned int DEFAULT_SCAN_WINDOW;
+  static const size_t SCAN_LIST_CHUNK;
+  static const unsigned int DELETE_PROGRESS_INTERVAL;
+  static const uint64_t EXPORT_CHUNK_SIZE;
+  static const unsigned int DEFAULT_EXPORT_INFLIGHT_MB;
+  static const char *EXPORT_MANIFEST;
+  static const char *REPLAY_JOURNAL_SUFFIX;
+
  private:
   std::map<std::string, std::string> *opts;
   librmb::RadosStorage *storage;
   librmb::RadosCluster *cluster;
   bool is_debug;
+  // configuration of the metadata module created by init_metadata_storage_module
+  librmb::RadosConfig dovecot_cfg;
+  librmb::RadosDovecotCephCfg *metadata_cfg;
 };
 
 } /* namespace librmb */
@@ -35,6 +35,7 @@
 #include "rados-dovecot-ceph-cfg.h"
 #include "rados-dovecot-ceph-cfg-impl.h"
 #include "rados-metadata-storage-default.h"
+#include "rados-throttle.h"
 #include "rmb-commands.h"
 #undef PACKAGE_BUGREPORT
 #undef PACKAGE_NAME
@@ -166,7 +167,21 @@ static void usage(std::ostream &out) {
          "   -u    rados user name, default: 'client.admin' \n"
          "   -D    debug output \n"
          "   -r    save log with objects to delete => deletes all entries (save,mv,cp) from object store, use with \n"
+         "   --print-save-log  convert a save log (csv or binary format) to csv and print it to screen\n"
          "   -v    print plugin version\n"
+         "   -t    number of parallel threads listing the namespace (ls, get, delete), default: 4\n"
+         "   --max-concurrent-ios  max number of outstanding operations per thread (ls, get, delete, -r), default: 64\n"
+         "   --max-inflight-mb  max number of mail bytes (MB) read in parallel (get), default: 64\n"
+         "   --dedup-pool  pool of the deduplicated mail bodies (rbox_dedup_pool) (get), default: -p\n"
+         "   --metadata-pool  pool of the mail metadata (rbox_metadata_pool), default: the mail objects\n"
+         "   --rate  max number of objects deleted per second (delete -), default: unlimited\n"
+         "   --limit  show only the first n mails (ls, get) in sort order\n"
+         "   --throttle-ops  max number of operations per second and pool (rbox_throttle_ops_per_sec), default: "
+         "unlimited\n"
+         "   --throttle-mb  max number of bytes (MB) per second and pool (rbox_throttle_bytes_per_sec), default: "
+         "unlimited\n"
+         "   --throttle-inflight-ops  max number of operations in flight per pool, default: unlimited\n"
+         "   --throttle-inflight-mb  max number of bytes (MB) in flight per pool, default: unlimited\n"
          "care!!!! \n "
          "\n"
          "\nMAIL COMMANDS\n"
@@ -174,11 +189,12 @@ static void usage(std::ostream &out) {
          "            use Metadata value to filter results \n"
          "            filter: e.g. U=7, \"U<7\", \"U>7\"\n"
          "            date format:  %Y-%m-%d %H:%M:%S e.g. (\"R=2017-08-22 14:30\")\n"
-         "            comparison operators: =,>,< for strings only = is supported.\n"
-         "    get -   download mails to file\n"
+         "            comparison operators: =,>,<\n"
+         "            multiple filters separated by ';' must all match e.g. \"U>7;B=INBOX\"\n"
+         "    get -   download mails to file, an interrupted download is resumed (see -O/.rmb_export_manifest)\n"
          "            filter: e.g. U=7, \"U<7\", \"U>7\"\n"
          "            date format: %Y-%m-%d %H:%M:%S e.g. (\"R=2017-08-22 14:30\")\n"
-         "            comparison operators: =,>,< for strings only = is supported.\n"
+         "            comparison operators: =,>,<\n"
          "    set     oid metadata value   e.g. U 1 B INBOX R \"2017-08-22 14:30\"\n"
          "    sort    values: uid, recv_date, save_date, phy_size\n"
          "    lspools list all available pools\n"
@@ -244,6 +260,30 @@ static void parse_cmd_line_args(std::map<std::string, std::string> *opts, bool &
       (*opts)["debug"] = "true";
     } else if (ceph_argparse_witharg(args, &i, &val, "-r", "--remove", static_cast<char>(NULL))) {
       (*opts)["remove_save_log"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--print-save-log", static_cast<char>(NULL))) {
+      (*opts)["print_save_log"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "-t", "--threads", static_cast<char>(NULL))) {
+      (*opts)["threads"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--max-concurrent-ios", static_cast<char>(NULL))) {
+      (*opts)["max_concurrent_ios"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--max-inflight-mb", static_cast<char>(NULL))) {
+      (*opts)["max_inflight_mb"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--dedup-pool", static_cast<char>(NULL))) {
+      (*opts)["dedup_pool"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--metadata-pool", static_cast<char>(NULL))) {
+      (*opts)["metadata_pool"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--rate", static_cast<char>(NULL))) {
+      (*opts)["rate"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--limit", static_cast<char>(NULL))) {
+      (*opts)["limit"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--throttle-ops", static_cast<char>(NULL))) {
+      (*opts)["throttle_ops"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--throttle-mb", static_cast<char>(NULL))) {
+      (*opts)["throttle_mb"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--throttle-inflight-ops", static_cast<char>(NULL))) {
+      (*opts)["throttle_inflight_ops"] = val;
+    } else if (ceph_argparse_witharg(args, &i, &val, "--throttle-inflight-mb", static_cast<char>(NULL))) {
+      (*opts)["throttle_inflight_mb"] = val;
     } else if (ceph_argparse_witharg(args, &i, &val, "ls", "--ls", static_cast<char>(NULL))) {
       (*opts)["ls"] = val;
     } else if (ceph_argparse_witharg(args, &i, &val, "get", "--get", static_cast<char>(NULL))) {
@@ -281,6 +321,17 @@ static void parse_cmd_line_args(std::map<std::string, std::string> *opts, bool &
   }
 }
 
+/* limits of the process wide throttle (see rbox_throttle_*), all operations of rmb are submitted through it */
+static void set_throttle_limits(std::map<std::string, std::string> *opts) {
+  librmb::RadosThrottle::Limits limits;
+  limits.ops_per_sec = librmb::RmbCommands::get_uint_option(opts, "throttle_ops", 0);
+  limits.bytes_per_sec = static_cast<uint64_t>(librmb::RmbCommands::get_uint_option(opts, "throttle_mb", 0)) << 20;
+  limits.max_inflight_ops = librmb::RmbCommands::get_uint_option(opts, "throttle_inflight_ops", 0);
+  limits.max_inflight_bytes =
+      static_cast<uint64_t>(librmb::RmbCommands::get_uint_option(opts, "throttle_inflight_mb", 0)) << 20;
+  librmb::RadosThrottle::global().set_limits(limits);
+}
+
 int main(int argc, const char **argv) {
   std::list<librmb::RadosMail *> mail_objects;
   std::vector<const char *> args;
@@ -289,6 +340,7 @@ int main(int argc, const char **argv) {
   std::map<std::string, std::string> metadata;
   std::string sort_type;
   librmb::RmbCommands *rmb_commands = nullptr;
+  int exit_code = 0;
 
   bool is_config_option = false;
   bool create_config = false;
@@ -313,6 +365,12 @@ int main(int argc, const char **argv) {
     usage_exit();
   }
 
+  set_throttle_limits(&opts);
+
+  if (opts.find("print_save_log") != opts.end()) {
+    return librmb::RmbCommands::print_save_log(opts["print_save_log"]) < 0 ? 1 : 0;
+  }
+
   is_lspools_cmd = strcmp(args[0], "lspools") == 0;
   delete_mail_option = opts.find("to_delete") != opts.end();
   sort_type = (opts.find("sort") != opts.end()) ? opts["sort"] : "uid";
@@ -324,7 +382,12 @@ int main(int argc, const char **argv) {
   if (!remove_save_log.empty()) {
     if (confirmed) {
       std::map<std::string, std::list<librmb::RadosSaveLogEntry>> moved_items;
-      return librmb::RmbCommands::delete_with_save_log(remove_save_log, rados_cluster, rados_user, &moved_items);
+      unsigned int window =
+          librmb::RmbCommands::get_uint_option(&opts, "max_concurrent_ios", librmb::RmbCommands::DEFAULT_SCAN_WINDOW);
+      std::string dedup_pool = opts.find("dedup_pool") != opts.end() ? opts["dedup_pool"] : "";
+      std::string metadata_pool = opts.find("metadata_pool") != opts.end() ? opts["metadata_pool"] : "";
+      return librmb::RmbCommands::delete_with_save_log(remove_save_log, rados_cluster, rados_user, &moved_items,
+                                                       window, dedup_pool, metadata_pool);
     } else {
       std::cout << "WARNING:" << std::endl;
       std::cout << "Performing this command, will delete all mail objects from ceph object store which are "
@@ -404,12 +467,12 @@ int main(int argc, const char **argv) {
 
   if (delete_mail_option) {
     if (opts["to_delete"].size() == 1 && opts["to_delete"].compare("-") == 0) {
-      if (rmb_commands->delete_namespace(ms, mail_objects, &ceph_cfg, confirmed) < 0) {
+      if (rmb_commands->delete_namespace(&ceph_cfg, confirmed, ms) < 0) {
         std::cerr << "error deleting namespace " << std::endl;
         release_exit(&mail_objects, &cluster, false);
       }
     } else {
-      if (rmb_commands->delete_mail(confirmed) < 0) {
+      if (rmb_commands->delete_mail(confirmed, ms) < 0) {
         std::cerr << "error deleting mail" << std::endl;
       }
     }
@@ -425,7 +488,7 @@ int main(int argc, const char **argv) {
   } else if (opts.find("ls") != opts.end()) {
     librmb::CmdLineParser parser(opts["ls"]);
     if (opts["ls"].compare("all") == 0 || opts["ls"].compare("-") == 0 || parser.parse_ls_string()) {
-      rmb_commands->load_objects(ms, mail_objects, sort_type);
+      rmb_commands->load_objects(ms, mail_objects, sort_type, true, &parser);
       rmb_commands->query_mail_storage(&mail_objects, &parser, false, false);
       std::cout << " NOTE: rmb tool does not have access to dovecot index. so all objects are set  <<<   MAIL OBJECT "
                    "HAS NO INDEX REFERENCE <<<< use doveadm rmb ls - instead "
@@ -438,8 +501,11 @@ int main(int argc, const char **argv) {
 
     if (opts["get"].compare("all") == 0 || opts["get"].compare("-") == 0 || parser.parse_ls_string()) {
       // get load all objects metadata into memory
-      rmb_commands->load_objects(ms, mail_objects, sort_type);
-      rmb_commands->query_mail_storage(&mail_objects, &parser, true, false);
+      rmb_commands->load_objects(ms, mail_objects, sort_type, true, &parser);
+      if (rmb_commands->query_mail_storage(&mail_objects, &parser, true, false) < 0) {
+        std::cerr << "error exporting mails" << std::endl;
+        exit_code = 1;
+      }
     }
   } else if (opts.find("set") != opts.end()) {
     rmb_commands->update_attributes(ms, &metadata);
@@ -450,4 +516,5 @@ int main(int argc, const char **argv) {
 
   // tear down.
   release_exit(&mail_objects, &cluster, false);
+  return exit_code;
 }
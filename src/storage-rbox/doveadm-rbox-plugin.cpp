@@ -55,11 +55,16 @@ extern "C" {
 #include "rados-dovecot-ceph-cfg.h"
 #include "rados-dovecot-ceph-cfg-impl.h"
 #include "rados-namespace-manager.h"
+#include "rados-mail-oid-index.h"
+#include "rados-metrics.h"
+#include "rados-dedup.h"
+#include "rados-util.h"
 #include "rbox-storage.h"
 #include "rbox-save.h"
+#include "rbox-mail.h"
 #include "rbox-storage.hpp"
 
-int check_namespace_mailboxes(const struct mail_namespace *ns, const std::list<librmb::RadosMail *> &mail_objects);
+int check_namespace_mailboxes(const struct mail_namespace *ns, const librmb::RadosMailOidIndex &oid_index);
 
 class RboxDoveadmPlugin {
  public:
@@ -166,6 +171,7 @@ static int cmd_rmb_search_run(std::map<std::string, std::string> &opts, struct m
   }
 
   opts["namespace"] = user->username;
+  opts["metadata_pool"] = plugin.config->get_metadata_pool();
   librmb::RmbCommands rmb_cmds(plugin.storage, plugin.cluster, &opts);
 
   std::string uid;
@@ -185,9 +191,11 @@ static int cmd_rmb_search_run(std::map<std::string, std::string> &opts, struct m
     return ret;
   }
   if (user->namespaces != NULL) {
+    // build the oid index once, so that each index record can be matched in constant time.
+    librmb::RadosMailOidIndex oid_index(mail_objects);
     struct mail_namespace *ns = mail_namespace_find_inbox(user->namespaces);
     for (; ns != NULL; ns = ns->next) {
-      check_namespace_mailboxes(ns, mail_objects);
+      check_namespace_mailboxes(ns, oid_index);
     }
   }
   if (download) {
@@ -313,6 +321,7 @@ static int cmd_rmb_set_run(struct doveadm_mail_cmd_context *ctx, struct mail_use
   std::map<std::string, std::string> opts;
   opts["set"] = oid;
   opts["namespace"] = user->username;
+  opts["metadata_pool"] = plugin.config->get_metadata_pool();
 
   librmb::RmbCommands rmb_cmds(plugin.storage, plugin.cluster, &opts);
 
@@ -375,6 +384,10 @@ static int cmd_rmb_delete_run(struct doveadm_mail_cmd_context *ctx, struct mail_
   std::map<std::string, std::string> opts;
   opts["to_delete"] = oid;
   opts["namespace"] = user->username;
+  if (!plugin.config->get_dedup_pool().empty()) {
+    opts["dedup_pool"] = plugin.config->get_dedup_pool();
+  }
+  opts["metadata_pool"] = plugin.config->get_metadata_pool();
 
   librmb::RmbCommands rmb_cmds(plugin.storage, plugin.cluster, &opts);
   librmb::RadosCephConfig *cfg = (static_cast<librmb::RadosDovecotCephCfgImpl *>(plugin.config))->get_rados_ceph_cfg();
@@ -387,7 +400,7 @@ static int cmd_rmb_delete_run(struct doveadm_mail_cmd_context *ctx, struct mail_
     ctx->exit_code = -1;
     return 0;
   }
-  ctx->exit_code = rmb_cmds.delete_mail(true);
+  ctx->exit_code = rmb_cmds.delete_mail(true, ms);
   if (ctx->exit_code < 0) {
     i_error("Error deleting mail. Errorcode: %d", ctx->exit_code);
   }
@@ -591,7 +604,10 @@ static int cmd_rmb_revert_log_run(struct doveadm_mail_cmd_context *ctx, struct m
   }
   std::map<std::string, std::list<librmb::RadosSaveLogEntry>> moved_items;
   ctx->exit_code = librmb::RmbCommands::delete_with_save_log(log_file, plugin.config->get_rados_cluster_name(),
-                                                             plugin.config->get_rados_username(), &moved_items) >= 0
+                                                             plugin.config->get_rados_username(), &moved_items,
+                                                             librmb::RmbCommands::DEFAULT_SCAN_WINDOW,
+                                                             plugin.config->get_dedup_pool(),
+                                                             plugin.config->get_metadata_pool()) >= 0
                        ? 0
                        : -1;
 
@@ -610,7 +626,7 @@ static int cmd_rmb_revert_log_run(struct doveadm_mail_cmd_context *ctx, struct m
 }
 
 static int iterate_mailbox(const struct mail_namespace *ns, const struct mailbox_info *info,
-                           const std::list<librmb::RadosMail *> &mail_objects) {
+                           const librmb::RadosMailOidIndex &oid_index) {
   int ret = 0;
   struct mailbox_transaction_context *mailbox_transaction;
   struct mail_search_context *search_ctx;
@@ -641,8 +657,15 @@ static int iterate_mailbox(const struct mail_namespace *ns, const struct mailbox
   std::cout << "box: " << info->vname << std::endl;
   int mail_count = 0;
   int mail_count_missing = 0;
+  int mail_count_packed = 0;
   while (mailbox_search_next(search_ctx, &mail)) {
     ++mail_count;
+    // packed mails are entries of a pack container, there is no object to check.
+    librmb::RadosMailPack::Location location;
+    if (rbox_mail_index_get_pack(mail->transaction->view, rbox->pack_ext_id, mail->seq, &location)) {
+      ++mail_count_packed;
+      continue;
+    }
     const struct obox_mail_index_record *obox_rec;
     const void *rec_data;
     mail_index_lookup_ext(mail->transaction->view, mail->seq, rbox->ext_id, &rec_data, NULL);
@@ -652,19 +675,11 @@ static int iterate_mailbox(const struct mail_namespace *ns, const struct mailbox
       std::cerr << "no valid extended header for mail with uid: " << mail->uid << std::endl;
       continue;
     }
-    std::string guid = guid_128_to_string(obox_rec->guid);
-    std::string oid = guid_128_to_string(obox_rec->oid);
-
-    auto it_mail = std::find_if(mail_objects.begin(), mail_objects.end(),
-                                [oid](librmb::RadosMail *m) { return m->get_oid()->compare(oid) == 0; });
-
-    if (it_mail == mail_objects.end()) {
-      /*  std::cout << "   missing mail object: uid=" << mail->uid << " guid=" << guid << " oid : " << oid
-                  << " available: " << (it_mail != mail_objects.end()) << std::doveadm-rbox-plugin.cpp:1108:113:endl;*/
+    librmb::RadosMail *rados_mail = oid_index.find(obox_rec->oid);
+    if (rados_mail == nullptr) {
       ++mail_count_missing;
     } else {
-      (*it_mail)->set_index_ref(true);
-      // mail_objects.erase(it_mail);  // calls destructor of RadosMail*
+      rados_mail->set_index_ref(true);
     }
   }
   if (mailbox_search_deinit(&search_ctx) < 0) {
@@ -674,8 +689,8 @@ static int iterate_mailbox(const struct mail_namespace *ns, const struct mailbox
     return -1;
   }
   mailbox_free(&box);
-  std::cout << "   mails total: " << mail_count << ", missing mails in objectstore: " << mail_count_missing
-            << std::endl;
+  std::cout << "   mails total: " << mail_count << ", packed mails: " << mail_count_packed
+            << ", missing mails in objectstore: " << mail_count_missing << std::endl;
 
   if (mail_count_missing > 0) {
     std::cout << "NOTE: you can fix(remove) the invalid index entries by using doveadm force-resync" << std::endl;
@@ -683,7 +698,7 @@ static int iterate_mailbox(const struct mail_namespace *ns, const struct mailbox
   return ret;
 }
 
-int check_namespace_mailboxes(const struct mail_namespace *ns, const std::list<librmb::RadosMail *> &mail_objects) {
+int check_namespace_mailboxes(const struct mail_namespace *ns, const librmb::RadosMailOidIndex &oid_index) {
   struct mailbox_list_iterate_context *iter;
   const struct mailbox_info *info;
   int ret = 0;
@@ -691,7 +706,7 @@ int check_namespace_mailboxes(const struct mail_namespace *ns, const std::list<l
                                                    MAILBOX_LIST_ITER_RAW_LIST | MAILBOX_LIST_ITER_RETURN_NO_FLAGS));
   while ((info = mailbox_list_iter_next(iter)) != NULL) {
     if ((info->flags & (MAILBOX_NONEXISTENT | MAILBOX_NOSELECT)) == 0) {
-      ret = iterate_mailbox(ns, info, mail_objects);
+      ret = iterate_mailbox(ns, info, oid_index);
       if (ret < 0) {
         ret = -1;
         break;
@@ -738,6 +753,7 @@ static int cmd_rmb_check_indices_run(struct doveadm_mail_cmd_context *ctx, struc
     return 0;
   }
   opts["namespace"] = user->username;
+  opts["metadata_pool"] = plugin.config->get_metadata_pool();
 
   librmb::RmbCommands rmb_cmds(plugin.storage, plugin.cluster, &opts);
   librmb::RadosCephConfig *cfg = (static_cast<librmb::RadosDovecotCephCfgImpl *>(plugin.config))->get_rados_ceph_cfg();
@@ -751,11 +767,32 @@ static int cmd_rmb_check_indices_run(struct doveadm_mail_cmd_context *ctx, struc
     return 0;
   }
 
+  // deduplicated mails release their body reference, the dedup pool defaults to the mail pool.
+  librmb::RadosDedup dedup;
+  if (ctx_->delete_not_referenced_objects) {
+    const std::string &dedup_pool =
+        plugin.config->get_dedup_pool().empty() ? plugin.config->get_pool_name() : plugin.config->get_dedup_pool();
+    int ret_dedup = dedup.open(plugin.cluster, dedup_pool);
+    if (ret_dedup < 0) {
+      i_warning("dedup pool %s not available (%d), references of deduplicated mails are not released",
+                dedup_pool.c_str(), ret_dedup);
+    }
+  }
+
   for (auto mo : mail_objects) {
     std::cout << mo->to_string("  ") << std::endl;
     if (open >= 0 && ctx_->delete_not_referenced_objects && !mo->is_index_ref()) {
-      std::cout << "mail object: " << mo->get_oid()->c_str()
-                << " deleted: " << (plugin.storage->delete_mail(mo) < 0 ? " FALSE " : " TRUE") << std::endl;
+      // the references of the mail are only known from its immutable metadata
+      ms->load_immutable_metadata(mo);
+      bool deleted = plugin.storage->delete_mail(mo) >= 0;
+      if (deleted) {
+        int ret_refs = librmb::RadosUtils::release_mail_refs(plugin.storage->get_io_ctx(), mo, &dedup);
+        if (ret_refs < 0) {
+          i_error("releasing references of mail object %s failed with %d", mo->get_oid()->c_str(), ret_refs);
+        }
+      }
+      std::cout << "mail object: " << mo->get_oid()->c_str() << " deleted: " << (deleted ? " TRUE" : " FALSE ")
+                << std::endl;
       ctx->exit_code = 2;
     }
     delete mo;
@@ -1105,3 +1142,20 @@ int cmd_rmb_version(int argc, char *argv[]) {
   std::cout << "Plugin version:: " << PACKAGE_VERSION << std::endl;
   return 0;
 }
+int cmd_rmb_stats(int argc, char *argv[]) {
+  RboxDoveadmPlugin plugin;
+  plugin.read_doveadm_plugin_configuration();
+  std::string metrics_file = argc > 1 && argv[1] != NULL ? argv[1] : plugin.config->get_metrics_file();
+  if (metrics_file.empty()) {
+    i_error("no metrics file given and rbox_metrics_file is not set");
+    return -1;
+  }
+  librmb::RadosMetrics metrics;
+  int ret = metrics.load_file(metrics_file);
+  if (ret < 0) {
+    i_error("Error reading metrics file %s. Errorcode: %d", metrics_file.c_str(), ret);
+    return -1;
+  }
+  std::cout << metrics.to_string();
+  return 0;
+}
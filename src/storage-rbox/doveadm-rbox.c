@@ -40,7 +40,8 @@ struct doveadm_cmd doveadm_cmd_rbox[] = {{(void *)cmd_rmb_config_show, "rmb conf
                                          {(void *)cmd_rmb_config_create, "rmb config create", NULL},
                                          {(void *)cmd_rmb_config_update, "rmb config update", "key=value"},
                                          {(void *)cmd_rmb_lspools, "rmb lspools", ""},
-                                         {(void *)cmd_rmb_version, "rmb version", ""}};
+                                         {(void *)cmd_rmb_version, "rmb version", ""},
+                                         {(void *)cmd_rmb_stats, "rmb stats", "[metrics file]"}};
 
 void doveadm_rbox_plugin_init(struct module *module ATTR_UNUSED) {
   unsigned int i;
@@ -65,3 +65,196 @@ struct istream *i_stream_create_from_bufferlist(librados::bufferlist *data, cons
   i_stream_set_name(&bstream->istream.istream, "(buffer)");
   return &bstream->istream.istream;
 }
+
+#define DECOMPRESS_READ_SIZE (32 * 1024)
+
+struct bufferlist_decompress_istream {
+  struct istream_private istream;
+  librados::bufferlist *bl;
+  librmb::RadosDecompressor *decompressor;
+  unsigned char *data;
+  size_t size;
+};
+
+static ssize_t i_stream_decompress_read(struct istream_private *stream) {
+  struct bufferlist_decompress_istream *dstream = (struct bufferlist_decompress_istream *)stream;
+  if (stream->pos >= dstream->size) {
+    stream->istream.eof = TRUE;
+    return -1;
+  }
+  // decompressed data is never discarded, so the buffer stays valid for seeks and snapshots.
+  size_t size = I_MIN(dstream->size - stream->pos, DECOMPRESS_READ_SIZE);
+  ssize_t ret = dstream->decompressor->read(reinterpret_cast<char *>(dstream->data) + stream->pos, size);
+  if (ret < 0) {
+    i_error("decompressing mail failed at offset %zu", stream->pos);
+    stream->istream.stream_errno = EINVAL;
+    return -1;
+  }
+  if (ret == 0) {
+    i_error("compressed mail is shorter than its uncompressed size (%zu < %zu)", stream->pos, dstream->size);
+    stream->istream.stream_errno = EINVAL;
+    return -1;
+  }
+  stream->pos += ret;
+  return ret;
+}
+
+static void i_stream_decompress_seek(struct istream_private *stream, uoff_t v_offset, bool mark ATTR_UNUSED) {
+  while (stream->pos < v_offset) {
+    if (i_stream_decompress_read(stream) < 0) {
+      v_offset = stream->pos;
+      break;
+    }
+  }
+  stream->skip = v_offset;
+  stream->istream.v_offset = v_offset;
+}
+
+static void rbox_decompress_istream_destroy(struct iostream_private *stream) {
+  struct bufferlist_decompress_istream *dstream = (struct bufferlist_decompress_istream *)stream;
+  delete dstream->decompressor;
+  delete dstream->bl;
+  i_free(dstream->data);
+}
+
+struct istream *i_stream_create_from_compressed_bufferlist(librados::bufferlist *data,
+                                                          librmb::RadosDecompressor *decompressor, const size_t &size) {
+  struct bufferlist_decompress_istream *dstream;
+
+  dstream = i_new(struct bufferlist_decompress_istream, 1);
+  dstream->data = (unsigned char *)i_malloc(I_MAX(size, 1));
+  dstream->size = size;
+  dstream->bl = data;
+  dstream->decompressor = decompressor;
+
+  dstream->istream.buffer = dstream->data;
+  dstream->istream.pos = 0;
+  dstream->istream.max_buffer_size = I_MAX(size, 1);
+
+  dstream->istream.read = i_stream_decompress_read;
+  dstream->istream.seek = i_stream_decompress_seek;
+
+  dstream->istream.istream.readable_fd = FALSE;
+  dstream->istream.istream.blocking = TRUE;
+  dstream->istream.istream.seekable = TRUE;
+  dstream->istream.iostream.destroy = rbox_decompress_istream_destroy;
+
+#if DOVECOT_PREREQ(2, 3)
+  i_stream_create(&dstream->istream, NULL, -1, ISTREAM_CREATE_FLAG_NOOP_SNAPSHOT);
+#else
+  i_stream_create(&dstream->istream, NULL, -1);
+#endif
+  dstream->istream.statbuf.st_size = size;
+  i_stream_set_name(&dstream->istream.istream, "(compressed buffer)");
+  return &dstream->istream.istream;
+}
+
+struct bufferlist_stripes_istream {
+  struct istream_private istream;
+  librados::bufferlist *bl;
+  librados::IoCtx *io_ctx;
+  std::string *oid;
+  librmb::RadosStriping::Manifest *manifest;
+  // stripes which have been read into data
+  bool *loaded;
+  unsigned char *data;
+};
+
+static bool i_stream_stripes_load(struct bufferlist_stripes_istream *sstream, uint32_t index) {
+  if (sstream->loaded[index]) {
+    return true;
+  }
+  uint64_t offset = static_cast<uint64_t>(index) * sstream->manifest->stripe_size;
+  librados::bufferlist bl;
+  int ret = librmb::RadosStriping::read(*sstream->io_ctx, *sstream->oid, *sstream->manifest, offset,
+                                        sstream->manifest->stripe_size, &bl);
+  if (ret < 0) {
+    i_error("reading stripe %u of mail %s failed: %d", index, sstream->oid->c_str(), ret);
+    sstream->istream.istream.stream_errno = EIO;
+    return false;
+  }
+  memcpy(sstream->data + offset, bl.c_str(), bl.length());
+  sstream->loaded[index] = true;
+  return true;
+}
+
+/* end of the read data which follows offset */
+static size_t i_stream_stripes_loaded_end(struct bufferlist_stripes_istream *sstream, size_t offset) {
+  uint32_t index = offset / sstream->manifest->stripe_size;
+  while (index < sstream->manifest->count && sstream->loaded[index]) {
+    index++;
+  }
+  return I_MIN(static_cast<uint64_t>(index) * sstream->manifest->stripe_size, sstream->manifest->size);
+}
+
+static ssize_t i_stream_stripes_read(struct istream_private *stream) {
+  struct bufferlist_stripes_istream *sstream = (struct bufferlist_stripes_istream *)stream;
+  if (stream->pos >= sstream->manifest->size) {
+    stream->istream.eof = TRUE;
+    return -1;
+  }
+  if (!i_stream_stripes_load(sstream, stream->pos / sstream->manifest->stripe_size)) {
+    return -1;
+  }
+  size_t end = i_stream_stripes_loaded_end(sstream, stream->pos);
+  ssize_t ret = end - stream->pos;
+  stream->pos = end;
+  return ret;
+}
+
+static void i_stream_stripes_seek(struct istream_private *stream, uoff_t v_offset, bool mark ATTR_UNUSED) {
+  struct bufferlist_stripes_istream *sstream = (struct bufferlist_stripes_istream *)stream;
+  // read data is never discarded, the stripes before v_offset are only read if the stream seeks back to them.
+  stream->skip = v_offset;
+  stream->istream.v_offset = v_offset;
+  stream->pos = v_offset;
+  if (v_offset < sstream->manifest->size) {
+    stream->pos = i_stream_stripes_loaded_end(sstream, v_offset);
+  }
+}
+
+static void rbox_stripes_istream_destroy(struct iostream_private *stream) {
+  struct bufferlist_stripes_istream *sstream = (struct bufferlist_stripes_istream *)stream;
+  delete sstream->io_ctx;
+  delete sstream->oid;
+  delete sstream->manifest;
+  delete sstream->bl;
+  i_free(sstream->loaded);
+  i_free(sstream->data);
+}
+
+struct istream *i_stream_create_from_stripes(librados::IoCtx &io_ctx, const std::string &oid,
+                                             const librmb::RadosStriping::Manifest &manifest,
+                                             librados::bufferlist *data) {
+  struct bufferlist_stripes_istream *sstream;
+
+  sstream = i_new(struct bufferlist_stripes_istream, 1);
+  sstream->bl = data;
+  sstream->io_ctx = new librados::IoCtx();
+  sstream->io_ctx->dup(io_ctx);
+  sstream->oid = new std::string(oid);
+  sstream->manifest = new librmb::RadosStriping::Manifest(manifest);
+  sstream->loaded = i_new(bool, I_MAX(manifest.count, 1));
+  sstream->data = (unsigned char *)i_malloc(I_MAX(manifest.size, 1));
+
+  sstream->istream.buffer = sstream->data;
+  sstream->istream.pos = 0;
+  sstream->istream.max_buffer_size = I_MAX(manifest.size, 1);
+
+  sstream->istream.read = i_stream_stripes_read;
+  sstream->istream.seek = i_stream_stripes_seek;
+
+  sstream->istream.istream.readable_fd = FALSE;
+  sstream->istream.istream.blocking = TRUE;
+  sstream->istream.istream.seekable = TRUE;
+  sstream->istream.iostream.destroy = rbox_stripes_istream_destroy;
+
+#if DOVECOT_PREREQ(2, 3)
+  i_stream_create(&sstream->istream, NULL, -1, ISTREAM_CREATE_FLAG_NOOP_SNAPSHOT);
+#else
+  i_stream_create(&sstream->istream, NULL, -1);
+#endif
+  sstream->istream.statbuf.st_size = manifest.size;
+  i_stream_set_name(&sstream->istream.istream, "(striped buffer)");
+  return &sstream->istream.istream;
+}
@@ -11,6 +11,8 @@
  */
 
 #include <rados/librados.hpp>
+#include "rados-compression.h"
+#include "rados-striping.h"
 
 #ifndef SRC_STORAGE_RBOX_ISTREAM_BUFFERLIST_H_
 #define SRC_STORAGE_RBOX_ISTREAM_BUFFERLIST_H_
@@ -20,5 +22,24 @@
  * @param[in] size size of initial buffer.
  */
 struct istream *i_stream_create_from_bufferlist(librados::bufferlist *data, const size_t &size);
+/**
+ * @brief: creates a istream which decompresses the given librados:bufferlist while it is read.
+ * @param[in] data valid pointer to the compressed bufferlist, owned by the istream.
+ * @param[in] decompressor decompressor reading from data, owned by the istream.
+ * @param[in] size uncompressed size of the mail.
+ */
+struct istream *i_stream_create_from_compressed_bufferlist(librados::bufferlist *data,
+                                                          librmb::RadosDecompressor *decompressor, const size_t &size);
+/**
+ * @brief: creates a istream which reads the stripes of a striped mail while it is read. Only the stripes covering
+ *         the read (or seeked) range are read.
+ * @param[in] io_ctx io context of the mail object, duplicated by the istream.
+ * @param[in] oid oid of the mail object.
+ * @param[in] manifest stripes of the mail.
+ * @param[in] data valid pointer to the (empty) mail buffer, owned by the istream.
+ */
+struct istream *i_stream_create_from_stripes(librados::IoCtx &io_ctx, const std::string &oid,
+                                             const librmb::RadosStriping::Manifest &manifest,
+                                             librados::bufferlist *data);
 
 #endif /* SRC_STORAGE_RBOX_ISTREAM_BUFFERLIST_H_ */
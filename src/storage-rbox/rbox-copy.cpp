@@ -28,6 +28,7 @@ extern "C" {
 #include "rbox-mail.h"
 #include "rbox-save.h"
 #include "rbox-sync.h"
+#include "rbox-event.h"
 #include "rbox-copy.h"
 #include "rados-util.h"
 
@@ -47,6 +48,13 @@ int rbox_mail_copy(struct mail_save_context *_ctx, struct mail *mail) {
 
   r_ctx->copying = _ctx->saving != TRUE && strcmp(mail->box->storage->name, "rbox") == 0 &&
                    strcmp(mail->box->storage->name, storage_name) == 0;
+  librmb::RadosMailPack::Location pack_location;
+  if (r_ctx->copying && rbox_mail_index_get_pack(mail->transaction->view,
+                                                 ((struct rbox_mailbox *)mail->box)->pack_ext_id, mail->seq,
+                                                 &pack_location)) {
+    // packed mails have no object of their own, they are saved (and packed) again.
+    r_ctx->copying = FALSE;
+  }
 
   int ret = rbox_mail_storage_copy(_ctx, mail);
   // cppcheck-suppress redundantAssignment
@@ -105,6 +113,25 @@ static int rbox_mail_save_copy_default_metadata(struct mail_save_context *ctx, s
   return 0;
 }
 
+/* size of the source mail if it is known without reading from rados, (uoff_t)-1 otherwise */
+static uoff_t rbox_mail_copy_known_size(struct rbox_mail *rmail, uoff_t data_size, enum rbox_metadata_key key) {
+  if (data_size != (uoff_t)-1) {
+    return data_size;
+  }
+  char *value = NULL;
+  librmb::RadosUtils::get_metadata(key, rmail->rados_mail->get_metadata(), &value);
+  if (value == NULL) {
+    return (uoff_t)-1;
+  }
+  try {
+    return std::stoull(value);
+  } catch (const std::invalid_argument &e) {
+    return (uoff_t)-1;
+  } catch (const std::out_of_range &e) {
+    return (uoff_t)-1;
+  }
+}
+
 static void set_mailbox_metadata(struct mail_save_context *ctx, std::list<librmb::RadosMetadata> *metadata_update) {
   {
     FUNC_START();
@@ -174,6 +201,84 @@ static void mail_copy_set_failed(struct mail_save_context *ctx, struct mail *mai
   errstr = mail_storage_get_last_error(mail->box->storage, &error);
   mail_storage_set_error(ctx->transaction->box->storage, error, t_strdup_printf("%s (%s)", errstr, func));
 }
+/* a copy of a deduplicated mail references the same body (RBOX_METADATA_EXT_REF is copied with the object),
+   a copy of a striped mail gets its own stripes (RBOX_METADATA_STRIPES is copied with the object). Both are
+   decided from the metadata of the source mail. If it is not loaded yet, its immutable metadata is read
+   asynchronously, together with the copy of the object. */
+struct rbox_copy_body_refs {
+  librmb::RadosMail source;
+  librados::IoCtx io_ctx;
+  librados::ObjectReadOperation read_op;
+  std::map<std::string, ceph::bufferlist> xattrs;
+  int xattrs_ret;
+  librados::AioCompletion *completion;
+  int ret;
+};
+
+static void copy_body_refs_start(struct rbox_storage *r_storage, librmb::RadosStorage *rados_storage,
+                                 librmb::RadosMail *source, const std::string *ns_src,
+                                 struct rbox_copy_body_refs *refs) {
+  refs->completion = nullptr;
+  refs->xattrs_ret = 0;
+  refs->ret = 0;
+  refs->source.set_oid(*source->get_oid());
+  if (source->get_metadata()->size() > 0) {
+    *refs->source.get_metadata() = *source->get_metadata();
+    return;
+  }
+  refs->io_ctx.dup(rados_storage->get_io_ctx());
+  refs->io_ctx.set_namespace(*ns_src);
+  librmb::RadosStorageMetadataModule *ms = r_storage->ms->get_storage();
+  ms->set_io_ctx(&refs->io_ctx);
+  librados::IoCtx *metadata_io_ctx = ms->read_immutable_metadata(&refs->read_op, &refs->xattrs, &refs->xattrs_ret);
+  if (metadata_io_ctx == nullptr) {
+    refs->ret = ms->load_immutable_metadata(&refs->source);
+  } else {
+    refs->completion = librados::Rados::aio_create_completion();
+    refs->ret = rados_storage->aio_operate(metadata_io_ctx, *refs->source.get_oid(), refs->completion,
+                                           &refs->read_op, librmb::RadosReplicaReads::global().get_flags(), nullptr);
+    if (refs->ret < 0) {
+      refs->completion->release();
+      refs->completion = nullptr;
+    }
+  }
+  ms->set_io_ctx(&rados_storage->get_io_ctx());
+}
+
+/* wait for the metadata read of the source (also needed if the copy failed) */
+static int copy_body_refs_wait(struct rbox_storage *r_storage, struct rbox_copy_body_refs *refs) {
+  if (refs->completion != nullptr) {
+    refs->completion->wait_for_complete();
+    refs->ret = refs->completion->get_return_value();
+    refs->completion->release();
+    refs->completion = nullptr;
+    if (refs->ret >= 0) {
+      refs->ret = refs->xattrs_ret < 0 ? refs->xattrs_ret
+                                       : r_storage->ms->get_storage()->decode_immutable_metadata(&refs->source,
+                                                                                                 &refs->xattrs);
+    }
+  }
+  return refs->ret;
+}
+
+static int copy_body_refs(struct rbox_storage *r_storage, librmb::RadosStorage *rados_storage,
+                          struct rbox_copy_body_refs *refs, const std::string &oid) {
+  int ret = copy_body_refs_wait(r_storage, refs);
+  if (ret < 0) {
+    return ret;
+  }
+  const char *hash = refs->source.get_metadata(rbox_metadata_key::RBOX_METADATA_EXT_REF);
+  if (hash != NULL) {
+    // also if rbox_dedup has been disabled since, the body is released with the last reference.
+    return r_storage->dedup->add_ref(hash, oid);
+  }
+  librmb::RadosStriping::Manifest manifest;
+  if (librmb::RadosStriping::get_manifest(&refs->source, &manifest)) {
+    return librmb::RadosStriping::copy(rados_storage->get_io_ctx(), *refs->source.get_oid(), oid, manifest);
+  }
+  return 0;
+}
+
 static int copy_mail(struct mail_save_context *ctx, librmb::RadosStorage *rados_storage, struct rbox_mail *rmail,
                      const std::string *ns_src, const std::string *ns_dest) {
   struct rbox_save_context *r_ctx = (struct rbox_save_context *)ctx;
@@ -188,7 +293,25 @@ static int copy_mail(struct mail_save_context *ctx, librmb::RadosStorage *rados_
 
   set_mailbox_metadata(ctx, &metadata_update);
 
+  struct rbox_copy_body_refs refs;
+  copy_body_refs_start(r_storage, rados_storage, rmail->rados_mail, ns_src, &refs);
   int ret_val = rados_storage->copy(src_oid, ns_src->c_str(), dest_oid, ns_dest->c_str(), metadata_update);
+  if (ret_val >= 0) {
+    // metadata stored in a separate pool is copied on its own.
+    ret_val = r_storage->ms->get_storage()->copy_metadata(src_oid, ns_src->c_str(), dest_oid, ns_dest->c_str(),
+                                                          metadata_update, false);
+    if (ret_val >= 0) {
+      ret_val = copy_body_refs(r_storage, rados_storage, &refs, dest_oid);
+      if (ret_val < 0) {
+        r_storage->ms->get_storage()->remove_metadata(dest_oid);
+      }
+    }
+    if (ret_val < 0) {
+      // without a reference or stripes the body may be released with the source (-ENOENT: already released).
+      rados_storage->delete_mail(dest_oid);
+    }
+  }
+  copy_body_refs_wait(r_storage, &refs);
   if (ret_val < 0) {
     if (ret_val == -ENOENT) {
       i_warning(
@@ -239,6 +362,11 @@ static int move_mail(struct mail_save_context *ctx, librmb::RadosStorage *rados_
   bool delete_source = true;
   int ret_val =
       rados_storage->move(src_oid, ns_src->c_str(), dest_oid, ns_dest->c_str(), metadata_update, delete_source);
+  if (ret_val >= 0) {
+    // metadata stored in a separate pool is moved on its own.
+    ret_val = r_storage->ms->get_storage()->copy_metadata(src_oid, ns_src->c_str(), dest_oid, ns_dest->c_str(),
+                                                          metadata_update, delete_source);
+  }
   if (ret_val < 0) {
     if (ret_val == -ENOENT) {
       i_warning(
@@ -279,9 +407,12 @@ static int move_mail(struct mail_save_context *ctx, librmb::RadosStorage *rados_
     metadata.push_back(&uid);
     metadata.push_back(&guid);
 
-    r_storage->save_log->append(librmb::RadosSaveLogEntry(
-        dest_oid, *ns_dest, rados_storage->get_pool_name(),
-        librmb::RadosSaveLogEntry::op_mv(*ns_src, src_oid, dest_mbox->list->ns->owner->username, metadata)));
+    if (!r_storage->save_log->append(librmb::RadosSaveLogEntry(
+            dest_oid, *ns_dest, rados_storage->get_pool_name(),
+            librmb::RadosSaveLogEntry::op_mv(*ns_src, src_oid, dest_mbox->list->ns->owner->username, metadata)))) {
+      i_error("move of %s (ns=%s) not written to the save log: entry too long", dest_oid.c_str(),
+              ns_dest->c_str());
+    }
   }
 #ifdef DEBUG
   i_debug("move successfully finished from %s (ns=%s) to %s (ns=%s)", src_oid.c_str(), ns_src->c_str(), src_oid.c_str(),
@@ -321,8 +452,14 @@ static int rbox_mail_storage_try_copy(struct mail_save_context **_ctx, struct ma
     }
 
     librmb::RadosStorage *rados_storage = !from_alt_storage ? r_storage->s : r_storage->alt;
+    struct rbox_op_event copy_event;
+    rbox_op_event_begin(&copy_event, dest_mbox, rados_storage,
+                        ctx->moving ? "rbox_mail_move_finished" : "rbox_mail_copy_finished",
+                        rmail->rados_mail->get_oid()->c_str());
+    rbox_op_event_add_str(&copy_event, "src_namespace", ns_src.c_str());
     if (ctx->moving != TRUE) {
       if (copy_mail(ctx, rados_storage, rmail, &ns_src, &ns_dest) < 0) {
+        rbox_op_event_end(&copy_event, -1, 0);
         FUNC_END_RET("ret == -1, copy mail failed");
         return -1;
       }
@@ -337,11 +474,33 @@ static int rbox_mail_storage_try_copy(struct mail_save_context **_ctx, struct ma
       }
       T_END;
       if (ret < 0) {
+        rbox_op_event_end(&copy_event, ret, 0);
         return ret;
       }
     }
+    // copies are done by the osd, no mail data is transferred.
+    rbox_op_event_end(&copy_event, 0, 0);
 
     index_copy_cache_fields(ctx, mail, r_ctx->seq);
+    struct index_mail_data *src_data = &rmail->imail.data;
+    struct obox_mail_index_stat_record src_stat;
+    rbox_mail_get_index_stat(mail, &src_stat);
+    uoff_t physical_size =
+        rbox_mail_copy_known_size(rmail, src_data->physical_size, rbox_metadata_key::RBOX_METADATA_PHYSICAL_SIZE);
+    if (physical_size == (uoff_t)-1 && src_stat.physical_size != 0) {
+      physical_size = src_stat.physical_size;
+    }
+    uoff_t virtual_size =
+        rbox_mail_copy_known_size(rmail, src_data->virtual_size, rbox_metadata_key::RBOX_METADATA_VIRTUAL_SIZE);
+    rbox_save_add_cache_fields(r_ctx, physical_size, virtual_size);
+
+    // a copy is a new object, a moved object keeps its save date.
+    time_t save_date = ioloop_time;
+    if (ctx->moving) {
+      save_date = src_data->save_date != (time_t)-1 ? src_data->save_date : (time_t)src_stat.save_date;
+    }
+    rbox_mail_index_set_stat(r_ctx->trans, ((struct rbox_mailbox *)dest_mbox)->stat_ext_id, r_ctx->seq, save_date,
+                             physical_size);
     if (ctx->dest_mail != NULL) {
       mail_set_seq_saving(ctx->dest_mail, r_ctx->seq);
     }
@@ -0,0 +1,81 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "dovecot-ceph-plugin-config.h"
+#endif
+
+#include <string>
+
+extern "C" {
+#include "dovecot-all.h"
+}
+
+#include "../librmb/rados-storage.h"
+#include "../librmb/rados-metrics.h"
+#include "rbox-event.h"
+
+void rbox_op_event_begin(struct rbox_op_event *op, struct mailbox *box, librmb::RadosStorage *storage,
+                         const char *name, const char *oid) {
+  op->event = NULL;
+  op->start = librmb::RadosMetrics::now_usecs();
+#if DOVECOT_PREREQ(2, 3)
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_MAILBOX_EVENT
+  op->event = event_create(box != NULL ? box->event : NULL);
+#else
+  op->event = event_create(NULL);
+#endif
+  event_set_name(op->event, name);
+  if (oid != NULL) {
+    event_add_str(op->event, "oid", oid);
+  }
+  if (storage != nullptr) {
+    event_add_str(op->event, "pool", storage->get_pool_name().c_str());
+    event_add_str(op->event, "namespace", storage->get_namespace().c_str());
+  }
+#endif
+}
+
+void rbox_op_event_add_str(struct rbox_op_event *op, const char *key, const char *value) {
+#if DOVECOT_PREREQ(2, 3)
+  if (op->event != NULL && value != NULL) {
+    event_add_str(op->event, key, value);
+  }
+#endif
+}
+
+void rbox_op_event_add_int(struct rbox_op_event *op, const char *key, int64_t value) {
+#if DOVECOT_PREREQ(2, 3)
+  if (op->event != NULL) {
+    event_add_int(op->event, key, value);
+  }
+#endif
+}
+
+void rbox_op_event_end(struct rbox_op_event *op, int ret, uint64_t bytes) {
+#if DOVECOT_PREREQ(2, 3)
+  if (op->event == NULL) {
+    return;
+  }
+  // the ioloop time does not advance during blocking rados calls, so the duration is measured here.
+  uint64_t usecs = librmb::RadosMetrics::now_usecs() - op->start;
+  event_add_int(op->event, "bytes", bytes);
+  event_add_int(op->event, "rados_usecs", usecs);
+  if (ret < 0) {
+    event_add_int(op->event, "error", ret);
+  }
+  // the event and its fields are built for every operation; e_debug only formats the message if debugging or a
+  // metric filter wants the event.
+  e_debug(op->event, "finished with %d: %llu bytes in %llu usecs", ret, (unsigned long long)bytes,  // NOLINT
+          (unsigned long long)usecs);                                                            // NOLINT
+  event_unref(&op->event);
+#endif
+}
@@ -0,0 +1,54 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_STORAGE_RBOX_RBOX_EVENT_H_
+#define SRC_STORAGE_RBOX_RBOX_EVENT_H_
+
+#include <stdint.h>
+
+struct event;
+struct mailbox;
+namespace librmb {
+class RadosStorage;
+}
+
+/**
+ * rbox storage operation, sent as dovecot event "rbox_<op>_finished" with
+ * the fields oid, pool, namespace, bytes, rados_usecs and error (on failure).
+ * The event is a child of the mailbox event, so metric filters can group by
+ * user, mailbox and command. The event is created for every operation, even
+ * if no filter consumes it. Without event support (dovecot < 2.3) the
+ * functions do nothing.
+ */
+struct rbox_op_event {
+  struct event *event;
+  uint64_t start;
+};
+
+/*!
+ * start the operation.
+ * @param[in] box parent mailbox or NULL
+ * @param[in] storage rados storage (pool and namespace) or nullptr
+ * @param[in] name event name e.g. rbox_mail_read_finished
+ * @param[in] oid object id of the mail or NULL
+ */
+void rbox_op_event_begin(struct rbox_op_event *op, struct mailbox *box, librmb::RadosStorage *storage,
+                         const char *name, const char *oid);
+void rbox_op_event_add_str(struct rbox_op_event *op, const char *key, const char *value);
+void rbox_op_event_add_int(struct rbox_op_event *op, const char *key, int64_t value);
+/*!
+ * send the event and free it.
+ * @param[in] ret result of the operation, < 0 sets the field error
+ * @param[in] bytes bytes read or written
+ */
+void rbox_op_event_end(struct rbox_op_event *op, int ret, uint64_t bytes);
+
+#endif /* SRC_STORAGE_RBOX_RBOX_EVENT_H_ */
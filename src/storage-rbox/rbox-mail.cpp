@@ -41,7 +41,10 @@ extern "C" {
 #include "../librmb/rados-storage-impl.h"
 #include "istream-bufferlist.h"
 #include "rbox-mail.h"
+#include "rbox-event.h"
 #include "rados-util.h"
+#include "rados-metrics.h"
+#include "rados-replica-reads.h"
 
 using librmb::RadosMail;
 using librmb::rbox_metadata_key;
@@ -78,6 +81,71 @@ int rbox_get_index_record(struct mail *_mail) {
   return 0;
 }
 
+void rbox_mail_get_index_stat(struct mail *_mail, struct obox_mail_index_stat_record *rec_r) {
+  struct rbox_mailbox *rbox = (struct rbox_mailbox *)_mail->transaction->box;
+  const void *rec_data = NULL;
+
+  i_zero(rec_r);
+  mail_index_lookup_ext(_mail->transaction->view, _mail->seq, rbox->stat_ext_id, &rec_data, NULL);
+  if (rec_data != NULL) {
+    memcpy(rec_r, rec_data, sizeof(*rec_r));
+  }
+}
+
+void rbox_mail_index_set_stat(struct mail_index_transaction *trans, uint32_t stat_ext_id, uint32_t seq,
+                              time_t save_date, uoff_t physical_size) {
+  struct obox_mail_index_stat_record rec;
+  i_zero(&rec);
+  rec.save_date = save_date > 0 ? save_date : 0;
+  rec.physical_size = physical_size != (uoff_t)-1 ? physical_size : 0;
+  mail_index_update_ext(trans, seq, stat_ext_id, &rec, NULL);
+}
+
+bool rbox_mail_index_get_pack(struct mail_index_view *view, uint32_t pack_ext_id, uint32_t seq,
+                              librmb::RadosMailPack::Location *location_r) {
+  const void *rec_data = NULL;
+  mail_index_lookup_ext(view, seq, pack_ext_id, &rec_data, NULL);
+  if (rec_data == NULL) {
+    return false;
+  }
+  const struct obox_mail_index_pack_record *rec = static_cast<const struct obox_mail_index_pack_record *>(rec_data);
+  location_r->container = rec->container;
+  location_r->offset = rec->offset;
+  location_r->length = rec->length;
+  return location_r->container != 0;
+}
+
+void rbox_mail_index_set_pack(struct mail_index_transaction *trans, uint32_t pack_ext_id, uint32_t seq,
+                              const librmb::RadosMailPack::Location &location) {
+  struct obox_mail_index_pack_record rec;
+  i_zero(&rec);
+  rec.container = location.container;
+  rec.offset = location.offset;
+  rec.length = location.length;
+  mail_index_update_ext(trans, seq, pack_ext_id, &rec, NULL);
+}
+
+/* the container of a packed mail may have been compacted and removed by another session after the view of the
+   mail was synced. Before the mail is treated as expunged, its location is looked up in the refreshed index.
+   @return true if the mail is still in the index with another location (location is updated) */
+static bool rbox_mail_refresh_pack_location(struct mail *mail, librmb::RadosMailPack::Location *location) {
+  struct rbox_mailbox *rbox = (struct rbox_mailbox *)mail->box;
+  if (mail_index_refresh(mail->box->index) < 0) {
+    return false;
+  }
+  struct mail_index_view *view = mail_index_view_open(mail->box->index);
+  uint32_t seq;
+  librmb::RadosMailPack::Location current;
+  bool moved = mail_index_lookup_seq(view, mail->uid, &seq) &&
+               rbox_mail_index_get_pack(view, rbox->pack_ext_id, seq, &current) &&
+               (current.container != location->container || current.offset != location->offset);
+  mail_index_view_close(&view);
+  if (moved) {
+    *location = current;
+  }
+  return moved;
+}
+
 struct mail *rbox_mail_alloc(struct mailbox_transaction_context *t, enum mail_fetch_field wanted_fields,
                              struct mailbox_header_lookup_ctx *wanted_headers) {
   FUNC_START();
@@ -109,14 +177,28 @@ static int rbox_mail_metadata_get(struct rbox_mail *rmail, enum rbox_metadata_ke
     return -1;
   }
 
-  // update metadata storage io_ctx and load metadata
-  if (alt_storage) {
-    r_storage->ms->get_storage()->set_io_ctx(&r_storage->alt->get_io_ctx());
+  int ret_load_metadata;
+  struct rbox_mailbox *rbox = (struct rbox_mailbox *)mail->box;
+  librmb::RadosMailPack::Location pack_location;
+  if (!alt_storage && rbox_mail_index_get_pack(mail->transaction->view, rbox->pack_ext_id, mail->seq, &pack_location)) {
+    // the metadata of packed mails is part of their container entry
+    ret_load_metadata = librmb::RadosMailPack::load_metadata(
+        r_storage->s->get_io_ctx(), guid_128_to_string(rbox->mailbox_guid), pack_location.container, rmail->rados_mail);
+    if (ret_load_metadata == -ENOENT && rbox_mail_refresh_pack_location(mail, &pack_location)) {
+      ret_load_metadata =
+          librmb::RadosMailPack::load_metadata(r_storage->s->get_io_ctx(), guid_128_to_string(rbox->mailbox_guid),
+                                               pack_location.container, rmail->rados_mail);
+    }
   } else {
-    r_storage->ms->get_storage()->set_io_ctx(&r_storage->s->get_io_ctx());
+    // update metadata storage io_ctx and load metadata
+    if (alt_storage) {
+      r_storage->ms->get_storage()->set_io_ctx(&r_storage->alt->get_io_ctx());
+    } else {
+      r_storage->ms->get_storage()->set_io_ctx(&r_storage->s->get_io_ctx());
+    }
+    // only immutable attributes are read here, flags and keywords come from the index
+    ret_load_metadata = r_storage->ms->get_storage()->load_immutable_metadata(rmail->rados_mail);
   }
-
-  int ret_load_metadata = r_storage->ms->get_storage()->load_metadata(rmail->rados_mail);
   if (ret_load_metadata < 0) {
     std::string metadata_key = librmb::rbox_metadata_key_to_char(key);
     if (ret_load_metadata == -ENOENT) {
@@ -219,6 +301,13 @@ static int rbox_mail_get_save_date(struct mail *_mail, time_t *date_r) {
     FUNC_END_RET("ret == 0");
     return 0;
   }
+  struct obox_mail_index_stat_record stat_rec;
+  rbox_mail_get_index_stat(_mail, &stat_rec);
+  if (stat_rec.save_date != 0) {
+    *date_r = data->save_date = stat_rec.save_date;
+    FUNC_END_RET("ret == 0; index record");
+    return 0;
+  }
   if (rmail->rados_mail->get_rados_save_date() != -1) {
     *date_r = data->save_date = rmail->rados_mail->get_rados_save_date();
     return 0;
@@ -240,6 +329,9 @@ static int rbox_mail_get_save_date(struct mail *_mail, time_t *date_r) {
   }
   // check if this is null
   *date_r = data->save_date = save_date_rados;
+  // stat only once, the next lookup is served by the index.
+  rbox_mail_index_set_stat(_mail->transaction->itrans, ((struct rbox_mailbox *)_mail->box)->stat_ext_id, _mail->seq,
+                           save_date_rados, stat_rec.physical_size != 0 ? stat_rec.physical_size : (uoff_t)-1);
 
   FUNC_END();
   return 0;
@@ -317,6 +409,13 @@ static int rbox_mail_get_physical_size(struct mail *_mail, uoff_t *size_r) {
     FUNC_END_RET("ret == 0");
     return 0;
   }
+  struct obox_mail_index_stat_record stat_rec;
+  rbox_mail_get_index_stat(_mail, &stat_rec);
+  if (stat_rec.physical_size != 0) {
+    *size_r = data->physical_size = stat_rec.physical_size;
+    FUNC_END_RET("ret == 0; index record");
+    return 0;
+  }
 
   if (rmail->rados_mail == nullptr) {
     // Mail already deleted
@@ -339,6 +438,8 @@ static int rbox_mail_get_physical_size(struct mail *_mail, uoff_t *size_r) {
   }
   try {
     *size_r = data->physical_size = std::stol(value);
+    rbox_mail_index_set_stat(_mail->transaction->itrans, ((struct rbox_mailbox *)_mail->box)->stat_ext_id,
+                             _mail->seq, stat_rec.save_date, data->physical_size);
   } catch (const std::invalid_argument &e) {
     ret = -1;
     std::string oid = rmail->rados_mail != nullptr ? *rmail->rados_mail->get_oid() : "";
@@ -359,12 +460,118 @@ static int rbox_mail_get_physical_size(struct mail *_mail, uoff_t *size_r) {
   return ret;
 }
 
-static int get_mail_stream(struct rbox_mail *mail, librados::bufferlist *buffer, const size_t physical_size,
+/* mails compressed by librmb (rbox_compression) carry the codec in the metadata. The frame magic is checked
+   first, so the metadata is only loaded for mails which may be compressed. */
+static int get_mail_decompressor(struct rbox_mail *mail, librados::bufferlist *buffer, const size_t physical_size,
+                                 librmb::RadosDecompressor **decompressor_r, uint64_t *uncompressed_size_r) {
+  *decompressor_r = nullptr;
+  if (!librmb::RadosCompression::has_frame_magic(buffer->c_str(), physical_size)) {
+    return 0;
+  }
+  char *value = NULL;
+  if (rbox_mail_metadata_get(mail, rbox_metadata_key::RBOX_METADATA_COMPRESSION, &value) < 0) {
+    // not compressed by librmb (e.g. zlib plugin)
+    return 0;
+  }
+  i_free(value);
+
+  librmb::rbox_compression_codec codec;
+  if (!librmb::RadosCompression::get_compression(mail->rados_mail, &codec, uncompressed_size_r)) {
+    return 0;
+  }
+  if (*uncompressed_size_r == 0) {
+    // size unknown, decompress the whole buffer
+    if (librmb::RadosCompression::decompress(mail->rados_mail) < 0) {
+      i_error("decompressing mail %s failed", mail->rados_mail->get_oid()->c_str());
+      return -1;
+    }
+    *uncompressed_size_r = buffer->length();
+    return 0;
+  }
+  *decompressor_r = librmb::RadosCompression::create_decompressor(codec, buffer->c_str(), physical_size);
+  if (*decompressor_r == nullptr) {
+    i_error("mail %s is compressed with %s, which is not supported by this build",
+            mail->rados_mail->get_oid()->c_str(), librmb::RadosCompression::to_string(codec));
+    return -1;
+  }
+  return 0;
+}
+
+/* deduplicated mails (rbox_dedup) have no data, their body is stored once in the dedup pool. */
+static int read_dedup_body(struct rbox_mail *rmail, int *physical_size_r) {
+  struct mail *mail = (struct mail *)rmail;
+  struct rbox_storage *r_storage = (struct rbox_storage *)mail->box->storage;
+
+  char *value = NULL;
+  if (rbox_mail_metadata_get(rmail, rbox_metadata_key::RBOX_METADATA_EXT_REF, &value) < 0) {
+    // not deduplicated
+    return 0;
+  }
+  i_free(value);
+
+  int ret = r_storage->dedup->resolve(rmail->rados_mail);
+  if (ret < 0) {
+    i_error("reading deduplicated body of mail %s failed: %d", rmail->rados_mail->get_oid()->c_str(), ret);
+    return ret;
+  }
+  *physical_size_r = rmail->rados_mail->get_mail_size();
+  return ret;
+}
+
+/* striped mails (rbox_stripe_min_size) have no data, their body is stored in stripes next to the mail object.
+   Uncompressed stripes are read while the mail stream is read, so a partial fetch only reads the stripes it
+   needs. Compressed stripes are read completely, the decompressor needs the whole buffer.
+   @return 1 if the mail is striped (stripes_r is set if the stripes are not read yet), 0 if not, < 0 on error */
+static int read_striped_body(struct rbox_mail *rmail, librmb::RadosStorage *rados_storage, int *physical_size_r,
+                             librmb::RadosStriping::Manifest *stripes_r) {
+  char *value = NULL;
+  if (rbox_mail_metadata_get(rmail, rbox_metadata_key::RBOX_METADATA_STRIPES, &value) < 0) {
+    // not striped
+    return 0;
+  }
+  i_free(value);
+
+  if (rbox_mail_metadata_get(rmail, rbox_metadata_key::RBOX_METADATA_COMPRESSION, &value) < 0) {
+    if (!librmb::RadosStriping::get_manifest(rmail->rados_mail, stripes_r)) {
+      i_error("invalid stripe manifest of mail %s", rmail->rados_mail->get_oid()->c_str());
+      return -1;
+    }
+    *physical_size_r = stripes_r->size > INT_MAX ? INT_MAX : stripes_r->size;
+    return 1;
+  }
+  i_free(value);
+
+  int ret = librmb::RadosStriping::resolve(rados_storage->get_io_ctx(), rmail->rados_mail);
+  if (ret < 0) {
+    i_error("reading stripes of mail %s failed: %d", rmail->rados_mail->get_oid()->c_str(), ret);
+    return ret;
+  }
+  *physical_size_r = rmail->rados_mail->get_mail_size();
+  return ret;
+}
+
+static int get_mail_stream(struct rbox_mail *mail, librmb::RadosStorage *rados_storage, librados::bufferlist *buffer,
+                           const size_t physical_size, const librmb::RadosStriping::Manifest &stripes,
                            struct istream **stream_r) {
   struct mail_private *pmail = &mail->imail.mail;
   int ret = 0;
 
-  struct istream *input = i_stream_create_from_bufferlist(buffer, physical_size);
+  librmb::RadosDecompressor *decompressor = nullptr;
+  uint64_t uncompressed_size = 0;
+  if (stripes.count == 0 && get_mail_decompressor(mail, buffer, physical_size, &decompressor, &uncompressed_size) < 0) {
+    return -1;
+  }
+  struct istream *input;
+  if (stripes.count > 0) {
+    input = i_stream_create_from_stripes(rados_storage->get_io_ctx(), *mail->rados_mail->get_oid(), stripes, buffer);
+  } else if (decompressor != nullptr) {
+    input = i_stream_create_from_compressed_bufferlist(buffer, decompressor, uncompressed_size);
+  } else if (uncompressed_size > 0) {
+    // decompressed in place
+    input = i_stream_create_from_bufferlist(buffer, buffer->length());
+  } else {
+    input = i_stream_create_from_bufferlist(buffer, physical_size);
+  }
   i_stream_seek(input, 0);
 
   *stream_r = input;
@@ -378,6 +585,41 @@ static int get_mail_stream(struct rbox_mail *mail, librados::bufferlist *buffer,
   return ret;
 }
 
+/* sequential reads (POP3 RETR, initial IMAP sync) start the reads of the following mails in primary storage, so
+   they are bandwidth instead of latency bound. */
+static void rbox_mail_read_ahead(struct mail *_mail, librmb::RadosStorage *rados_storage) {
+  struct rbox_mailbox *rbox = (struct rbox_mailbox *)_mail->box;
+  librmb::RadosReadAhead *read_ahead = rbox->storage->read_ahead;
+
+  if (!read_ahead->is_enabled() || !read_ahead->is_sequential(guid_128_to_string(rbox->mailbox_guid), _mail->seq)) {
+    return;
+  }
+
+  struct mail_index_view *view = _mail->transaction->view;
+  uint32_t last_seq = I_MIN(mail_index_view_get_messages_count(view), _mail->seq + read_ahead->get_max_mails());
+  std::list<std::pair<std::string, uint64_t>> next_mails;
+  for (uint32_t seq = _mail->seq + 1; seq <= last_seq; seq++) {
+    librmb::RadosMailPack::Location pack_location;
+    if (mail_index_is_expunged(view, seq) || (mail_index_lookup(view, seq)->flags & RBOX_INDEX_FLAG_ALT) != 0 ||
+        rbox_mail_index_get_pack(view, rbox->pack_ext_id, seq, &pack_location)) {
+      continue;
+    }
+    const void *rec_data = NULL;
+    mail_index_lookup_ext(view, seq, rbox->ext_id, &rec_data, NULL);
+    if (rec_data == NULL) {
+      continue;
+    }
+    const struct obox_mail_index_record *obox_rec = static_cast<const struct obox_mail_index_record *>(rec_data);
+    // the expected size keeps the window within rbox_read_ahead_max_bytes
+    const void *stat_data = NULL;
+    mail_index_lookup_ext(view, seq, rbox->stat_ext_id, &stat_data, NULL);
+    uint64_t size =
+        stat_data != NULL ? static_cast<const struct obox_mail_index_stat_record *>(stat_data)->physical_size : 0;
+    next_mails.push_back(std::make_pair(std::string(guid_128_to_string(obox_rec->oid)), size));
+  }
+  read_ahead->update_window(rados_storage, next_mails);
+}
+
 static int rbox_mail_get_stream(struct mail *_mail, bool get_body ATTR_UNUSED, struct message_size *hdr_size,
                                 struct message_size *body_size, struct istream **stream_r) {
   FUNC_START();
@@ -416,20 +658,81 @@ static int rbox_mail_get_stream(struct mail *_mail, bool get_body ATTR_UNUSED, s
     uint64_t psize;
     time_t save_date;
 
-    int stat_err = 0;
-    int read_err = 0;
-
-    librados::ObjectReadOperation *read_mail = new librados::ObjectReadOperation();
-    read_mail->read(0, INT_MAX, rmail->rados_mail->get_mail_buffer(), &read_err);
-    read_mail->stat(&psize, &save_date, &stat_err);
-
-    librados::AioCompletion *completion = librados::Rados::aio_create_completion();
-    ret = rados_storage->get_io_ctx().aio_operate(*rmail->rados_mail->get_oid(), completion, read_mail,
-                                                  rmail->rados_mail->get_mail_buffer());
-    completion->wait_for_complete_and_cb();
-    ret = completion->get_return_value();
-    completion->release();
-    delete read_mail;
+    librmb::RadosMailCache &mail_cache = librmb::RadosMailCache::global();
+    if (mail_cache.is_enabled() &&
+        mail_cache.get(rados_storage, *rmail->rados_mail->get_oid(), rmail->rados_mail->get_mail_buffer(), &psize,
+                       &save_date)) {
+      ret = 0;
+    } else {
+      struct rbox_op_event read_event;
+      rbox_op_event_begin(&read_event, _mail->box, rados_storage, "rbox_mail_read_finished",
+                          rmail->rados_mail->get_oid()->c_str());
+      uint64_t read_start = librmb::RadosMetrics::now_usecs();
+      librmb::RadosReadAhead *read_ahead = ((struct rbox_storage *)_mail->box->storage)->read_ahead;
+      struct rbox_mailbox *rbox = (struct rbox_mailbox *)_mail->box;
+      librmb::RadosMailPack::Location pack_location;
+      // reads sent here use the replica read flags, a mail taken from the read ahead is not counted
+      bool replica_read = true;
+      if (!alt_storage &&
+          rbox_mail_index_get_pack(_mail->transaction->view, rbox->pack_ext_id, _mail->seq, &pack_location)) {
+        // packed mails are a ranged read of their container, the save date is kept in the index.
+        ret = librmb::RadosMailPack::read(rados_storage->get_io_ctx(), guid_128_to_string(rbox->mailbox_guid),
+                                          pack_location, rmail->rados_mail->get_mail_buffer());
+        if (ret == -ENOENT && rbox_mail_refresh_pack_location(_mail, &pack_location)) {
+          // the container has been compacted by another session
+          rmail->rados_mail->get_mail_buffer()->clear();
+          ret = librmb::RadosMailPack::read(rados_storage->get_io_ctx(), guid_128_to_string(rbox->mailbox_guid),
+                                            pack_location, rmail->rados_mail->get_mail_buffer());
+        }
+        struct obox_mail_index_stat_record stat_rec;
+        rbox_mail_get_index_stat(_mail, &stat_rec);
+        psize = pack_location.length;
+        save_date = stat_rec.save_date != 0 ? (time_t)stat_rec.save_date : (time_t)-1;
+      } else if (alt_storage || !read_ahead->take(*rmail->rados_mail->get_oid(), rmail->rados_mail->get_mail_buffer(),
+                                                  &psize, &save_date, &ret)) {
+        librmb::RadosHedgedReads &hedged_reads = librmb::RadosHedgedReads::global();
+        if (hedged_reads.is_enabled()) {
+          ret = hedged_reads.read(&rados_storage->get_io_ctx(), *rmail->rados_mail->get_oid(),
+                                  rmail->rados_mail->get_mail_buffer(), &psize, &save_date);
+        } else {
+          int stat_err = 0;
+          int read_err = 0;
+
+          librados::ObjectReadOperation *read_mail = new librados::ObjectReadOperation();
+          read_mail->read(0, INT_MAX, rmail->rados_mail->get_mail_buffer(), &read_err);
+          read_mail->stat(&psize, &save_date, &stat_err);
+
+          librados::AioCompletion *completion = librados::Rados::aio_create_completion();
+          ret = rados_storage->aio_operate(&rados_storage->get_io_ctx(), *rmail->rados_mail->get_oid(), completion,
+                                           read_mail, librmb::RadosReplicaReads::global().get_flags(),
+                                           rmail->rados_mail->get_mail_buffer());
+          if (ret >= 0) {
+            completion->wait_for_complete_and_cb();
+            ret = completion->get_return_value();
+          }
+          completion->release();
+          delete read_mail;
+        }
+      } else {
+        replica_read = false;
+      }
+      librmb::RadosMetrics::global().record(librmb::METRIC_READ_MAIL, librmb::RadosMetrics::now_usecs() - read_start,
+                                            ret < 0 && ret != -ENOENT);
+      if (replica_read && librmb::RadosReplicaReads::global().is_enabled()) {
+        librmb::RadosMetrics::global().record(librmb::METRIC_REPLICA_READ_MAIL,
+                                              librmb::RadosMetrics::now_usecs() - read_start,
+                                              ret < 0 && ret != -ENOENT);
+      }
+      rbox_op_event_end(&read_event, ret, rmail->rados_mail->get_mail_buffer()->length());
+      if (ret >= 0 && mail_cache.is_enabled()) {
+        // cached as read from rados, decompression and dedup resolving work on the mail's own bufferlist
+        mail_cache.put(rados_storage, *rmail->rados_mail->get_oid(), *rmail->rados_mail->get_mail_buffer(), psize,
+                       save_date);
+      }
+    }
+    if (!alt_storage) {
+      rbox_mail_read_ahead(_mail, rados_storage);
+    }
 
     if (ret < 0) {
       if (ret == -ENOENT) {
@@ -451,6 +754,17 @@ static int rbox_mail_get_stream(struct mail *_mail, bool get_body ATTR_UNUSED, s
     rmail->rados_mail->set_mail_size(psize);
     rmail->rados_mail->set_rados_save_date(save_date);
 
+    if (physical_size == 0 && read_dedup_body(rmail, &physical_size) < 0) {
+      FUNC_END_RET("ret == -1");
+      delete rmail->rados_mail->get_mail_buffer();
+      return -1;
+    }
+    librmb::RadosStriping::Manifest stripes;
+    if (physical_size == 0 && read_striped_body(rmail, rados_storage, &physical_size, &stripes) < 0) {
+      FUNC_END_RET("ret == -1");
+      delete rmail->rados_mail->get_mail_buffer();
+      return -1;
+    }
     if (physical_size == 0) {
       i_error(
           "trying to read a mail(%s) with size = 0, namespace(%s), alt_storage(%d) uid(%d), which is currently copied, "
@@ -470,7 +784,8 @@ static int rbox_mail_get_stream(struct mail *_mail, bool get_body ATTR_UNUSED, s
       return -1;
     }
 
-    if (get_mail_stream(rmail, rmail->rados_mail->get_mail_buffer(), physical_size, &input) < 0) {
+    if (get_mail_stream(rmail, rados_storage, rmail->rados_mail->get_mail_buffer(), physical_size, stripes, &input) <
+        0) {
       FUNC_END_RET("ret == -1");
       delete rmail->rados_mail->get_mail_buffer();
       return -1;
@@ -495,14 +810,23 @@ int rbox_get_guid_metadata(struct rbox_mail *mail, const char **value_r) {
     return 0;
   }
   // lost for some reason, use fallback
-  // index is empty. we have to check the object attributes do we have to tell someone that the index is broken?
-  if (rbox_mail_metadata_get(mail, rbox_metadata_key::RBOX_METADATA_GUID, value_r) < 0) {
+  // the guid is written to the cache at save time, a cache hit saves the metadata read.
+  struct index_mail *imail = &mail->imail;
+  struct index_mailbox_context *ibox =
+      reinterpret_cast<index_mailbox_context *>(RBOX_INDEX_STORAGE_CONTEXT(imail->mail.mail.box));
+  string_t *cached_guid = str_new(imail->mail.data_pool, 64);
+  if (mail_cache_lookup_field(imail->mail.mail.transaction->cache_view, cached_guid, imail->mail.mail.seq,
+                              ibox->cache_fields[MAIL_CACHE_GUID].idx) > 0 &&
+      guid_128_from_string(str_c(cached_guid), mail->index_guid) == 0) {
+    *value_r = str_c(cached_guid);
+  } else if (rbox_mail_metadata_get(mail, rbox_metadata_key::RBOX_METADATA_GUID, value_r) < 0) {
+    // index is empty. we have to check the object attributes do we have to tell someone that the index is broken?
     return -1;
+  } else {
+    guid_128_from_string(*value_r, mail->index_guid);
   }
 
   // restore the index extension header quietly.
-  guid_128_from_string(*value_r, mail->index_guid);
-  struct index_mail *imail = &mail->imail;
   struct mail *_mail = (struct mail *)mail;
   struct rbox_mailbox *mbox = (struct rbox_mailbox *)_mail->box;
 
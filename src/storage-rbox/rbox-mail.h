@@ -15,6 +15,9 @@
 #include "index-mail.h"
 #include <rados/librados.hpp>
 #include "../librmb/rados-mail.h"
+#include "../librmb/rados-mail-pack.h"
+
+struct obox_mail_index_stat_record;
 
 /**
  * @brief: holds the rados mail object.
@@ -36,4 +39,27 @@ extern int rbox_mail_get_virtual_size(struct mail *_mail, uoff_t *size_r);
 
 extern int rbox_get_guid_metadata(struct rbox_mail *mail, const char **value_r);
 
+/*!
+ * reads the save date / physical size record of the mail, zeroed if there is none.
+ */
+extern void rbox_mail_get_index_stat(struct mail *_mail, struct obox_mail_index_stat_record *rec_r);
+/*!
+ * writes the save date / physical size record of the mail with the given seq.
+ * @param[in] save_date <= 0 if unknown
+ * @param[in] physical_size (uoff_t)-1 if unknown
+ */
+extern void rbox_mail_index_set_stat(struct mail_index_transaction *trans, uint32_t stat_ext_id, uint32_t seq,
+                                     time_t save_date, uoff_t physical_size);
+/*!
+ * reads the pack record of the mail with the given seq.
+ * @return false if the mail is not packed
+ */
+extern bool rbox_mail_index_get_pack(struct mail_index_view *view, uint32_t pack_ext_id, uint32_t seq,
+                                     librmb::RadosMailPack::Location *location_r);
+/*!
+ * writes the pack record of the mail with the given seq.
+ */
+extern void rbox_mail_index_set_pack(struct mail_index_transaction *trans, uint32_t pack_ext_id, uint32_t seq,
+                                     const librmb::RadosMailPack::Location &location);
+
 #endif  // SRC_STORAGE_RBOX_RBOX_MAIL_H_
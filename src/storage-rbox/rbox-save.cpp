@@ -17,6 +17,8 @@
 #include <string>
 #include <map>
 #include <list>
+#include <set>
+#include <vector>
 #include <rados/librados.hpp>
 
 extern "C" {
@@ -26,6 +28,8 @@ extern "C" {
 #include "istream-crlf.h"
 #include "ostream.h"
 #include "str.h"
+#include "sha2.h"
+#include "hex-binary.h"
 
 #include "rbox-sync.h"
 #include "rados-types.h"
@@ -38,6 +42,7 @@ extern "C" {
 #include "../librmb/rados-mail.h"
 #include "rbox-storage.hpp"
 #include "rbox-save.h"
+#include "rbox-event.h"
 #include "rados-util.h"
 #include "rbox-mail.h"
 #include "ostream-bufferlist.h"
@@ -404,6 +409,18 @@ static void clean_up_failed(struct rbox_save_context *r_ctx, bool wait_for_opera
     if (delete_ret < 0 && delete_ret != -ENOENT) {
       i_error("Librados obj: %s, could not be removed", (*it_cur_obj)->get_oid()->c_str());
     }
+    if (r_storage->ms->get_storage()->remove_metadata(*(*it_cur_obj)->get_oid()) < 0) {
+      i_error("metadata of obj: %s, could not be removed", (*it_cur_obj)->get_oid()->c_str());
+    }
+    const char *hash = (*it_cur_obj)->get_metadata(rbox_metadata_key::RBOX_METADATA_EXT_REF);
+    if (hash != NULL && r_storage->dedup->release_ref(hash, *(*it_cur_obj)->get_oid()) < 0) {
+      i_error("dedup reference of obj: %s, could not be removed", (*it_cur_obj)->get_oid()->c_str());
+    }
+    librmb::RadosStriping::Manifest manifest;
+    if (librmb::RadosStriping::get_manifest(*it_cur_obj, &manifest) &&
+        librmb::RadosStriping::remove(r_storage->s->get_io_ctx(), *(*it_cur_obj)->get_oid(), manifest) < 0) {
+      i_error("stripes of obj: %s, could not be removed", (*it_cur_obj)->get_oid()->c_str());
+    }
   }
   // clean up index
   if (r_ctx->seq > 0) {
@@ -441,6 +458,64 @@ static void clean_up_write_finish(struct mail_save_context *_ctx) {
   FUNC_END();
 }
 
+static void rbox_save_cache_add(struct rbox_save_context *r_ctx, enum index_cache_field field, const void *data,
+                                size_t data_size) {
+  struct index_mailbox_context *ibox =
+      reinterpret_cast<index_mailbox_context *>(RBOX_INDEX_STORAGE_CONTEXT(&r_ctx->mbox->box));
+  struct mail_cache_transaction_ctx *cache_trans = r_ctx->ctx.transaction->cache_trans;
+  unsigned int field_idx = ibox->cache_fields[field].idx;
+
+  if (mail_cache_field_can_add(cache_trans, r_ctx->seq, field_idx)) {
+    mail_cache_add(cache_trans, r_ctx->seq, field_idx, data, data_size);
+  }
+}
+
+/* write-through: everything we know about a saved, copied or moved mail goes to the cache, so the first fetch
+   after a delivery does not have to load the metadata from rados. Fields the cache decisions don't want are
+   skipped. */
+void rbox_save_add_cache_fields(struct rbox_save_context *r_ctx, uoff_t physical_size, uoff_t virtual_size) {
+  struct mail_save_data *mdata = &r_ctx->ctx.data;
+
+  if (!guid_128_is_empty(r_ctx->mail_guid)) {
+    const char *guid = guid_128_to_string(r_ctx->mail_guid);
+    rbox_save_cache_add(r_ctx, MAIL_CACHE_GUID, guid, strlen(guid) + 1);
+  }
+  if (mdata->received_date != (time_t)-1) {
+    uint32_t t = mdata->received_date;
+    rbox_save_cache_add(r_ctx, MAIL_CACHE_RECEIVED_DATE, &t, sizeof(t));
+  }
+  if (physical_size != (uoff_t)-1) {
+    rbox_save_cache_add(r_ctx, MAIL_CACHE_PHYSICAL_FULL_SIZE, &physical_size, sizeof(physical_size));
+  }
+  if (virtual_size != (uoff_t)-1) {
+    rbox_save_cache_add(r_ctx, MAIL_CACHE_VIRTUAL_FULL_SIZE, &virtual_size, sizeof(virtual_size));
+  }
+  if (mdata->pop3_uidl != NULL) {
+    rbox_save_cache_add(r_ctx, MAIL_CACHE_POP3_UIDL, mdata->pop3_uidl, strlen(mdata->pop3_uidl) + 1);
+  }
+  if (mdata->pop3_order != 0) {
+    unsigned int order = mdata->pop3_order;
+    rbox_save_cache_add(r_ctx, MAIL_CACHE_POP3_ORDER, &order, sizeof(order));
+  }
+}
+
+/* mails with the same content hash share one body object in the dedup pool. The hash is taken over the stored
+   (possibly compressed) buffer. */
+static int rbox_save_dedup_mail(struct rbox_storage *r_storage, librmb::RadosMail *mail) {
+  librados::bufferlist *buffer = mail->get_mail_buffer();
+  if (buffer->length() < r_storage->dedup->get_min_size()) {
+    return 0;
+  }
+  unsigned char digest[SHA256_RESULTLEN];
+  struct sha256_ctx ctx;
+  sha256_init(&ctx);
+  for (const auto &ptr : buffer->buffers()) {
+    sha256_loop(&ctx, ptr.c_str(), ptr.length());
+  }
+  sha256_result(&ctx, digest);
+  return r_storage->dedup->dedup(mail, binary_to_hex(digest, sizeof(digest)));
+}
+
 int rbox_save_finish(struct mail_save_context *_ctx) {
   FUNC_START();
 
@@ -452,15 +527,6 @@ int rbox_save_finish(struct mail_save_context *_ctx) {
       uint32_t t = _ctx->data.save_date;
       index_mail_cache_add((struct index_mail *)_ctx->dest_mail, MAIL_CACHE_SAVE_DATE, &t, sizeof(t));
     }
-/*TODO create cache: #229
-    if (r_ctx->mail_guid != NULL) {
-      const char *guid = guid_128_to_string(r_ctx->mail_guid);
-      index_mail_cache_add_idx((struct index_mail *)_ctx->dest_mail, MAIL_CACHE_GUID, guid, strlen(guid) + 1);
-    }
-    uint32_t recv_date = _ctx->data.received_date;
-    index_mail_cache_add((struct index_mail *)_ctx->dest_mail, MAIL_CACHE_RECEIVED_DATE, &recv_date,
-   sizeof(recv_date));
-*/
 
 #if DOVECOT_PREREQ(2, 3)
     int ret = 0;
@@ -503,6 +569,10 @@ int rbox_save_finish(struct mail_save_context *_ctx) {
       i_error("ERROR, mailsize is <= 0 ");
     } else {
       bool async_write = true;
+      struct rbox_storage *r_storage = (struct rbox_storage *)&r_ctx->mbox->storage->storage;
+      struct rbox_op_event save_event;
+      rbox_op_event_begin(&save_event, &r_ctx->mbox->box, r_storage->s, "rbox_mail_save_finished",
+                          r_ctx->rados_mail->get_oid()->c_str());
 
       if (!zlib_plugin_active) {
         // write \0 to ceph (length()+1) if stream is not binary
@@ -513,25 +583,61 @@ int rbox_save_finish(struct mail_save_context *_ctx) {
         r_ctx->rados_mail->set_mail_size(r_ctx->output_stream->offset);
       }
 
+      // mails compressed by the zlib plugin and chunked writes (already sent to ceph) are saved as they are.
+      if (!zlib_plugin_active && !r_storage->config->is_write_chunks() && r_storage->compression->is_enabled()) {
+        if (r_storage->compression->compress(r_ctx->rados_mail, r_ctx->output_stream->offset) < 0) {
+          i_warning("compressing mail %s failed, saving it uncompressed", r_ctx->rados_mail->get_oid()->c_str());
+        }
+      }
+      // small mails are appended to a container of the mailbox at commit time instead of having their own object.
+      bool pack = !r_storage->config->is_write_chunks() &&
+                  r_storage->pack->is_packable(r_ctx->rados_mail->get_mail_buffer()->length());
+      if (!pack && !r_storage->config->is_write_chunks() && r_storage->dedup->is_enabled()) {
+        if (rbox_save_dedup_mail(r_storage, r_ctx->rados_mail) < 0) {
+          i_warning("deduplicating mail %s failed, saving it as it is", r_ctx->rados_mail->get_oid()->c_str());
+        }
+      }
+      // the stripes are written before the mail object, which makes them visible.
+      if (!pack && !r_storage->config->is_write_chunks() && r_storage->striping->is_enabled()) {
+        if (r_storage->striping->stripe(r_storage->s->get_io_ctx(), r_ctx->rados_mail) < 0) {
+          i_warning("striping mail %s failed, saving it as it is", r_ctx->rados_mail->get_oid()->c_str());
+        }
+      }
+
       rbox_save_mail_set_metadata(r_ctx, r_ctx->rados_mail);
 
-      librados::ObjectWriteOperation write_op;
-      struct rbox_storage *r_storage = (struct rbox_storage *)&r_ctx->mbox->storage->storage;
+      if (pack) {
+        r_ctx->packed_mails.push_back(std::make_pair(r_ctx->rados_mail, r_ctx->seq));
+      } else {
+        librados::ObjectWriteOperation write_op;
 
-      r_storage->ms->get_storage()->save_metadata(&write_op, r_ctx->rados_mail);
+        r_storage->ms->get_storage()->save_metadata(&write_op, r_ctx->rados_mail);
 
-      if (!r_storage->config->is_write_chunks()) {
-        r_ctx->failed = !r_storage->s->save_mail(&write_op, r_ctx->rados_mail, async_write);
-      } else {
-        int ret = r_storage->s->aio_operate(&r_storage->s->get_io_ctx(), *r_ctx->rados_mail->get_oid(),
-                                            r_ctx->rados_mail->get_completion(), &write_op);
-        r_ctx->failed = ret < 0;
+        if (!r_storage->config->is_write_chunks()) {
+          r_ctx->failed = !r_storage->s->save_mail(&write_op, r_ctx->rados_mail, async_write);
+        } else {
+          int ret = r_storage->s->aio_operate(&r_storage->s->get_io_ctx(), *r_ctx->rados_mail->get_oid(),
+                                              r_ctx->rados_mail->get_completion(), &write_op);
+          r_ctx->failed = ret < 0;
+        }
       }
       if (r_ctx->failed) {
         i_error("saved mail: %s failed metadata_count %ld, mail_size (%d)", r_ctx->rados_mail->get_oid()->c_str(),
                 r_ctx->rados_mail->get_metadata()->size(), r_ctx->rados_mail->get_mail_size());
+      } else {
+        uoff_t vsize = (uoff_t)-1;
+        if (mail_get_virtual_size(r_ctx->ctx.dest_mail, &vsize) < 0) {
+          vsize = (uoff_t)-1;
+        }
+        rbox_save_add_cache_fields(r_ctx, r_ctx->input->v_offset, vsize);
+        rbox_mail_index_set_stat(r_ctx->trans, r_ctx->mbox->stat_ext_id, r_ctx->seq,
+                                 _ctx->data.save_date != (time_t)-1 ? _ctx->data.save_date : ioloop_time,
+                                 r_ctx->input->v_offset);
       }
-      if (r_storage->save_log->is_open()) {
+      // the write is asynchronous, the event covers preparing and submitting it.
+      rbox_op_event_end(&save_event, r_ctx->failed ? -1 : 0, r_ctx->rados_mail->get_mail_size());
+      // packed mails are logged with their container once they are appended (rbox_save_append_packed_mails)
+      if (!pack && r_storage->save_log->is_open()) {
         r_storage->save_log->append(
             librmb::RadosSaveLogEntry(*r_ctx->rados_mail->get_oid(), r_storage->s->get_namespace(),
                                       r_storage->s->get_pool_name(), librmb::RadosSaveLogEntry::op_save()));
@@ -556,6 +662,63 @@ void rbox_save_cancel(struct mail_save_context *_ctx) {
   FUNC_END();
 }
 
+static bool rbox_save_is_packed(struct rbox_save_context *r_ctx, librmb::RadosMail *mail) {
+  for (std::list<std::pair<RadosMail *, uint32_t>>::iterator it = r_ctx->packed_mails.begin();
+       it != r_ctx->packed_mails.end(); ++it) {
+    if (it->first == mail) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* all packed mails of the transaction are appended at once, their locations go to the index record. */
+static int rbox_save_append_packed_mails(struct rbox_save_context *r_ctx) {
+  FUNC_START();
+
+  struct rbox_storage *r_storage = (struct rbox_storage *)&r_ctx->mbox->storage->storage;
+  std::string mailbox_guid = guid_128_to_string(r_ctx->mbox->mailbox_guid);
+  std::vector<RadosMail *> mails;
+  for (std::list<std::pair<RadosMail *, uint32_t>>::iterator it = r_ctx->packed_mails.begin();
+       it != r_ctx->packed_mails.end(); ++it) {
+    mails.push_back(it->first);
+  }
+  std::vector<librmb::RadosMailPack::Location> locations;
+  int ret = r_storage->pack->append(r_storage->s->get_io_ctx(), mailbox_guid, mails, &locations);
+  if (ret < 0) {
+    i_error("appending %lu mails to a pack container of mailbox %s failed: %d", mails.size(), mailbox_guid.c_str(),
+            ret);
+    // remove the entries which have been appended already
+    std::map<uint32_t, std::set<std::string>> appended;
+    for (size_t i = 0; i < locations.size(); i++) {
+      if (locations[i].container != 0) {
+        appended[locations[i].container].insert(*mails[i]->get_oid());
+      }
+    }
+    for (std::map<uint32_t, std::set<std::string>>::iterator it = appended.begin(); it != appended.end(); ++it) {
+      if (librmb::RadosMailPack::remove(r_storage->s->get_io_ctx(), mailbox_guid, it->first, it->second) < 0) {
+        i_error("entries of container %u of mailbox %s could not be removed", it->first, mailbox_guid.c_str());
+      }
+    }
+    FUNC_END_RET("ret == -1");
+    return -1;
+  }
+  size_t i = 0;
+  for (std::list<std::pair<RadosMail *, uint32_t>>::iterator it = r_ctx->packed_mails.begin();
+       it != r_ctx->packed_mails.end(); ++it) {
+    rbox_mail_index_set_pack(r_ctx->trans, r_ctx->mbox->pack_ext_id, it->second, locations[i]);
+    if (r_storage->save_log->is_open()) {
+      r_storage->save_log->append(librmb::RadosSaveLogEntry(
+          *it->first->get_oid(), r_storage->s->get_namespace(), r_storage->s->get_pool_name(),
+          librmb::RadosSaveLogEntry::op_pack(mailbox_guid, locations[i].container)));
+    }
+    i++;
+  }
+
+  FUNC_END();
+  return 0;
+}
+
 static int rbox_save_assign_uids(struct rbox_save_context *r_ctx, const ARRAY_TYPE(seq_range) * uids) {
   FUNC_START();
 
@@ -573,12 +736,16 @@ static int rbox_save_assign_uids(struct rbox_save_context *r_ctx, const ARRAY_TY
       i_assert(ret);
       if (r_storage->config->is_mail_attribute(rbox_metadata_key::RBOX_METADATA_MAIL_UID)) {
         metadata.convert(rbox_metadata_key::RBOX_METADATA_MAIL_UID, uid);
-
-        librados::ObjectWriteOperation write_mail_uid;
-        write_mail_uid.setxattr(metadata.key.c_str(), metadata.bl);
-
-        if (r_storage->ms->get_storage()->set_metadata(r_ctx->rados_mail, metadata, &write_mail_uid) < 0) {
-          return -1;
+        if (rbox_save_is_packed(r_ctx, r_ctx->rados_mail)) {
+          // written with the pack entry
+          r_ctx->rados_mail->add_metadata(metadata);
+        } else {
+          librados::ObjectWriteOperation write_mail_uid;
+          write_mail_uid.setxattr(metadata.key.c_str(), metadata.bl);
+
+          if (r_storage->ms->get_storage()->set_metadata(r_ctx->rados_mail, metadata, &write_mail_uid) < 0) {
+            return -1;
+          }
         }
       }
 #if DOVECOT_PREREQ(2, 3)
@@ -589,6 +756,9 @@ static int rbox_save_assign_uids(struct rbox_save_context *r_ctx, const ARRAY_TY
     }
     i_assert(!seq_range_array_iter_nth(&iter, n, &uid));
   }
+  if (!r_ctx->packed_mails.empty() && rbox_save_append_packed_mails(r_ctx) < 0) {
+    return -1;
+  }
 
   FUNC_END();
   return 0;
@@ -687,6 +857,11 @@ void rbox_transaction_save_commit_post(struct mail_save_context *_ctx,
   } else {
     r_ctx->failed = FALSE;
   }
+  // group commit: write the save log entries of this transaction.
+  struct rbox_storage *r_storage = (struct rbox_storage *)&r_ctx->mbox->storage->storage;
+  if (r_storage->save_log->is_open() && !r_storage->save_log->flush()) {
+    i_warning("unable to write the rados save log file %s", r_storage->config->get_rados_save_log_file().c_str());
+  }
   rbox_transaction_save_rollback(_ctx);
 
   FUNC_END();
@@ -700,6 +875,7 @@ void clean_up_mail_object_list(struct rbox_save_context *r_ctx, struct rbox_stor
     *it = nullptr;
   }
   r_ctx->rados_mails.clear();
+  r_ctx->packed_mails.clear();
 
   FUNC_END();
 }
@@ -14,6 +14,7 @@
 
 #include <string>
 #include <list>
+#include <utility>
 
 #include "../librmb/rados-storage-impl.h"
 #include "mail-storage-private.h"
@@ -73,6 +74,8 @@ class rbox_save_context {
   const librmb::RadosStorage &rados_storage;
   /** mails in the current save context **/
   std::list<librmb::RadosMail *> rados_mails;
+  /** mails (and their seq) appended to a pack container at commit time **/
+  std::list<std::pair<librmb::RadosMail *, uint32_t>> packed_mails;
   /** current mail in the context **/
   librmb::RadosMail *rados_mail;
 #if DOVECOT_PREREQ(2, 3)
@@ -95,4 +98,5 @@ void clean_up_mail_object_list(struct rbox_save_context *r_ctx, struct rbox_stor
 void rbox_save_update_header_flags(struct rbox_save_context *r_ctx, struct mail_index_view *sync_view, uint32_t ext_id,
                                    unsigned int flags_offset);
 void rbox_index_append(struct mail_save_context *_ctx);
+void rbox_save_add_cache_fields(struct rbox_save_context *r_ctx, uoff_t physical_size, uoff_t virtual_size);
 #endif  // SRC_STORAGE_RBOX_RBOX_SAVE_H_
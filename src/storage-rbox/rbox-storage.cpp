@@ -41,6 +41,7 @@ extern "C" {
 #include "../librmb/rados-dovecot-ceph-cfg-impl.h"
 #include "../librmb/rados-guid-generator.h"
 #include "../librmb/rados-metadata-storage-impl.h"
+#include "../librmb/rados-metrics.h"
 
 #include "rbox-copy.h"
 #include "rbox-mail.h"
@@ -74,11 +75,20 @@ struct mail_storage *rbox_storage_alloc(void) {
   r_storage->s = new librmb::RadosStorageImpl(r_storage->cluster);
   r_storage->config = new librmb::RadosDovecotCephCfgImpl(&r_storage->s->get_io_ctx());
   r_storage->ns_mgr = new librmb::RadosNamespaceManager(r_storage->config);
-  r_storage->ms = new librmb::RadosMetadataStorageImpl();
+  r_storage->ms = new librmb::RadosMetadataStorageImpl(r_storage->cluster);
   r_storage->alt = new librmb::RadosStorageImpl(r_storage->cluster);
 
   // logfile is set when 90-plugin.conf param rados_save_cfg is evaluated.
   r_storage->save_log = new librmb::RadosSaveLog();
+  // codecs are set when the plugin configuration is read.
+  r_storage->compression = new librmb::RadosCompression();
+  r_storage->alt_compression = new librmb::RadosCompression();
+  // dedup pool is opened with the rados connection.
+  r_storage->dedup = new librmb::RadosDedup();
+  // window is set when the plugin configuration is read.
+  r_storage->read_ahead = new librmb::RadosReadAhead();
+  r_storage->striping = new librmb::RadosStriping();
+  r_storage->pack = new librmb::RadosMailPack();
 
   FUNC_END();
   return &r_storage->storage;
@@ -188,6 +198,11 @@ void rbox_storage_destroy(struct mail_storage *storage) {
   FUNC_START();
   struct rbox_storage *r_storage = (struct rbox_storage *)storage;
 
+  // pending reads use the io context of the storage
+  if (r_storage->read_ahead != nullptr) {
+    delete r_storage->read_ahead;
+    r_storage->read_ahead = nullptr;
+  }
   if (r_storage->s != nullptr) {
     r_storage->s->close_connection();
     delete r_storage->s;
@@ -198,6 +213,19 @@ void rbox_storage_destroy(struct mail_storage *storage) {
     delete r_storage->alt;
     r_storage->alt = nullptr;
   }
+  if (r_storage->dedup != nullptr) {
+    r_storage->dedup->close();
+    delete r_storage->dedup;
+    r_storage->dedup = nullptr;
+  }
+  if (r_storage->striping != nullptr) {
+    delete r_storage->striping;
+    r_storage->striping = nullptr;
+  }
+  if (r_storage->pack != nullptr) {
+    delete r_storage->pack;
+    r_storage->pack = nullptr;
+  }
   if (r_storage->cluster != nullptr) {
     r_storage->cluster->deinit();
     delete r_storage->cluster;
@@ -208,6 +236,13 @@ void rbox_storage_destroy(struct mail_storage *storage) {
     r_storage->ns_mgr = nullptr;
   }
   if (r_storage->config != nullptr) {
+    const std::string &metrics_file = r_storage->config->get_metrics_file();
+    if (!metrics_file.empty()) {
+      int ret_metrics = librmb::RadosMetrics::global().flush_to_file(metrics_file);
+      if (ret_metrics < 0) {
+        i_warning("unable to write metrics to %s: %d", metrics_file.c_str(), ret_metrics);
+      }
+    }
     delete r_storage->config;
     r_storage->config = nullptr;
   }
@@ -222,6 +257,14 @@ void rbox_storage_destroy(struct mail_storage *storage) {
     delete r_storage->save_log;
     r_storage->save_log = nullptr;
   }
+  if (r_storage->compression != nullptr) {
+    delete r_storage->compression;
+    r_storage->compression = nullptr;
+  }
+  if (r_storage->alt_compression != nullptr) {
+    delete r_storage->alt_compression;
+    r_storage->alt_compression = nullptr;
+  }
 
   index_storage_destroy(storage);
 
@@ -281,6 +324,12 @@ static int rbox_mailbox_alloc_index(struct rbox_mailbox *rbox) {
 
   // register index record holding the mail guid
   rbox->ext_id = mail_index_ext_register(rbox->box.index, "obox", 0, sizeof(struct obox_mail_index_record), 1);
+  // register index record holding save date and physical size
+  rbox->stat_ext_id = mail_index_ext_register(rbox->box.index, "obox-stat", 0,
+                                              sizeof(struct obox_mail_index_stat_record), sizeof(uint64_t));
+  // register index record holding the location of packed mails
+  rbox->pack_ext_id = mail_index_ext_register(rbox->box.index, "obox-pack", 0,
+                                              sizeof(struct obox_mail_index_pack_record), sizeof(uint32_t));
 
   FUNC_END();
   return 0;
@@ -410,6 +459,29 @@ static void read_plugin_ceph_client_settings(struct mailbox *box, const char *pr
   }
 }
 
+static void read_plugin_compression_settings(struct rbox_storage *r_storage) {
+  const std::string &codec = r_storage->config->get_compression();
+  if (!r_storage->compression->set_codec(codec)) {
+    i_warning("rbox_compression=%s is unknown or not supported by this build, mails are saved uncompressed",
+              codec.c_str());
+  }
+  r_storage->compression->set_level(r_storage->config->get_compression_level());
+  r_storage->compression->set_min_size(r_storage->config->get_compression_min_size());
+
+  // alt storage defaults to the primary settings
+  const std::string &alt_codec = r_storage->config->get_alt_compression();
+  if (alt_codec.empty()) {
+    *r_storage->alt_compression = *r_storage->compression;
+  } else {
+    if (!r_storage->alt_compression->set_codec(alt_codec)) {
+      i_warning("rbox_alt_compression=%s is unknown or not supported by this build, mails are moved uncompressed",
+                alt_codec.c_str());
+    }
+    r_storage->alt_compression->set_level(r_storage->config->get_alt_compression_level());
+    r_storage->alt_compression->set_min_size(r_storage->config->get_compression_min_size());
+  }
+}
+
 void read_plugin_configuration(struct mailbox *box) {
   FUNC_START();
   struct rbox_storage *r_storage = (struct rbox_storage *)box->storage;
@@ -427,9 +499,47 @@ void read_plugin_configuration(struct mailbox *box) {
     }
     r_storage->config->set_config_valid(true);
     r_storage->save_log->set_save_log_file(r_storage->config->get_rados_save_log_file());
+    r_storage->save_log->set_binary_format(r_storage->config->is_save_log_binary());
     if (!r_storage->save_log->open() && !r_storage->config->get_rados_save_log_file().empty()) {
       i_warning("unable to open the rados save log file %s", r_storage->config->get_rados_save_log_file().c_str());
     }
+    read_plugin_compression_settings(r_storage);
+    if (r_storage->config->is_dedup() && !r_storage->config->get_metadata_pool().empty() &&
+        r_storage->config->get_dedup_pool().empty()) {
+      // the dedup index is kept in omap, which the erasure coded mail pool of a metadata pool setup lacks.
+      i_error("rbox_dedup requires rbox_dedup_pool with rbox_metadata_pool %s, mails are not deduplicated",
+              r_storage->config->get_metadata_pool().c_str());
+      r_storage->dedup->set_enabled(false);
+    } else {
+      r_storage->dedup->set_enabled(r_storage->config->is_dedup());
+    }
+    r_storage->dedup->set_min_size(r_storage->config->get_dedup_min_size());
+    r_storage->read_ahead->set_window(r_storage->config->get_read_ahead_mails(),
+                                      r_storage->config->get_read_ahead_max_bytes());
+    librmb::RadosMailCache::global().set_max_bytes(r_storage->config->get_mail_cache_size());
+    r_storage->striping->set_min_size(r_storage->config->get_stripe_min_size());
+    r_storage->striping->set_stripe_size(r_storage->config->get_stripe_size());
+    if (r_storage->config->get_pack_max_size() > 0 && !r_storage->config->get_metadata_pool().empty()) {
+      // the mail pool of a separate metadata pool usually is erasure coded, containers need omap and appends.
+      i_error("rbox_pack_max_size cannot be used with rbox_metadata_pool %s, mails are not packed",
+              r_storage->config->get_metadata_pool().c_str());
+      r_storage->pack->set_max_size(0);
+    } else {
+      r_storage->pack->set_max_size(r_storage->config->get_pack_max_size());
+    }
+    r_storage->pack->set_container_size(r_storage->config->get_pack_container_size());
+    librmb::RadosThrottle::Limits limits;
+    limits.ops_per_sec = r_storage->config->get_throttle_ops_per_sec();
+    limits.bytes_per_sec = r_storage->config->get_throttle_bytes_per_sec();
+    limits.max_inflight_ops = r_storage->config->get_throttle_inflight_ops();
+    limits.max_inflight_bytes = r_storage->config->get_throttle_inflight_bytes();
+    librmb::RadosThrottle::global().set_limits(limits);
+    if (!librmb::RadosReplicaReads::global().set_mode(r_storage->config->get_replica_reads())) {
+      i_warning("unknown rbox_replica_reads %s, reading from the primary osd",
+                r_storage->config->get_replica_reads().c_str());
+    }
+    librmb::RadosHedgedReads::global().set_percentile(r_storage->config->get_hedged_reads_percentile());
+    librmb::RadosHedgedReads::global().set_min_delay(r_storage->config->get_hedged_reads_min_delay());
   }
 
   FUNC_END();
@@ -503,7 +613,24 @@ int rbox_open_rados_connection(struct mailbox *box, bool alt_storage) {
     i_error("unable to read rados_config return value : %d", ret);
     return ret;
   }
-  rbox->storage->ms->create_metadata_storage(&rbox->storage->s->get_io_ctx(), rbox->storage->config);
+  if (rbox->storage->ms->create_metadata_storage(&rbox->storage->s->get_io_ctx(), rbox->storage->config) == nullptr) {
+    i_error("unable to open metadata pool %s", rbox->storage->config->get_metadata_pool().c_str());
+    return -1;
+  }
+
+  // deduplicated mails need to be readable, even if rbox_dedup has been disabled since. Without rbox_dedup_pool
+  // the mail pool is used, unless it is the (omap-less) mail pool of a metadata pool setup.
+  std::string dedup_pool = rbox->storage->config->get_dedup_pool();
+  if (dedup_pool.empty() && rbox->storage->config->get_metadata_pool().empty()) {
+    dedup_pool = rbox->storage->config->get_pool_name();
+  }
+  if (!rbox->storage->dedup->is_open() && !dedup_pool.empty()) {
+    int ret_dedup = rbox->storage->dedup->open(rbox->storage->cluster, dedup_pool);
+    if (ret_dedup < 0) {
+      i_warning("unable to open dedup pool %s: %d, mails are saved without deduplication", dedup_pool.c_str(),
+                ret_dedup);
+    }
+  }
 
   std::string uid;
   if (box->list->ns->owner != nullptr) {
@@ -705,6 +832,7 @@ static void rbox_mailbox_close(struct mailbox *box) {
   struct rbox_mailbox *rbox = (struct rbox_mailbox *)box;
   struct expunged_item *const *moved_items, *moved_item;
 
+  rbox->storage->read_ahead->clear();
   if (array_is_created(&rbox->moved_items)) {
     if (array_count(&rbox->moved_items) > 0) {
       unsigned int moved_count;
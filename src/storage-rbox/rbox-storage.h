@@ -87,6 +87,21 @@ struct obox_mail_index_record {
   unsigned char guid[GUID_128_SIZE];
   unsigned char oid[GUID_128_SIZE];
 };
+/* save date and physical size of a mail, so they can be looked up without a rados stat. They have their own
+   index extension to keep the obox records of existing indexes valid. 0 means unknown. */
+struct obox_mail_index_stat_record {
+  uint64_t physical_size;
+  uint32_t save_date;
+  uint32_t unused;
+};
+/* location of a mail packed into a container object of its mailbox (rbox_pack_max_size). container 0 means the
+   mail is stored in its own object. */
+struct obox_mail_index_pack_record {
+  uint32_t container;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t unused;
+};
 /**
  * @brief: rbox mailbox structure
  */
@@ -99,6 +114,10 @@ struct rbox_mailbox {
   uint32_t hdr_ext_id;
   /** ext id **/
   uint32_t ext_id;
+  /** ext id of the save date / physical size records **/
+  uint32_t stat_ext_id;
+  /** ext id of the pack records **/
+  uint32_t pack_ext_id;
   /** unique identifier **/
   guid_128_t mailbox_guid;
   /** list of moved_items, after move mail will not be deleted immediately,
@@ -30,6 +30,15 @@
 #include "../librmb/rados-dovecot-ceph-cfg.h"
 #include "../librmb/rados-metadata-storage-impl.h"
 #include "../librmb/rados-save-log.h"
+#include "../librmb/rados-compression.h"
+#include "../librmb/rados-dedup.h"
+#include "../librmb/rados-read-ahead.h"
+#include "../librmb/rados-mail-cache.h"
+#include "../librmb/rados-striping.h"
+#include "../librmb/rados-mail-pack.h"
+#include "../librmb/rados-throttle.h"
+#include "../librmb/rados-replica-reads.h"
+#include "../librmb/rados-hedged-reads.h"
 
 #include "rbox-storage-struct.h"
 
@@ -43,6 +52,12 @@ struct rbox_storage {
   librmb::RadosMetadataStorage *ms;
   librmb::RadosStorage *alt;
   librmb::RadosSaveLog *save_log;
+  librmb::RadosCompression *compression;
+  librmb::RadosCompression *alt_compression;
+  librmb::RadosDedup *dedup;
+  librmb::RadosReadAhead *read_ahead;
+  librmb::RadosStriping *striping;
+  librmb::RadosMailPack *pack;
 
   uint32_t corrupted_rebuild_count;
   bool corrupted;
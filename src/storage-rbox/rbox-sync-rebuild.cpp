@@ -10,6 +10,9 @@
  * Foundation.  See file COPYING.
  */
 #include <list>
+#include <map>
+#include <string>
+#include <vector>
 extern "C" {
 #include "dovecot-all.h"
 
@@ -30,14 +33,11 @@ using librmb::RadosMail;
 using librmb::rbox_metadata_key;
 
 int rbox_sync_add_object(struct index_rebuild_context *ctx, const std::string &oi, librmb::RadosMail *mail_obj,
-                         bool alt_storage, uint32_t next_uid) {
+                         bool alt_storage, uint32_t next_uid, const librmb::RadosMailPack::Location *pack_location) {
   FUNC_START();
   struct rbox_mailbox *rbox = (struct rbox_mailbox *)ctx->box;
-  char *xattr_mail_uid = NULL;
-  librmb::RadosUtils::get_metadata(rbox_metadata_key::RBOX_METADATA_MAIL_UID, mail_obj->get_metadata(),
-                                   &xattr_mail_uid);
-  char *xattr_guid = NULL;
-  librmb::RadosUtils::get_metadata(rbox_metadata_key::RBOX_METADATA_GUID, mail_obj->get_metadata(), &xattr_guid);
+  const char *xattr_mail_uid = mail_obj->get_metadata(rbox_metadata_key::RBOX_METADATA_MAIL_UID);
+  const char *xattr_guid = mail_obj->get_metadata(rbox_metadata_key::RBOX_METADATA_GUID);
   struct mail_storage *storage = ctx->box->storage;
   struct rbox_storage *r_storage = (struct rbox_storage *)storage;
   uint32_t seq;
@@ -66,13 +66,35 @@ int rbox_sync_add_object(struct index_rebuild_context *ctx, const std::string &o
   memcpy(rec.oid, oid, sizeof(oid));
 
   mail_index_update_ext(ctx->trans, seq, rbox->ext_id, &rec, NULL);
+
+  // the save date is not part of the metadata, it is looked up (once) on demand.
+  uoff_t physical_size = (uoff_t)-1;
+  const char *xattr_physical_size = mail_obj->get_metadata(rbox_metadata_key::RBOX_METADATA_PHYSICAL_SIZE);
+  if (xattr_physical_size != NULL) {
+    try {
+      physical_size = std::stoull(xattr_physical_size);
+    } catch (const std::invalid_argument &e) {
+      i_warning("invalid physical size '%s' for object %s", xattr_physical_size, oi.c_str());
+    } catch (const std::out_of_range &e) {
+      i_warning("invalid physical size '%s' for object %s", xattr_physical_size, oi.c_str());
+    }
+  }
+  rbox_mail_index_set_stat(ctx->trans, rbox->stat_ext_id, seq, 0, physical_size);
   if (alt_storage) {
     mail_index_update_flags(ctx->trans, seq, MODIFY_ADD, (enum mail_flags)RBOX_INDEX_FLAG_ALT);
   }
+  if (pack_location != nullptr) {
+    rbox_mail_index_set_pack(ctx->trans, rbox->pack_ext_id, seq, *pack_location);
+  }
 
   T_BEGIN { index_rebuild_index_metadata(ctx, seq, next_uid); }
   T_END;
 
+  if (pack_location != nullptr) {
+    // the uid of packed mails is updated in their container entry by the caller
+    FUNC_END();
+    return 0;
+  }
   // update uid.
   librmb::RadosMetadata mail_uid(librmb::RBOX_METADATA_MAIL_UID, next_uid);
   std::string s_oid = *mail_obj->get_oid();
@@ -87,6 +109,21 @@ int rbox_sync_add_object(struct index_rebuild_context *ctx, const std::string &o
   FUNC_END();
   return 0;
 }
+/* mails found by their separate metadata are in the primary or the alt storage, metadata without mail object is
+   left from an interrupted save (-ENOENT) */
+static int locate_mail_object(struct rbox_storage *r_storage, struct rbox_sync_rebuild_ctx *rebuild_ctx,
+                              const std::string &oid, bool *alt_storage) {
+  uint64_t size;
+  time_t mtime;
+  *alt_storage = false;
+  int ret = r_storage->s->stat_mail(oid, &size, &mtime);
+  if (ret == -ENOENT && rebuild_ctx->alt_valid) {
+    ret = r_storage->alt->stat_mail(oid, &size, &mtime);
+    *alt_storage = ret >= 0;
+  }
+  return ret;
+}
+
 // find objects with mailbox_guid 'U' attribute
 int rbox_sync_rebuild_entry(struct index_rebuild_context *ctx, librados::NObjectIterator &iter,
                             struct rbox_sync_rebuild_ctx *rebuild_ctx) {
@@ -105,6 +142,7 @@ int rbox_sync_rebuild_entry(struct index_rebuild_context *ctx, librados::NObject
 
   int found = 0;
   int sync_add_objects_ret = 0;
+  bool separate_metadata = r_storage->ms->get_storage()->has_separate_metadata();
   while (iter != librados::NObjectIterator::__EndObjectIterator) {
     std::map<std::string, ceph::bufferlist> attrset;
     librmb::RadosMail mail_object;
@@ -117,14 +155,24 @@ int rbox_sync_rebuild_entry(struct index_rebuild_context *ctx, librados::NObject
       load_metadata_ret = r_storage->ms->get_storage()->load_metadata(&mail_object);
     }
 
-    if (!librmb::RadosUtils::validate_metadata(mail_object.get_metadata())) {
+    if (!librmb::RadosUtils::validate_metadata(&mail_object)) {
       i_error("metadata for object : %s is not valid, skipping object ", mail_object.get_oid()->c_str());
       ++iter;
       continue;
     }
+    bool alt_storage = rebuild_ctx->alt_storage;
+    if (separate_metadata && load_metadata_ret >= 0) {
+      int locate_ret = locate_mail_object(r_storage, rebuild_ctx, (*iter).get_oid(), &alt_storage);
+      if (locate_ret < 0) {
+        i_warning("mail object for metadata %s cannot be found (%d), skipping object", (*iter).get_oid().c_str(),
+                  locate_ret);
+        ++iter;
+        continue;
+      }
+    }
     if (load_metadata_ret >= 0) {
       sync_add_objects_ret =
-          rbox_sync_add_object(ctx, (*iter).get_oid(), &mail_object, rebuild_ctx->alt_storage, rebuild_ctx->next_uid);
+          rbox_sync_add_object(ctx, (*iter).get_oid(), &mail_object, alt_storage, rebuild_ctx->next_uid);
       if (sync_add_objects_ret < 0) {
         i_error("sync_add_object: oid(%s), alt_storage(%d),uid(%d)", (*iter).get_oid().c_str(),
                 rebuild_ctx->alt_storage, rebuild_ctx->next_uid);
@@ -143,7 +191,7 @@ int rbox_sync_rebuild_entry(struct index_rebuild_context *ctx, librados::NObject
     return -1;
   }
 
-  if (found == 0) {
+  if (found == 0 && rebuild_ctx->packed_count == 0) {
 #ifdef DEBUG
     i_debug("no entry to restore can be found for mailbox %s", ctx->box->name);
 #endif
@@ -170,6 +218,62 @@ void rbox_sync_set_uidvalidity(struct index_rebuild_context *ctx) {
   FUNC_END();
 }
 
+// packed mails are found in the containers of the mailbox
+static int search_packed_objects(struct index_rebuild_context *ctx, struct rbox_sync_rebuild_ctx *rebuild_ctx) {
+  FUNC_START();
+  struct rbox_mailbox *rbox = (struct rbox_mailbox *)ctx->box;
+  struct rbox_storage *r_storage = (struct rbox_storage *)ctx->box->storage;
+  librados::IoCtx &io_ctx = r_storage->s->get_io_ctx();
+  std::string guid(guid_128_to_string(rbox->mailbox_guid));
+  std::vector<uint32_t> containers;
+
+  int ret = librmb::RadosMailPack::list_containers(io_ctx, guid, &containers);
+  if (ret < 0) {
+    i_error("search_packed_objects: listing the containers of mailbox %s failed with %d", guid.c_str(), ret);
+    FUNC_END();
+    return ret;
+  }
+  if (rebuild_ctx->next_uid == INT_MAX) {
+    const struct mail_index_header *hdr = mail_index_get_header(ctx->trans->view);
+    rebuild_ctx->next_uid = hdr->next_uid != 0 ? hdr->next_uid : 1;
+  }
+  for (std::vector<uint32_t>::iterator it = containers.begin(); it != containers.end(); ++it) {
+    std::map<std::string, librmb::RadosMailPack::Entry> entries;
+    ret = librmb::RadosMailPack::list_entries(io_ctx, guid, *it, &entries);
+    if (ret < 0) {
+      i_error("search_packed_objects: listing the entries of container %u failed with %d", *it, ret);
+      continue;
+    }
+    for (std::map<std::string, librmb::RadosMailPack::Entry>::iterator it_entry = entries.begin();
+         it_entry != entries.end(); ++it_entry) {
+      librmb::RadosMailPack::Location location;
+      location.container = *it;
+      location.offset = it_entry->second.offset;
+      location.length = it_entry->second.length;
+      librmb::RadosMail mail_object;
+      mail_object.set_oid(it_entry->first);
+      *mail_object.get_metadata() = it_entry->second.metadata;
+      ret = rbox_sync_add_object(ctx, it_entry->first, &mail_object, false, rebuild_ctx->next_uid, &location);
+      if (ret < 0) {
+        i_error("sync_add_object: packed oid(%s), container(%u), uid(%d)", it_entry->first.c_str(), *it,
+                rebuild_ctx->next_uid);
+        FUNC_END();
+        return ret;
+      }
+      librmb::RadosMetadata mail_uid(librmb::RBOX_METADATA_MAIL_UID, rebuild_ctx->next_uid);
+      it_entry->second.metadata[mail_uid.key] = mail_uid.bl;
+      if (librmb::RadosMailPack::save_entry(io_ctx, guid, *it, it_entry->first, it_entry->second) < 0) {
+        i_warning("update of MAIL_UID failed: for packed object: %s , uid: %d", it_entry->first.c_str(),
+                  rebuild_ctx->next_uid);
+      }
+      ++rebuild_ctx->next_uid;
+      ++rebuild_ctx->packed_count;
+    }
+  }
+  FUNC_END();
+  return 0;
+}
+
 int search_objects(struct index_rebuild_context *ctx, struct rbox_sync_rebuild_ctx *rebuild_ctx) {
   FUNC_START();
   struct rbox_mailbox *rbox = (struct rbox_mailbox *)ctx->box;
@@ -179,7 +283,21 @@ int search_objects(struct index_rebuild_context *ctx, struct rbox_sync_rebuild_c
   std::string guid(guid_128_to_string(rbox->mailbox_guid));
   librmb::RadosMetadata attr_guid(rbox_metadata_key::RBOX_METADATA_MAILBOX_GUID, guid);
   // rebuild index.
+  if (!rebuild_ctx->alt_storage && search_packed_objects(ctx, rebuild_ctx) < 0) {
+    FUNC_END();
+    return -1;
+  }
 
+  librmb::RadosStorageMetadataModule *metadata = r_storage->ms->get_storage();
+  if (metadata->has_separate_metadata()) {
+    // the metadata of primary and alt storage mails is listed once, without accessing the mail objects.
+    if (!rebuild_ctx->alt_storage) {
+      librados::NObjectIterator iter_metadata(metadata->find_mails(&attr_guid));
+      ret = rbox_sync_rebuild_entry(ctx, iter_metadata, rebuild_ctx);
+    }
+    FUNC_END();
+    return ret;
+  }
   librados::NObjectIterator iter_guid(storage->find_mails(&attr_guid));
   ret = rbox_sync_rebuild_entry(ctx, iter_guid, rebuild_ctx);
   FUNC_END();
@@ -219,6 +337,7 @@ int rbox_sync_index_rebuild_objects(struct index_rebuild_context *ctx) {
   rebuild_ctx = p_new(pool, struct rbox_sync_rebuild_ctx, 1);
   i_zero(rebuild_ctx);
   rebuild_ctx->alt_storage = false;
+  rebuild_ctx->alt_valid = alt_storage;
   rebuild_ctx->next_uid = INT_MAX;
 
   search_objects(ctx, rebuild_ctx);
@@ -17,6 +17,7 @@
 #include <rados/librados.hpp>
 
 #include "../librmb/rados-mail.h"
+#include "../librmb/rados-mail-pack.h"
 
 extern "C" {
 #include "index-rebuild.h"
@@ -24,12 +25,17 @@ extern "C" {
 
 struct rbox_sync_rebuild_ctx {
   bool alt_storage;
+  /* alt storage is configured and open */
+  bool alt_valid;
   uint32_t next_uid;
+  /* number of packed mails added to the index */
+  unsigned int packed_count;
 };
 extern void rbox_sync_update_header(struct index_rebuild_context *ctx);
 
 extern int rbox_sync_add_object(struct index_rebuild_context *ctx, const std::string &oi, librmb::RadosMail *mail_obj,
-                                bool alt_storage, uint32_t next_uid);
+                                bool alt_storage, uint32_t next_uid,
+                                const librmb::RadosMailPack::Location *pack_location = nullptr);
 
 extern int rbox_sync_index_rebuild(struct index_rebuild_context *ctx, librados::NObjectIterator &iter,
                                    struct rbox_sync_rebuild_ctx *rebuild_ctx);
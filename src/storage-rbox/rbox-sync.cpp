@@ -9,9 +9,13 @@
  * License version 2.1, as published by the Free Software
  * Foundation.  See file COPYING.
  */
+#include <algorithm>
 #include <string>
 #include <rados/librados.hpp>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 
 extern "C" {
 #include "dovecot-all.h"
@@ -21,11 +25,15 @@ extern "C" {
 #include "debug-helper.h"
 }
 #include "rados-util.h"
+#include "rados-metrics.h"
 #include "rbox-storage.hpp"
 #include "rbox-mail.h"
 #include "rbox-sync-rebuild.h"
+#include "rbox-event.h"
 
 #define RBOX_REBUILD_COUNT 3
+#define RBOX_MAX_PENDING_REMOVES 64
+#define RBOX_MAX_PACK_COMPACTIONS 4
 
 static int rbox_get_oid_from_index(struct mail_index_view *_sync_view, uint32_t seq, uint32_t ext_id,
                                    guid_128_t *index_oid) {
@@ -69,6 +77,11 @@ static void rbox_sync_expunge(struct rbox_sync_context *ctx, uint32_t seq1, uint
         // continue anyway
       } else {
         item->alt_storage = is_alternate_storage_set(rec->flags) && is_alternate_pool_valid(box);
+        librmb::RadosMailPack::Location pack_location;
+        if (!item->alt_storage &&
+            rbox_mail_index_get_pack(ctx->sync_view, ((struct rbox_mailbox *)box)->pack_ext_id, seq1, &pack_location)) {
+          item->pack_container = pack_location.container;
+        }
         array_append(&ctx->expunged_items, &item, 1);
       }
     }
@@ -112,7 +125,32 @@ static int update_extended_metadata(struct rbox_sync_context *ctx, uint32_t seq1
 
       std::string key_oid(oid);
       std::string ext_key = std::to_string(keyword_idx);
-      if (remove) {
+      librmb::RadosMailPack::Location pack_location;
+      if (!alt_storage &&
+          rbox_mail_index_get_pack(ctx->sync_view, ((struct rbox_mailbox *)box)->pack_ext_id, seq1, &pack_location)) {
+        // the keywords of packed mails are part of their container entry
+        librmb::RadosMailPack::Entry entry;
+        std::string mailbox_guid = guid_128_to_string(((struct rbox_mailbox *)box)->mailbox_guid);
+        ret = librmb::RadosMailPack::load_entry(r_storage->s->get_io_ctx(), mailbox_guid, pack_location.container,
+                                                key_oid, &entry);
+        if (ret >= 0) {
+          if (remove) {
+            entry.extended_metadata.erase(ext_key);
+          } else {
+            unsigned int count;
+            const char *const *keywords = array_get(&ctx->sync_view->index->keywords, &count);
+            if (keywords == NULL) {
+              i_error("update_extended_metadata: keywords == NULL , oid(%s), keyword_index(%s)", oid, ext_key.c_str());
+              continue;
+            }
+            std::string key_value = keywords[keyword_idx];
+            librmb::RadosMetadata ext_metadata(ext_key, key_value);
+            entry.extended_metadata[ext_metadata.key] = ext_metadata.bl;
+          }
+          ret = librmb::RadosMailPack::save_entry(r_storage->s->get_io_ctx(), mailbox_guid, pack_location.container,
+                                                  key_oid, entry);
+        }
+      } else if (remove) {
         ret = r_storage->ms->get_storage()->remove_keyword_metadata(key_oid, ext_key);
       } else {
         unsigned int count;
@@ -145,7 +183,20 @@ static int move_to_alt(struct rbox_sync_context *ctx, uint32_t seq1, uint32_t se
     i_error("move_to_alt: connection to rados failed");
     return -1;
   }
+  // mails are (re)compressed with the codec of the destination pool, without a codec they are moved as they are.
+  const librmb::RadosCompression *compression = inverse ? r_storage->compression : r_storage->alt_compression;
+  if (!compression->is_enabled()) {
+    compression = nullptr;
+  }
   for (; seq1 <= seq2; seq1++) {
+    librmb::RadosMailPack::Location pack_location;
+    if (rbox_mail_index_get_pack(ctx->sync_view, ctx->rbox->pack_ext_id, seq1, &pack_location)) {
+      // packed mails stay in their container in the primary storage
+      if (!inverse) {
+        mail_index_update_flags(ctx->trans, seq1, MODIFY_REMOVE, (enum mail_flags)RBOX_INDEX_FLAG_ALT);
+      }
+      continue;
+    }
     guid_128_t index_oid;
     if (rbox_get_oid_from_index(ctx->sync_view, seq1, ((struct rbox_mailbox *)&ctx->rbox->box)->ext_id, &index_oid) >=
         0) {
@@ -153,7 +204,7 @@ static int move_to_alt(struct rbox_sync_context *ctx, uint32_t seq1, uint32_t se
 #ifdef DEBUG
       i_debug("found oid: %s", oid.c_str());
 #endif
-      ret = librmb::RadosUtils::move_to_alt(oid, r_storage->s, r_storage->alt, r_storage->ms, inverse);
+      ret = librmb::RadosUtils::move_to_alt(oid, r_storage->s, r_storage->alt, r_storage->ms, inverse, compression);
       if (ret >= 0) {
         if (inverse) {
           mail_index_update_flags(ctx->trans, seq1, MODIFY_REMOVE, (enum mail_flags)RBOX_INDEX_FLAG_ALT);
@@ -201,7 +252,20 @@ static int update_flags(struct rbox_sync_context *ctx, uint32_t seq1, uint32_t s
 
       librmb::RadosMail mail_object;
       mail_object.set_oid(oid);
-      if (r_storage->ms->get_storage()->load_metadata(&mail_object) < 0) {
+      // the metadata of packed mails is part of their container entry
+      librmb::RadosMailPack::Location pack_location;
+      librmb::RadosMailPack::Entry entry;
+      std::string mailbox_guid = guid_128_to_string(ctx->rbox->mailbox_guid);
+      bool packed =
+          !alt_storage && rbox_mail_index_get_pack(ctx->sync_view, ctx->rbox->pack_ext_id, seq1, &pack_location);
+      if (packed) {
+        if (librmb::RadosMailPack::load_entry(r_storage->s->get_io_ctx(), mailbox_guid, pack_location.container,
+                                              *mail_object.get_oid(), &entry) < 0) {
+          i_error("update_flags: load_entry failed! for %d, oid(%s)", seq1, oid);
+          continue;
+        }
+        mail_object.get_metadata()->swap(entry.metadata);
+      } else if (r_storage->ms->get_storage()->load_metadata(&mail_object) < 0) {
         i_error("update_flags: load_metadata failed! for %d, oid(%s)", seq1, oid);
         continue;
       }
@@ -218,7 +282,14 @@ static int update_flags(struct rbox_sync_context *ctx, uint32_t seq1, uint32_t s
         std::string str_flags_metadata;
         if (librmb::RadosUtils::flags_to_string(flags, &str_flags_metadata)) {
           librmb::RadosMetadata update(librmb::RBOX_METADATA_OLDV1_FLAGS, str_flags_metadata);
-          ret = r_storage->ms->get_storage()->set_metadata(&mail_object, update);
+          if (packed) {
+            mail_object.add_metadata(update);
+            entry.metadata.swap(*mail_object.get_metadata());
+            ret = librmb::RadosMailPack::save_entry(r_storage->s->get_io_ctx(), mailbox_guid, pack_location.container,
+                                                    *mail_object.get_oid(), entry);
+          } else {
+            ret = r_storage->ms->get_storage()->set_metadata(&mail_object, update);
+          }
           if (ret < 0) {
             i_warning("updating metadata for object : oid(%s), seq (%d) failed with ceph errorcode: %d",
                       mail_object.get_oid()->c_str(), seq1, ret);
@@ -384,6 +455,9 @@ int rbox_sync_begin(struct rbox_mailbox *rbox, struct rbox_sync_context **ctx_r,
   ctx = i_new(struct rbox_sync_context, 1);
   ctx->rbox = rbox;
   i_array_init(&ctx->expunged_items, 32);
+  ctx->event = i_new(struct rbox_op_event, 1);
+  rbox_op_event_begin(ctx->event, &rbox->box, NULL, "rbox_sync_finished", NULL);
+  rbox_op_event_add_int(ctx->event, "rebuild", rebuild ? 1 : 0);
 
   int ret = 0;
   bool success = false;
@@ -420,6 +494,8 @@ int rbox_sync_begin(struct rbox_mailbox *rbox, struct rbox_sync_context **ctx_r,
   if (ret <= 0) {
     array_delete(&ctx->expunged_items, array_count(&ctx->expunged_items) - 1, 1);
     array_free(&ctx->expunged_items);
+    rbox_op_event_end(ctx->event, ret, 0);
+    i_free(ctx->event);
     i_free(ctx);
     *ctx_r = NULL;
     FUNC_END_RET("ret <= 0");
@@ -434,6 +510,8 @@ int rbox_sync_begin(struct rbox_mailbox *rbox, struct rbox_sync_context **ctx_r,
       index_storage_expunging_deinit(&ctx->rbox->box);
       array_delete(&ctx->expunged_items, array_count(&ctx->expunged_items) - 1, 1);
       array_free(&ctx->expunged_items);
+      rbox_op_event_end(ctx->event, -1, 0);
+      i_free(ctx->event);
       i_free(ctx);
       return -1;
     }
@@ -444,7 +522,127 @@ int rbox_sync_begin(struct rbox_mailbox *rbox, struct rbox_sync_context **ctx_r,
   return 0;
 }
 
-static int rbox_sync_object_expunge(struct rbox_sync_context *ctx, struct expunged_item *item) {
+/* pending aio operations of an expunged mail object. The immutable metadata is read first, the dedup reference
+   and the stripes of the mail are only known from it. Then the mail object and its separate metadata are removed. */
+struct rbox_sync_remove {
+  enum { READ_METADATA, REMOVE_MAIL, REMOVE_METADATA } stage;
+  std::string oid;
+  bool alt_storage;
+  librmb::RadosMail mail;
+  std::map<std::string, ceph::bufferlist> xattrs;
+  int xattrs_ret;
+  // dedup reference and stripes of the mail are released after the remove
+  librmb::RadosDedup *dedup;
+  librmb::RadosStorage *rados_storage;
+  // separate metadata is removed after the mail object
+  librmb::RadosStorageMetadataModule *metadata;
+  librados::ObjectReadOperation read_op;
+  librados::ObjectWriteOperation write_op;
+  librados::ObjectWriteOperation metadata_op;
+  librados::AioCompletion *completion;
+  uint64_t start;
+};
+
+static int rbox_sync_object_remove_start(struct rbox_sync_remove *remove) {
+  remove->stage = rbox_sync_remove::REMOVE_MAIL;
+  librmb::RadosMailCache::global().remove(remove->rados_storage, remove->oid);
+  remove->write_op.remove();
+  remove->completion = librados::Rados::aio_create_completion();
+  remove->start = librmb::RadosMetrics::now_usecs();
+  int ret_remove = remove->rados_storage->aio_operate(&remove->rados_storage->get_io_ctx(), remove->oid,
+                                                      remove->completion, &remove->write_op);
+  if (ret_remove < 0) {
+    i_error("rbox_sync_object_expunge: aio_remove failed with %d oid(%s), alt_storage(%d)", ret_remove,
+            remove->oid.c_str(), remove->alt_storage);
+    remove->completion->release();
+  }
+  return ret_remove;
+}
+
+/* @return 1 if the remove of the separate metadata is pending, 0 if there is none, < 0 on error */
+static int rbox_sync_object_remove_metadata_start(struct rbox_sync_remove *remove) {
+  // the module is shared by all expunged mails, other mails may have changed its io context since.
+  remove->metadata->set_io_ctx(&remove->rados_storage->get_io_ctx());
+  librados::IoCtx *metadata_io_ctx = remove->metadata->remove_metadata(&remove->metadata_op);
+  if (metadata_io_ctx == nullptr) {
+    return 0;
+  }
+  remove->stage = rbox_sync_remove::REMOVE_METADATA;
+  remove->completion = librados::Rados::aio_create_completion();
+  int ret_remove =
+      remove->rados_storage->aio_operate(metadata_io_ctx, remove->oid, remove->completion, &remove->metadata_op);
+  if (ret_remove < 0) {
+    remove->completion->release();
+    return ret_remove;
+  }
+  return 1;
+}
+
+/* wait for the current operation of remove and issue the next one.
+   @return 1 if the next operation is pending, 0 if the mail has been removed, < 0 on error (remove is freed) */
+static int rbox_sync_object_expunge_wait(struct rbox_sync_remove *remove,
+                                         std::list<struct rbox_sync_remove *> *pending) {
+  remove->completion->wait_for_complete();
+  int ret_remove = remove->completion->get_return_value();
+  remove->completion->release();
+
+  if (remove->stage == rbox_sync_remove::READ_METADATA) {
+    int ret_read = ret_remove < 0 ? ret_remove : remove->xattrs_ret;
+    if (ret_read >= 0) {
+      remove->metadata->decode_immutable_metadata(&remove->mail, &remove->xattrs);
+    } else if (ret_read != -ENOENT) {
+      i_warning("rbox_sync_object_expunge: reading metadata failed with %d oid(%s), alt_storage(%d)", ret_read,
+                remove->oid.c_str(), remove->alt_storage);
+    }
+    ret_remove = rbox_sync_object_remove_start(remove);
+    if (ret_remove < 0) {
+      delete remove;
+      return ret_remove;
+    }
+    pending->push_back(remove);
+    return 1;
+  }
+
+  if (remove->stage == rbox_sync_remove::REMOVE_MAIL) {
+    librmb::RadosMetrics::global().record(librmb::METRIC_DELETE_MAIL,
+                                          librmb::RadosMetrics::now_usecs() - remove->start,
+                                          ret_remove < 0 && ret_remove != -ENOENT);
+    if (ret_remove >= 0 || ret_remove == -ENOENT) {
+      // the metadata remove takes the slot of the mail remove, the references are released after it.
+      int ret_metadata = rbox_sync_object_remove_metadata_start(remove);
+      if (ret_metadata > 0) {
+        pending->push_back(remove);
+        return 1;
+      } else if (ret_metadata < 0) {
+        i_error("rbox_sync_object_expunge: removing metadata failed with %d oid(%s)", ret_metadata,
+                remove->oid.c_str());
+      }
+    }
+  } else {
+    if (ret_remove < 0 && ret_remove != -ENOENT) {
+      i_error("rbox_sync_object_expunge: removing metadata failed with %d oid(%s)", ret_remove, remove->oid.c_str());
+    }
+    // the mail object is removed, a failed metadata remove does not fail the expunge.
+    ret_remove = 0;
+  }
+  if (ret_remove < 0 && ret_remove != -ENOENT) {
+    i_error("rbox_sync_object_expunge: aio_remove failed with %d oid(%s), alt_storage(%d)", ret_remove,
+            remove->oid.c_str(), remove->alt_storage);
+  } else {
+    // the references are known from the mail's own metadata (rbox_dedup / rbox_striping may have changed since)
+    ret_remove = librmb::RadosUtils::release_mail_refs(remove->rados_storage->get_io_ctx(), &remove->mail,
+                                                       remove->dedup);
+    if (ret_remove < 0) {
+      i_error("rbox_sync_object_expunge: releasing references failed with %d oid(%s), alt_storage(%d)", ret_remove,
+              remove->oid.c_str(), remove->alt_storage);
+    }
+  }
+  delete remove;
+  return ret_remove == -ENOENT ? 0 : ret_remove;
+}
+
+static int rbox_sync_object_expunge(struct rbox_sync_context *ctx, struct expunged_item *item,
+                                    std::list<struct rbox_sync_remove *> *pending) {
   FUNC_START();
   int ret_remove = -1;
   struct mailbox *box = &ctx->rbox->box;
@@ -460,23 +658,65 @@ static int rbox_sync_object_expunge(struct rbox_sync_context *ctx, struct expung
     return ret_remove;
   }
   librmb::RadosStorage *rados_storage = item->alt_storage ? r_storage->alt : r_storage->s;
-  ret_remove = rados_storage->get_io_ctx().remove(oid);
-  if (ret_remove < 0) {
-    if(ret_remove != -ENOENT){
-    	i_error("rbox_sync_object_expunge: aio_remove failed with %d oid(%s), alt_storage(%d)", ret_remove, oid,
-            item->alt_storage);
+
+  struct rbox_sync_remove *remove = new struct rbox_sync_remove();
+  remove->oid = oid;
+  remove->alt_storage = item->alt_storage;
+  remove->dedup = r_storage->dedup;
+  remove->rados_storage = rados_storage;
+  remove->metadata = r_storage->ms->get_storage();
+  remove->mail.set_oid(remove->oid);
+  remove->xattrs_ret = 0;
+
+  // the metadata read is issued asynchronously as well, it takes one slot of the window.
+  remove->metadata->set_io_ctx(&rados_storage->get_io_ctx());
+  librados::IoCtx *metadata_io_ctx =
+      remove->metadata->read_immutable_metadata(&remove->read_op, &remove->xattrs, &remove->xattrs_ret);
+  if (metadata_io_ctx == nullptr) {
+    remove->metadata->load_immutable_metadata(&remove->mail);
+    ret_remove = rbox_sync_object_remove_start(remove);
+  } else {
+    remove->stage = rbox_sync_remove::READ_METADATA;
+    remove->completion = librados::Rados::aio_create_completion();
+    ret_remove = rados_storage->aio_operate(metadata_io_ctx, remove->oid, remove->completion, &remove->read_op,
+                                            librmb::RadosReplicaReads::global().get_flags(), nullptr);
+    if (ret_remove < 0) {
+      i_error("rbox_sync_object_expunge: reading metadata failed with %d oid(%s), alt_storage(%d)", ret_remove, oid,
+              item->alt_storage);
+      remove->completion->release();
     }
   }
+  if (ret_remove < 0) {
+    delete remove;
+  } else {
+    pending->push_back(remove);
+  }
 
   FUNC_END();
   return ret_remove;
 }
 
+/* complete the oldest pending operation */
+static void rbox_sync_expunge_wait_front(std::list<struct rbox_sync_remove *> *pending, unsigned int *removed,
+                                         unsigned int *failed) {
+  struct rbox_sync_remove *remove = pending->front();
+  pending->pop_front();
+  int ret = rbox_sync_object_expunge_wait(remove, pending);
+  if (ret < 0) {
+    (*failed)++;
+  } else if (ret == 0) {
+    (*removed)++;
+  }
+}
+
 static void rbox_sync_expunge_rbox_objects(struct rbox_sync_context *ctx) {
   FUNC_START();
   struct expunged_item *const *items, *item;
   struct expunged_item *const *moved_items, *moved_item;
   unsigned int count, moved_count = 0;
+  unsigned int removed = 0, failed = 0;
+  // removes are issued asynchronously, at most RBOX_MAX_PENDING_REMOVES at a time.
+  std::list<struct rbox_sync_remove *> pending;
 
   // rbox_sync_object_expunge;
   items = array_get(&ctx->expunged_items, &count);
@@ -495,7 +735,18 @@ static void rbox_sync_expunge_rbox_objects(struct rbox_sync_context *ctx) {
           }
         }
         if (moved != TRUE) {
-          rbox_sync_object_expunge(ctx, item);
+          if (item->pack_container != 0) {
+            // the pack entry has been removed after the index was committed (rbox_sync_finish_packs)
+            removed++;
+          } else {
+            // a completed metadata read issues the remove, which stays in the window.
+            while (pending.size() >= RBOX_MAX_PENDING_REMOVES) {
+              rbox_sync_expunge_wait_front(&pending, &removed, &failed);
+            }
+            if (rbox_sync_object_expunge(ctx, item, &pending) < 0) {
+              failed++;
+            }
+          }
           // directly notify
           if (ctx->rbox->box.v.sync_notify != NULL) {
             ctx->rbox->box.v.sync_notify(&ctx->rbox->box, item->uid, MAILBOX_SYNC_TYPE_EXPUNGE);
@@ -504,13 +755,142 @@ static void rbox_sync_expunge_rbox_objects(struct rbox_sync_context *ctx) {
       }
       T_END;
     }
+    while (!pending.empty()) {
+      rbox_sync_expunge_wait_front(&pending, &removed, &failed);
+    }
     if (ctx->rbox->box.v.sync_notify != NULL) {
       ctx->rbox->box.v.sync_notify(&ctx->rbox->box, 0, static_cast<mailbox_sync_type>(0));
     }
   }
+  rbox_op_event_add_int(ctx->event, "expunged", removed);
+  rbox_op_event_add_int(ctx->event, "expunge_failed", failed);
   FUNC_END();
 }
 
+static void rbox_sync_update_pack_locations(struct rbox_sync_context *ctx, uint32_t container,
+                                            const std::map<std::string, librmb::RadosMailPack::Location> &locations) {
+  struct rbox_mailbox *rbox = ctx->rbox;
+  uint32_t count = mail_index_view_get_messages_count(ctx->sync_view);
+
+  for (uint32_t seq = 1; seq <= count; seq++) {
+    librmb::RadosMailPack::Location location;
+    if (!rbox_mail_index_get_pack(ctx->sync_view, rbox->pack_ext_id, seq, &location) ||
+        location.container != container) {
+      continue;
+    }
+    guid_128_t index_oid;
+    if (rbox_get_oid_from_index(ctx->sync_view, seq, rbox->ext_id, &index_oid) < 0) {
+      continue;
+    }
+    std::map<std::string, librmb::RadosMailPack::Location>::const_iterator it =
+        locations.find(guid_128_to_string(index_oid));
+    if (it != locations.end()) {
+      rbox_mail_index_set_pack(ctx->trans, rbox->pack_ext_id, seq, it->second);
+    }
+  }
+}
+
+/* containers of expunged packed mails are compacted while the index is still locked: mails are only appended to
+   containers by processes holding the lock, so every live mail of a compacted container is in the sync view and gets
+   its new location with the sync transaction. The entries of the expunged mails are removed once the expunges are
+   committed (rbox_sync_finish_packs). */
+static void rbox_sync_expunge_packed(struct rbox_sync_context *ctx, std::map<uint32_t, std::set<std::string>> *expunged,
+                                     std::vector<uint32_t> *compacted,
+                                     std::map<uint32_t, std::set<std::string>> *relocated) {
+  FUNC_START();
+  struct rbox_mailbox *rbox = ctx->rbox;
+  struct rbox_storage *r_storage = (struct rbox_storage *)rbox->box.storage;
+  struct expunged_item *const *items;
+  unsigned int count = 0;
+
+  items = array_get(&ctx->expunged_items, &count);
+  for (unsigned int i = 0; i < count; i++) {
+    if (items[i]->pack_container != 0) {
+      (*expunged)[items[i]->pack_container].insert(guid_128_to_string(items[i]->oid));
+    }
+  }
+  if (expunged->empty()) {
+    FUNC_END();
+    return;
+  }
+  if (rbox_open_rados_connection(&rbox->box, false) < 0) {
+    i_error("rbox_sync_expunge_packed: connection to rados failed");
+    // the entries of the expunged mails stay in their containers
+    expunged->clear();
+    FUNC_END();
+    return;
+  }
+  std::string mailbox_guid = guid_128_to_string(rbox->mailbox_guid);
+  librados::IoCtx &io_ctx = r_storage->s->get_io_ctx();
+  for (std::map<uint32_t, std::set<std::string>>::iterator it = expunged->begin(); it != expunged->end(); ++it) {
+    if (compacted->size() >= RBOX_MAX_PACK_COMPACTIONS) {
+      break;
+    }
+    std::map<std::string, librmb::RadosMailPack::Location> locations;
+    int ret = r_storage->pack->compact(io_ctx, mailbox_guid, it->first, it->second, &locations);
+    if (ret < 0) {
+      i_error("rbox_sync_expunge_packed: compacting container %u failed with %d", it->first, ret);
+    }
+    if (ret <= 0) {
+      continue;
+    }
+    rbox_sync_update_pack_locations(ctx, it->first, locations);
+    for (std::map<std::string, librmb::RadosMailPack::Location>::iterator it_loc = locations.begin();
+         it_loc != locations.end(); ++it_loc) {
+      (*relocated)[it_loc->second.container].insert(it_loc->first);
+    }
+    compacted->push_back(it->first);
+  }
+  rbox_op_event_add_int(ctx->event, "pack_compacted", compacted->size());
+  FUNC_END();
+}
+
+/* once the expunges and new locations are committed the entries of the expunged mails and the compacted containers
+   are removed, otherwise the relocated copies. */
+static void rbox_sync_finish_packs(struct rbox_sync_context *ctx,
+                                   const std::map<uint32_t, std::set<std::string>> &expunged,
+                                   const std::vector<uint32_t> &compacted,
+                                   const std::map<uint32_t, std::set<std::string>> &relocated, bool committed) {
+  if (expunged.empty()) {
+    return;
+  }
+  struct rbox_storage *r_storage = (struct rbox_storage *)ctx->rbox->box.storage;
+  std::string mailbox_guid = guid_128_to_string(ctx->rbox->mailbox_guid);
+  librados::IoCtx &io_ctx = r_storage->s->get_io_ctx();
+
+  if (committed) {
+    for (std::map<uint32_t, std::set<std::string>>::const_iterator it = expunged.begin(); it != expunged.end();
+         ++it) {
+      for (std::set<std::string>::const_iterator it_oid = it->second.begin(); it_oid != it->second.end(); ++it_oid) {
+        // packed mails are always read from the primary storage
+        librmb::RadosMailCache::global().remove(r_storage->s, *it_oid);
+      }
+      if (std::find(compacted.begin(), compacted.end(), it->first) != compacted.end()) {
+        continue;
+      }
+      int ret = librmb::RadosMailPack::remove(io_ctx, mailbox_guid, it->first, it->second);
+      if (ret < 0) {
+        i_error("rbox_sync_finish_packs: removing %lu entries of container %u failed with %d", it->second.size(),
+                it->first, ret);
+      }
+    }
+    for (std::vector<uint32_t>::const_iterator it = compacted.begin(); it != compacted.end(); ++it) {
+      int ret = librmb::RadosMailPack::remove_container(io_ctx, mailbox_guid, *it);
+      if (ret < 0) {
+        i_error("rbox_sync_finish_packs: removing container %u failed with %d", *it, ret);
+      }
+    }
+    return;
+  }
+  for (std::map<uint32_t, std::set<std::string>>::const_iterator it = relocated.begin(); it != relocated.end();
+       ++it) {
+    int ret = librmb::RadosMailPack::remove(io_ctx, mailbox_guid, it->first, it->second);
+    if (ret < 0) {
+      i_error("rbox_sync_finish_packs: removing relocated entries of container %u failed with %d", it->first, ret);
+    }
+  }
+}
+
 int rbox_sync_finish(struct rbox_sync_context **_ctx, bool success) {
   FUNC_START();
   struct rbox_sync_context *ctx = *_ctx;
@@ -520,12 +900,18 @@ int rbox_sync_finish(struct rbox_sync_context **_ctx, bool success) {
 
   *_ctx = NULL;
   if (success) {
+    std::map<uint32_t, std::set<std::string>> expunged;
+    std::vector<uint32_t> compacted;
+    std::map<uint32_t, std::set<std::string>> relocated;
+    rbox_sync_expunge_packed(ctx, &expunged, &compacted, &relocated);
     mail_index_view_ref(ctx->sync_view);
     if (mail_index_sync_commit(&ctx->index_sync_ctx) < 0) {
       mailbox_set_index_error(&ctx->rbox->box);
+      rbox_sync_finish_packs(ctx, expunged, compacted, relocated, false);
       FUNC_END_RET("ret == -1");
       ret = -1;
     } else {
+      rbox_sync_finish_packs(ctx, expunged, compacted, relocated, true);
       // delete/move objects from mailstorage
       rbox_sync_expunge_rbox_objects(ctx);
       // close the view, write changes to index.
@@ -549,6 +935,8 @@ int rbox_sync_finish(struct rbox_sync_context **_ctx, bool success) {
     array_free(&ctx->expunged_items);
   }
 
+  rbox_op_event_end(ctx->event, ret, 0);
+  i_free(ctx->event);
   i_free(ctx);
   FUNC_END();
   return ret;
@@ -14,6 +14,8 @@
 
 #include "dovecot-all.h"
 
+struct rbox_op_event;
+
 enum rbox_sync_flags { RBOX_SYNC_FLAG_FORCE = 0x01, RBOX_SYNC_FLAG_FSYNC = 0x02, RBOX_SYNC_FLAG_FORCE_REBUILD = 0x04 };
 
 /**
@@ -27,6 +29,8 @@ struct expunged_item {
   guid_128_t oid;
   /** storage location **/
   bool alt_storage;
+  /** pack container of a packed mail, 0 if the mail has its own object **/
+  uint32_t pack_container;
 };
 
 /**
@@ -45,6 +49,8 @@ struct rbox_sync_context {
   uint32_t uid_validity;
   /** list of expunged mails**/
   ARRAY(struct expunged_item *) expunged_items;
+  /** rbox_sync_finished event, sent by rbox_sync_finish **/
+  struct rbox_op_event *event;
 };
 /**
  * @brief: callback data used to send a notification callback
@@ -0,0 +1,441 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+/*
+ * Offline benchmarks of the librmb operations used by storage-rbox.
+ * The storage operations (save, read, copy, move, expunge, rebuild) run
+ * against RadosStorageMem, so they only count the round trips and bytes the
+ * operation sequence costs and the rados time simulated by the latency model.
+ * The metadata encode/decode benchmarks run the real metadata modules and
+ * report the measured cpu time.
+ *
+ * usage: bench_librmb [-l latency usecs] [-b bandwidth MB/s] [-m mail size] [-n mailbox sizes] [-f filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rados-ceph-config.h"
+#include "rados-dovecot-ceph-cfg-impl.h"
+#include "rados-dovecot-config.h"
+#include "rados-metadata-storage-binary.h"
+#include "rados-metadata-storage-default.h"
+#include "rados-metadata-storage-ima.h"
+#include "rados-metrics.h"
+#include "rados-storage-mem.h"
+
+using librmb::RadosMail;
+using librmb::RadosMetadata;
+using librmb::RadosMetrics;
+using librmb::RadosStorageMem;
+
+static const char *BENCH_NAMESPACE = "bench";
+static const char *BENCH_NAMESPACE_DEST = "bench_dest";
+static const size_t LIST_CHUNK_SIZE = 1024;
+
+struct bench_context {
+  RadosStorageMem *storage;
+  librmb::RadosStorageMetadataModule *ms;
+  librmb::RadosDovecotCephCfg *cfg;
+  size_t mail_size;
+
+  uint64_t start_usecs;
+  uint64_t wall_usecs;
+  // encoded bytes of the cpu only benchmarks
+  uint64_t bytes;
+};
+
+typedef void (*bench_func)(struct bench_context *ctx, size_t mails);
+
+struct bench_def {
+  const char *name;
+  bench_func func;
+  // measures librmb code, not only the in memory storage
+  bool cpu;
+};
+
+/* encoded metadata attribute of the ima and binary module */
+class BenchCodec {
+ public:
+  virtual ~BenchCodec() {}
+  virtual void encode(RadosMail *mail, ceph::bufferlist *bl) = 0;
+};
+
+template <class T>
+class BenchMetadataCodec : public T, public BenchCodec {
+ public:
+  explicit BenchMetadataCodec(librmb::RadosDovecotCephCfg *cfg_) : T(nullptr, cfg_) {}
+  void encode(RadosMail *mail, ceph::bufferlist *bl) override {
+    librados::ObjectWriteOperation write_op;
+    this->encode_attribute(mail, &write_op, bl);
+  }
+};
+
+static void bench_start(struct bench_context *ctx) {
+  ctx->storage->reset_stats();
+  ctx->bytes = 0;
+  ctx->start_usecs = RadosMetrics::now_usecs();
+}
+
+static void bench_stop(struct bench_context *ctx) { ctx->wall_usecs = RadosMetrics::now_usecs() - ctx->start_usecs; }
+
+static std::string bench_oid(size_t uid) {
+  char oid[32];
+  snprintf(oid, sizeof(oid), "bench-%010zu", uid);
+  return oid;
+}
+
+static void bench_add_metadata(RadosMail *mail, size_t uid, size_t size) {
+  time_t now = time(NULL);
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_MAILBOX_GUID, "a0b1c2d3e4f5a6b7c8d9e0f1a2b3c4d5"));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_GUID, "f5e4d3c2b1a0f9e8d7c6b5a4f3e2d1c0"));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_MAIL_UID, static_cast<uint>(uid)));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_RECEIVED_TIME, now));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_PHYSICAL_SIZE, size));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_VIRTUAL_SIZE, size + size / 32));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_VERSION, "0.1"));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_FROM_ENVELOPE, "sender@example.com"));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_ORIG_MAILBOX, "INBOX"));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_POP3_UIDL, bench_oid(uid)));
+  mail->add_metadata(RadosMetadata(librmb::RBOX_METADATA_OLDV1_FLAGS, "0x08"));
+  std::string key = "K1";
+  std::string value = "$Forwarded";
+  mail->add_extended_metadata(RadosMetadata(key, value));
+}
+
+static RadosMail *bench_create_mail(struct bench_context *ctx, size_t uid) {
+  RadosMail *mail = ctx->storage->alloc_rados_mail();
+  mail->set_oid(bench_oid(uid));
+  librados::bufferlist *buffer = new librados::bufferlist();
+  buffer->append_zero(ctx->mail_size);
+  mail->set_mail_buffer(buffer);
+  mail->set_mail_size(ctx->mail_size);
+  mail->set_rados_save_date(time(NULL));
+  bench_add_metadata(mail, uid, ctx->mail_size);
+  return mail;
+}
+
+/* saves the mailbox like a transaction of storage-rbox: all writes async, one wait at commit */
+static void bench_fill(struct bench_context *ctx, size_t mails) {
+  ctx->storage->clear();
+  ctx->storage->set_namespace(BENCH_NAMESPACE);
+
+  std::list<RadosMail *> saved;
+  std::list<librados::ObjectWriteOperation *> write_ops;
+  for (size_t i = 1; i <= mails; i++) {
+    RadosMail *mail = bench_create_mail(ctx, i);
+    librados::ObjectWriteOperation *write_op = new librados::ObjectWriteOperation();
+    ctx->ms->save_metadata(write_op, mail);
+    ctx->storage->save_mail(write_op, mail, true);
+    saved.push_back(mail);
+    write_ops.push_back(write_op);
+  }
+  ctx->storage->wait_for_rados_operations(saved);
+  for (std::list<RadosMail *>::iterator it = saved.begin(); it != saved.end(); ++it) {
+    ctx->storage->free_rados_mail(*it);
+  }
+  for (std::list<librados::ObjectWriteOperation *>::iterator it = write_ops.begin(); it != write_ops.end(); ++it) {
+    delete *it;
+  }
+}
+
+static void bench_save_sync(struct bench_context *ctx, size_t mails) {
+  ctx->storage->clear();
+  ctx->storage->set_namespace(BENCH_NAMESPACE);
+  bench_start(ctx);
+  for (size_t i = 1; i <= mails; i++) {
+    RadosMail *mail = bench_create_mail(ctx, i);
+    librados::ObjectWriteOperation write_op;
+    ctx->ms->save_metadata(&write_op, mail);
+    ctx->storage->save_mail(&write_op, mail, false);
+    ctx->storage->free_rados_mail(mail);
+  }
+  bench_stop(ctx);
+}
+
+static void bench_save_async(struct bench_context *ctx, size_t mails) {
+  bench_start(ctx);
+  bench_fill(ctx, mails);
+  bench_stop(ctx);
+}
+
+static void bench_read(struct bench_context *ctx, size_t mails) {
+  bench_fill(ctx, mails);
+  bench_start(ctx);
+  for (size_t i = 1; i <= mails; i++) {
+    RadosMail *mail = ctx->storage->alloc_rados_mail();
+    mail->set_oid(bench_oid(i));
+    ctx->ms->load_metadata(mail);
+    librados::bufferlist buffer;
+    ctx->storage->read_mail(*mail->get_oid(), &buffer);
+    ctx->storage->free_rados_mail(mail);
+  }
+  bench_stop(ctx);
+}
+
+static void bench_copy_move(struct bench_context *ctx, size_t mails, bool move) {
+  bench_fill(ctx, mails);
+  bench_start(ctx);
+  for (size_t i = 1; i <= mails; i++) {
+    std::string src_oid = bench_oid(i);
+    std::string dest_oid = bench_oid(mails + i);
+    std::list<RadosMetadata> to_update;
+    to_update.push_back(RadosMetadata(librmb::RBOX_METADATA_MAILBOX_GUID, "d5c4b3a2f1e0d9c8b7a6f5e4d3c2b1a0"));
+    to_update.push_back(RadosMetadata(librmb::RBOX_METADATA_MAIL_UID, static_cast<uint>(i)));
+    if (move) {
+      ctx->storage->move(src_oid, BENCH_NAMESPACE, dest_oid, BENCH_NAMESPACE_DEST, to_update, true);
+    } else {
+      ctx->storage->copy(src_oid, BENCH_NAMESPACE, dest_oid, BENCH_NAMESPACE_DEST, to_update);
+    }
+  }
+  bench_stop(ctx);
+}
+
+static void bench_copy(struct bench_context *ctx, size_t mails) { bench_copy_move(ctx, mails, false); }
+
+static void bench_move(struct bench_context *ctx, size_t mails) { bench_copy_move(ctx, mails, true); }
+
+static void bench_expunge(struct bench_context *ctx, size_t mails) {
+  bench_fill(ctx, mails);
+  bench_start(ctx);
+  for (size_t i = 1; i <= mails; i++) {
+    ctx->storage->delete_mail(bench_oid(i));
+  }
+  bench_stop(ctx);
+}
+
+/* object listing and metadata of every mail, like rbox_sync_index_rebuild_objects */
+static void bench_rebuild(struct bench_context *ctx, size_t mails) {
+  bench_fill(ctx, mails);
+  bench_start(ctx);
+  std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> slices;
+  ctx->storage->split_mail_listing(1, &slices);
+  for (size_t s = 0; s < slices.size(); s++) {
+    librados::ObjectCursor cursor = slices[s].first;
+    bool more = true;
+    while (more) {
+      std::vector<std::string> oids;
+      if (ctx->storage->list_mails(&cursor, slices[s].second, LIST_CHUNK_SIZE, nullptr, &oids, &more) < 0) {
+        break;
+      }
+      for (std::vector<std::string>::iterator it = oids.begin(); it != oids.end(); ++it) {
+        RadosMail mail;
+        mail.set_oid(*it);
+        ctx->ms->load_metadata(&mail);
+      }
+    }
+  }
+  bench_stop(ctx);
+}
+
+/* cpu only: encode (save_metadata) and decode (load_metadata from read xattributes) of a metadata module */
+static void bench_metadata_codec(struct bench_context *ctx, size_t mails, librmb::RadosStorageMetadataModule *module,
+                                 bool decode) {
+  std::vector<RadosMail *> src(mails);
+  for (size_t i = 0; i < mails; i++) {
+    src[i] = new RadosMail();
+    src[i]->set_oid(bench_oid(i + 1));
+    bench_add_metadata(src[i], i + 1, ctx->mail_size);
+  }
+
+  // xattributes as read from the object
+  std::vector<std::map<std::string, ceph::bufferlist>> xattrs(mails);
+  uint64_t bytes = 0;
+  BenchCodec *codec = dynamic_cast<BenchCodec *>(module);
+  for (size_t i = 0; i < mails; i++) {
+    if (codec != nullptr) {
+      codec->encode(src[i], &xattrs[i][ctx->cfg->get_metadata_storage_attribute()]);
+    } else {
+      xattrs[i] = *src[i]->get_metadata();
+    }
+    for (std::map<std::string, ceph::bufferlist>::iterator it = xattrs[i].begin(); it != xattrs[i].end(); ++it) {
+      bytes += it->first.size() + it->second.length();
+    }
+  }
+
+  bench_start(ctx);
+  if (decode) {
+    for (size_t i = 0; i < mails; i++) {
+      RadosMail mail;
+      module->load_metadata(&mail, &xattrs[i], nullptr);
+    }
+  } else {
+    for (size_t i = 0; i < mails; i++) {
+      librados::ObjectWriteOperation write_op;
+      module->save_metadata(&write_op, src[i]);
+    }
+  }
+  bench_stop(ctx);
+  ctx->bytes = bytes;
+
+  for (size_t i = 0; i < mails; i++) {
+    delete src[i];
+  }
+}
+
+static void bench_metadata(struct bench_context *ctx, size_t mails, const std::string &module_name, bool decode) {
+  librmb::RadosStorageMetadataModule *module;
+  if (module_name == librmb::RadosMetadataStorageIma::module_name) {
+    module = new BenchMetadataCodec<librmb::RadosMetadataStorageIma>(ctx->cfg);
+  } else if (module_name == librmb::RadosMetadataStorageBinary::module_name) {
+    module = new BenchMetadataCodec<librmb::RadosMetadataStorageBinary>(ctx->cfg);
+  } else {
+    module = new librmb::RadosMetadataStorageDefault(nullptr);
+  }
+  bench_metadata_codec(ctx, mails, module, decode);
+  delete module;
+}
+
+static void bench_encode_default(struct bench_context *ctx, size_t mails) {
+  bench_metadata(ctx, mails, librmb::RadosMetadataStorageDefault::module_name, false);
+}
+static void bench_decode_default(struct bench_context *ctx, size_t mails) {
+  bench_metadata(ctx, mails, librmb::RadosMetadataStorageDefault::module_name, true);
+}
+static void bench_encode_json(struct bench_context *ctx, size_t mails) {
+  bench_metadata(ctx, mails, librmb::RadosMetadataStorageIma::module_name, false);
+}
+static void bench_decode_json(struct bench_context *ctx, size_t mails) {
+  bench_metadata(ctx, mails, librmb::RadosMetadataStorageIma::module_name, true);
+}
+static void bench_encode_binary(struct bench_context *ctx, size_t mails) {
+  bench_metadata(ctx, mails, librmb::RadosMetadataStorageBinary::module_name, false);
+}
+static void bench_decode_binary(struct bench_context *ctx, size_t mails) {
+  bench_metadata(ctx, mails, librmb::RadosMetadataStorageBinary::module_name, true);
+}
+
+static const struct bench_def benchmarks[] = {{"save_sync", bench_save_sync, false},
+                                              {"save_async", bench_save_async, false},
+                                              {"read", bench_read, false},
+                                              {"copy", bench_copy, false},
+                                              {"move", bench_move, false},
+                                              {"expunge", bench_expunge, false},
+                                              {"rebuild", bench_rebuild, false},
+                                              {"metadata_encode_default", bench_encode_default, true},
+                                              {"metadata_decode_default", bench_decode_default, true},
+                                              {"metadata_encode_json", bench_encode_json, true},
+                                              {"metadata_decode_json", bench_decode_json, true},
+                                              {"metadata_encode_binary", bench_encode_binary, true},
+                                              {"metadata_decode_binary", bench_decode_binary, true}};
+
+static void print_header() {
+  std::cout << std::left << std::setw(26) << "benchmark" << std::right << std::setw(8) << "mails" << std::setw(12)
+            << "cpu(ms)" << std::setw(12) << "us/mail" << std::setw(10) << "rtt" << std::setw(10) << "async"
+            << std::setw(14) << "bytes" << std::setw(12) << "rados(ms)" << std::endl;
+}
+
+/* the storage benchmarks only report the simulated rados cost, the codec benchmarks only the cpu time */
+static void print_result(const struct bench_def *bench, size_t mails, struct bench_context *ctx) {
+  const librmb::RadosMemStats &stats = ctx->storage->get_stats();
+  std::cout << std::left << std::setw(26) << bench->name << std::right << std::setw(8) << mails << std::fixed
+            << std::setprecision(2);
+  if (bench->cpu) {
+    std::cout << std::setw(12) << ctx->wall_usecs / 1000.0 << std::setw(12)
+              << (mails > 0 ? static_cast<double>(ctx->wall_usecs) / mails : 0) << std::setw(10) << "-"
+              << std::setw(10) << "-" << std::setw(14) << ctx->bytes << std::setw(12) << "-" << std::endl;
+  } else {
+    std::cout << std::setw(12) << "-" << std::setw(12) << "-" << std::setw(10) << stats.round_trips << std::setw(10)
+              << stats.async_ops << std::setw(14) << stats.bytes_written + stats.bytes_read << std::setw(12)
+              << stats.simulated_usecs / 1000.0 << std::endl;
+  }
+}
+
+static void usage(const char *name) {
+  std::cerr << "usage: " << name << " [-l latency usecs] [-b bandwidth MB/s] [-m mail size] [-n mailbox sizes] "
+            << "[-f filter]" << std::endl
+            << "  -l  simulated round trip latency in usecs (default 500)" << std::endl
+            << "  -b  simulated bandwidth in MB/s, 0 = unlimited (default 100)" << std::endl
+            << "  -m  mail size in bytes (default 16384)" << std::endl
+            << "  -n  comma separated mailbox sizes (default 100,1000,10000)" << std::endl
+            << "  -f  only run benchmarks containing filter" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  RadosStorageMem storage;
+  librmb::RadosMetadataStorageMem metadata_storage(&storage);
+  librmb::RadosConfig dovecot_cfg;
+  librmb::RadosCephConfig ceph_cfg;
+  librmb::RadosDovecotCephCfgImpl cfg(dovecot_cfg, ceph_cfg);
+
+  struct bench_context ctx;
+  ctx.storage = &storage;
+  ctx.cfg = &cfg;
+  ctx.ms = metadata_storage.create_metadata_storage(nullptr, &cfg);
+  ctx.mail_size = 16384;
+  ctx.bytes = 0;
+  storage.get_latency_model()->latency_usecs = 500;
+  storage.get_latency_model()->bandwidth = 100 * 1024 * 1024;
+
+  std::string sizes = "100,1000,10000";
+  std::string filter;
+  int c;
+  while ((c = getopt(argc, argv, "l:b:m:n:f:h")) != -1) {
+    switch (c) {
+      case 'l':
+        storage.get_latency_model()->latency_usecs = strtoull(optarg, NULL, 10);
+        break;
+      case 'b':
+        storage.get_latency_model()->bandwidth = strtoull(optarg, NULL, 10) * 1024 * 1024;
+        break;
+      case 'm':
+        ctx.mail_size = strtoull(optarg, NULL, 10);
+        break;
+      case 'n':
+        sizes = optarg;
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (ctx.mail_size == 0) {
+    std::cerr << "mail size needs to be > 0" << std::endl;
+    return 1;
+  }
+
+  std::vector<size_t> mailbox_sizes;
+  std::stringstream ss(sizes);
+  std::string size;
+  while (std::getline(ss, size, ',')) {
+    mailbox_sizes.push_back(strtoull(size.c_str(), NULL, 10));
+  }
+
+  std::cout << "latency " << storage.get_latency_model()->latency_usecs << "us, bandwidth "
+            << storage.get_latency_model()->bandwidth / (1024 * 1024) << "MB/s, mail size " << ctx.mail_size
+            << " bytes" << std::endl;
+  print_header();
+  for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+    if (!filter.empty() && strstr(benchmarks[b].name, filter.c_str()) == NULL) {
+      continue;
+    }
+    for (std::vector<size_t>::iterator it = mailbox_sizes.begin(); it != mailbox_sizes.end(); ++it) {
+      benchmarks[b].func(&ctx, *it);
+      print_result(&benchmarks[b], *it, &ctx);
+    }
+  }
+  storage.clear();
+  return 0;
+}
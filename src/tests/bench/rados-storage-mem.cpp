@@ -0,0 +1,382 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-storage-mem.h"
+
+#include <errno.h>
+
+namespace librmb {
+
+static uint64_t metadata_size(const std::map<std::string, librados::bufferlist> &metadata) {
+  uint64_t size = 0;
+  for (std::map<std::string, librados::bufferlist>::const_iterator it = metadata.begin(); it != metadata.end();
+       ++it) {
+    size += it->first.size() + it->second.length();
+  }
+  return size;
+}
+
+uint64_t RadosLatencyModel::transfer(uint64_t bytes) const {
+  return bandwidth > 0 ? bytes * 1000000 / bandwidth : 0;
+}
+
+uint64_t RadosLatencyModel::cost(uint64_t bytes) const { return latency_usecs + transfer(bytes); }
+
+RadosStorageMem::RadosStorageMem()
+    : pool_name("mail_storage"), max_write_size(10), listing_offset(0), pending_ops(0), pending_bytes(0) {}
+
+void RadosStorageMem::simulate(uint64_t usecs) {
+  stats.simulated_usecs += usecs;
+}
+
+void RadosStorageMem::round_trip(uint64_t bytes_written, uint64_t bytes_read) {
+  stats.round_trips++;
+  stats.bytes_written += bytes_written;
+  stats.bytes_read += bytes_read;
+  simulate(latency.cost(bytes_written + bytes_read));
+}
+
+void RadosStorageMem::submit(uint64_t bytes_written) {
+  stats.async_ops++;
+  stats.bytes_written += bytes_written;
+  pending_ops++;
+  pending_bytes += bytes_written;
+}
+
+void RadosStorageMem::wait() {
+  if (pending_ops == 0) {
+    return;
+  }
+  stats.waits++;
+  stats.round_trips++;
+  simulate(latency.cost(pending_bytes));
+  pending_ops = 0;
+  pending_bytes = 0;
+}
+
+RadosMemObject *RadosStorageMem::get_object(const std::string &oid) {
+  std::map<std::string, RadosMemObject> &ns_objects = objects[nspace];
+  std::map<std::string, RadosMemObject>::iterator it = ns_objects.find(oid);
+  return it != ns_objects.end() ? &it->second : nullptr;
+}
+
+size_t RadosStorageMem::get_object_count() { return objects[nspace].size(); }
+
+int RadosStorageMem::stat_mail(const std::string &oid, uint64_t *psize, time_t *pmtime) {
+  round_trip(0, 0);
+  RadosMemObject *obj = get_object(oid);
+  if (obj == nullptr) {
+    return -ENOENT;
+  }
+  *psize = obj->data.length();
+  *pmtime = obj->mtime;
+  return 0;
+}
+
+int RadosStorageMem::split_buffer_and_exec_op(RadosMail *current_object,
+                                              librados::ObjectWriteOperation *write_op_xattr,
+                                              const uint64_t &max_write) {
+  if (current_object->get_mail_buffer() == nullptr || current_object->get_mail_size() <= 0 || max_write <= 0) {
+    return -1;
+  }
+  RadosMemObject &obj = objects[nspace][*current_object->get_oid()];
+  obj.data = *current_object->get_mail_buffer();
+  obj.xattrs = *current_object->get_metadata();
+  obj.omap = *current_object->get_extended_metadata();
+  obj.mtime = current_object->get_rados_save_date();
+
+  submit(obj.data.length() + metadata_size(obj.xattrs) + metadata_size(obj.omap));
+  current_object->set_active_op(1);
+  current_object->set_write_operation(write_op_xattr);
+  return 0;
+}
+
+int RadosStorageMem::delete_mail(RadosMail *mail) { return mail != nullptr ? delete_mail(*mail->get_oid()) : -1; }
+
+int RadosStorageMem::delete_mail(const std::string &oid) {
+  if (oid.empty()) {
+    return -1;
+  }
+  round_trip(0, 0);
+  return objects[nspace].erase(oid) > 0 ? 0 : -ENOENT;
+}
+
+int RadosStorageMem::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                 librados::ObjectWriteOperation *op) {
+  return -ENOTSUP;
+}
+
+int RadosStorageMem::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                 librados::ObjectReadOperation *op, librados::bufferlist *pbl) {
+  return -ENOTSUP;
+}
+
+int RadosStorageMem::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                 librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) {
+  return -ENOTSUP;
+}
+
+librados::NObjectIterator RadosStorageMem::find_mails(const RadosMetadata *attr) {
+  return librados::NObjectIterator::__EndObjectIterator;
+}
+
+int RadosStorageMem::split_mail_listing(
+    unsigned int slice_count, std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) {
+  if (slices == nullptr) {
+    return -1;
+  }
+  slices->push_back(std::make_pair(librados::ObjectCursor(), librados::ObjectCursor()));
+  listing_offset = 0;
+  return 0;
+}
+
+int RadosStorageMem::list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish,
+                                size_t max_count, const RadosMetadata *attr, std::vector<std::string> *oids,
+                                bool *more) {
+  if (cursor == nullptr || oids == nullptr || more == nullptr) {
+    return -1;
+  }
+  std::map<std::string, RadosMemObject> &ns_objects = objects[nspace];
+  std::map<std::string, RadosMemObject>::iterator it = ns_objects.begin();
+  size_t offset = 0;
+  for (; it != ns_objects.end() && offset < listing_offset; ++it, ++offset) {
+  }
+  uint64_t bytes = 0;
+  for (size_t count = 0; it != ns_objects.end() && count < max_count; ++it, ++count) {
+    listing_offset++;
+    if (attr != nullptr) {
+      std::map<std::string, librados::bufferlist>::iterator value = it->second.xattrs.find(attr->key);
+      if (value == it->second.xattrs.end() || !(value->second == attr->bl)) {
+        continue;
+      }
+    }
+    oids->push_back(it->first);
+    bytes += it->first.size();
+  }
+  round_trip(0, bytes);
+  *more = it != ns_objects.end();
+  if (!*more) {
+    listing_offset = 0;
+  }
+  return 0;
+}
+
+int RadosStorageMem::open_connection(const std::string &poolname) {
+  pool_name = poolname;
+  return 0;
+}
+
+int RadosStorageMem::open_connection(const std::string &poolname, const std::string &clustername,
+                                     const std::string &rados_username) {
+  return open_connection(poolname);
+}
+
+bool RadosStorageMem::wait_for_write_operations_complete(librados::AioCompletion *completion,
+                                                         librados::ObjectWriteOperation *write_operation) {
+  wait();
+  return false;
+}
+
+// like RadosStorageImpl: true if an operation failed, mail buffers are freed.
+bool RadosStorageMem::wait_for_rados_operations(const std::list<librmb::RadosMail *> &object_list) {
+  for (std::list<librmb::RadosMail *>::const_iterator it = object_list.begin(); it != object_list.end(); ++it) {
+    if ((*it)->has_active_op()) {
+      wait();
+      (*it)->set_active_op(0);
+      (*it)->set_write_operation(nullptr);
+    }
+    delete (*it)->get_mail_buffer();
+    (*it)->set_mail_buffer(nullptr);
+  }
+  return false;
+}
+
+int RadosStorageMem::save_mail(const std::string &oid, librados::bufferlist &buffer) {
+  RadosMemObject &obj = objects[nspace][oid];
+  obj.data = buffer;
+  obj.mtime = time(NULL);
+  round_trip(buffer.length(), 0);
+  return 0;
+}
+
+int RadosStorageMem::read_mail(const std::string &oid, librados::bufferlist *buffer) {
+  RadosMemObject *obj = get_object(oid);
+  if (obj == nullptr) {
+    round_trip(0, 0);
+    return -ENOENT;
+  }
+  buffer->append(obj->data);
+  round_trip(0, obj->data.length());
+  return obj->data.length();
+}
+
+int RadosStorageMem::move(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+                          std::list<RadosMetadata> &to_update, bool delete_source) {
+  int ret = copy(src_oid, src_ns, dest_oid, dest_ns, to_update);
+  if (ret == 0 && delete_source && std::string(src_ns) != dest_ns) {
+    objects[src_ns].erase(src_oid);
+    round_trip(0, 0);
+  }
+  return ret;
+}
+
+int RadosStorageMem::copy(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+                          std::list<RadosMetadata> &to_update) {
+  std::map<std::string, RadosMemObject> &src_objects = objects[src_ns];
+  std::map<std::string, RadosMemObject>::iterator src = src_objects.find(src_oid);
+  if (src == src_objects.end()) {
+    round_trip(0, 0);
+    return -ENOENT;
+  }
+  // copy_from is executed by the osd, only the metadata updates are transferred.
+  RadosMemObject copied = src->second;
+  uint64_t bytes = 0;
+  for (std::list<RadosMetadata>::iterator it = to_update.begin(); it != to_update.end(); ++it) {
+    copied.xattrs[it->key] = it->bl;
+    bytes += it->key.size() + it->bl.length();
+  }
+  copied.mtime = time(NULL);
+  objects[dest_ns][dest_oid] = copied;
+  round_trip(bytes, 0);
+  return 0;
+}
+
+bool RadosStorageMem::save_mail(RadosMail *mail, bool &save_async) {
+  librados::ObjectWriteOperation write_op_xattr;
+  return save_mail(&write_op_xattr, mail, save_async);
+}
+
+bool RadosStorageMem::save_mail(librados::ObjectWriteOperation *write_op_xattr, RadosMail *mail, bool save_async) {
+  if (write_op_xattr == nullptr || mail == nullptr) {
+    return false;
+  }
+  if (split_buffer_and_exec_op(mail, write_op_xattr, get_max_write_size_bytes()) != 0) {
+    mail->set_active_op(0);
+    return false;
+  }
+  if (!save_async) {
+    std::list<librmb::RadosMail *> mails;
+    mails.push_back(mail);
+    return !wait_for_rados_operations(mails);
+  }
+  return true;
+}
+
+int RadosStorageMetadataModuleMem::load_metadata(RadosMail *mail) {
+  if (mail == nullptr) {
+    return -1;
+  }
+  RadosMemObject *obj = storage->get_object(*mail->get_oid());
+  if (obj == nullptr) {
+    storage->round_trip(0, 0);
+    return -ENOENT;
+  }
+  *mail->get_metadata() = obj->xattrs;
+  *mail->get_extended_metadata() = obj->omap;
+  storage->round_trip(0, metadata_size(obj->xattrs) + metadata_size(obj->omap));
+  return 0;
+}
+
+int RadosStorageMetadataModuleMem::load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                                                 std::map<std::string, ceph::bufferlist> *omap) {
+  if (mail == nullptr || xattrs == nullptr) {
+    return -1;
+  }
+  mail->get_metadata()->swap(*xattrs);
+  if (omap != nullptr) {
+    mail->get_extended_metadata()->swap(*omap);
+  }
+  return 0;
+}
+
+int RadosStorageMetadataModuleMem::set_metadata(RadosMail *mail, RadosMetadata &xattr) {
+  mail->add_metadata(xattr);
+  RadosMemObject *obj = storage->get_object(*mail->get_oid());
+  storage->round_trip(xattr.key.size() + xattr.bl.length(), 0);
+  if (obj == nullptr) {
+    return -ENOENT;
+  }
+  obj->xattrs[xattr.key] = xattr.bl;
+  return 0;
+}
+
+int RadosStorageMetadataModuleMem::set_metadata(RadosMail *mail, RadosMetadata &xattr,
+                                                librados::ObjectWriteOperation *write_op) {
+  mail->add_metadata(xattr);
+  RadosMemObject *obj = storage->get_object(*mail->get_oid());
+  if (obj == nullptr) {
+    return -ENOENT;
+  }
+  obj->xattrs[xattr.key] = xattr.bl;
+  storage->submit(xattr.key.size() + xattr.bl.length());
+  mail->set_active_op(1);
+  return 0;
+}
+
+bool RadosStorageMetadataModuleMem::update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) {
+  RadosMemObject *obj = storage->get_object(oid);
+  uint64_t bytes = 0;
+  for (std::list<RadosMetadata>::iterator it = to_update.begin(); obj != nullptr && it != to_update.end(); ++it) {
+    obj->xattrs[it->key] = it->bl;
+    bytes += it->key.size() + it->bl.length();
+  }
+  storage->round_trip(bytes, 0);
+  return obj != nullptr;
+}
+
+int RadosStorageMetadataModuleMem::update_keyword_metadata(const std::string &oid, RadosMetadata *metadata) {
+  RadosMemObject *obj = storage->get_object(oid);
+  storage->round_trip(metadata->key.size() + metadata->bl.length(), 0);
+  if (obj == nullptr) {
+    return -ENOENT;
+  }
+  obj->omap[metadata->key] = metadata->bl;
+  return 0;
+}
+
+int RadosStorageMetadataModuleMem::remove_keyword_metadata(const std::string &oid, std::string &key) {
+  RadosMemObject *obj = storage->get_object(oid);
+  storage->round_trip(key.size(), 0);
+  if (obj == nullptr) {
+    return -ENOENT;
+  }
+  obj->omap.erase(key);
+  return 0;
+}
+
+int RadosStorageMetadataModuleMem::load_keyword_metadata(const std::string &oid, std::set<std::string> &keys,
+                                                         std::map<std::string, ceph::bufferlist> *metadata) {
+  RadosMemObject *obj = storage->get_object(oid);
+  if (obj == nullptr) {
+    storage->round_trip(0, 0);
+    return -ENOENT;
+  }
+  uint64_t bytes = 0;
+  for (std::set<std::string>::iterator it = keys.begin(); it != keys.end(); ++it) {
+    std::map<std::string, librados::bufferlist>::iterator value = obj->omap.find(*it);
+    if (value != obj->omap.end()) {
+      (*metadata)[*it] = value->second;
+      bytes += it->size() + value->second.length();
+    }
+  }
+  storage->round_trip(0, bytes);
+  return 0;
+}
+
+RadosStorageMetadataModule *RadosMetadataStorageMem::create_metadata_storage(librados::IoCtx *io_ctx_,
+                                                                             RadosDovecotCephCfg *cfg_) {
+  if (module == nullptr) {
+    module = new RadosStorageMetadataModuleMem(storage);
+  }
+  return module;
+}
+
+}  // namespace librmb
@@ -0,0 +1,239 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_TESTS_BENCH_RADOS_STORAGE_MEM_H_
+#define SRC_TESTS_BENCH_RADOS_STORAGE_MEM_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <rados/librados.hpp>
+#include "rados-metadata-storage.h"
+#include "rados-metadata-storage-module.h"
+#include "rados-storage.h"
+
+namespace librmb {
+
+/**
+ * RadosLatencyModel
+ *
+ * Simulated cost of a rados operation: a fixed round trip latency plus the
+ * transfer time of the payload. Async operations submitted before a wait
+ * overlap, so a wait costs one latency plus the transfer time of all of them.
+ */
+class RadosLatencyModel {
+ public:
+  RadosLatencyModel() : latency_usecs(0), bandwidth(0) {}
+
+  /*!
+   * @return simulated duration of one operation transferring bytes
+   */
+  uint64_t cost(uint64_t bytes) const;
+  uint64_t transfer(uint64_t bytes) const;
+
+  // round trip latency in usecs
+  uint64_t latency_usecs;
+  // bytes per second, 0 = unlimited
+  uint64_t bandwidth;
+};
+
+/**
+ * Operations executed by RadosStorageMem
+ */
+struct RadosMemStats {
+  RadosMemStats() { reset(); }
+  void reset() {
+    round_trips = 0;
+    async_ops = 0;
+    waits = 0;
+    bytes_written = 0;
+    bytes_read = 0;
+    simulated_usecs = 0;
+  }
+
+  // synchronous operations and waits for async operations
+  uint64_t round_trips;
+  uint64_t async_ops;
+  uint64_t waits;
+  uint64_t bytes_written;
+  uint64_t bytes_read;
+  uint64_t simulated_usecs;
+};
+
+struct RadosMemObject {
+  RadosMemObject() : mtime(0) {}
+  librados::bufferlist data;
+  std::map<std::string, librados::bufferlist> xattrs;
+  std::map<std::string, librados::bufferlist> omap;
+  time_t mtime;
+};
+
+/**
+ * RadosStorageMem
+ *
+ * In memory RadosStorage for benchmarks and tests without a ceph cluster.
+ * Objects are kept per namespace, every operation is charged to the latency
+ * model. It replaces RadosStorageImpl, so it counts the rados operations a
+ * caller issues, but its own cpu time says nothing about RadosStorageImpl. Opaque librados operations can not be executed: mail data and
+ * metadata are taken from the RadosMail on save, aio_operate fails with
+ * -ENOTSUP and find_mails returns the end iterator. list_mails ignores the
+ * cursors and lists the whole namespace in chunks (one listing at a time).
+ * Not thread safe.
+ */
+class RadosStorageMem : public RadosStorage {
+ public:
+  RadosStorageMem();
+  virtual ~RadosStorageMem() {}
+
+  /* the io context is never opened, it must not be used */
+  librados::IoCtx &get_io_ctx() override { return io_ctx; }
+  int stat_mail(const std::string &oid, uint64_t *psize, time_t *pmtime) override;
+  void set_namespace(const std::string &_nspace) override { nspace = _nspace; }
+  std::string get_namespace() override { return nspace; }
+  std::string get_pool_name() override { return pool_name; }
+  void set_ceph_wait_method(enum rbox_ceph_aio_wait_method wait_method) override {}
+  int get_max_write_size() override { return max_write_size; }
+  int get_max_write_size_bytes() override { return max_write_size * 1024 * 1024; }
+  int split_buffer_and_exec_op(RadosMail *current_object, librados::ObjectWriteOperation *write_op_xattr,
+                               const uint64_t &max_write) override;
+  int delete_mail(RadosMail *mail) override;
+  int delete_mail(const std::string &oid) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectWriteOperation *op) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, librados::bufferlist *pbl) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) override;
+  librados::NObjectIterator find_mails(const RadosMetadata *attr) override;
+  int split_mail_listing(unsigned int slice_count,
+                         std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) override;
+  int list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish, size_t max_count,
+                 const RadosMetadata *attr, std::vector<std::string> *oids, bool *more) override;
+  int open_connection(const std::string &poolname) override;
+  int open_connection(const std::string &poolname, const std::string &clustername,
+                      const std::string &rados_username) override;
+  void close_connection() override {}
+  bool wait_for_write_operations_complete(librados::AioCompletion *completion,
+                                          librados::ObjectWriteOperation *write_operation) override;
+  bool wait_for_rados_operations(const std::list<librmb::RadosMail *> &object_list) override;
+  int save_mail(const std::string &oid, librados::bufferlist &buffer) override;
+  int read_mail(const std::string &oid, librados::bufferlist *buffer) override;
+  int move(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+           std::list<RadosMetadata> &to_update, bool delete_source) override;
+  int copy(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+           std::list<RadosMetadata> &to_update) override;
+  bool save_mail(RadosMail *mail, bool &save_async) override;
+  bool save_mail(librados::ObjectWriteOperation *write_op_xattr, RadosMail *mail, bool save_async) override;
+  librmb::RadosMail *alloc_rados_mail() override { return new librmb::RadosMail(); }
+  void free_rados_mail(librmb::RadosMail *mail) override { delete mail; }
+
+  /*!
+   * @return object in the current namespace or nullptr
+   */
+  RadosMemObject *get_object(const std::string &oid);
+  /*!
+   * @return number of objects in the current namespace
+   */
+  size_t get_object_count();
+  void clear() { objects.clear(); }
+
+  RadosLatencyModel *get_latency_model() { return &latency; }
+  const RadosMemStats &get_stats() const { return stats; }
+  void reset_stats() { stats.reset(); }
+
+  /*!
+   * charge one synchronous round trip
+   */
+  void round_trip(uint64_t bytes_written, uint64_t bytes_read);
+  /*!
+   * charge an async operation, it is paid by the next wait
+   */
+  void submit(uint64_t bytes_written);
+  /*!
+   * wait for all submitted async operations
+   */
+  void wait();
+
+ private:
+  void simulate(uint64_t usecs);
+
+  librados::IoCtx io_ctx;
+  std::string nspace;
+  std::string pool_name;
+  int max_write_size;
+  // namespace -> oid -> object
+  std::map<std::string, std::map<std::string, RadosMemObject>> objects;
+  size_t listing_offset;
+
+  RadosLatencyModel latency;
+  RadosMemStats stats;
+  uint64_t pending_ops;
+  uint64_t pending_bytes;
+};
+
+/**
+ * RadosStorageMetadataModuleMem
+ *
+ * Metadata module of RadosStorageMem: every attribute is kept as separate
+ * xattribute (like the default module), keywords as omap values.
+ */
+class RadosStorageMetadataModuleMem : public RadosStorageMetadataModule {
+ public:
+  explicit RadosStorageMetadataModuleMem(RadosStorageMem *storage_) : storage(storage_) {}
+  virtual ~RadosStorageMetadataModuleMem() {}
+
+  bool has_xattr_metadata() override { return true; }
+  int load_metadata(RadosMail *mail) override;
+  int load_metadata(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                    std::map<std::string, ceph::bufferlist> *omap) override;
+  int set_metadata(RadosMail *mail, RadosMetadata &xattr) override;
+  int set_metadata(RadosMail *mail, RadosMetadata &xattr, librados::ObjectWriteOperation *write_op) override;
+  bool update_metadata(const std::string &oid, std::list<RadosMetadata> &to_update) override;
+  /* nothing to do, RadosStorageMem takes the metadata from the mail on save */
+  void save_metadata(librados::ObjectWriteOperation *write_op, RadosMail *mail) override {}
+  int update_keyword_metadata(const std::string &oid, RadosMetadata *metadata) override;
+  int remove_keyword_metadata(const std::string &oid, std::string &key) override;
+  int load_keyword_metadata(const std::string &oid, std::set<std::string> &keys,
+                            std::map<std::string, ceph::bufferlist> *metadata) override;
+
+ private:
+  RadosStorageMem *storage;
+};
+
+/**
+ * RadosMetadataStorageMem
+ *
+ * Creates the RadosStorageMetadataModuleMem of a RadosStorageMem, io_ctx and
+ * configuration are ignored.
+ */
+class RadosMetadataStorageMem : public RadosMetadataStorage {
+ public:
+  explicit RadosMetadataStorageMem(RadosStorageMem *storage_) : storage(storage_), module(nullptr) {}
+  virtual ~RadosMetadataStorageMem() { delete module; }
+
+  RadosStorageMetadataModule *create_metadata_storage(librados::IoCtx *io_ctx_, RadosDovecotCephCfg *cfg_) override;
+  RadosStorageMetadataModule *get_storage() override { return module; }
+
+ private:
+  RadosStorageMem *storage;
+  RadosStorageMetadataModule *module;
+};
+
+}  // namespace librmb
+
+#endif  // SRC_TESTS_BENCH_RADOS_STORAGE_MEM_H_
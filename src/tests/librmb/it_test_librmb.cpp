@@ -19,10 +19,14 @@
 #include "gmock/gmock.h"
 #include "../../librmb/rados-metadata-storage-default.h"
 #include "../../librmb/rados-metadata-storage-ima.h"
+#include "../../librmb/rados-metadata-storage-pool.h"
 #include "../../librmb/rados-dovecot-ceph-cfg-impl.h"
 #include "../../librmb/rados-util.h"
 #include "../../librmb/tools/rmb/rmb-commands.h"
 #include "../../librmb/rados-save-log.h"
+#include "../../librmb/rados-dedup.h"
+#include "../../librmb/rados-mail-pack.h"
+#include "../../librmb/rados-striping.h"
 
 using ::testing::AtLeast;
 using ::testing::Return;
@@ -1381,6 +1385,444 @@ TEST(librmb, move_object_delete_with_save_log) {
   EXPECT_EQ(storage.delete_mail("abc3"), 0);  // move does not delete the object
   cluster.deinit();
 }
+/**
+ * Test RmbCommands
+ */
+TEST(librmb, replay_save_log_duplicates_and_journal) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+
+  std::string pool_name("rmb_tool_tests");
+  std::string ns("t1");
+
+  int open_connection = storage.open_connection(pool_name);
+  EXPECT_EQ(0, open_connection);
+  storage.set_namespace(ns);
+
+  std::string test_file_name = "test_replay.log";
+  librmb::RadosSaveLog log_file(test_file_name);
+  EXPECT_EQ(true, log_file.open());
+  log_file.append(librmb::RadosSaveLogEntry("abc4", "t1", "rmb_tool_tests", "save"));
+  log_file.append(librmb::RadosSaveLogEntry("abc4", "t1", "rmb_tool_tests", "save"));
+  log_file.append(librmb::RadosSaveLogEntry("abc5", "t1", "rmb_tool_tests", "cpy"));
+  log_file.append(librmb::RadosSaveLogEntry("abc6", "t1", "rmb_tool_tests", "save"));
+  EXPECT_EQ(true, log_file.close());
+  librados::bufferlist bl;
+  EXPECT_EQ(0, storage.save_mail("abc4", bl));
+  EXPECT_EQ(0, storage.save_mail("abc5", bl));
+  EXPECT_EQ(0, storage.save_mail("abc6", bl));
+  cluster.deinit();
+
+  // abc6 has been replayed by a previous run
+  std::string journal_file = test_file_name + librmb::RmbCommands::REPLAY_JOURNAL_SUFFIX;
+  std::ofstream journal(journal_file);
+  journal << "save,rmb_tool_tests,t1,abc6" << std::endl;
+  journal.close();
+
+  std::map<std::string, std::list<librmb::RadosSaveLogEntry>> moved_items;
+  EXPECT_EQ(2, librmb::RmbCommands::delete_with_save_log(test_file_name, "ceph", "client.admin", &moved_items, 1));
+  EXPECT_EQ(0, moved_items.size());
+  // replay complete => journal removed
+  std::ifstream journal_read(journal_file);
+  EXPECT_FALSE(journal_read.is_open());
+  std::remove(test_file_name.c_str());
+
+  open_connection = storage.open_connection(pool_name);
+  EXPECT_EQ(0, open_connection);
+  storage.set_namespace(ns);
+  EXPECT_EQ(-ENOENT, storage.delete_mail("abc4"));
+  EXPECT_EQ(-ENOENT, storage.delete_mail("abc5"));
+  EXPECT_EQ(0, storage.delete_mail("abc6"));  // skipped
+  cluster.deinit();
+}
+TEST(librmb, dedup_references) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  std::string pool_name("rmb_dedup_tests");
+  ASSERT_EQ(0, storage.open_connection(pool_name));
+  storage.set_namespace("t1");
+
+  librmb::RadosDedup dedup;
+  ASSERT_EQ(0, dedup.open(&cluster, pool_name));
+  dedup.set_enabled(true);
+  dedup.set_min_size(4);
+
+  std::string hash("0123456789abcdef");
+  librados::bufferlist body;
+  body.append("Subject: dedup\n\nbody");
+
+  librmb::RadosMail mail1;
+  mail1.set_oid("dedup_mail_1");
+  mail1.set_mail_buffer(new librados::bufferlist(body));
+  mail1.set_mail_size(body.length());
+  librmb::RadosMail mail2;
+  mail2.set_oid("dedup_mail_2");
+  mail2.set_mail_buffer(new librados::bufferlist(body));
+  mail2.set_mail_size(body.length());
+
+  EXPECT_EQ(1, dedup.dedup(&mail1, hash));
+  EXPECT_EQ(1, dedup.dedup(&mail2, hash));
+  EXPECT_EQ(0, mail1.get_mail_buffer()->length());
+  EXPECT_EQ(0, mail1.get_mail_size());
+  EXPECT_STREQ(hash.c_str(), mail1.get_metadata(librmb::RBOX_METADATA_EXT_REF));
+  uint64_t count = 0;
+  EXPECT_EQ(0, dedup.get_ref_count(hash, &count));
+  EXPECT_EQ(2, count);
+
+  // copy of mail2
+  EXPECT_EQ(0, dedup.add_ref(hash, "dedup_mail_3"));
+  EXPECT_EQ(-ENOENT, dedup.add_ref("not_stored", "dedup_mail_3"));
+
+  EXPECT_EQ(1, dedup.resolve(&mail2));
+  EXPECT_EQ(body.to_str(), mail2.get_mail_buffer()->to_str());
+  EXPECT_EQ(body.length(), mail2.get_mail_size());
+
+  EXPECT_EQ(0, dedup.release_ref(hash, "dedup_mail_1"));
+  EXPECT_EQ(0, dedup.release_ref(hash, "dedup_mail_2"));
+  EXPECT_EQ(0, dedup.get_ref_count(hash, &count));
+  EXPECT_EQ(1, count);
+  EXPECT_EQ(0, dedup.release_ref(hash, "dedup_mail_3"));
+  // last reference released => body removed
+  librados::bufferlist read;
+  EXPECT_EQ(-ENOENT, dedup.read(hash, &read));
+  EXPECT_EQ(0, dedup.release_ref(hash, "dedup_mail_3"));
+
+  delete mail1.get_mail_buffer();
+  delete mail2.get_mail_buffer();
+  dedup.close();
+  cluster.deinit();
+}
+static librmb::RadosMail *pack_test_mail(const std::string &oid, const std::string &data) {
+  librmb::RadosMail *mail = new librmb::RadosMail();
+  mail->set_oid(oid);
+  mail->set_mail_buffer(new librados::bufferlist());
+  mail->get_mail_buffer()->append(data);
+  mail->set_mail_size(data.size());
+  return mail;
+}
+static int pack_test_append(librmb::RadosMailPack *pack, librados::IoCtx &io_ctx, const std::string &mailbox_guid,
+                            librmb::RadosMail *mail, librmb::RadosMailPack::Location *location) {
+  std::vector<librmb::RadosMail *> mails(1, mail);
+  std::vector<librmb::RadosMailPack::Location> locations;
+  int ret = pack->append(io_ctx, mailbox_guid, mails, &locations);
+  if (ret >= 0) {
+    *location = locations[0];
+  }
+  return ret;
+}
+static std::string pack_test_read(librados::IoCtx &io_ctx, const std::string &mailbox_guid,
+                                  const librmb::RadosMailPack::Location &location) {
+  librados::bufferlist bl;
+  int ret = librmb::RadosMailPack::read(io_ctx, mailbox_guid, location, &bl);
+  return ret < 0 ? std::to_string(ret) : bl.to_str();
+}
+static void pack_test_cleanup(librados::IoCtx &io_ctx, const std::string &mailbox_guid,
+                              std::vector<librmb::RadosMail *> *mails) {
+  std::vector<uint32_t> containers;
+  librmb::RadosMailPack::list_containers(io_ctx, mailbox_guid, &containers);
+  for (std::vector<uint32_t>::iterator it = containers.begin(); it != containers.end(); ++it) {
+    librmb::RadosMailPack::remove_container(io_ctx, mailbox_guid, *it);
+  }
+  for (std::vector<librmb::RadosMail *>::iterator it = mails->begin(); it != mails->end(); ++it) {
+    delete (*it)->get_mail_buffer();
+    delete *it;
+  }
+}
+/**
+ * concurrent appends to the same container: the writer with an outdated size retries (-ECANCELED) after the
+ * mail of the other writer.
+ */
+TEST(librmb, mail_pack_append_race) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  ASSERT_EQ(0, storage.open_connection("rmb_pack_tests"));
+  storage.set_namespace("t1");
+  librados::IoCtx &io_ctx = storage.get_io_ctx();
+  std::string mailbox_guid = "pack_race_" + std::to_string(time(NULL));
+
+  librmb::RadosMailPack pack1;
+  librmb::RadosMailPack pack2;
+  std::vector<librmb::RadosMail *> mails;
+  mails.push_back(pack_test_mail("pack_mail_1", "aaaa"));
+  mails.push_back(pack_test_mail("pack_mail_2", "bbbbbb"));
+  mails.push_back(pack_test_mail("pack_mail_3", "cc"));
+
+  librmb::RadosMailPack::Location location1;
+  librmb::RadosMailPack::Location location2;
+  librmb::RadosMailPack::Location location3;
+  EXPECT_EQ(0, pack_test_append(&pack1, io_ctx, mailbox_guid, mails[0], &location1));
+  EXPECT_EQ(0, pack_test_append(&pack2, io_ctx, mailbox_guid, mails[1], &location2));
+  // pack1 still expects the container size after mail 1
+  EXPECT_EQ(0, pack_test_append(&pack1, io_ctx, mailbox_guid, mails[2], &location3));
+  EXPECT_EQ(1u, location1.container);
+  EXPECT_EQ(0u, location1.offset);
+  EXPECT_EQ(1u, location2.container);
+  EXPECT_EQ(4u, location2.offset);
+  EXPECT_EQ(1u, location3.container);
+  EXPECT_EQ(10u, location3.offset);
+  EXPECT_EQ("aaaa", pack_test_read(io_ctx, mailbox_guid, location1));
+  EXPECT_EQ("bbbbbb", pack_test_read(io_ctx, mailbox_guid, location2));
+  EXPECT_EQ("cc", pack_test_read(io_ctx, mailbox_guid, location3));
+
+  std::map<std::string, librmb::RadosMailPack::Entry> entries;
+  EXPECT_EQ(0, librmb::RadosMailPack::list_entries(io_ctx, mailbox_guid, 1, &entries));
+  EXPECT_EQ(3u, entries.size());
+
+  pack_test_cleanup(io_ctx, mailbox_guid, &mails);
+  cluster.deinit();
+}
+/**
+ * a full container is replaced by the next one, also within one batch of mails.
+ */
+TEST(librmb, mail_pack_container_full) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  ASSERT_EQ(0, storage.open_connection("rmb_pack_tests"));
+  storage.set_namespace("t1");
+  librados::IoCtx &io_ctx = storage.get_io_ctx();
+  std::string mailbox_guid = "pack_full_" + std::to_string(time(NULL));
+
+  librmb::RadosMailPack pack;
+  pack.set_container_size(10);
+  std::vector<librmb::RadosMail *> mails;
+  mails.push_back(pack_test_mail("pack_mail_1", "11111111"));
+  mails.push_back(pack_test_mail("pack_mail_2", "22222222"));
+  mails.push_back(pack_test_mail("pack_mail_3", "3"));
+  mails.push_back(pack_test_mail("pack_mail_4", "44444444"));
+
+  librmb::RadosMailPack::Location location;
+  EXPECT_EQ(0, pack_test_append(&pack, io_ctx, mailbox_guid, mails[0], &location));
+  EXPECT_EQ(1u, location.container);
+  EXPECT_EQ(0, pack_test_append(&pack, io_ctx, mailbox_guid, mails[1], &location));
+  EXPECT_EQ(2u, location.container);
+  EXPECT_EQ(0u, location.offset);
+
+  std::vector<librmb::RadosMail *> batch(mails.begin() + 2, mails.end());
+  std::vector<librmb::RadosMailPack::Location> locations;
+  EXPECT_EQ(0, pack.append(io_ctx, mailbox_guid, batch, &locations));
+  ASSERT_EQ(2u, locations.size());
+  EXPECT_EQ(2u, locations[0].container);
+  EXPECT_EQ(8u, locations[0].offset);
+  EXPECT_EQ(3u, locations[1].container);
+  EXPECT_EQ(0u, locations[1].offset);
+  EXPECT_EQ("3", pack_test_read(io_ctx, mailbox_guid, locations[0]));
+  EXPECT_EQ("44444444", pack_test_read(io_ctx, mailbox_guid, locations[1]));
+
+  std::vector<uint32_t> containers;
+  EXPECT_EQ(0, librmb::RadosMailPack::list_containers(io_ctx, mailbox_guid, &containers));
+  EXPECT_EQ(3u, containers.size());
+
+  pack_test_cleanup(io_ctx, mailbox_guid, &mails);
+  cluster.deinit();
+}
+/**
+ * compaction relocates the live mails (not the expunged ones) to the current container, an interrupted
+ * compaction leaves a sealed container which is compacted again.
+ */
+TEST(librmb, mail_pack_compaction) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  ASSERT_EQ(0, storage.open_connection("rmb_pack_tests"));
+  storage.set_namespace("t1");
+  librados::IoCtx &io_ctx = storage.get_io_ctx();
+  std::string mailbox_guid = "pack_compact_" + std::to_string(time(NULL));
+
+  librmb::RadosMailPack pack;
+  pack.set_container_size(16);
+  std::vector<librmb::RadosMail *> mails;
+  mails.push_back(pack_test_mail("pack_mail_1", "11111111"));
+  mails.push_back(pack_test_mail("pack_mail_2", "2222"));
+  mails.push_back(pack_test_mail("pack_mail_3", "33333333"));
+
+  librmb::RadosMailPack::Location location;
+  EXPECT_EQ(0, pack_test_append(&pack, io_ctx, mailbox_guid, mails[0], &location));
+  EXPECT_EQ(0, pack_test_append(&pack, io_ctx, mailbox_guid, mails[1], &location));
+  EXPECT_EQ(1u, location.container);
+  EXPECT_EQ(0, pack_test_append(&pack, io_ctx, mailbox_guid, mails[2], &location));
+  EXPECT_EQ(2u, location.container);
+
+  std::set<std::string> expunged;
+  std::map<std::string, librmb::RadosMailPack::Location> relocated;
+  // more than half of the data is live
+  EXPECT_EQ(0, pack.compact(io_ctx, mailbox_guid, 1, expunged, &relocated));
+  // the current container is not compacted
+  expunged.insert("pack_mail_3");
+  EXPECT_EQ(0, pack.compact(io_ctx, mailbox_guid, 2, expunged, &relocated));
+
+  expunged.insert("pack_mail_1");
+  EXPECT_EQ(1, pack.compact(io_ctx, mailbox_guid, 1, expunged, &relocated));
+  ASSERT_EQ(1u, relocated.size());
+  ASSERT_TRUE(relocated.find("pack_mail_2") != relocated.end());
+  EXPECT_EQ(2u, relocated["pack_mail_2"].container);
+  EXPECT_EQ(8u, relocated["pack_mail_2"].offset);
+  EXPECT_EQ("2222", pack_test_read(io_ctx, mailbox_guid, relocated["pack_mail_2"]));
+
+  // the container is sealed but was not removed: the compaction is repeated
+  relocated.clear();
+  EXPECT_EQ(1, pack.compact(io_ctx, mailbox_guid, 1, expunged, &relocated));
+  ASSERT_EQ(1u, relocated.size());
+  EXPECT_EQ(12u, relocated["pack_mail_2"].offset);
+  EXPECT_EQ("2222", pack_test_read(io_ctx, mailbox_guid, relocated["pack_mail_2"]));
+
+  librmb::RadosMailPack::Location old_location;
+  old_location.container = 1;
+  old_location.offset = 8;
+  old_location.length = 4;
+  EXPECT_EQ(0, librmb::RadosMailPack::remove_container(io_ctx, mailbox_guid, 1));
+  EXPECT_EQ(std::to_string(-ENOENT), pack_test_read(io_ctx, mailbox_guid, old_location));
+
+  pack_test_cleanup(io_ctx, mailbox_guid, &mails);
+  cluster.deinit();
+}
+/**
+ * a mail without metadata cannot be found: if the metadata object cannot be written, writing the mail fails.
+ */
+TEST(librmb, metadata_pool_save_rollback) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  std::string pool_name("rmb_metadata_pool_tests");
+  ASSERT_EQ(0, storage.open_connection(pool_name));
+  storage.set_namespace("t1");
+  librados::IoCtx &io_ctx = storage.get_io_ctx();
+
+  librmb::RadosMail mail;
+  mail.set_oid("metadata_pool_mail_1");
+  librmb::RadosMetadata subject(librmb::RBOX_METADATA_MAILBOX_GUID, "mailbox_guid");
+  mail.add_metadata(subject);
+  librados::bufferlist body;
+  body.append("Subject: metadata pool\n\nbody");
+
+  // metadata pool not opened => the metadata write fails
+  librmb::RadosMetadataStoragePool not_opened(&io_ctx);
+  librados::ObjectWriteOperation write_op;
+  write_op.write_full(body);
+  not_opened.save_metadata(&write_op, &mail);
+  EXPECT_EQ(-ENOENT, io_ctx.operate(*mail.get_oid(), &write_op));
+  uint64_t size;
+  time_t mtime;
+  EXPECT_EQ(-ENOENT, io_ctx.stat(*mail.get_oid(), &size, &mtime));
+
+  librmb::RadosMetadataStoragePool metadata(&io_ctx);
+  ASSERT_EQ(0, metadata.open(&cluster, pool_name));
+  librados::ObjectWriteOperation write_op2;
+  write_op2.write_full(body);
+  metadata.save_metadata(&write_op2, &mail);
+  EXPECT_EQ(0, io_ctx.operate(*mail.get_oid(), &write_op2));
+  librmb::RadosMail loaded;
+  loaded.set_oid(*mail.get_oid());
+  EXPECT_EQ(0, metadata.load_metadata(&loaded));
+  EXPECT_STREQ("mailbox_guid", loaded.get_metadata(librmb::RBOX_METADATA_MAILBOX_GUID));
+
+  EXPECT_EQ(0, io_ctx.remove(*mail.get_oid()));
+  EXPECT_EQ(0, metadata.remove_metadata(*mail.get_oid()));
+  metadata.close();
+  cluster.deinit();
+}
+/**
+ * the metadata follows a move of the mail object to another namespace, updated attributes are replaced.
+ */
+TEST(librmb, metadata_pool_copy_cross_namespace) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  std::string pool_name("rmb_metadata_pool_tests");
+  ASSERT_EQ(0, storage.open_connection(pool_name));
+  storage.set_namespace("t1");
+  librados::IoCtx &io_ctx = storage.get_io_ctx();
+
+  librmb::RadosMetadataStoragePool metadata(&io_ctx);
+  ASSERT_EQ(0, metadata.open(&cluster, pool_name));
+
+  librmb::RadosMail mail;
+  mail.set_oid("metadata_pool_mail_2");
+  librmb::RadosMetadata guid(librmb::RBOX_METADATA_MAILBOX_GUID, "mailbox_1");
+  librmb::RadosMetadata from(librmb::RBOX_METADATA_FROM_ENVELOPE, "sender@example.com");
+  mail.add_metadata(guid);
+  mail.add_metadata(from);
+  std::map<std::string, ceph::bufferlist> keywords;
+  keywords["kw1"].append("keyword");
+  *mail.get_extended_metadata() = keywords;
+  librados::ObjectWriteOperation write_op;
+  metadata.save_metadata(&write_op, &mail);
+
+  std::list<librmb::RadosMetadata> to_update;
+  to_update.push_back(librmb::RadosMetadata(librmb::RBOX_METADATA_MAILBOX_GUID, "mailbox_2"));
+
+  // copy keeps the source
+  EXPECT_EQ(0, metadata.copy_metadata(*mail.get_oid(), "t1", "metadata_pool_mail_3", "t2", to_update, false));
+  librmb::RadosMail source;
+  source.set_oid(*mail.get_oid());
+  EXPECT_EQ(0, metadata.load_metadata(&source));
+  EXPECT_STREQ("mailbox_1", source.get_metadata(librmb::RBOX_METADATA_MAILBOX_GUID));
+
+  // move removes the source
+  EXPECT_EQ(0, metadata.copy_metadata(*mail.get_oid(), "t1", "metadata_pool_mail_4", "t2", to_update, true));
+  source.get_metadata()->clear();
+  EXPECT_EQ(-ENOENT, metadata.load_metadata(&source));
+
+  storage.set_namespace("t2");
+  const char *dest_oids[] = {"metadata_pool_mail_3", "metadata_pool_mail_4"};
+  for (const char *dest_oid : dest_oids) {
+    librmb::RadosMail dest;
+    dest.set_oid(dest_oid);
+    EXPECT_EQ(0, metadata.load_metadata(&dest));
+    EXPECT_STREQ("mailbox_2", dest.get_metadata(librmb::RBOX_METADATA_MAILBOX_GUID));
+    EXPECT_STREQ("sender@example.com", dest.get_metadata(librmb::RBOX_METADATA_FROM_ENVELOPE));
+    EXPECT_EQ(1u, dest.get_extended_metadata()->size());
+    EXPECT_EQ(0, metadata.remove_metadata(dest_oid));
+  }
+  // source gone already
+  EXPECT_EQ(-ENOENT, metadata.copy_metadata(*mail.get_oid(), "t1", "metadata_pool_mail_5", "t2", to_update, true));
+
+  metadata.close();
+  cluster.deinit();
+}
+/**
+ * striped mails: a ranged read only reads the stripes covering the range, releasing the references of the
+ * removed mail removes the stripes.
+ */
+TEST(librmb, striping_ranged_read_release) {
+  librmb::RadosClusterImpl cluster;
+  librmb::RadosStorageImpl storage(&cluster);
+  std::string pool_name("rmb_striping_tests");
+  ASSERT_EQ(0, storage.open_connection(pool_name));
+  storage.set_namespace("t1");
+  librados::IoCtx &io_ctx = storage.get_io_ctx();
+
+  librmb::RadosStriping striping;
+  striping.set_min_size(1);
+  striping.set_stripe_size(4);
+  librmb::RadosMail mail;
+  mail.set_oid("striped_mail_1");
+  librados::bufferlist *buffer = new librados::bufferlist();
+  buffer->append("0123456789");
+  mail.set_mail_buffer(buffer);
+  ASSERT_EQ(1, striping.stripe(io_ctx, &mail));
+  librmb::RadosStriping::Manifest manifest;
+  ASSERT_TRUE(librmb::RadosStriping::get_manifest(&mail, &manifest));
+  EXPECT_EQ(3u, manifest.count);
+
+  librados::bufferlist range;
+  EXPECT_EQ(4, librmb::RadosStriping::read(io_ctx, *mail.get_oid(), manifest, 3, 4, &range));
+  EXPECT_EQ("3456", std::string(range.c_str(), range.length()));
+  librados::bufferlist tail;
+  EXPECT_EQ(2, librmb::RadosStriping::read(io_ctx, *mail.get_oid(), manifest, 8, 100, &tail));
+  EXPECT_EQ("89", std::string(tail.c_str(), tail.length()));
+
+  EXPECT_EQ(1, librmb::RadosStriping::resolve(io_ctx, &mail));
+  EXPECT_EQ("0123456789", std::string(buffer->c_str(), buffer->length()));
+
+  EXPECT_EQ(0, librmb::RadosUtils::release_mail_refs(io_ctx, &mail, nullptr));
+  librados::IoCtx stripe_io_ctx;
+  stripe_io_ctx.dup(io_ctx);
+  stripe_io_ctx.set_namespace(librmb::RadosStriping::STRIPE_NAMESPACE);
+  uint64_t size;
+  time_t mtime;
+  EXPECT_EQ(-ENOENT, stripe_io_ctx.stat(librmb::RadosStriping::get_stripe_oid(*mail.get_oid(), 0), &size, &mtime));
+  mail.set_mail_buffer(nullptr);
+  delete buffer;
+  cluster.deinit();
+}
+
 TEST(librmb, mock_obj) {}
 int main(int argc, char **argv) {
   ::testing::InitGoogleMock(&argc, argv);
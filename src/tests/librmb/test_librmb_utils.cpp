@@ -22,11 +22,27 @@
 #include "rados-types.h"
 #include "rados-save-log.h"
 #include "rados-mail.h"
+#include "rados-mail-oid-index.h"
+#include "rados-metadata-storage-binary.h"
+#include "rados-compression.h"
+#include "rados-metrics.h"
+#include "rados-mail-cache.h"
+#include "rados-striping.h"
+#include "rados-mail-pack.h"
+#include "rados-metadata-storage-impl.h"
+#include "rados-throttle.h"
+#include "rados-replica-reads.h"
+#include "rados-hedged-reads.h"
+#include "rados-read-ahead.h"
 #include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <pthread.h>
 
 using ::testing::AtLeast;
 using ::testing::Return;
+using ::testing::ReturnRef;
+using ::testing::_;
 
 TEST(librmb, get_metadata_1) {
   enum librmb::rbox_metadata_key key = librmb::rbox_metadata_key::RBOX_METADATA_GUID;
@@ -377,6 +393,241 @@ TEST(librmb, test_mvn_option) {
   std::remove(test_file_name.c_str());
 }
 
+TEST(librmb, test_pack_option) {
+  std::string test_file_name = "test_pack.log";
+  librmb::RadosSaveLog log_file(test_file_name);
+  EXPECT_EQ(true, log_file.open());
+  log_file.append(librmb::RadosSaveLogEntry("packed_oid", "ns_1", "mail_storage",
+                                            librmb::RadosSaveLogEntry::op_pack("ABCDEFG", 7)));
+  EXPECT_EQ(true, log_file.close());
+
+  std::ifstream read(test_file_name);
+  librmb::RadosSaveLogEntry entry;
+  read >> entry;
+  read.close();
+  std::remove(test_file_name.c_str());
+
+  EXPECT_EQ(entry.op, "pack:ABCDEFG:7");
+  std::string mailbox_guid;
+  uint32_t container = 0;
+  EXPECT_TRUE(entry.parse_pack_op(&mailbox_guid, &container));
+  EXPECT_EQ(mailbox_guid, "ABCDEFG");
+  EXPECT_EQ(container, 7u);
+
+  librmb::RadosSaveLogEntry save("abc", "ns_1", "mail_storage", librmb::RadosSaveLogEntry::op_save());
+  EXPECT_FALSE(save.parse_pack_op(&mailbox_guid, &container));
+  librmb::RadosSaveLogEntry broken("abc", "ns_1", "mail_storage", "pack:ABCDEFG:x");
+  EXPECT_FALSE(broken.parse_pack_op(&mailbox_guid, &container));
+}
+
+TEST(librmb, binary_log_file) {
+  std::list<librmb::RadosMetadata *> metadata;
+  librmb::RadosMetadata guid(librmb::RBOX_METADATA_MAILBOX_GUID, "ABCDEFG");
+  metadata.push_back(&guid);
+
+  std::string test_file_name = "test_3.log";
+  librmb::RadosSaveLog log_file(test_file_name);
+  log_file.set_binary_format(true);
+  log_file.set_flush_interval(3600);
+  EXPECT_EQ(true, log_file.open());
+  for (int i = 0; i < 10; i++) {
+    log_file.append(librmb::RadosSaveLogEntry("abc", "ns_1", "mail_storage", "save"));
+  }
+  log_file.append(librmb::RadosSaveLogEntry("dest_oid", "ns_dest", "mail_storage",
+                                            librmb::RadosSaveLogEntry::op_mv("ns_src", "src_oid", "user", metadata)));
+  // entries are buffered until flush (transaction commit) or close
+  std::ifstream empty(test_file_name);
+  EXPECT_EQ(std::ifstream::traits_type::eof(), empty.peek());
+  empty.close();
+  EXPECT_EQ(true, log_file.flush());
+  std::ifstream flushed(test_file_name);
+  EXPECT_NE(std::ifstream::traits_type::eof(), flushed.peek());
+  flushed.close();
+  EXPECT_EQ(true, log_file.close());
+
+  int count = 0;
+  std::ifstream read(test_file_name, std::ifstream::in | std::ifstream::binary);
+  EXPECT_TRUE(librmb::RadosSaveLogEntry::is_binary(read));
+  while (true) {
+    librmb::RadosSaveLogEntry entry;
+    librmb::RadosSaveLogEntry::read_binary(read, &entry);
+    if (read.eof()) {
+      break;
+    }
+    EXPECT_FALSE(read.fail());
+    if (count < 10) {
+      EXPECT_EQ(entry.oid, "abc");
+      EXPECT_EQ(entry.op, "save");
+    } else {
+      EXPECT_EQ(entry.oid, "dest_oid");
+      EXPECT_EQ(entry.src_oid, "src_oid");
+      EXPECT_EQ(entry.src_user, "user");
+      EXPECT_EQ(entry.metadata.size(), 1);
+    }
+    count++;
+  }
+  EXPECT_EQ(11, count);
+  read.close();
+
+  // corrupt the payload of the first entry => checksum mismatch
+  std::fstream corrupt(test_file_name, std::fstream::in | std::fstream::out | std::fstream::binary);
+  corrupt.seekp(12);
+  corrupt.put('X');
+  corrupt.close();
+  std::ifstream read_corrupt(test_file_name, std::ifstream::in | std::ifstream::binary);
+  librmb::RadosSaveLogEntry entry;
+  EXPECT_FALSE(librmb::RadosSaveLogEntry::read_binary(read_corrupt, &entry));
+  EXPECT_TRUE(read_corrupt.fail());
+  EXPECT_FALSE(read_corrupt.eof());
+  read_corrupt.close();
+  std::remove(test_file_name.c_str());
+}
+TEST(librmb, binary_log_file_damaged_entry) {
+  std::string torn;
+  EXPECT_TRUE(librmb::RadosSaveLogEntry("torn", "ns_1", "mail_storage", "save").to_binary(&torn));
+  std::string log;
+  EXPECT_TRUE(librmb::RadosSaveLogEntry("abc1", "ns_1", "mail_storage", "save").to_binary(&log));
+  // a process killed in the middle of its write
+  log.append(torn, 0, torn.size() / 2);
+  size_t damaged = log.size() - torn.size() / 2;
+  EXPECT_TRUE(librmb::RadosSaveLogEntry("abc2", "ns_1", "mail_storage", "save").to_binary(&log));
+  // a torn entry at the end
+  log.append(torn, 0, 5);
+
+  std::istringstream read(log);
+  librmb::RadosSaveLogEntry entry;
+  EXPECT_TRUE(librmb::RadosSaveLogEntry::read_binary(read, &entry));
+  EXPECT_EQ("abc1", entry.oid);
+  std::streampos start = read.tellg();
+  EXPECT_EQ(damaged, static_cast<size_t>(start));
+  EXPECT_FALSE(librmb::RadosSaveLogEntry::read_binary(read, &entry));
+  uint64_t skipped = 0;
+  EXPECT_TRUE(librmb::RadosSaveLogEntry::skip_damaged_binary(read, start, &entry, &skipped));
+  EXPECT_EQ("abc2", entry.oid);
+  EXPECT_EQ(torn.size() / 2, skipped);
+
+  start = read.tellg();
+  EXPECT_FALSE(librmb::RadosSaveLogEntry::read_binary(read, &entry));
+  EXPECT_FALSE(librmb::RadosSaveLogEntry::skip_damaged_binary(read, start, &entry, &skipped));
+  EXPECT_TRUE(read.eof());
+  EXPECT_EQ(5u, skipped);
+}
+TEST(librmb, binary_log_file_long_field) {
+  std::list<librmb::RadosMetadata *> metadata;
+  librmb::RadosMetadata mailbox(librmb::RBOX_METADATA_ORIG_MAILBOX, std::string(0x10000, 'x'));
+  metadata.push_back(&mailbox);
+  librmb::RadosSaveLogEntry entry("dest_oid", "ns_dest", "mail_storage",
+                                  librmb::RadosSaveLogEntry::op_mv("ns_src", "src_oid", "user", metadata));
+  // never stored truncated
+  std::string buffer;
+  EXPECT_FALSE(entry.to_binary(&buffer));
+  EXPECT_TRUE(buffer.empty());
+
+  std::string test_file_name = "test_4.log";
+  librmb::RadosSaveLog log_file(test_file_name);
+  log_file.set_binary_format(true);
+  EXPECT_TRUE(log_file.open());
+  EXPECT_FALSE(log_file.append(entry));
+  EXPECT_TRUE(log_file.append(librmb::RadosSaveLogEntry("abc", "ns_1", "mail_storage", "save")));
+  EXPECT_TRUE(log_file.close());
+  std::remove(test_file_name.c_str());
+}
+
+class RadosMetadataStorageBinaryCodec : public librmb::RadosMetadataStorageBinary {
+ public:
+  explicit RadosMetadataStorageBinaryCodec(librmb::RadosDovecotCephCfg *cfg_)
+      : librmb::RadosMetadataStorageBinary(nullptr, cfg_) {}
+  using librmb::RadosMetadataStorageBinary::decode_attribute;
+  using librmb::RadosMetadataStorageBinary::encode_attribute;
+};
+
+TEST(librmb, binary_metadata_encoding) {
+  librmbtest::RadosDovecotCephCfgMock cfg_mock;
+  EXPECT_CALL(cfg_mock, is_updateable_attribute(_)).WillRepeatedly(Return(false));
+  EXPECT_CALL(cfg_mock, is_update_attributes()).WillRepeatedly(Return(false));
+  RadosMetadataStorageBinaryCodec codec(&cfg_mock);
+
+  librmb::RadosMail mail;
+  librmb::RadosMetadata guid(librmb::RBOX_METADATA_MAILBOX_GUID, "ABCDEFG");
+  librmb::RadosMetadata mb_name(librmb::RBOX_METADATA_ORIG_MAILBOX, "INBOX");
+  uint uid_ = 17;
+  librmb::RadosMetadata uid(librmb::RBOX_METADATA_MAIL_UID, uid_);
+  mail.add_metadata(guid);
+  mail.add_metadata(mb_name);
+  mail.add_metadata(uid);
+  std::string keyword_key = "kw_1";
+  std::string keyword_value = "$Label1";
+  librmb::RadosMetadata keyword(keyword_key, keyword_value);
+  mail.add_extended_metadata(keyword);
+
+  librados::ObjectWriteOperation write_op;
+  ceph::bufferlist bl;
+  codec.encode_attribute(&mail, &write_op, &bl);
+  EXPECT_TRUE(librmb::RadosMetadataStorageBinary::is_binary(bl.c_str(), bl.length()));
+
+  librmb::RadosMetadataBinaryView view;
+  EXPECT_TRUE(librmb::RadosMetadataStorageBinary::decode(bl.c_str(), bl.length(), &view));
+  // values are \0 terminated (see RadosMetadata)
+  EXPECT_STREQ("INBOX", view.values[librmb::RBOX_METADATA_ORIG_MAILBOX]);
+  EXPECT_EQ(6, view.sizes[librmb::RBOX_METADATA_ORIG_MAILBOX]);
+  EXPECT_EQ(nullptr, view.values[librmb::RBOX_METADATA_GUID]);
+
+  librmb::RadosMail decoded;
+  EXPECT_EQ(0, codec.decode_attribute(&decoded, bl));
+  EXPECT_EQ(3, decoded.get_metadata()->size());
+  EXPECT_STREQ("ABCDEFG", (*decoded.get_metadata())["M"].c_str());
+  EXPECT_STREQ("17", (*decoded.get_metadata())["U"].c_str());
+  EXPECT_STREQ("$Label1", decoded.get_extended_metadata("kw_1").c_str());
+
+  // truncated attribute
+  EXPECT_FALSE(librmb::RadosMetadataStorageBinary::decode(bl.c_str(), bl.length() - 1, &view));
+
+  // json (ima module) is still readable
+  ceph::bufferlist json_bl;
+  json_bl.append("{\"B\":\"INBOX\",\"U\":\"1\"}");
+  librmb::RadosMail json_mail;
+  EXPECT_EQ(0, codec.decode_attribute(&json_mail, json_bl));
+  EXPECT_EQ("INBOX", (*json_mail.get_metadata())["B"].to_str());
+  EXPECT_EQ("1", (*json_mail.get_metadata())["U"].to_str());
+}
+
+/**
+ * asynchronous read of the immutable metadata (expunge and copy decide on the dedup reference and the stripes
+ * of a mail from it): decoding replaces the metadata loaded before.
+ */
+TEST(librmb, decode_immutable_metadata) {
+  librados::IoCtx io_ctx;
+  librmb::RadosMetadataStorageDefault ms_default(&io_ctx);
+  librados::ObjectReadOperation read_op;
+  std::map<std::string, ceph::bufferlist> xattrs;
+  int prval = 0;
+  EXPECT_EQ(&io_ctx, ms_default.read_immutable_metadata(&read_op, &xattrs, &prval));
+
+  librmb::RadosMail mail;
+  librmb::RadosMetadata stale(librmb::RBOX_METADATA_ORIG_MAILBOX, "Trash");
+  mail.add_metadata(stale);
+  xattrs[std::string(1, static_cast<char>(librmb::RBOX_METADATA_EXT_REF))].append("hash");
+  EXPECT_EQ(0, ms_default.decode_immutable_metadata(&mail, &xattrs));
+  EXPECT_EQ(1, mail.get_metadata()->size());
+  EXPECT_EQ("hash", (*mail.get_metadata())["X"].to_str());
+
+  librmbtest::RadosDovecotCephCfgMock cfg_mock;
+  std::string ima_attribute = "rbox_ima";
+  EXPECT_CALL(cfg_mock, get_metadata_storage_attribute()).WillRepeatedly(ReturnRef(ima_attribute));
+  EXPECT_CALL(cfg_mock, is_updateable_attribute(_)).WillRepeatedly(Return(false));
+  librmb::RadosMetadataStorageIma ms_ima(&io_ctx, &cfg_mock);
+  std::map<std::string, ceph::bufferlist> ima_xattrs;
+  ima_xattrs[ima_attribute].append("{\"B\":\"INBOX\",\"X\":\"hash\"}");
+  EXPECT_EQ(0, ms_ima.decode_immutable_metadata(&mail, &ima_xattrs));
+  EXPECT_EQ(2, mail.get_metadata()->size());
+  EXPECT_EQ("INBOX", (*mail.get_metadata())["B"].to_str());
+  EXPECT_EQ(&io_ctx, ms_ima.read_immutable_metadata(&read_op, &xattrs, &prval));
+
+  // without connection to the metadata pool, the read can not be issued
+  librmb::RadosMetadataStoragePool ms_pool(&io_ctx);
+  EXPECT_EQ(nullptr, ms_pool.read_immutable_metadata(&read_op, &xattrs, &prval));
+}
+
 /*TEST(librmb, test_if) {
   int arr[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
 
@@ -389,6 +640,632 @@ TEST(librmb, test_mvn_option) {
 
   EXPECT_EQ(1, 2);
 }*/
+TEST(librmb, oid_index_lookup) {
+  librmb::RadosMail mail_1;
+  mail_1.set_oid("0123456789abcdef0123456789ABCDEF");
+  librmb::RadosMail mail_2;
+  mail_2.set_oid("fedcba9876543210fedcba9876543210");
+  librmb::RadosMail mail_3;
+  mail_3.set_oid("no_guid_oid");
+
+  std::list<librmb::RadosMail *> mail_objects;
+  mail_objects.push_back(&mail_1);
+  mail_objects.push_back(&mail_2);
+  mail_objects.push_back(&mail_3);
+  librmb::RadosMailOidIndex oid_index(mail_objects);
+  EXPECT_EQ(3, oid_index.size());
+
+  unsigned char guid[librmb::RadosMailOidIndex::OID_GUID_SIZE];
+  EXPECT_TRUE(librmb::RadosMailOidIndex::oid_to_guid("fedcba9876543210fedcba9876543210", guid));
+  EXPECT_EQ(0xfe, guid[0]);
+  EXPECT_EQ(0x10, guid[15]);
+  EXPECT_EQ(&mail_2, oid_index.find(guid));
+  // oids are compared exactly, only lowercase hex oids use the binary index
+  EXPECT_EQ(&mail_1, oid_index.find("0123456789abcdef0123456789ABCDEF"));
+  EXPECT_EQ(nullptr, oid_index.find("0123456789ABCDEF0123456789abcdef"));
+  EXPECT_EQ(nullptr, oid_index.find("0123456789abcdef0123456789abcdef"));
+  EXPECT_FALSE(librmb::RadosMailOidIndex::oid_to_guid("0123456789abcdef0123456789ABCDEF", guid));
+  EXPECT_EQ(&mail_3, oid_index.find("no_guid_oid"));
+
+  EXPECT_FALSE(librmb::RadosMailOidIndex::oid_to_guid("fedcba9876543210fedcba987654321x", guid));
+  EXPECT_EQ(nullptr, oid_index.find("00000000000000000000000000000000"));
+  EXPECT_EQ(nullptr, oid_index.find("unknown"));
+}
+TEST(librmb, compact_metadata) {
+  librmb::RadosMail mail;
+  librmb::RadosMetadata mailbox_guid(librmb::RBOX_METADATA_MAILBOX_GUID, "ABCDEFG");
+  librmb::RadosMetadata guid(librmb::RBOX_METADATA_GUID, "0123456789");
+  uint uid_ = 17;
+  librmb::RadosMetadata uid(librmb::RBOX_METADATA_MAIL_UID, uid_);
+  time_t recv_time = 1500000000;
+  librmb::RadosMetadata recv(librmb::RBOX_METADATA_RECEIVED_TIME, recv_time);
+  librmb::RadosMetadata p_size(librmb::RBOX_METADATA_PHYSICAL_SIZE, "1024");
+  librmb::RadosMetadata v_size(librmb::RBOX_METADATA_VIRTUAL_SIZE, "1040");
+  mail.add_metadata(mailbox_guid);
+  mail.add_metadata(guid);
+  mail.add_metadata(uid);
+  mail.add_metadata(recv);
+  mail.add_metadata(p_size);
+  mail.add_metadata(v_size);
+  std::string keyword_key = "K1";
+  (*mail.get_metadata())[keyword_key].append("$Label1");
+
+  EXPECT_STREQ("17", mail.get_metadata(librmb::RBOX_METADATA_MAIL_UID));
+  EXPECT_TRUE(librmb::RadosUtils::validate_metadata(&mail));
+
+  mail.compact_metadata();
+  EXPECT_TRUE(mail.is_compact());
+  EXPECT_TRUE(mail.has_metadata());
+  // only the multi character keyword key stays in the map
+  EXPECT_EQ(1, mail.get_metadata()->size());
+
+  EXPECT_STREQ("ABCDEFG", mail.get_metadata(librmb::RBOX_METADATA_MAILBOX_GUID));
+  EXPECT_STREQ("17", mail.get_metadata(librmb::RBOX_METADATA_MAIL_UID));
+  int64_t value = 0;
+  EXPECT_TRUE(mail.get_metadata(librmb::RBOX_METADATA_MAIL_UID, &value));
+  EXPECT_EQ(17, value);
+  EXPECT_TRUE(mail.get_metadata(librmb::RBOX_METADATA_PHYSICAL_SIZE, &value));
+  EXPECT_EQ(1024, value);
+  EXPECT_FALSE(mail.get_metadata(librmb::RBOX_METADATA_GUID, &value));
+  EXPECT_EQ(nullptr, mail.get_metadata(librmb::RBOX_METADATA_ORIG_MAILBOX));
+  EXPECT_TRUE(librmb::RadosUtils::validate_metadata(&mail));
+
+  librmb::RadosMail empty;
+  empty.compact_metadata();
+  EXPECT_FALSE(empty.has_metadata());
+  EXPECT_EQ(nullptr, empty.get_metadata(librmb::RBOX_METADATA_MAIL_UID));
+  EXPECT_FALSE(librmb::RadosUtils::validate_metadata(&empty));
+}
+TEST(librmb, mail_compression) {
+  librmb::RadosCompression compression;
+  EXPECT_TRUE(compression.set_codec("none"));
+  EXPECT_FALSE(compression.set_codec("gzip"));
+  EXPECT_FALSE(compression.is_enabled());
+
+  std::string text;
+  for (int i = 0; i < 500; i++) {
+    text += "Received: from localhost by mail.example.com; " + std::to_string(i % 7) + "\r\n";
+  }
+  librmb::RadosMail mail;
+  librados::bufferlist *buffer = new librados::bufferlist();
+  buffer->append(text);
+  mail.set_mail_buffer(buffer);
+  mail.set_mail_size(text.size());
+  EXPECT_EQ(0, compression.compress(&mail, text.size()));
+
+  if (!compression.set_codec("zstd") && !compression.set_codec("lz4")) {
+    // built without compression libraries
+    delete buffer;
+    return;
+  }
+  compression.set_min_size(text.size() + 1);
+  EXPECT_EQ(0, compression.compress(&mail, text.size()));
+  EXPECT_EQ(text.size(), buffer->length());
+
+  compression.set_min_size(1024);
+  EXPECT_EQ(1, compression.compress(&mail, text.size()));
+  EXPECT_GT(static_cast<int>(text.size()), mail.get_mail_size());
+  EXPECT_TRUE(librmb::RadosCompression::has_frame_magic(buffer->c_str(), buffer->length()));
+  librmb::rbox_compression_codec codec;
+  uint64_t uncompressed_size = 0;
+  EXPECT_TRUE(librmb::RadosCompression::get_compression(&mail, &codec, &uncompressed_size));
+  EXPECT_EQ(compression.get_codec(), codec);
+  EXPECT_EQ(text.size(), uncompressed_size);
+
+  // streaming, small chunks
+  librmb::RadosDecompressor *decompressor =
+      librmb::RadosCompression::create_decompressor(codec, buffer->c_str(), buffer->length());
+  ASSERT_NE(nullptr, decompressor);
+  std::string out;
+  char chunk[100];
+  ssize_t ret;
+  while ((ret = decompressor->read(chunk, sizeof(chunk))) > 0) {
+    out.append(chunk, ret);
+  }
+  delete decompressor;
+  EXPECT_EQ(0, ret);
+  EXPECT_EQ(text, out);
+
+  // truncated data
+  decompressor = librmb::RadosCompression::create_decompressor(codec, buffer->c_str(), buffer->length() / 2);
+  while ((ret = decompressor->read(chunk, sizeof(chunk))) > 0) {
+  }
+  delete decompressor;
+  EXPECT_GT(0, ret);
+
+  EXPECT_EQ(0, librmb::RadosCompression::decompress(&mail));
+  EXPECT_EQ(text, buffer->to_str());
+  EXPECT_EQ(static_cast<int>(text.size()), mail.get_mail_size());
+  EXPECT_EQ(nullptr, mail.get_metadata(librmb::RBOX_METADATA_COMPRESSION));
+  EXPECT_FALSE(librmb::RadosCompression::has_frame_magic(buffer->c_str(), buffer->length()));
+  delete buffer;
+}
+TEST(librmb, metrics_histogram) {
+  for (int i = 0; i < librmb::RadosHistogram::BUCKET_COUNT; i++) {
+    uint64_t upper_bound = librmb::RadosHistogram::bucket_upper_bound(i);
+    EXPECT_EQ(i, librmb::RadosHistogram::bucket_index(upper_bound));
+    EXPECT_EQ(i, librmb::RadosHistogram::bucket_index(upper_bound - (upper_bound >> 4)));
+  }
+  EXPECT_EQ(librmb::RadosHistogram::BUCKET_COUNT - 1, librmb::RadosHistogram::bucket_index(UINT64_MAX));
+
+  librmb::RadosHistogram histogram;
+  EXPECT_EQ(0u, histogram.percentile(50));
+  for (uint64_t i = 1; i <= 1000; i++) {
+    histogram.record(i);
+  }
+  EXPECT_EQ(1000u, histogram.get_count());
+  EXPECT_EQ(500500u, histogram.get_sum());
+  EXPECT_EQ(1000u, histogram.get_max());
+  // relative error is below 1/SUB_BUCKETS
+  EXPECT_LE(500u, histogram.percentile(50));
+  EXPECT_GE(500u + 500u / librmb::RadosHistogram::SUB_BUCKETS, histogram.percentile(50));
+  EXPECT_LE(990u, histogram.percentile(99));
+  EXPECT_EQ(1000u, histogram.percentile(100));
+}
+TEST(librmb, metrics_registry) {
+  librmb::RadosMetrics metrics;
+  metrics.record(librmb::METRIC_SAVE_MAIL, 100, false);
+  metrics.record(librmb::METRIC_SAVE_MAIL, 300, true);
+  metrics.record(librmb::METRIC_DICT_LOOKUP, 20, false);
+  EXPECT_EQ(2u, metrics.get_histogram(librmb::METRIC_SAVE_MAIL).get_count());
+  EXPECT_EQ(1u, metrics.get_errors(librmb::METRIC_SAVE_MAIL));
+  EXPECT_EQ(0u, metrics.get_histogram(librmb::METRIC_COPY).get_count());
+
+  // serialized lines of several processes are summed up
+  librmb::RadosMetrics merged;
+  std::string line;
+  std::istringstream lines(metrics.serialize() + metrics.serialize());
+  while (std::getline(lines, line)) {
+    EXPECT_TRUE(merged.merge(line));
+  }
+  EXPECT_EQ(4u, merged.get_histogram(librmb::METRIC_SAVE_MAIL).get_count());
+  EXPECT_EQ(800u, merged.get_histogram(librmb::METRIC_SAVE_MAIL).get_sum());
+  EXPECT_EQ(300u, merged.get_histogram(librmb::METRIC_SAVE_MAIL).get_max());
+  EXPECT_EQ(2u, merged.get_errors(librmb::METRIC_SAVE_MAIL));
+  EXPECT_EQ(2u, merged.get_histogram(librmb::METRIC_DICT_LOOKUP).get_count());
+  EXPECT_FALSE(merged.merge("unknown_op 1 0 1 1 1:1"));
+
+  std::string file = "metrics_registry_test.log";
+  std::remove(file.c_str());
+  EXPECT_EQ(0, metrics.flush_to_file(file));
+  EXPECT_EQ(0u, metrics.get_histogram(librmb::METRIC_SAVE_MAIL).get_count());
+  EXPECT_EQ(0u, metrics.get_errors(librmb::METRIC_SAVE_MAIL));
+  librmb::RadosMetrics loaded;
+  EXPECT_EQ(0, loaded.load_file(file));
+  EXPECT_EQ(2u, loaded.get_histogram(librmb::METRIC_SAVE_MAIL).get_count());
+  EXPECT_EQ(1u, loaded.get_errors(librmb::METRIC_SAVE_MAIL));
+  std::remove(file.c_str());
+
+  librmb::RadosMetricsTimer *timer = new librmb::RadosMetricsTimer(librmb::METRIC_MOVE);
+  EXPECT_EQ(-ENOENT, timer->result(-ENOENT));
+  uint64_t count = librmb::RadosMetrics::global().get_histogram(librmb::METRIC_MOVE).get_count();
+  uint64_t errors = librmb::RadosMetrics::global().get_errors(librmb::METRIC_MOVE);
+  delete timer;
+  EXPECT_EQ(count + 1, librmb::RadosMetrics::global().get_histogram(librmb::METRIC_MOVE).get_count());
+  EXPECT_EQ(errors + 1, librmb::RadosMetrics::global().get_errors(librmb::METRIC_MOVE));
+}
+TEST(librmb, metrics_file_compaction) {
+  librmb::RadosMetrics metrics;
+  metrics.record(librmb::METRIC_SAVE_MAIL, 100, false);
+  metrics.record(librmb::METRIC_SAVE_MAIL, 300, true);
+  std::string line = metrics.serialize();
+
+  std::string file = "metrics_compaction_test.log";
+  std::remove(file.c_str());
+  uint64_t lines = 0;
+  {
+    std::ofstream out(file.c_str());
+    for (std::streamoff size = 0; size < librmb::RadosMetrics::COMPACT_FILE_SIZE; size += line.size()) {
+      out << line;
+      ++lines;
+    }
+  }
+  EXPECT_EQ(0, librmb::RadosMetrics::compact_file(file));
+  std::ifstream in(file.c_str(), std::ios::ate);
+  EXPECT_GT(librmb::RadosMetrics::COMPACT_FILE_SIZE, static_cast<off_t>(in.tellg()));
+
+  // the compacted file still holds the sum of all lines
+  librmb::RadosMetrics loaded;
+  EXPECT_EQ(0, loaded.load_file(file));
+  EXPECT_EQ(2 * lines, loaded.get_histogram(librmb::METRIC_SAVE_MAIL).get_count());
+  EXPECT_EQ(lines, loaded.get_errors(librmb::METRIC_SAVE_MAIL));
+  EXPECT_EQ(300u, loaded.get_histogram(librmb::METRIC_SAVE_MAIL).get_max());
+  std::remove(file.c_str());
+}
+TEST(librmb, mail_cache_lru) {
+  librmbtest::RadosStorageMock storage;
+  EXPECT_CALL(storage, get_pool_name()).WillRepeatedly(Return("mail_storage"));
+  EXPECT_CALL(storage, get_namespace()).WillRepeatedly(Return("user1"));
+  librmb::RadosMailCache cache;
+  librados::bufferlist bl;
+  bl.append(std::string(100, 'a'));
+  cache.put(&storage, "oid1", bl, 100, 1);
+  // disabled
+  EXPECT_EQ(0u, cache.get_count());
+
+  cache.set_max_bytes(400);
+  cache.put(&storage, "oid1", bl, 100, 1);
+  cache.put(&storage, "oid2", bl, 100, 2);
+  cache.put(&storage, "oid3", bl, 100, 3);
+  EXPECT_EQ(300u, cache.get_bytes());
+
+  librados::bufferlist read;
+  uint64_t psize = 0;
+  time_t save_date = 0;
+  // oid1 becomes the most recently used
+  EXPECT_TRUE(cache.get(&storage, "oid1", &read, &psize, &save_date));
+  EXPECT_EQ(bl.to_str(), read.to_str());
+  EXPECT_EQ(100u, psize);
+  EXPECT_EQ(1, save_date);
+
+  cache.put(&storage, "oid4", bl, 100, 4);
+  cache.put(&storage, "oid5", bl, 100, 5);
+  EXPECT_EQ(4u, cache.get_count());
+  EXPECT_EQ(400u, cache.get_bytes());
+  EXPECT_FALSE(cache.get(&storage, "oid2", &read, &psize, &save_date));
+  EXPECT_TRUE(cache.get(&storage, "oid1", &read, &psize, &save_date));
+
+  // too large for the cache
+  librados::bufferlist large;
+  large.append(std::string(101, 'b'));
+  cache.put(&storage, "oid6", large, 101, 6);
+  EXPECT_FALSE(cache.get(&storage, "oid6", &read, &psize, &save_date));
+
+  cache.remove(&storage, "oid1");
+  EXPECT_FALSE(cache.get(&storage, "oid1", &read, &psize, &save_date));
+  EXPECT_EQ(300u, cache.get_bytes());
+  EXPECT_EQ(2u, cache.get_hits());
+  EXPECT_EQ(3u, cache.get_misses());
+
+  // the same oid in another pool or namespace is a different mail
+  librmbtest::RadosStorageMock alt_storage;
+  EXPECT_CALL(alt_storage, get_pool_name()).WillRepeatedly(Return("mail_storage_alt"));
+  EXPECT_CALL(alt_storage, get_namespace()).WillRepeatedly(Return("user1"));
+  librmbtest::RadosStorageMock other_user;
+  EXPECT_CALL(other_user, get_pool_name()).WillRepeatedly(Return("mail_storage"));
+  EXPECT_CALL(other_user, get_namespace()).WillRepeatedly(Return("user2"));
+  EXPECT_FALSE(cache.get(&alt_storage, "oid5", &read, &psize, &save_date));
+  EXPECT_FALSE(cache.get(&other_user, "oid5", &read, &psize, &save_date));
+  cache.remove(&alt_storage, "oid5");
+  EXPECT_EQ(300u, cache.get_bytes());
+  EXPECT_EQ(2u, cache.get_hits());
+  EXPECT_EQ(5u, cache.get_misses());
+
+  cache.set_max_bytes(150);
+  EXPECT_EQ(1u, cache.get_count());
+  EXPECT_TRUE(cache.get(&storage, "oid5", &read, &psize, &save_date));
+  cache.clear();
+  EXPECT_EQ(0u, cache.get_bytes());
+}
+TEST(librmb, striping_manifest) {
+  librmb::RadosStriping::Manifest manifest;
+  manifest.count = 3;
+  manifest.stripe_size = 4096;
+  manifest.size = 10000;
+  EXPECT_EQ("3 4096 10000", manifest.to_string());
+
+  librmb::RadosStriping::Manifest parsed;
+  EXPECT_TRUE(parsed.from_string(manifest.to_string().c_str()));
+  EXPECT_EQ(3u, parsed.count);
+  EXPECT_EQ(4096u, parsed.stripe_size);
+  EXPECT_EQ(10000u, parsed.size);
+  // count does not match the size
+  EXPECT_FALSE(parsed.from_string("2 4096 10000"));
+  EXPECT_FALSE(parsed.from_string("1 0 10"));
+  EXPECT_FALSE(parsed.from_string("abc"));
+  EXPECT_FALSE(parsed.from_string(NULL));
+
+  librmb::RadosMail mail;
+  EXPECT_FALSE(librmb::RadosStriping::get_manifest(&mail, &parsed));
+  librmb::RadosMetadata stripes(librmb::RBOX_METADATA_STRIPES, manifest.to_string());
+  mail.add_metadata(stripes);
+  mail.compact_metadata();
+  EXPECT_TRUE(librmb::RadosStriping::get_manifest(&mail, &parsed));
+  EXPECT_EQ(10000u, parsed.size);
+
+  EXPECT_EQ("abc.2", librmb::RadosStriping::get_stripe_oid("abc", 2));
+  librmb::RadosStriping striping;
+  EXPECT_FALSE(striping.is_enabled());
+  striping.set_min_size(1024 * 1024);
+  EXPECT_TRUE(striping.is_enabled());
+}
+
+TEST(librmb, mail_pack_entry) {
+  librmb::RadosMailPack::Entry entry;
+  entry.offset = 4096;
+  entry.length = 1234;
+  librmb::RadosMetadata uid(librmb::RBOX_METADATA_MAIL_UID, 17);
+  entry.metadata[uid.key] = uid.bl;
+  std::string key = "1";
+  std::string keyword = "$Forwarded";
+  librmb::RadosMetadata ext(key, keyword);
+  entry.extended_metadata[ext.key] = ext.bl;
+
+  librados::bufferlist bl;
+  entry.encode(&bl);
+  librmb::RadosMailPack::Entry decoded;
+  EXPECT_TRUE(decoded.decode(bl));
+  EXPECT_EQ(4096u, decoded.offset);
+  EXPECT_EQ(1234u, decoded.length);
+  EXPECT_EQ(1u, decoded.metadata.size());
+  EXPECT_EQ(uid.bl.to_str(), decoded.metadata[uid.key].to_str());
+  EXPECT_EQ(1u, decoded.extended_metadata.size());
+  EXPECT_EQ(ext.bl.to_str(), decoded.extended_metadata["1"].to_str());
+
+  // truncated or foreign values
+  librados::bufferlist truncated;
+  truncated.append(bl.c_str(), bl.length() - 1);
+  EXPECT_FALSE(decoded.decode(truncated));
+  librados::bufferlist other;
+  other.append("abc");
+  EXPECT_FALSE(decoded.decode(other));
+
+  EXPECT_EQ("abc.0000001f", librmb::RadosMailPack::get_container_oid("abc", 31));
+
+  librmb::RadosMailPack pack;
+  EXPECT_FALSE(pack.is_enabled());
+  EXPECT_FALSE(pack.is_packable(100));
+  pack.set_max_size(1024);
+  EXPECT_TRUE(pack.is_enabled());
+  EXPECT_TRUE(pack.is_packable(1024));
+  EXPECT_FALSE(pack.is_packable(1025));
+  EXPECT_FALSE(pack.is_packable(0));
+  pack.set_container_size(512);
+  EXPECT_FALSE(pack.is_packable(1000));
+}
+TEST(librmb, metadata_storage_pool_not_open) {
+  librmbtest::RadosDovecotCephCfgMock cfg_mock;
+  std::string metadata_pool = "mail_metadata";
+  std::string module = "default";
+  EXPECT_CALL(cfg_mock, get_metadata_pool()).WillRepeatedly(ReturnRef(metadata_pool));
+  EXPECT_CALL(cfg_mock, get_metadata_storage_module()).WillRepeatedly(ReturnRef(module));
+
+  // the metadata pool cannot be opened without cluster, there is no fallback to the mail objects.
+  librmb::RadosMetadataStorageImpl ms;
+  EXPECT_EQ(nullptr, ms.create_metadata_storage(nullptr, &cfg_mock));
+
+  librmb::RadosMetadataStoragePool pool_storage(nullptr);
+  EXPECT_EQ(-ENOTCONN, pool_storage.open(nullptr, metadata_pool));
+  EXPECT_TRUE(pool_storage.has_separate_metadata());
+  librmb::RadosMail mail;
+  mail.set_oid("abc");
+  EXPECT_EQ(-ENOTCONN, pool_storage.load_metadata(&mail));
+  EXPECT_EQ(-ENOTCONN, pool_storage.remove_metadata("abc"));
+  std::list<librmb::RadosMetadata> to_update;
+  EXPECT_FALSE(pool_storage.update_metadata("abc", to_update));
+}
+TEST(librmb, throttle_limits) {
+  librmb::RadosThrottle throttle;
+  EXPECT_FALSE(throttle.is_enabled());
+
+  librmb::RadosThrottle::Limits limits;
+  limits.ops_per_sec = 100;
+  limits.max_inflight_bytes = 1024;
+  throttle.set_limits(limits);
+  EXPECT_TRUE(throttle.is_enabled());
+  EXPECT_EQ(100u, throttle.get_limits().ops_per_sec);
+  EXPECT_EQ(0u, throttle.get_limits().bytes_per_sec);
+  EXPECT_EQ(1024u, throttle.get_limits().max_inflight_bytes);
+  EXPECT_EQ(0u, throttle.get_inflight_ops(0));
+  EXPECT_EQ(0u, throttle.get_throttled());
+
+  // all limits 0: unlimited
+  throttle.set_limits(librmb::RadosThrottle::Limits());
+  EXPECT_FALSE(throttle.is_enabled());
+}
+TEST(librmb, throttle_ops_per_sec) {
+  librmb::RadosThrottle throttle;
+  librmb::RadosThrottle::Limits limits;
+  limits.ops_per_sec = 10;
+  throttle.set_limits(limits);
+
+  // the bucket starts full: a burst of one second
+  uint64_t now = 1000000;
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(0u, throttle.try_acquire(1, 0, now));
+  }
+  EXPECT_NEAR(100000, throttle.try_acquire(1, 0, now), 2);
+  EXPECT_NEAR(50000, throttle.try_acquire(1, 0, now + 50000), 2);
+  EXPECT_EQ(0u, throttle.try_acquire(1, 0, now + 100000));
+  // other pools have their own bucket
+  EXPECT_EQ(0u, throttle.try_acquire(2, 0, now + 100000));
+
+  // an idle pool does not collect more than one second of tokens
+  now += 60 * 1000000;
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(0u, throttle.try_acquire(1, 0, now));
+  }
+  EXPECT_LT(0u, throttle.try_acquire(1, 0, now));
+  EXPECT_EQ(21u, throttle.get_inflight_ops(1));
+}
+TEST(librmb, throttle_bytes_per_sec) {
+  librmb::RadosThrottle throttle;
+  librmb::RadosThrottle::Limits limits;
+  limits.bytes_per_sec = 1000;
+  throttle.set_limits(limits);
+
+  uint64_t now = 1000000;
+  EXPECT_EQ(0u, throttle.try_acquire(1, 600, now));
+  // 200 bytes missing
+  EXPECT_NEAR(200000, throttle.try_acquire(1, 600, now), 2);
+  EXPECT_EQ(0u, throttle.try_acquire(1, 600, now + 200000));
+  // larger than the burst: waits for a full bucket, then it is admitted and the bucket overdrawn
+  EXPECT_NEAR(1000000, throttle.try_acquire(1, 5000, now + 200000), 2);
+  EXPECT_EQ(0u, throttle.try_acquire(1, 5000, now + 1200000));
+  // the overdraft of 4000 bytes is paid back before the next operation
+  EXPECT_NEAR(2001000, throttle.try_acquire(1, 1, now + 3200000), 2);
+  EXPECT_NEAR(1000, throttle.try_acquire(1, 1, now + 5200000), 2);
+  EXPECT_EQ(6200u, throttle.get_inflight_bytes(1));
+}
+TEST(librmb, throttle_inflight) {
+  librmb::RadosThrottle throttle;
+  librmb::RadosThrottle::Limits limits;
+  limits.max_inflight_ops = 2;
+  limits.max_inflight_bytes = 100;
+  throttle.set_limits(limits);
+
+  uint64_t now = 1000000;
+  EXPECT_EQ(0u, throttle.try_acquire(1, 80, now));
+  // the release of an operation in flight is waited for, not time
+  EXPECT_EQ(UINT64_MAX, throttle.try_acquire(1, 30, now));
+  EXPECT_EQ(0u, throttle.try_acquire(1, 20, now));
+  EXPECT_EQ(UINT64_MAX, throttle.try_acquire(1, 0, now));
+  EXPECT_EQ(2u, throttle.get_inflight_ops(1));
+  EXPECT_EQ(100u, throttle.get_inflight_bytes(1));
+
+  throttle.release(1, 80);
+  throttle.release(1, 20);
+  EXPECT_EQ(0u, throttle.get_inflight_ops(1));
+  EXPECT_EQ(0u, throttle.get_inflight_bytes(1));
+  // larger than the limit: admitted if nothing else is in flight
+  EXPECT_EQ(0u, throttle.try_acquire(1, 500, now));
+  EXPECT_EQ(UINT64_MAX, throttle.try_acquire(1, 1, now));
+  throttle.release(1, 500);
+  EXPECT_EQ(0u, throttle.try_acquire(1, 1, now));
+}
+TEST(librmb, replica_reads_mode) {
+  librmb::RadosReplicaReads replica_reads;
+  EXPECT_FALSE(replica_reads.is_enabled());
+  EXPECT_EQ(LIBRADOS_OPERATION_NOFLAG, replica_reads.get_flags());
+
+  EXPECT_TRUE(replica_reads.set_mode("localize"));
+  EXPECT_EQ(LIBRADOS_OPERATION_LOCALIZE_READS, replica_reads.get_flags());
+  EXPECT_TRUE(replica_reads.set_mode("balance"));
+  EXPECT_EQ(librmb::REPLICA_READS_BALANCE, replica_reads.get_mode());
+  EXPECT_EQ(LIBRADOS_OPERATION_BALANCE_READS, replica_reads.get_flags());
+
+  // unknown modes disable replica reads
+  EXPECT_FALSE(replica_reads.set_mode("nearest"));
+  EXPECT_FALSE(replica_reads.is_enabled());
+  EXPECT_TRUE(replica_reads.set_mode("none"));
+  EXPECT_EQ(LIBRADOS_OPERATION_NOFLAG, replica_reads.get_flags());
+}
+TEST(librmb, hedged_reads_delay) {
+  librmb::RadosHedgedReads hedged_reads;
+  EXPECT_FALSE(hedged_reads.is_enabled());
+  hedged_reads.set_percentile(150);
+  EXPECT_EQ(100, hedged_reads.get_percentile());
+  hedged_reads.set_percentile(90);
+  EXPECT_TRUE(hedged_reads.is_enabled());
+  hedged_reads.set_min_delay(1000);
+
+  // without samples the minimum delay is used
+  librmb::RadosHistogram latency;
+  EXPECT_EQ(1000u, hedged_reads.get_delay(latency));
+
+  for (int i = 0; i < 90; i++) {
+    latency.record(500);
+  }
+  for (int i = 0; i < 10; i++) {
+    latency.record(100000);
+  }
+  EXPECT_EQ(1000u, hedged_reads.get_delay(latency));
+  hedged_reads.set_percentile(99);
+  EXPECT_EQ(latency.percentile(99), hedged_reads.get_delay(latency));
+  EXPECT_LE(100000u, hedged_reads.get_delay(latency));
+
+  // the delay of read does not depend on METRIC_READ_MAIL (cache, pack and read ahead hits)
+  librmb::RadosMetrics::global().record(librmb::METRIC_READ_MAIL, 500000, false);
+  EXPECT_EQ(0u, hedged_reads.get_read_latency().get_count());
+  EXPECT_EQ(1000u, hedged_reads.get_delay(hedged_reads.get_read_latency()));
+  librmb::RadosMetrics::global().reset();
+
+  hedged_reads.set_percentile(0);
+  EXPECT_FALSE(hedged_reads.is_enabled());
+}
+
+/* read ahead without librados completions: reads complete when the test says so */
+class ReadAheadTest : public librmb::RadosReadAhead {
+ public:
+  ReadAheadTest() : completed(false), cancelled(0) {}
+  ~ReadAheadTest() {
+    completed = true;
+    clear();
+  }
+  bool completed;
+  int cancelled;
+
+ protected:
+  void cancel(PendingRead *read) override { ++cancelled; }
+  bool is_complete(PendingRead *read) override { return completed; }
+  void wait(PendingRead *read) override {}
+};
+
+TEST(librmb, read_ahead_sequential) {
+  librmb::RadosReadAhead read_ahead;
+  EXPECT_FALSE(read_ahead.is_enabled());
+  EXPECT_FALSE(read_ahead.is_sequential("box1", 1));
+  EXPECT_FALSE(read_ahead.is_sequential("box1", 2));
+  EXPECT_TRUE(read_ahead.is_sequential("box1", 3));
+  EXPECT_TRUE(read_ahead.is_sequential("box1", 4));
+  // a gap or another mailbox starts a new run
+  EXPECT_FALSE(read_ahead.is_sequential("box1", 6));
+  EXPECT_FALSE(read_ahead.is_sequential("box2", 7));
+  EXPECT_FALSE(read_ahead.is_sequential("box2", 8));
+  EXPECT_TRUE(read_ahead.is_sequential("box2", 9));
+  EXPECT_FALSE(read_ahead.is_sequential("box2", 9));
+}
+
+TEST(librmb, read_ahead_window) {
+  librmbtest::RadosStorageMock storage_mock;
+  librados::IoCtx io_ctx;
+  EXPECT_CALL(storage_mock, get_io_ctx()).WillRepeatedly(ReturnRef(io_ctx));
+  EXPECT_CALL(storage_mock, aio_operate(&io_ctx, _, _, _, _, _)).WillRepeatedly(Return(0));
+
+  ReadAheadTest read_ahead;
+  read_ahead.set_window(3, 100);
+  EXPECT_TRUE(read_ahead.is_enabled());
+  std::list<std::pair<std::string, uint64_t>> next_mails;
+  next_mails.push_back(std::make_pair("oid_1", 40));
+  next_mails.push_back(std::make_pair("oid_2", 40));
+  next_mails.push_back(std::make_pair("oid_3", 40));
+  // byte limit
+  EXPECT_EQ(2, read_ahead.update_window(&storage_mock, next_mails));
+  EXPECT_EQ(2u, read_ahead.get_pending_count());
+  EXPECT_EQ(80u, read_ahead.get_pending_bytes());
+
+  // mail limit, pending reads are not started again
+  read_ahead.set_window(3, 1000);
+  next_mails.push_back(std::make_pair("oid_4", 10));
+  EXPECT_EQ(1, read_ahead.update_window(&storage_mock, next_mails));
+  EXPECT_EQ(3u, read_ahead.get_pending_count());
+  EXPECT_EQ(120u, read_ahead.get_pending_bytes());
+
+  // reads outside of the window are cancelled without waiting for them
+  next_mails.clear();
+  next_mails.push_back(std::make_pair("oid_3", 40));
+  next_mails.push_back(std::make_pair("oid_5", 2000));
+  EXPECT_EQ(0, read_ahead.update_window(&storage_mock, next_mails));
+  EXPECT_EQ(2, read_ahead.cancelled);
+  EXPECT_EQ(2u, read_ahead.get_dropped_count());
+  EXPECT_EQ(1u, read_ahead.get_pending_count());
+  EXPECT_EQ(40u, read_ahead.get_pending_bytes());
+
+  librados::bufferlist bl;
+  uint64_t psize = 0;
+  time_t save_date = 0;
+  int ret = -1;
+  EXPECT_FALSE(read_ahead.take("oid_1", &bl, &psize, &save_date, &ret));
+  EXPECT_TRUE(read_ahead.take("oid_3", &bl, &psize, &save_date, &ret));
+  EXPECT_EQ(0u, read_ahead.get_pending_count());
+  EXPECT_EQ(0u, read_ahead.get_pending_bytes());
+
+  // a read larger than the byte limit is started if nothing else is pending, dropped reads are released
+  read_ahead.completed = true;
+  next_mails.pop_front();
+  EXPECT_EQ(1, read_ahead.update_window(&storage_mock, next_mails));
+  EXPECT_EQ(0u, read_ahead.get_dropped_count());
+  EXPECT_EQ(2000u, read_ahead.get_pending_bytes());
+  read_ahead.clear();
+  EXPECT_EQ(0u, read_ahead.get_pending_count());
+  EXPECT_EQ(0u, read_ahead.get_dropped_count());
+
+  // a failed submit stops the window
+  EXPECT_CALL(storage_mock, aio_operate(&io_ctx, _, _, _, _, _)).WillOnce(Return(-EIO));
+  EXPECT_EQ(0, read_ahead.update_window(&storage_mock, next_mails));
+  EXPECT_EQ(0u, read_ahead.get_pending_count());
+}
+
 TEST(librmb, mock_obj) {}
 int main(int argc, char **argv) {
   ::testing::InitGoogleMock(&argc, argv);
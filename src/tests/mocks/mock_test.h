@@ -12,6 +12,8 @@
 #include <map>
 #include <string>
 #include <list>
+#include <utility>
+#include <vector>
 #include "rados-types.h"
 #include "../../librmb/rados-cluster.h"
 #include "../../librmb/rados-dictionary.h"
@@ -48,7 +50,17 @@ class RadosStorageMock : public RadosStorage {
   MOCK_METHOD1(delete_mail, int(const std::string &oid));
   MOCK_METHOD4(aio_operate, int(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
                                 librados::ObjectWriteOperation *op));
+  MOCK_METHOD5(aio_operate, int(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                librados::ObjectReadOperation *op, librados::bufferlist *pbl));
+  MOCK_METHOD6(aio_operate, int(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl));
   MOCK_METHOD1(find_mails, librados::NObjectIterator(const RadosMetadata *attr));
+  MOCK_METHOD2(split_mail_listing,
+               int(unsigned int slice_count,
+                   std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices));
+  MOCK_METHOD6(list_mails,
+               int(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish, size_t max_count,
+                   const RadosMetadata *attr, std::vector<std::string> *oids, bool *more));
   MOCK_METHOD1(open_connection, int(const std::string &poolname));
   MOCK_METHOD3(open_connection,
                int(const std::string &poolname, const std::string &clustername, const std::string &rados_username));
@@ -75,6 +87,9 @@ class RadosStorageMetadataMock : public RadosStorageMetadataModule {
  public:
   MOCK_METHOD1(set_io_ctx, void(librados::IoCtx *io_ctx));
   MOCK_METHOD1(load_metadata, int(RadosMail *mail));
+  MOCK_METHOD0(has_xattr_metadata, bool());
+  MOCK_METHOD3(load_metadata, int(RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                                  std::map<std::string, ceph::bufferlist> *omap));
   MOCK_METHOD2(set_metadata, int(RadosMail *mail, RadosMetadata &xattr));
   MOCK_METHOD3(set_metadata, int(RadosMail *mail, RadosMetadata &xattr, librados::ObjectWriteOperation *write_op));
 
@@ -139,6 +154,7 @@ class RadosDovecotCephCfgMock : public RadosDovecotCephCfg {
   MOCK_METHOD0(get_rados_cluster_name, const std::string &());
   MOCK_METHOD0(get_rados_username, const std::string &());
   MOCK_METHOD0(get_rados_save_log_file, const std::string &());
+  MOCK_METHOD0(is_save_log_binary, bool());
 
   // dovecot configuration
   MOCK_METHOD1(is_mail_attribute, bool(enum librmb::rbox_metadata_key key));
@@ -147,6 +163,30 @@ class RadosDovecotCephCfgMock : public RadosDovecotCephCfg {
   MOCK_METHOD0(is_ceph_posix_bugfix_enabled, bool());
   MOCK_METHOD0(is_ceph_aio_wait_for_safe_and_cb, bool());
   MOCK_METHOD0(is_write_chunks, bool());
+  MOCK_METHOD0(get_compression, const std::string &());
+  MOCK_METHOD0(get_compression_level, int());
+  MOCK_METHOD0(get_compression_min_size, uint64_t());
+  MOCK_METHOD0(get_alt_compression, const std::string &());
+  MOCK_METHOD0(get_alt_compression_level, int());
+  MOCK_METHOD0(is_dedup, bool());
+  MOCK_METHOD0(get_dedup_min_size, uint64_t());
+  MOCK_METHOD0(get_dedup_pool, const std::string &());
+  MOCK_METHOD0(get_metrics_file, const std::string &());
+  MOCK_METHOD0(get_read_ahead_mails, unsigned int());
+  MOCK_METHOD0(get_read_ahead_max_bytes, uint64_t());
+  MOCK_METHOD0(get_mail_cache_size, uint64_t());
+  MOCK_METHOD0(get_stripe_min_size, uint64_t());
+  MOCK_METHOD0(get_stripe_size, uint64_t());
+  MOCK_METHOD0(get_pack_max_size, uint64_t());
+  MOCK_METHOD0(get_pack_container_size, uint64_t());
+  MOCK_METHOD0(get_metadata_pool, const std::string &());
+  MOCK_METHOD0(get_throttle_ops_per_sec, uint64_t());
+  MOCK_METHOD0(get_throttle_bytes_per_sec, uint64_t());
+  MOCK_METHOD0(get_throttle_inflight_ops, uint64_t());
+  MOCK_METHOD0(get_throttle_inflight_bytes, uint64_t());
+  MOCK_METHOD0(get_replica_reads, const std::string &());
+  MOCK_METHOD0(get_hedged_reads_percentile, double());
+  MOCK_METHOD0(get_hedged_reads_min_delay, uint64_t());
 
   MOCK_METHOD1(update_mail_attributes, void(const char *value));
   MOCK_METHOD1(update_updatable_attributes, void(const char *value));
@@ -20,8 +20,12 @@
 #include "../../librmb/tools/rmb/ls_cmd_parser.h"
 #include "../../librmb/tools/rmb/mailbox_tools.h"
 #include "../../librmb/tools/rmb/rmb-commands.h"
+#include "../../librmb/rados-metadata-storage-pool.h"
 #include "mock_test.h"
 #include "../../librmb/rados-types.h"
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
 using ::testing::Return;
 using ::testing::_;
 using ::testing::ReturnRef;
@@ -60,6 +64,72 @@ TEST(rmb, test_cmd_parser) {
   EXPECT_FALSE(p3->eval(value));
 }
 
+/**
+ * test compiled predicates
+ * - all predicates have to match
+ * - equality predicates can be pushed down
+ * - invalid reference values are rejected
+ */
+TEST(rmb, test_cmd_parser_matches) {
+  librmb::CmdLineParser parser("U>7;B=INBOX;R>2013-12-04");
+  EXPECT_TRUE(parser.parse_ls_string());
+  EXPECT_EQ(librmb::Predicate::PREDICATE_NUMERIC, parser.get_predicate("U")->get_type());
+  EXPECT_EQ(librmb::Predicate::PREDICATE_DATE, parser.get_predicate("R")->get_type());
+  EXPECT_EQ(librmb::Predicate::PREDICATE_STRING, parser.get_predicate("B")->get_type());
+  EXPECT_EQ("B", parser.get_filter_predicate()->key);
+
+  librmb::RadosMail mail;
+  std::string uid_key = "U";
+  std::string uid = "8";
+  std::string box_key = "B";
+  std::string box = "INBOX";
+  std::string recv_key = "R";
+  std::string recv = "1503393219";
+  librmb::RadosMetadata m_uid(uid_key, uid);
+  librmb::RadosMetadata m_box(box_key, box);
+  librmb::RadosMetadata m_recv(recv_key, recv);
+  mail.add_metadata(m_uid);
+  mail.add_metadata(m_box);
+  EXPECT_FALSE(parser.matches(&mail));
+  mail.add_metadata(m_recv);
+  EXPECT_TRUE(parser.matches(&mail));
+
+  uid = "7";
+  librmb::RadosMetadata m_uid2(uid_key, uid);
+  mail.add_metadata(m_uid2);
+  EXPECT_FALSE(parser.matches(&mail));
+
+  librmb::CmdLineParser invalid("U>abc");
+  EXPECT_FALSE(invalid.parse_ls_string());
+
+  librmb::CmdLineParser range("U>7");
+  EXPECT_TRUE(range.parse_ls_string());
+  EXPECT_EQ(nullptr, range.get_filter_predicate());
+
+  // uid and date values are not stored as the query string, they can not be pushed down
+  librmb::CmdLineParser typed("U=7;R=2013-12-04");
+  EXPECT_TRUE(typed.parse_ls_string());
+  EXPECT_EQ(nullptr, typed.get_filter_predicate());
+}
+
+/**
+ * Test sort functions
+ */
+TEST(rmb1, sort_uid) {
+  librmb::RadosMail mail_1;
+  librmb::RadosMail mail_2;
+  std::string key = "U";
+  std::string uid_1 = "2";
+  std::string uid_2 = "10";
+  librmb::RadosMetadata m1(key, uid_1);
+  librmb::RadosMetadata m2(key, uid_2);
+  mail_1.add_metadata(m1);
+  mail_2.add_metadata(m2);
+  EXPECT_TRUE(librmb::RmbCommands::sort_uid(&mail_1, &mail_2));
+  EXPECT_FALSE(librmb::RmbCommands::sort_uid(&mail_2, &mail_1));
+  EXPECT_FALSE(librmb::RmbCommands::sort_uid(&mail_1, &mail_1));
+}
+
 /**
  * Test date predicate
  */
@@ -154,9 +224,210 @@ TEST(rmb1, rmb_commands_no_objects_found) {
   EXPECT_CALL(storage_mock, find_mails(nullptr)).WillRepeatedly(Return(iter));
   EXPECT_CALL(storage_mock, get_io_ctx()).WillRepeatedly(ReturnRef(test_ioctx));
   EXPECT_CALL(storage_mock, stat_mail(_, _, _)).WillRepeatedly(Return(0));
+  EXPECT_CALL(storage_mock, split_mail_listing(_, _)).WillRepeatedly(Return(0));
   int ret = rmb_cmd.load_objects(&ms_module_mock, mails, search_string);
   EXPECT_EQ(ret, 0);
+  EXPECT_EQ(0, mails.size());
+}
+/**
+ * Test rmb commands
+ * - objects whose read operation can not be issued are skipped
+ * - listing errors are returned
+ */
+static int split_one_slice(unsigned int slice_count,
+                           std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) {
+  slices->push_back(std::make_pair(librados::ObjectCursor(), librados::ObjectCursor()));
+  return 0;
+}
+static int list_two_oids(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish, size_t max_count,
+                         const librmb::RadosMetadata *attr, std::vector<std::string> *oids, bool *more) {
+  oids->push_back("oid_1");
+  oids->push_back("oid_2");
+  *more = false;
+  return 0;
+}
+TEST(rmb1, rmb_commands_scan_objects) {
+  librmbtest::RadosStorageMock storage_mock;
+  librmbtest::RadosClusterMock cluster_mock;
+  librmbtest::RadosStorageMetadataMock ms_module_mock;
+
+  std::map<std::string, std::string> opts;
+  opts["threads"] = "1";
+  librmb::RmbCommands rmb_cmd(&storage_mock, &cluster_mock, &opts);
+  std::list<librmb::RadosMail *> mails;
+  std::string sort_string = "uid";
+
+  EXPECT_CALL(storage_mock, split_mail_listing(1, _)).WillRepeatedly(testing::Invoke(split_one_slice));
+  EXPECT_CALL(storage_mock, list_mails(_, _, _, _, _, _)).WillOnce(testing::Invoke(list_two_oids));
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectReadOperation *>(), _))
+      .Times(2)
+      .WillRepeatedly(Return(-ENOENT));
+  EXPECT_EQ(0, rmb_cmd.load_objects(&ms_module_mock, mails, sort_string));
+  EXPECT_EQ(0, mails.size());
+
+  EXPECT_CALL(storage_mock, list_mails(_, _, _, _, _, _)).WillOnce(Return(-EIO));
+  EXPECT_EQ(-EIO, rmb_cmd.load_objects(&ms_module_mock, mails, sort_string));
 }
+/**
+ * Test rmb commands
+ * - ls with a uid / date filter is evaluated on the client, only string equalities are
+ *   pushed down to the osd
+ */
+TEST(rmb1, rmb_commands_load_objects_typed_filter) {
+  librmbtest::RadosStorageMock storage_mock;
+  librmbtest::RadosClusterMock cluster_mock;
+  librmbtest::RadosStorageMetadataMock ms_module_mock;
+
+  std::map<std::string, std::string> opts;
+  opts["threads"] = "1";
+  librmb::RmbCommands rmb_cmd(&storage_mock, &cluster_mock, &opts);
+  std::list<librmb::RadosMail *> mails;
+  std::string sort_string = "uid";
+
+  EXPECT_CALL(ms_module_mock, has_xattr_metadata()).WillRepeatedly(Return(true));
+  EXPECT_CALL(storage_mock, split_mail_listing(1, _)).WillRepeatedly(testing::Invoke(split_one_slice));
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectReadOperation *>(), _))
+      .WillRepeatedly(Return(-ENOENT));
+
+  librmb::CmdLineParser typed("U=7;R=2013-12-04");
+  EXPECT_TRUE(typed.parse_ls_string());
+  EXPECT_CALL(storage_mock, list_mails(_, _, _, testing::IsNull(), _, _)).WillOnce(testing::Invoke(list_two_oids));
+  EXPECT_EQ(0, rmb_cmd.load_objects(&ms_module_mock, mails, sort_string, true, &typed));
+  testing::Mock::VerifyAndClearExpectations(&storage_mock);
+
+  EXPECT_CALL(storage_mock, split_mail_listing(1, _)).WillRepeatedly(testing::Invoke(split_one_slice));
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectReadOperation *>(), _))
+      .WillRepeatedly(Return(-ENOENT));
+  librmb::CmdLineParser mixed("U=7;B=INBOX");
+  EXPECT_TRUE(mixed.parse_ls_string());
+  EXPECT_CALL(storage_mock, list_mails(_, _, _, testing::NotNull(), _, _)).WillOnce(testing::Invoke(list_two_oids));
+  EXPECT_EQ(0, rmb_cmd.load_objects(&ms_module_mock, mails, sort_string, true, &mixed));
+  EXPECT_EQ(0, mails.size());
+}
+/**
+ * Test rmb commands
+ * - namespace delete needs to be confirmed
+ * - failed removes are reported
+ * - the metadata of the objects is loaded before they are removed
+ */
+TEST(rmb1, rmb_commands_delete_namespace) {
+  librmbtest::RadosStorageMock storage_mock;
+  librmbtest::RadosClusterMock cluster_mock;
+  librmbtest::RadosStorageMetadataMock ms_module_mock;
+  librmb::RadosCephConfig ceph_cfg;
+
+  std::map<std::string, std::string> opts;
+  opts["threads"] = "1";
+  librmb::RmbCommands rmb_cmd(&storage_mock, &cluster_mock, &opts);
+
+  EXPECT_CALL(storage_mock, split_mail_listing(_, _)).Times(0);
+  EXPECT_EQ(0, rmb_cmd.delete_namespace(&ceph_cfg, false));
+  testing::Mock::VerifyAndClearExpectations(&storage_mock);
+
+  EXPECT_CALL(storage_mock, split_mail_listing(1, _)).WillOnce(testing::Invoke(split_one_slice));
+  EXPECT_CALL(storage_mock, list_mails(_, _, _, _, _, _)).WillOnce(testing::Invoke(list_two_oids));
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectWriteOperation *>()))
+      .Times(2)
+      .WillRepeatedly(Return(-EIO));
+  EXPECT_EQ(-1, rmb_cmd.delete_namespace(&ceph_cfg, true));
+  testing::Mock::VerifyAndClearExpectations(&storage_mock);
+
+  EXPECT_CALL(storage_mock, split_mail_listing(1, _)).WillOnce(testing::Invoke(split_one_slice));
+  EXPECT_CALL(storage_mock, list_mails(_, _, _, _, _, _)).WillOnce(testing::Invoke(list_two_oids));
+  EXPECT_CALL(ms_module_mock, load_metadata(_)).Times(2).WillRepeatedly(Return(0));
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectWriteOperation *>()))
+      .Times(2)
+      .WillRepeatedly(Return(-EIO));
+  EXPECT_EQ(-1, rmb_cmd.delete_namespace(&ceph_cfg, true, &ms_module_mock));
+}
+/**
+ * Test rmb commands
+ * - export: failed reads do not leave (partial) mail files and are reported
+ */
+TEST(rmb1, rmb_commands_export_mails_read_error) {
+  librmbtest::RadosStorageMock storage_mock;
+  librmbtest::RadosClusterMock cluster_mock;
+  std::map<std::string, std::string> opts;
+  librmb::RmbCommands rmb_cmd(&storage_mock, &cluster_mock, &opts);
+
+  std::string mbox_guid = "abc";
+  librmb::RadosMailBox mbox(mbox_guid, 1, mbox_guid);
+  librmb::RadosMail mail;
+  mail.set_oid("oid_1");
+  mail.set_mail_size(10);
+  std::string key = "U";
+  std::string uid = "1";
+  librmb::RadosMetadata m(key, uid);
+  mail.add_metadata(m);
+  mbox.add_mail(&mail);
+  std::map<std::string, librmb::RadosMailBox *> mailbox;
+  mailbox[mbox_guid] = &mbox;
+
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectReadOperation *>(), _))
+      .WillOnce(Return(-EIO));
+  std::string output_dir = "test_export";
+  EXPECT_EQ(-EIO, rmb_cmd.export_mails(&mailbox, output_dir));
+
+  std::ifstream mail_file(output_dir + "/" + mbox_guid + "/1.oid_1");
+  EXPECT_FALSE(mail_file.good());
+
+  EXPECT_EQ(0, std::remove((output_dir + "/" + librmb::RmbCommands::EXPORT_MANIFEST).c_str()));
+  EXPECT_EQ(0, rmdir((output_dir + "/" + mbox_guid).c_str()));
+  EXPECT_EQ(0, rmdir(output_dir.c_str()));
+}
+/**
+ * Test rmb commands
+ * - export: mails without data and without dedup reference or stripes are reported as failed
+ */
+TEST(rmb1, rmb_commands_export_mails_no_data) {
+  librmbtest::RadosStorageMock storage_mock;
+  librmbtest::RadosClusterMock cluster_mock;
+  std::map<std::string, std::string> opts;
+  librmb::RmbCommands rmb_cmd(&storage_mock, &cluster_mock, &opts);
+
+  std::string mbox_guid = "abc";
+  librmb::RadosMailBox mbox(mbox_guid, 1, mbox_guid);
+  librmb::RadosMail mail;
+  mail.set_oid("oid_1");
+  mail.set_mail_size(0);
+  std::string key = "U";
+  std::string uid = "1";
+  librmb::RadosMetadata m(key, uid);
+  mail.add_metadata(m);
+  mbox.add_mail(&mail);
+  std::map<std::string, librmb::RadosMailBox *> mailbox;
+  mailbox[mbox_guid] = &mbox;
+
+  EXPECT_CALL(storage_mock, aio_operate(_, _, _, testing::An<librados::ObjectReadOperation *>(), _)).Times(0);
+  std::string output_dir = "test_export_no_data";
+  EXPECT_EQ(-EIO, rmb_cmd.export_mails(&mailbox, output_dir));
+
+  EXPECT_EQ(0, std::remove((output_dir + "/" + librmb::RmbCommands::EXPORT_MANIFEST).c_str()));
+  EXPECT_EQ(0, rmdir((output_dir + "/" + mbox_guid).c_str()));
+  EXPECT_EQ(0, rmdir(output_dir.c_str()));
+}
+TEST(rmb1, rmb_commands_metadata_pool_module) {
+  librmbtest::RadosClusterMock cluster_mock;
+  librmbtest::RadosDovecotCephCfgMock cfg_mock;
+  librados::IoCtx io_ctx;
+  std::string module_name = librmb::RadosMetadataStoragePool::module_name;
+  std::string no_pool;
+  std::string metadata_pool = "mail_metadata";
+
+  // the pool module without a metadata pool
+  EXPECT_CALL(cfg_mock, get_metadata_storage_module()).WillRepeatedly(ReturnRef(module_name));
+  EXPECT_CALL(cfg_mock, get_metadata_pool()).WillRepeatedly(ReturnRef(no_pool));
+  EXPECT_EQ(nullptr, librmb::RmbCommands::create_metadata_storage_module(&cluster_mock, &io_ctx, &cfg_mock));
+
+  // the metadata pool can not be opened, there is no fall back to the mail objects
+  librmbtest::RadosDovecotCephCfgMock cfg_pool_mock;
+  EXPECT_CALL(cfg_pool_mock, get_metadata_storage_module()).WillRepeatedly(ReturnRef(module_name));
+  EXPECT_CALL(cfg_pool_mock, get_metadata_pool()).WillRepeatedly(ReturnRef(metadata_pool));
+  EXPECT_CALL(cluster_mock, is_connected()).WillRepeatedly(Return(true));
+  EXPECT_CALL(cluster_mock, io_ctx_create(metadata_pool, _)).WillOnce(Return(-ENOENT));
+  EXPECT_EQ(nullptr, librmb::RmbCommands::create_metadata_storage_module(&cluster_mock, &io_ctx, &cfg_pool_mock));
+}
+
 /**
  * Test rmb commands
  * - search filter
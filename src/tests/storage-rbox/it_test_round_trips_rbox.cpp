@@ -0,0 +1,291 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "TestCase.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"           // turn off warnings for Dovecot :-(
+#pragma GCC diagnostic ignored "-Wundef"            // turn off warnings for Dovecot :-(
+#pragma GCC diagnostic ignored "-Wredundant-decls"  // turn off warnings for Dovecot :-(
+#ifndef __cplusplus
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"  // turn off warnings for Dovecot :-(
+#endif
+
+extern "C" {
+#include "lib.h"
+#include "mail-user.h"
+#include "mail-storage.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mailbox-list.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "mail-search-build.h"
+
+#include "libdict-rados-plugin.h"
+#include "mail-search-parser-private.h"
+#include "mail-search.h"
+}
+#include "rbox-storage.hpp"
+#include "../mocks/mock_test.h"
+#include "dovecot-ceph-plugin-config.h"
+#include "../test-utils/it_utils.h"
+#include "../test-utils/rados-storage-counting.h"
+
+/*
+ * Upper bounds for the rados round trips of the common IMAP operations.
+ * The bounds are regression guards: a change which adds a round trip per
+ * mail (or a wait per mail) to one of these paths fails here.
+ */
+
+static const unsigned int MAIL_COUNT = 20;
+
+static const char *message =
+    "From: user@domain.org\n"
+    "Date: Sat, 24 Mar 2017 23:00:00 +0200\n"
+    "Mime-Version: 1.0\n"
+    "Content-Type: text/plain; charset=us-ascii\n"
+    "\n"
+    "body\n";
+
+static struct mailbox *open_inbox() {
+  struct mail_namespace *ns = mail_namespace_find_inbox(StorageTest::s_test_mail_user->namespaces);
+  struct mailbox *box = mailbox_alloc(ns->list, "INBOX", (mailbox_flags)0);
+  if (mailbox_open(box) < 0) {
+    i_error("Opening mailbox INBOX failed: %s", mailbox_get_last_internal_error(box, NULL));
+    mailbox_free(&box);
+    return NULL;
+  }
+  return box;
+}
+
+static struct mailbox_transaction_context *begin_trans(struct mailbox *box) {
+#ifdef DOVECOT_CEPH_PLUGIN_HAVE_MAIL_STORAGE_TRANSACTION_OLD_SIGNATURE
+  return mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+#else
+  char reason[256];
+  memset(reason, '\0', sizeof(reason));
+  return mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL, reason);
+#endif
+}
+
+static struct mail_search_context *search_all(struct mailbox_transaction_context *trans,
+                                              enum mail_fetch_field wanted_fields) {
+  struct mail_search_args *search_args = mail_search_build_init();
+  mail_search_build_add(search_args, SEARCH_ALL);
+  struct mail_search_context *search_ctx = mailbox_search_init(trans, search_args, NULL, wanted_fields, NULL);
+  mail_search_args_unref(&search_args);
+  return search_ctx;
+}
+
+TEST_F(StorageTest, init) {}
+
+/**
+ * - save MAIL_COUNT mails in one transaction
+ * - one write per mail, all writes are waited for once at commit
+ */
+TEST_F(StorageTest, save_mails_waits_once) {
+  struct mailbox *box = open_inbox();
+  ASSERT_NE(box, nullptr);
+  {
+    testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+    counter.reset();
+
+    struct mailbox_transaction_context *trans = begin_trans(box);
+    for (unsigned int i = 0; i < MAIL_COUNT; i++) {
+      struct mail_save_context *save_ctx = mailbox_save_alloc(trans);
+      struct istream *input = i_stream_create_from_data(message, strlen(message));
+      ASSERT_GE(mailbox_save_begin(&save_ctx, input), 0);
+      do {
+        ASSERT_GE(mailbox_save_continue(save_ctx), 0);
+      } while (i_stream_read(input) > 0);
+      ASSERT_GE(mailbox_save_finish(&save_ctx), 0);
+      i_stream_unref(&input);
+    }
+    ASSERT_GE(mailbox_transaction_commit(&trans), 0);
+
+    const testutils::RadosOpCounts &counts = counter.get_counts();
+    EXPECT_EQ(MAIL_COUNT, counts.get_calls("save_mail"));
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "read_mail", 0));
+    EXPECT_TRUE(testutils::rados_ops_at_most(counts, 2 * MAIL_COUNT, 1));
+  }
+  mailbox_free(&box);
+}
+
+/**
+ * - fetch the flags of all mails
+ * - flags are served by the index, no rados operation at all
+ */
+TEST_F(StorageTest, fetch_flags_no_rados_ops) {
+  struct mailbox *box = open_inbox();
+  ASSERT_NE(box, nullptr);
+  ASSERT_GE(mailbox_sync(box, static_cast<mailbox_sync_flags>(0)), 0);
+  {
+    testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+    counter.reset();
+
+    struct mailbox_transaction_context *trans = begin_trans(box);
+    struct mail_search_context *search_ctx = search_all(trans, MAIL_FETCH_FLAGS);
+    struct mail *mail;
+    unsigned int count = 0;
+    while (mailbox_search_next(search_ctx, &mail)) {
+      mail_get_flags(mail);
+      count++;
+    }
+    ASSERT_GE(mailbox_search_deinit(&search_ctx), 0);
+    ASSERT_GE(mailbox_transaction_commit(&trans), 0);
+
+    EXPECT_EQ(MAIL_COUNT, count);
+    EXPECT_TRUE(testutils::rados_ops_at_most(counter.get_counts(), 0, 0));
+  }
+  mailbox_free(&box);
+}
+
+/**
+ * - fetch save date and physical size of all mails
+ * - both are kept in the index, no rados stat or metadata read
+ */
+TEST_F(StorageTest, fetch_save_date_and_size_no_rados_ops) {
+  struct mailbox *box = open_inbox();
+  ASSERT_NE(box, nullptr);
+  {
+    testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+    counter.reset();
+
+    struct mailbox_transaction_context *trans = begin_trans(box);
+    struct mail_search_context *search_ctx = search_all(trans, static_cast<mail_fetch_field>(0));
+    struct mail *mail;
+    unsigned int count = 0;
+    while (mailbox_search_next(search_ctx, &mail)) {
+      time_t save_date;
+      uoff_t physical_size;
+      EXPECT_GE(mail_get_save_date(mail, &save_date), 0);
+      EXPECT_GE(mail_get_physical_size(mail, &physical_size), 0);
+      EXPECT_GT(save_date, 0);
+      EXPECT_EQ(strlen(message), physical_size);
+      count++;
+    }
+    ASSERT_GE(mailbox_search_deinit(&search_ctx), 0);
+    ASSERT_GE(mailbox_transaction_commit(&trans), 0);
+
+    EXPECT_EQ(MAIL_COUNT, count);
+    EXPECT_TRUE(testutils::rados_ops_at_most(counter.get_counts(), 0, 0));
+  }
+  mailbox_free(&box);
+}
+
+/**
+ * - read the body of all mails
+ * - one read of the mail object per mail
+ */
+TEST_F(StorageTest, read_mails_one_read_per_mail) {
+  struct mailbox *box = open_inbox();
+  ASSERT_NE(box, nullptr);
+  {
+    testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+    counter.reset();
+
+    struct mailbox_transaction_context *trans = begin_trans(box);
+    struct mail_search_context *search_ctx = search_all(trans, static_cast<mail_fetch_field>(0));
+    struct mail *mail;
+    unsigned int count = 0;
+    while (mailbox_search_next(search_ctx, &mail)) {
+      struct istream *input;
+      ASSERT_GE(mail_get_stream(mail, NULL, NULL, &input), 0);
+      count++;
+    }
+    ASSERT_GE(mailbox_search_deinit(&search_ctx), 0);
+    ASSERT_GE(mailbox_transaction_commit(&trans), 0);
+
+    const testutils::RadosOpCounts &counts = counter.get_counts();
+    EXPECT_EQ(MAIL_COUNT, count);
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "aio_operate_read", MAIL_COUNT));
+    EXPECT_TRUE(testutils::rados_ops_at_most(counts, 2 * MAIL_COUNT));
+  }
+  mailbox_free(&box);
+}
+
+/**
+ * - move all mails
+ * - one move per mail, at most one wait for the whole transaction
+ */
+TEST_F(StorageTest, move_mails_waits_at_most_once) {
+  struct mailbox *box = open_inbox();
+  ASSERT_NE(box, nullptr);
+  {
+    testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+    counter.reset();
+
+    struct mailbox_transaction_context *trans = begin_trans(box);
+    struct mail_search_context *search_ctx = search_all(trans, static_cast<mail_fetch_field>(0));
+    struct mail *mail;
+    unsigned int count = 0;
+    while (mailbox_search_next(search_ctx, &mail)) {
+      struct mail_save_context *save_ctx = mailbox_save_alloc(trans);
+      mailbox_save_copy_flags(save_ctx, mail);
+      EXPECT_EQ(0, mailbox_move(&save_ctx, mail));
+      count++;
+    }
+    ASSERT_GE(mailbox_search_deinit(&search_ctx), 0);
+    ASSERT_GE(mailbox_transaction_commit(&trans), 0);
+    ASSERT_GE(mailbox_sync(box, static_cast<mailbox_sync_flags>(0)), 0);
+
+    const testutils::RadosOpCounts &counts = counter.get_counts();
+    EXPECT_EQ(MAIL_COUNT, count);
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "move", MAIL_COUNT));
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "read_mail", 0));
+    EXPECT_TRUE(testutils::rados_ops_at_most(counts, 3 * MAIL_COUNT, 1));
+  }
+  mailbox_free(&box);
+}
+
+/**
+ * - expunge all mails
+ * - one remove per mail, no read of the mail objects
+ */
+TEST_F(StorageTest, expunge_mails_one_remove_per_mail) {
+  struct mailbox *box = open_inbox();
+  ASSERT_NE(box, nullptr);
+  {
+    testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+    counter.reset();
+
+    struct mailbox_transaction_context *trans = begin_trans(box);
+    struct mail_search_context *search_ctx = search_all(trans, static_cast<mail_fetch_field>(0));
+    struct mail *mail;
+    unsigned int count = 0;
+    while (mailbox_search_next(search_ctx, &mail)) {
+      mail_expunge(mail);
+      count++;
+    }
+    ASSERT_GE(mailbox_search_deinit(&search_ctx), 0);
+    ASSERT_GE(mailbox_transaction_commit(&trans), 0);
+    ASSERT_GE(mailbox_sync(box, static_cast<mailbox_sync_flags>(0)), 0);
+
+    const testutils::RadosOpCounts &counts = counter.get_counts();
+    EXPECT_EQ(MAIL_COUNT, count);
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "aio_operate_write", MAIL_COUNT));
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "read_mail", 0));
+    EXPECT_TRUE(testutils::rados_calls_at_most(counts, "aio_operate_read", 0));
+    EXPECT_TRUE(testutils::rados_ops_at_most(counts, 2 * MAIL_COUNT));
+  }
+  ASSERT_EQ(0, (int)box->index->map->hdr.messages_count);
+  mailbox_free(&box);
+}
+
+TEST_F(StorageTest, deinit) {}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
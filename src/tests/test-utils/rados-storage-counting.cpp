@@ -0,0 +1,311 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include "rados-storage-counting.h"
+
+#include <sstream>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"           // turn off warnings for Dovecot :-(
+#pragma GCC diagnostic ignored "-Wundef"            // turn off warnings for Dovecot :-(
+#pragma GCC diagnostic ignored "-Wredundant-decls"  // turn off warnings for Dovecot :-(
+extern "C" {
+#include "lib.h"
+#include "mail-storage.h"
+}
+#pragma GCC diagnostic pop
+
+#include "rbox-storage.hpp"
+
+namespace testutils {
+
+uint64_t RadosOpCounts::get_calls(const std::string &method) const {
+  std::map<std::string, uint64_t>::const_iterator it = calls.find(method);
+  return it != calls.end() ? it->second : 0;
+}
+
+std::string RadosOpCounts::to_string() const {
+  std::stringstream ss;
+  ss << "sync_ops=" << sync_ops << " async_ops=" << async_ops << " waits=" << waits
+     << " bytes_written=" << bytes_written << " bytes_read=" << bytes_read << " calls={";
+  for (std::map<std::string, uint64_t>::const_iterator it = calls.begin(); it != calls.end(); ++it) {
+    ss << (it == calls.begin() ? "" : ", ") << it->first << ":" << it->second;
+  }
+  ss << "}";
+  return ss.str();
+}
+
+static void count_op(RadosOpCounts *counts, const char *method, bool async, uint64_t bytes_written,
+                     uint64_t bytes_read) {
+  if (async) {
+    counts->async_ops++;
+  } else {
+    counts->sync_ops++;
+  }
+  counts->bytes_written += bytes_written;
+  counts->bytes_read += bytes_read;
+  counts->calls[method]++;
+}
+
+static uint64_t mail_size(librmb::RadosMail *mail) {
+  return mail != nullptr && mail->get_mail_size() > 0 ? mail->get_mail_size() : 0;
+}
+
+void RadosStorageCounting::count(const char *method, bool async, uint64_t bytes_written, uint64_t bytes_read) {
+  count_op(counts, method, async, bytes_written, bytes_read);
+}
+
+int RadosStorageCounting::stat_mail(const std::string &oid, uint64_t *psize, time_t *pmtime) {
+  count("stat_mail", false, 0, 0);
+  return storage->stat_mail(oid, psize, pmtime);
+}
+
+int RadosStorageCounting::split_buffer_and_exec_op(librmb::RadosMail *current_object,
+                                                   librados::ObjectWriteOperation *write_op_xattr,
+                                                   const uint64_t &max_write) {
+  count("split_buffer_and_exec_op", true, mail_size(current_object), 0);
+  return storage->split_buffer_and_exec_op(current_object, write_op_xattr, max_write);
+}
+
+int RadosStorageCounting::delete_mail(librmb::RadosMail *mail) {
+  count("delete_mail", false, 0, 0);
+  return storage->delete_mail(mail);
+}
+
+int RadosStorageCounting::delete_mail(const std::string &oid) {
+  count("delete_mail", false, 0, 0);
+  return storage->delete_mail(oid);
+}
+
+int RadosStorageCounting::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                      librados::ObjectWriteOperation *op) {
+  count("aio_operate_write", true, 0, 0);
+  return storage->aio_operate(io_ctx_, oid, c, op);
+}
+
+int RadosStorageCounting::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                      librados::ObjectReadOperation *op, librados::bufferlist *pbl) {
+  count("aio_operate_read", true, 0, 0);
+  return storage->aio_operate(io_ctx_, oid, c, op, pbl);
+}
+
+int RadosStorageCounting::aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                                      librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) {
+  count("aio_operate_read", true, 0, 0);
+  return storage->aio_operate(io_ctx_, oid, c, op, flags, pbl);
+}
+
+librados::NObjectIterator RadosStorageCounting::find_mails(const librmb::RadosMetadata *attr) {
+  // the listing is paged by the iterator, count the request only.
+  count("find_mails", false, 0, 0);
+  return storage->find_mails(attr);
+}
+
+int RadosStorageCounting::split_mail_listing(
+    unsigned int slice_count, std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) {
+  return storage->split_mail_listing(slice_count, slices);
+}
+
+int RadosStorageCounting::list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish,
+                                     size_t max_count, const librmb::RadosMetadata *attr,
+                                     std::vector<std::string> *oids, bool *more) {
+  count("list_mails", false, 0, 0);
+  return storage->list_mails(cursor, finish, max_count, attr, oids, more);
+}
+
+bool RadosStorageCounting::wait_for_write_operations_complete(librados::AioCompletion *completion,
+                                                              librados::ObjectWriteOperation *write_operation) {
+  counts->waits++;
+  counts->calls["wait_for_write_operations_complete"]++;
+  return storage->wait_for_write_operations_complete(completion, write_operation);
+}
+
+bool RadosStorageCounting::wait_for_rados_operations(const std::list<librmb::RadosMail *> &object_list) {
+  counts->waits++;
+  counts->calls["wait_for_rados_operations"]++;
+  return storage->wait_for_rados_operations(object_list);
+}
+
+int RadosStorageCounting::save_mail(const std::string &oid, librados::bufferlist &buffer) {
+  count("save_mail", false, buffer.length(), 0);
+  return storage->save_mail(oid, buffer);
+}
+
+int RadosStorageCounting::read_mail(const std::string &oid, librados::bufferlist *buffer) {
+  int ret = storage->read_mail(oid, buffer);
+  count("read_mail", false, 0, ret > 0 ? ret : 0);
+  return ret;
+}
+
+int RadosStorageCounting::move(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+                               std::list<librmb::RadosMetadata> &to_update, bool delete_source) {
+  count("move", false, 0, 0);
+  return storage->move(src_oid, src_ns, dest_oid, dest_ns, to_update, delete_source);
+}
+
+int RadosStorageCounting::copy(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+                               std::list<librmb::RadosMetadata> &to_update) {
+  count("copy", false, 0, 0);
+  return storage->copy(src_oid, src_ns, dest_oid, dest_ns, to_update);
+}
+
+bool RadosStorageCounting::save_mail(librmb::RadosMail *mail, bool &save_async) {
+  count("save_mail", save_async, mail_size(mail), 0);
+  return storage->save_mail(mail, save_async);
+}
+
+bool RadosStorageCounting::save_mail(librados::ObjectWriteOperation *write_op_xattr, librmb::RadosMail *mail,
+                                     bool save_async) {
+  count("save_mail", save_async, mail_size(mail), 0);
+  return storage->save_mail(write_op_xattr, mail, save_async);
+}
+
+void RadosStorageMetadataCounting::count(const char *method, bool async, uint64_t bytes_written,
+                                         uint64_t bytes_read) {
+  count_op(counts, method, async, bytes_written, bytes_read);
+}
+
+int RadosStorageMetadataCounting::load_metadata(librmb::RadosMail *mail) {
+  // already loaded metadata is not read again
+  bool loaded = mail != nullptr && mail->get_metadata()->size() > 0 && !has_xattr_metadata();
+  int ret = module->load_metadata(mail);
+  if (!loaded) {
+    count("load_metadata", false, 0, 0);
+  }
+  return ret;
+}
+
+int RadosStorageMetadataCounting::load_immutable_metadata(librmb::RadosMail *mail) {
+  bool loaded = mail != nullptr && mail->get_metadata()->size() > 0 && !has_xattr_metadata();
+  int ret = module->load_immutable_metadata(mail);
+  if (!loaded) {
+    count("load_metadata", false, 0, 0);
+  }
+  return ret;
+}
+
+int RadosStorageMetadataCounting::set_metadata(librmb::RadosMail *mail, librmb::RadosMetadata &xattr) {
+  count("set_metadata", false, xattr.bl.length(), 0);
+  return module->set_metadata(mail, xattr);
+}
+
+int RadosStorageMetadataCounting::set_metadata(librmb::RadosMail *mail, librmb::RadosMetadata &xattr,
+                                               librados::ObjectWriteOperation *write_op) {
+  count("set_metadata", true, xattr.bl.length(), 0);
+  return module->set_metadata(mail, xattr, write_op);
+}
+
+bool RadosStorageMetadataCounting::update_metadata(const std::string &oid,
+                                                   std::list<librmb::RadosMetadata> &to_update) {
+  uint64_t bytes = 0;
+  for (std::list<librmb::RadosMetadata>::iterator it = to_update.begin(); it != to_update.end(); ++it) {
+    bytes += it->bl.length();
+  }
+  count("update_metadata", false, bytes, 0);
+  return module->update_metadata(oid, to_update);
+}
+
+librados::NObjectIterator RadosStorageMetadataCounting::find_mails(const librmb::RadosMetadata *attr) {
+  if (has_separate_metadata()) {
+    count("find_mails", false, 0, 0);
+  }
+  return module->find_mails(attr);
+}
+
+int RadosStorageMetadataCounting::copy_metadata(const std::string &src_oid, const char *src_ns,
+                                                const std::string &dest_oid, const char *dest_ns,
+                                                std::list<librmb::RadosMetadata> &to_update, bool delete_source) {
+  // modules without separate metadata do not access rados
+  if (has_separate_metadata()) {
+    count("copy_metadata", false, 0, 0);
+  }
+  return module->copy_metadata(src_oid, src_ns, dest_oid, dest_ns, to_update, delete_source);
+}
+
+int RadosStorageMetadataCounting::remove_metadata(const std::string &oid) {
+  if (has_separate_metadata()) {
+    count("remove_metadata", false, 0, 0);
+  }
+  return module->remove_metadata(oid);
+}
+
+int RadosStorageMetadataCounting::update_keyword_metadata(const std::string &oid, librmb::RadosMetadata *metadata) {
+  count("update_keyword_metadata", false, metadata != nullptr ? metadata->bl.length() : 0, 0);
+  return module->update_keyword_metadata(oid, metadata);
+}
+
+int RadosStorageMetadataCounting::remove_keyword_metadata(const std::string &oid, std::string &key) {
+  count("remove_keyword_metadata", false, 0, 0);
+  return module->remove_keyword_metadata(oid, key);
+}
+
+int RadosStorageMetadataCounting::load_keyword_metadata(const std::string &oid, std::set<std::string> &keys,
+                                                        std::map<std::string, ceph::bufferlist> *metadata) {
+  count("load_keyword_metadata", false, 0, 0);
+  return module->load_keyword_metadata(oid, keys, metadata);
+}
+
+librmb::RadosStorageMetadataModule *RadosMetadataStorageCounting::wrap(
+    librmb::RadosStorageMetadataModule *storage_module) {
+  if (storage_module == nullptr) {
+    return nullptr;
+  }
+  if (storage_module != wrapped_module) {
+    delete module;
+    module = new RadosStorageMetadataCounting(storage_module, counts);
+    wrapped_module = storage_module;
+  }
+  return module;
+}
+
+librmb::RadosStorageMetadataModule *RadosMetadataStorageCounting::create_metadata_storage(
+    librados::IoCtx *io_ctx_, librmb::RadosDovecotCephCfg *cfg_) {
+  return wrap(ms->create_metadata_storage(io_ctx_, cfg_));
+}
+
+librmb::RadosStorageMetadataModule *RadosMetadataStorageCounting::get_storage() { return wrap(ms->get_storage()); }
+
+RadosOpCounter::RadosOpCounter(struct rbox_storage *r_storage_) : r_storage(r_storage_) {
+  storage = new RadosStorageCounting(r_storage->s, &counts);
+  ms = new RadosMetadataStorageCounting(r_storage->ms, &counts);
+  r_storage->s = storage;
+  r_storage->ms = ms;
+}
+
+RadosOpCounter::~RadosOpCounter() {
+  r_storage->s = storage->get_wrapped();
+  r_storage->ms = ms->get_wrapped();
+  delete storage;
+  delete ms;
+}
+
+::testing::AssertionResult rados_ops_at_most(const RadosOpCounts &counts, uint64_t max_ops, uint64_t max_waits) {
+  if (counts.ops() > max_ops) {
+    return ::testing::AssertionFailure() << counts.ops() << " rados operations, expected at most " << max_ops << " ("
+                                         << counts.to_string() << ")";
+  }
+  if (counts.waits > max_waits) {
+    return ::testing::AssertionFailure() << counts.waits << " waits, expected at most " << max_waits << " ("
+                                         << counts.to_string() << ")";
+  }
+  return ::testing::AssertionSuccess();
+}
+
+::testing::AssertionResult rados_calls_at_most(const RadosOpCounts &counts, const std::string &method,
+                                               uint64_t max_calls) {
+  if (counts.get_calls(method) > max_calls) {
+    return ::testing::AssertionFailure() << counts.get_calls(method) << " calls of " << method
+                                         << ", expected at most " << max_calls << " (" << counts.to_string() << ")";
+  }
+  return ::testing::AssertionSuccess();
+}
+
+}  // namespace testutils
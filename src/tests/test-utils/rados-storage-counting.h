@@ -0,0 +1,244 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copyright (c) 2017-2018 Tallence AG and the authors
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#ifndef SRC_TESTS_TEST_UTILS_RADOS_STORAGE_COUNTING_H_
+#define SRC_TESTS_TEST_UTILS_RADOS_STORAGE_COUNTING_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <rados/librados.hpp>
+#include "rados-metadata-storage.h"
+#include "rados-metadata-storage-module.h"
+#include "rados-storage.h"
+
+struct rbox_storage;
+
+namespace testutils {
+
+static const uint64_t RADOS_OPS_UNLIMITED = UINT64_MAX;
+
+/**
+ * Rados operations seen by RadosStorageCounting and RadosStorageMetadataCounting.
+ */
+struct RadosOpCounts {
+  RadosOpCounts() { reset(); }
+  void reset() {
+    sync_ops = 0;
+    async_ops = 0;
+    waits = 0;
+    bytes_written = 0;
+    bytes_read = 0;
+    calls.clear();
+  }
+  uint64_t ops() const { return sync_ops + async_ops; }
+  uint64_t get_calls(const std::string &method) const;
+  std::string to_string() const;
+
+  // blocking operations (one round trip each)
+  uint64_t sync_ops;
+  // operations submitted without waiting for them
+  uint64_t async_ops;
+  // calls waiting for submitted operations
+  uint64_t waits;
+  uint64_t bytes_written;
+  // only synchronous reads, the size of async reads is unknown at submit time
+  uint64_t bytes_read;
+  // number of calls per method
+  std::map<std::string, uint64_t> calls;
+};
+
+/**
+ * RadosStorageCounting
+ *
+ * Forwards all calls to the wrapped storage and counts them. Operations on
+ * the io context (get_io_ctx()) and waits on completions returned by librados
+ * are not visible to the wrapper.
+ */
+class RadosStorageCounting : public librmb::RadosStorage {
+ public:
+  RadosStorageCounting(librmb::RadosStorage *storage_, RadosOpCounts *counts_) : storage(storage_), counts(counts_) {}
+  virtual ~RadosStorageCounting() {}
+
+  librmb::RadosStorage *get_wrapped() { return storage; }
+
+  librados::IoCtx &get_io_ctx() override { return storage->get_io_ctx(); }
+  int stat_mail(const std::string &oid, uint64_t *psize, time_t *pmtime) override;
+  void set_namespace(const std::string &_nspace) override { storage->set_namespace(_nspace); }
+  std::string get_namespace() override { return storage->get_namespace(); }
+  std::string get_pool_name() override { return storage->get_pool_name(); }
+  void set_ceph_wait_method(enum librmb::rbox_ceph_aio_wait_method wait_method) override {
+    storage->set_ceph_wait_method(wait_method);
+  }
+  int get_max_write_size() override { return storage->get_max_write_size(); }
+  int get_max_write_size_bytes() override { return storage->get_max_write_size_bytes(); }
+  int split_buffer_and_exec_op(librmb::RadosMail *current_object, librados::ObjectWriteOperation *write_op_xattr,
+                               const uint64_t &max_write) override;
+  int delete_mail(librmb::RadosMail *mail) override;
+  int delete_mail(const std::string &oid) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectWriteOperation *op) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, librados::bufferlist *pbl) override;
+  int aio_operate(librados::IoCtx *io_ctx_, const std::string &oid, librados::AioCompletion *c,
+                  librados::ObjectReadOperation *op, int flags, librados::bufferlist *pbl) override;
+  librados::NObjectIterator find_mails(const librmb::RadosMetadata *attr) override;
+  int split_mail_listing(unsigned int slice_count,
+                         std::vector<std::pair<librados::ObjectCursor, librados::ObjectCursor>> *slices) override;
+  int list_mails(librados::ObjectCursor *cursor, const librados::ObjectCursor &finish, size_t max_count,
+                 const librmb::RadosMetadata *attr, std::vector<std::string> *oids, bool *more) override;
+  int open_connection(const std::string &poolname) override { return storage->open_connection(poolname); }
+  int open_connection(const std::string &poolname, const std::string &clustername,
+                      const std::string &rados_username) override {
+    return storage->open_connection(poolname, clustername, rados_username);
+  }
+  void close_connection() override { storage->close_connection(); }
+  bool wait_for_write_operations_complete(librados::AioCompletion *completion,
+                                          librados::ObjectWriteOperation *write_operation) override;
+  bool wait_for_rados_operations(const std::list<librmb::RadosMail *> &object_list) override;
+  int save_mail(const std::string &oid, librados::bufferlist &buffer) override;
+  int read_mail(const std::string &oid, librados::bufferlist *buffer) override;
+  int move(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+           std::list<librmb::RadosMetadata> &to_update, bool delete_source) override;
+  int copy(std::string &src_oid, const char *src_ns, std::string &dest_oid, const char *dest_ns,
+           std::list<librmb::RadosMetadata> &to_update) override;
+  bool save_mail(librmb::RadosMail *mail, bool &save_async) override;
+  bool save_mail(librados::ObjectWriteOperation *write_op_xattr, librmb::RadosMail *mail, bool save_async) override;
+  librmb::RadosMail *alloc_rados_mail() override { return storage->alloc_rados_mail(); }
+  void free_rados_mail(librmb::RadosMail *mail) override { storage->free_rados_mail(mail); }
+
+ private:
+  void count(const char *method, bool async, uint64_t bytes_written, uint64_t bytes_read);
+
+  librmb::RadosStorage *storage;
+  RadosOpCounts *counts;
+};
+
+/**
+ * RadosStorageMetadataCounting
+ *
+ * Counts the calls of a metadata module. Modules access rados through their
+ * io context, so every call is counted as one operation.
+ */
+class RadosStorageMetadataCounting : public librmb::RadosStorageMetadataModule {
+ public:
+  RadosStorageMetadataCounting(librmb::RadosStorageMetadataModule *module_, RadosOpCounts *counts_)
+      : module(module_), counts(counts_) {}
+  virtual ~RadosStorageMetadataCounting() {}
+
+  void set_io_ctx(librados::IoCtx *io_ctx) override { module->set_io_ctx(io_ctx); }
+  bool has_xattr_metadata() override { return module->has_xattr_metadata(); }
+  bool has_separate_metadata() override { return module->has_separate_metadata(); }
+  librados::NObjectIterator find_mails(const librmb::RadosMetadata *attr) override;
+  int load_metadata(librmb::RadosMail *mail) override;
+  int load_metadata(librmb::RadosMail *mail, std::map<std::string, ceph::bufferlist> *xattrs,
+                    std::map<std::string, ceph::bufferlist> *omap) override {
+    return module->load_metadata(mail, xattrs, omap);
+  }
+  int load_immutable_metadata(librmb::RadosMail *mail) override;
+  int set_metadata(librmb::RadosMail *mail, librmb::RadosMetadata &xattr) override;
+  int set_metadata(librmb::RadosMail *mail, librmb::RadosMetadata &xattr,
+                   librados::ObjectWriteOperation *write_op) override;
+  bool update_metadata(const std::string &oid, std::list<librmb::RadosMetadata> &to_update) override;
+  void save_metadata(librados::ObjectWriteOperation *write_op, librmb::RadosMail *mail) override {
+    module->save_metadata(write_op, mail);
+  }
+  int copy_metadata(const std::string &src_oid, const char *src_ns, const std::string &dest_oid,
+                    const char *dest_ns, std::list<librmb::RadosMetadata> &to_update, bool delete_source) override;
+  int remove_metadata(const std::string &oid) override;
+  int update_keyword_metadata(const std::string &oid, librmb::RadosMetadata *metadata) override;
+  int remove_keyword_metadata(const std::string &oid, std::string &key) override;
+  int load_keyword_metadata(const std::string &oid, std::set<std::string> &keys,
+                            std::map<std::string, ceph::bufferlist> *metadata) override;
+
+ private:
+  void count(const char *method, bool async, uint64_t bytes_written, uint64_t bytes_read);
+
+  librmb::RadosStorageMetadataModule *module;
+  RadosOpCounts *counts;
+};
+
+/**
+ * RadosMetadataStorageCounting
+ *
+ * Wraps the module of a metadata storage (producer) in RadosStorageMetadataCounting.
+ */
+class RadosMetadataStorageCounting : public librmb::RadosMetadataStorage {
+ public:
+  RadosMetadataStorageCounting(librmb::RadosMetadataStorage *ms_, RadosOpCounts *counts_)
+      : ms(ms_), counts(counts_), module(nullptr), wrapped_module(nullptr) {}
+  virtual ~RadosMetadataStorageCounting() { delete module; }
+
+  librmb::RadosMetadataStorage *get_wrapped() { return ms; }
+
+  librmb::RadosStorageMetadataModule *create_metadata_storage(librados::IoCtx *io_ctx_,
+                                                              librmb::RadosDovecotCephCfg *cfg_) override;
+  librmb::RadosStorageMetadataModule *get_storage() override;
+
+ private:
+  librmb::RadosStorageMetadataModule *wrap(librmb::RadosStorageMetadataModule *storage_module);
+
+  librmb::RadosMetadataStorage *ms;
+  RadosOpCounts *counts;
+  librmb::RadosStorageMetadataModule *module;
+  librmb::RadosStorageMetadataModule *wrapped_module;
+};
+
+/**
+ * RadosOpCounter
+ *
+ * Installs the counting wrappers into the primary storage and metadata
+ * storage of a rbox storage (alt storage is not counted) and removes them
+ * again on destruction. Use reset() before the operation to measure:
+ *
+ *   testutils::RadosOpCounter counter((struct rbox_storage *)box->storage);
+ *   counter.reset();
+ *   ... move N mails ...
+ *   EXPECT_TRUE(testutils::rados_ops_at_most(counter.get_counts(), 3 * N, 1));
+ */
+class RadosOpCounter {
+ public:
+  explicit RadosOpCounter(struct rbox_storage *r_storage_);
+  ~RadosOpCounter();
+
+  void reset() { counts.reset(); }
+  const RadosOpCounts &get_counts() const { return counts; }
+
+ private:
+  struct rbox_storage *r_storage;
+  RadosOpCounts counts;
+  RadosStorageCounting *storage;
+  RadosMetadataStorageCounting *ms;
+};
+
+/*!
+ * @param[in] max_ops max number of sync and async operations
+ * @param[in] max_waits max number of waits for async operations
+ * @return success if counts are within the bounds, else failure with the counted operations
+ */
+::testing::AssertionResult rados_ops_at_most(const RadosOpCounts &counts, uint64_t max_ops,
+                                             uint64_t max_waits = RADOS_OPS_UNLIMITED);
+/*!
+ * @return success if method has been called at most max_calls times
+ */
+::testing::AssertionResult rados_calls_at_most(const RadosOpCounts &counts, const std::string &method,
+                                               uint64_t max_calls);
+
+}  // namespace testutils
+
+#endif  // SRC_TESTS_TEST_UTILS_RADOS_STORAGE_COUNTING_H_